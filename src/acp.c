@@ -73,6 +73,8 @@ int acp_render_line(vid_t *s, void *arg, int nlines, vid_line_t **lines)
 {
 	acp_t *a = arg;
 	int i, x;
+	uint32_t rgb;
+	int16_t y;
 	vid_line_t *l = lines[0];
 	
 	i = 0;
@@ -85,9 +87,10 @@ int acp_render_line(vid_t *s, void *arg, int nlines, vid_line_t **lines)
 		if(i < 0) i = 0;
 		else if(i > 255) i = 255;
 		
-		i = s->yuv_level_lookup[i << 16 | i << 8 | i].y;
+		rgb = i << 16 | i << 8 | i;
+		vid_rgb_to_yuv(s, &y, NULL, NULL, 1, &rgb, 0, 1);
 		
-		a->pagc_level = s->sync_level + round((i - s->sync_level) * 1.10);
+		a->pagc_level = s->sync_level + round((y - s->sync_level) * 1.10);
 	}
 	
 	i = 0;
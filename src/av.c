@@ -23,6 +23,7 @@ void av_frame_init(av_frame_t *frame, int width, int height, uint32_t *framebuff
 	*frame = (av_frame_t) {
 		.width = width,
 		.height = height,
+		.format = AV_FRAME_RGB32,
 		.framebuffer = framebuffer,
 		.pixel_stride = pstride,
 		.line_stride = lstride,
@@ -31,6 +32,43 @@ void av_frame_init(av_frame_t *frame, int width, int height, uint32_t *framebuff
 	};
 }
 
+void av_frame_init_ycc(av_frame_t *frame, int width, int height, uint8_t *planes[3], int pstride, int lstride, int matrix, int full_range)
+{
+	*frame = (av_frame_t) {
+		.width = width,
+		.height = height,
+		.format = AV_FRAME_YCC444,
+		.ycc = { planes[0], planes[1], planes[2] },
+		.ycc_matrix = matrix,
+		.ycc_full_range = full_range,
+		.pixel_stride = pstride,
+		.line_stride = lstride,
+		.pixel_aspect_ratio = { 1, 1 },
+		.interlaced = 0,
+	};
+}
+
+int av_frame_empty(const av_frame_t *frame)
+{
+	return(frame->framebuffer == NULL && frame->ycc[0] == NULL);
+}
+
+static void _frame_offset(av_frame_t *frame, int offset)
+{
+	int i;
+	
+	/* Move the origin of the frame by offset pixels */
+	if(frame->framebuffer)
+	{
+		frame->framebuffer += offset;
+	}
+	
+	for(i = 0; i < 3; i++)
+	{
+		if(frame->ycc[i]) frame->ycc[i] += offset;
+	}
+}
+
 int av_read_video(av_t *s, av_frame_t *frame)
 {
 	int r = AV_EOF;
@@ -99,6 +137,21 @@ int av_close(av_t *s)
 	return(r);
 }
 
+void av_move(av_t *dst, av_t *src)
+{
+	/* Move an open source to another av_t, leaving src closed.
+	 * Frame and sample counters stay with dst */
+	dst->av_source_ctx = src->av_source_ctx;
+	dst->read_video = src->read_video;
+	dst->read_audio = src->read_audio;
+	dst->close = src->close;
+	
+	src->av_source_ctx = NULL;
+	src->read_video = NULL;
+	src->read_audio = NULL;
+	src->close = NULL;
+}
+
 r64_t av_calculate_frame_size(av_t *av, r64_t resolution, r64_t aspect)
 {
 	r64_t r = { av->width, av->height };
@@ -240,13 +293,13 @@ void av_set_display_aspect_ratio(av_frame_t *frame, r64_t display_aspect_ratio)
 
 void av_hflip_frame(av_frame_t *frame)
 {
-	frame->framebuffer += (frame->width - 1) * frame->pixel_stride;
+	_frame_offset(frame, (frame->width - 1) * frame->pixel_stride);
 	frame->pixel_stride = -frame->pixel_stride;
 }
 
 void av_vflip_frame(av_frame_t *frame)
 {
-	frame->framebuffer += (frame->height - 1) * frame->line_stride;
+	_frame_offset(frame, (frame->height - 1) * frame->line_stride);
 	frame->line_stride = -frame->line_stride;
 }
 
@@ -262,7 +315,7 @@ void av_rotate_frame(av_frame_t *frame, int a)
 		/* Rotate the frame 90 degrees clockwise */
 		
 		/* Move the origin to the bottom left of the image */
-		frame->framebuffer += (frame->height - 1) * frame->line_stride;
+		_frame_offset(frame, (frame->height - 1) * frame->line_stride);
 		
 		/* Reverse the image dimensions */
 		i = frame->width;
@@ -296,7 +349,7 @@ void av_crop_frame(av_frame_t *frame, int x, int y, int width, int height)
 	if(x + width > frame->width) width = frame->width - x;
 	if(y + height > frame->height) height = frame->height - y;
 	
-	frame->framebuffer += y * frame->line_stride + x * frame->pixel_stride;
+	_frame_offset(frame, y * frame->line_stride + x * frame->pixel_stride);
 	frame->width = width;
 	frame->height = height;
 }
@@ -28,14 +28,32 @@
 #define AV_OUT_OF_MEMORY -2
 #define AV_EOF           -3
 
+/* Frame pixel formats */
+#define AV_FRAME_RGB32  0 /* 32-bit RGBx, in framebuffer */
+#define AV_FRAME_YCC444 1 /* Planar 8-bit Y'CbCr 4:4:4, in ycc[] */
+
+/* Y'CbCr matrix coefficients */
+#define AV_YCC_BT601 0
+#define AV_YCC_BT709 1
+
 typedef struct {
 	
 	/* Dimensions */
 	int width;
 	int height;
 	
+	/* Pixel format */
+	int format;
+	
 	/* 32-bit RGBx framebuffer */
 	uint32_t *framebuffer;
+	
+	/* Y'CbCr planes. The strides are shared by all three */
+	uint8_t *ycc[3];
+	int ycc_matrix;
+	int ycc_full_range;
+	
+	/* Strides, in pixels of the frame's format */
 	int pixel_stride;
 	int line_stride;
 	
@@ -77,6 +95,19 @@ typedef enum {
 	AV_FIT_NONE,
 } av_fit_mode_t;
 
+/* Default number of video frames a source may buffer ahead */
+#define AV_DEFAULT_VIDEO_BUFFERS 4
+
+/* Video scaler algorithms. The default, bicubic, is zero so that
+ * a zero initialised av_t scales as hacktv does */
+typedef enum {
+	AV_SCALER_BICUBIC,
+	AV_SCALER_POINT,
+	AV_SCALER_FAST_BILINEAR,
+	AV_SCALER_BILINEAR,
+	AV_SCALER_LANCZOS,
+} av_scaler_t;
+
 typedef struct {
 	
 	pthread_mutex_t mutex;
@@ -92,6 +123,20 @@ typedef struct {
 	r64_t max_display_aspect_ratio;
 	av_frame_t default_frame;
 	
+	/* Sources may return AV_FRAME_YCC444 frames if set */
+	int ycc;
+	
+	/* Scaling algorithm and number of scaler threads (0 = auto) */
+	av_scaler_t scaler;
+	int scaler_threads;
+	
+	/* Number of video frames a source may buffer ahead, per stage */
+	int video_buffers;
+	
+	/* Position of the first frame to read, in units of frame_rate.
+	 * Sources that can't seek start from the beginning */
+	int64_t start;
+	
 	/* Video state */
 	unsigned int frames;
 	
@@ -110,11 +155,14 @@ typedef struct {
 } av_t;
 
 extern void av_frame_init(av_frame_t *frame, int width, int height, uint32_t *framebuffer, int pstride, int lstride);
+extern void av_frame_init_ycc(av_frame_t *frame, int width, int height, uint8_t *planes[3], int pstride, int lstride, int matrix, int full_range);
+extern int av_frame_empty(const av_frame_t *frame);
 
 extern int av_read_video(av_t *s, av_frame_t *frame);
 extern int av_read_audio(av_t *s, int16_t **samples, size_t *nsamples);
 extern int av_eof(av_t *s);
 extern int av_close(av_t *s);
+extern void av_move(av_t *dst, av_t *src);
 
 extern r64_t av_display_aspect_ratio(av_frame_t *frame);
 extern void av_set_display_aspect_ratio(av_frame_t *frame, r64_t display_aspect_ratio);
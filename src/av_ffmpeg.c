@@ -44,6 +44,7 @@
 #include <libavutil/opt.h>
 #include <libavutil/time.h>
 #include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
 #include <libavutil/cpu.h>
 #include "hacktv.h"
 
@@ -88,7 +89,37 @@ typedef struct {
 
 typedef struct {
 	
-	av_t *av;
+	int depth;	/* Maximum number of frames */
+	int length;	/* Number of frames in the queue */
+	int first;	/* Index of the oldest frame */
+	int eof;	/* End of stream flag, set by the writer */
+	int abort;	/* Abort flag */
+	
+	/* Frame references, or repeat markers when empty */
+	AVFrame **frame;
+	
+	/* Thread locking and signaling */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	
+} _frame_queue_t;
+
+typedef struct {
+	
+	/* Pool of whole frame buffers, for one size and format */
+	AVBufferPool *pool;
+	int count;	/* Number of buffers to pre-allocate */
+	int width;
+	int height;
+	enum AVPixelFormat format;
+	
+} _frame_pool_t;
+
+typedef struct {
+	
+	/* A copy of the output settings. The source may be
+	 * moved to another av_t after it has been opened */
+	av_t av;
 	
 	AVFormatContext *format_ctx;
 	
@@ -98,12 +129,16 @@ typedef struct {
 	_packet_queue_t video_queue;
 	AVStream *video_stream;
 	AVCodecContext *video_codec_ctx;
-	_frame_dbuffer_t in_video_buffer;
+	_frame_queue_t in_video_queue;
 	int video_eof;
 	
 	/* Video scaling */
 	struct SwsContext *sws_ctx;
-	_frame_dbuffer_t out_video_buffer;
+	int sws_src[3];	/* Source width, height and format of sws_ctx */
+	int sws_dst[3];	/* Output width, height and format of sws_ctx */
+	_frame_pool_t video_pool;
+	_frame_queue_t out_video_queue;
+	AVFrame *video_frame;	/* The frame returned by the last read */
 	
 	/* Audio decoder */
 	AVRational audio_time_base;
@@ -422,6 +457,214 @@ static AVFrame *_frame_dbuffer_flip(_frame_dbuffer_t *d)
 	return(frame);
 }
 
+static int _frame_queue_init(_frame_queue_t *q, int depth)
+{
+	int i;
+	
+	q->depth = depth;
+	q->length = 0;
+	q->first = 0;
+	q->eof = 0;
+	q->abort = 0;
+	
+	q->frame = calloc(depth, sizeof(AVFrame *));
+	if(!q->frame)
+	{
+		return(-1);
+	}
+	
+	for(i = 0; i < depth; i++)
+	{
+		q->frame[i] = av_frame_alloc();
+		if(!q->frame[i])
+		{
+			while(i--) av_frame_free(&q->frame[i]);
+			free(q->frame);
+			return(-1);
+		}
+	}
+	
+	pthread_mutex_init(&q->mutex, NULL);
+	pthread_cond_init(&q->cond, NULL);
+	
+	return(0);
+}
+
+static void _frame_queue_free(_frame_queue_t *q)
+{
+	int i;
+	
+	pthread_cond_destroy(&q->cond);
+	pthread_mutex_destroy(&q->mutex);
+	
+	for(i = 0; i < q->depth; i++)
+	{
+		av_frame_free(&q->frame[i]);
+	}
+	
+	free(q->frame);
+}
+
+static void _frame_queue_abort(_frame_queue_t *q)
+{
+	pthread_mutex_lock(&q->mutex);
+	
+	q->abort = 1;
+	
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->mutex);
+}
+
+static void _frame_queue_eof(_frame_queue_t *q)
+{
+	pthread_mutex_lock(&q->mutex);
+	
+	q->eof = 1;
+	
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->mutex);
+}
+
+static int _frame_queue_write(_frame_queue_t *q, AVFrame *frame)
+{
+	pthread_mutex_lock(&q->mutex);
+	
+	/* Wait for space in the queue */
+	while(q->length == q->depth && q->abort == 0)
+	{
+		pthread_cond_wait(&q->cond, &q->mutex);
+	}
+	
+	if(q->abort != 0)
+	{
+		pthread_mutex_unlock(&q->mutex);
+		return(-1);
+	}
+	
+	/* Take the reference. A NULL frame repeats the previous one */
+	if(frame != NULL)
+	{
+		av_frame_move_ref(q->frame[(q->first + q->length) % q->depth], frame);
+	}
+	
+	q->length++;
+	
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->mutex);
+	
+	return(0);
+}
+
+static int _frame_queue_read(_frame_queue_t *q, AVFrame *frame)
+{
+	AVFrame *f;
+	
+	pthread_mutex_lock(&q->mutex);
+	
+	/* Wait for a frame, or the end of the stream */
+	while(q->length == 0 && q->eof == 0 && q->abort == 0)
+	{
+		pthread_cond_wait(&q->cond, &q->mutex);
+	}
+	
+	/* Frames still queued at the EOF are returned, but not on abort */
+	if(q->abort != 0 || q->length == 0)
+	{
+		pthread_mutex_unlock(&q->mutex);
+		return(-1);
+	}
+	
+	/* Replace the caller's frame, unless this is a repeat */
+	f = q->frame[q->first];
+	
+	if(f->buf[0] != NULL)
+	{
+		av_frame_unref(frame);
+		av_frame_move_ref(frame, f);
+	}
+	
+	q->first = (q->first + 1) % q->depth;
+	q->length--;
+	
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->mutex);
+	
+	return(0);
+}
+
+static int _frame_pool_get(_frame_pool_t *p, AVFrame *frame, int width, int height, enum AVPixelFormat format)
+{
+	AVBufferRef **bufs;
+	int align = av_cpu_max_align();
+	int size;
+	int i;
+	
+	size = av_image_get_buffer_size(format, width, height, align);
+	if(size < 0)
+	{
+		return(-1);
+	}
+	
+	if(p->pool == NULL ||
+	   width != p->width ||
+	   height != p->height ||
+	   format != p->format)
+	{
+		/* Buffers of the old size are freed once they are released */
+		av_buffer_pool_uninit(&p->pool);
+		
+		p->pool = av_buffer_pool_init(size, NULL);
+		if(!p->pool)
+		{
+			return(-1);
+		}
+		
+		/* Allocate the buffers up front, they return to the pool when released */
+		bufs = calloc(p->count, sizeof(AVBufferRef *));
+		for(i = 0; bufs && i < p->count; i++)
+		{
+			bufs[i] = av_buffer_pool_get(p->pool);
+		}
+		
+		for(i = 0; bufs && i < p->count; i++)
+		{
+			av_buffer_unref(&bufs[i]);
+		}
+		
+		free(bufs);
+		
+		p->width = width;
+		p->height = height;
+		p->format = format;
+	}
+	
+	av_frame_unref(frame);
+	
+	frame->buf[0] = av_buffer_pool_get(p->pool);
+	if(!frame->buf[0])
+	{
+		return(-1);
+	}
+	
+	frame->format = format;
+	frame->width = width;
+	frame->height = height;
+	
+	/* All the planes share the one aligned buffer */
+	av_image_fill_arrays(
+		frame->data, frame->linesize,
+		frame->buf[0]->data,
+		format, width, height, align
+	);
+	
+	return(0);
+}
+
+static void _frame_pool_free(_frame_pool_t *p)
+{
+	av_buffer_pool_uninit(&p->pool);
+}
+
 static void *_input_thread(void *arg)
 {
 	av_ffmpeg_t *s = (av_ffmpeg_t *) arg;
@@ -514,8 +757,11 @@ static void *_video_decode_thread(void *arg)
 		if(r == 0)
 		{
 			/* We have received a frame! */
-			av_frame_ref(_frame_dbuffer_back_buffer(&s->in_video_buffer), frame);
-			_frame_dbuffer_ready(&s->in_video_buffer, 0);
+			if(_frame_queue_write(&s->in_video_queue, frame) != 0)
+			{
+				/* Thread is aborting */
+				break;
+			}
 		}
 		else if(r != AVERROR(EAGAIN))
 		{
@@ -524,7 +770,7 @@ static void *_video_decode_thread(void *arg)
 		}
 	}
 	
-	_frame_dbuffer_abort(&s->in_video_buffer);
+	_frame_queue_eof(&s->in_video_queue);
 	
 	av_frame_free(&frame);
 	
@@ -533,18 +779,94 @@ static void *_video_decode_thread(void *arg)
 	return(NULL);
 }
 
+static int _ycc_source(const AVFrame *frame)
+{
+	const AVPixFmtDescriptor *d = av_pix_fmt_desc_get(frame->format);
+	
+	/* Y'CbCr sources, other than palette and greyscale formats */
+	return(d != NULL && d->nb_components >= 3 &&
+		(d->flags & (AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_PAL)) == 0);
+}
+
+static int _sws_flags(av_scaler_t scaler)
+{
+	switch(scaler)
+	{
+	case AV_SCALER_POINT: return(SWS_POINT);
+	case AV_SCALER_FAST_BILINEAR: return(SWS_FAST_BILINEAR);
+	case AV_SCALER_BILINEAR: return(SWS_BILINEAR);
+	case AV_SCALER_LANCZOS: return(SWS_LANCZOS);
+	default: break;
+	}
+	
+	return(SWS_BICUBIC);
+}
+
+static int _sws_context(av_ffmpeg_t *s, const AVFrame *frame, const AVFrame *oframe)
+{
+	int src[3] = { frame->width, frame->height, frame->format };
+	int dst[3] = { oframe->width, oframe->height, oframe->format };
+	
+	if(s->sws_ctx != NULL &&
+	   memcmp(src, s->sws_src, sizeof(src)) == 0 &&
+	   memcmp(dst, s->sws_dst, sizeof(dst)) == 0)
+	{
+		/* The current context can be reused */
+		return(0);
+	}
+	
+	/* Initialise / re-initialise software scaler. sws_getCachedContext()
+	 * can't be used here as it doesn't take the number of threads */
+	sws_freeContext(s->sws_ctx);
+	
+	s->sws_ctx = sws_alloc_context();
+	if(!s->sws_ctx)
+	{
+		return(-1);
+	}
+	
+	av_opt_set_int(s->sws_ctx, "srcw", src[0], 0);
+	av_opt_set_int(s->sws_ctx, "srch", src[1], 0);
+	av_opt_set_int(s->sws_ctx, "src_format", src[2], 0);
+	av_opt_set_int(s->sws_ctx, "dstw", dst[0], 0);
+	av_opt_set_int(s->sws_ctx, "dsth", dst[1], 0);
+	av_opt_set_int(s->sws_ctx, "dst_format", dst[2], 0);
+	av_opt_set_int(s->sws_ctx, "sws_flags", _sws_flags(s->av.scaler), 0);
+#if LIBSWSCALE_VERSION_INT >= AV_VERSION_INT(6, 1, 100)
+	/* The output is split into horizontal slices, one per thread */
+	av_opt_set_int(s->sws_ctx, "threads", s->av.scaler_threads, 0);
+#endif
+	
+	if(sws_init_context(s->sws_ctx, NULL, NULL) < 0)
+	{
+		sws_freeContext(s->sws_ctx);
+		s->sws_ctx = NULL;
+		return(-1);
+	}
+	
+	memcpy(s->sws_src, src, sizeof(src));
+	memcpy(s->sws_dst, dst, sizeof(dst));
+	
+	return(0);
+}
+
 static void *_video_scaler_thread(void *arg)
 {
 	av_ffmpeg_t *s = (av_ffmpeg_t *) arg;
 	AVFrame *frame, *oframe;
 	AVRational ratio;
+	enum AVPixelFormat format;
+	int full_range;
 	r64_t r;
 	int64_t pts;
 	
 	//fprintf(stderr, "_video_scaler_thread(): Starting\n");
 	
+	frame = av_frame_alloc();
+	oframe = av_frame_alloc();
+	
 	/* Fetch video frames and pass them through the scaler */
-	while((frame = _frame_dbuffer_flip(&s->in_video_buffer)) != NULL)
+	while(frame && oframe && _frame_queue_read(&s->in_video_queue, frame) == 0)
 	{
 		pts = frame->best_effort_timestamp;
 		
@@ -563,14 +885,12 @@ static void *_video_scaler_thread(void *arg)
 			while(pts > 0)
 			{
 				/* This frame is in the future. Repeat the previous one */
-				_frame_dbuffer_ready(&s->out_video_buffer, 1);
+				_frame_queue_write(&s->out_video_queue, NULL);
 				s->video_start_time++;
 				pts--;
 			}
 		}
 		
-		oframe = _frame_dbuffer_back_buffer(&s->out_video_buffer);
-		
 		ratio = av_guess_sample_aspect_ratio(s->format_ctx, s->video_stream, frame);
 		
 		if(ratio.num == 0 || ratio.den == 0)
@@ -580,7 +900,7 @@ static void *_video_scaler_thread(void *arg)
 		}
 		
 		r = av_calculate_frame_size(
-			s->av,
+			&s->av,
 			(r64_t) { frame->width, frame->height },
 			r64_mul(
 				(r64_t) { ratio.num, ratio.den },
@@ -588,41 +908,39 @@ static void *_video_scaler_thread(void *arg)
 			)
 		);
 		
-		if(r.num != oframe->width ||
-		   r.den != oframe->height)
+		/* Y'CbCr sources are scaled to planar 4:4:4 without
+		 * a colour conversion, the renderer does that */
+		format = s->av.ycc && _ycc_source(frame) ? AV_PIX_FMT_YUV444P : AV_PIX_FMT_RGB32;
+		
+		/* Take a free output frame from the pool */
+		if(_frame_pool_get(&s->video_pool, oframe, r.num, r.den, format) != 0) break;
+		
+		if(_sws_context(s, frame, oframe) != 0) break;
+		
+		if(format == AV_PIX_FMT_YUV444P)
 		{
-			av_freep(&oframe->data[0]);
-			
-			oframe->format = AV_PIX_FMT_RGB32;
-			oframe->width = r.num;
-			oframe->height = r.den;
+			full_range = frame->color_range == AVCOL_RANGE_JPEG ||
+				frame->format == AV_PIX_FMT_YUVJ420P ||
+				frame->format == AV_PIX_FMT_YUVJ422P ||
+				frame->format == AV_PIX_FMT_YUVJ444P;
 			
-			int i = av_image_alloc(
-				oframe->data,
-				oframe->linesize,
-				oframe->width, oframe->height,
-				AV_PIX_FMT_RGB32, av_cpu_max_align()
+			/* Keep the source range, full range (JPEG) sources
+			 * would otherwise be converted to limited range */
+			sws_setColorspaceDetails(
+				s->sws_ctx,
+				sws_getCoefficients(SWS_CS_DEFAULT), full_range,
+				sws_getCoefficients(SWS_CS_DEFAULT), full_range,
+				0, 1 << 16, 1 << 16
 			);
-			memset(oframe->data[0], 0, i);
+			
+			oframe->color_range = full_range ? AVCOL_RANGE_JPEG : AVCOL_RANGE_MPEG;
+			oframe->colorspace = frame->colorspace;
 		}
 		
-		/* Initialise / re-initialise software scaler */
-		s->sws_ctx = sws_getCachedContext(
-			s->sws_ctx,
-			frame->width,
-			frame->height,
-			frame->format,
-			oframe->width,
-			oframe->height,
-			AV_PIX_FMT_RGB32,
-			SWS_BICUBIC,
-			NULL,
-			NULL,
-			NULL
-		);
-		
-		if(!s->sws_ctx) break;
-		
+#if LIBSWSCALE_VERSION_INT >= AV_VERSION_INT(6, 1, 100)
+		/* Scale the slices in parallel */
+		sws_scale_frame(s->sws_ctx, oframe, frame);
+#else
 		sws_scale(
 			s->sws_ctx,
 			(uint8_t const * const *) frame->data,
@@ -632,6 +950,7 @@ static void *_video_scaler_thread(void *arg)
 			oframe->data,
 			oframe->linesize
 		);
+#endif
 		
 		/* Adjust the pixel ratio for the scaled image */
 		av_reduce(
@@ -653,11 +972,15 @@ static void *_video_scaler_thread(void *arg)
 		/* Done with the frame */
 		av_frame_unref(frame);
 		
-		_frame_dbuffer_ready(&s->out_video_buffer, 0);
+		/* Pass the reference to the output queue */
+		if(_frame_queue_write(&s->out_video_queue, oframe) != 0) break;
 		s->video_start_time++;
 	}
 	
-	_frame_dbuffer_abort(&s->out_video_buffer);
+	_frame_queue_eof(&s->out_video_queue);
+	
+	av_frame_free(&frame);
+	av_frame_free(&oframe);
 	
 	//fprintf(stderr, "_video_scaler_thread(): Ending\n");
 	
@@ -676,8 +999,10 @@ static int _ffmpeg_read_video(void *ctx, av_frame_t *frame)
 		return(AV_EOF);
 	}
 	
-	avframe = _frame_dbuffer_flip(&s->out_video_buffer);
-	if(!avframe)
+	/* The previous frame is kept if this one is a repeat */
+	avframe = s->video_frame;
+	
+	if(_frame_queue_read(&s->out_video_queue, avframe) != 0)
 	{
 		/* EOF or abort */
 		s->video_eof = 1;
@@ -710,9 +1035,25 @@ static int _ffmpeg_read_video(void *ctx, av_frame_t *frame)
 	/* Set the pointer to the framebuffer */
 	frame->width = avframe->width;
 	frame->height = avframe->height;
-	frame->framebuffer = (uint32_t *) avframe->data[0];
-	frame->pixel_stride = 1;
-	frame->line_stride = avframe->linesize[0] / sizeof(uint32_t);
+	
+	if(avframe->format == AV_PIX_FMT_YUV444P)
+	{
+		/* The 4:4:4 planes share a common line size */
+		frame->format = AV_FRAME_YCC444;
+		frame->ycc[0] = avframe->data[0];
+		frame->ycc[1] = avframe->data[1];
+		frame->ycc[2] = avframe->data[2];
+		frame->ycc_matrix = avframe->colorspace == AVCOL_SPC_BT709 ? AV_YCC_BT709 : AV_YCC_BT601;
+		frame->ycc_full_range = avframe->color_range == AVCOL_RANGE_JPEG;
+		frame->pixel_stride = 1;
+		frame->line_stride = avframe->linesize[0];
+	}
+	else
+	{
+		frame->framebuffer = (uint32_t *) avframe->data[0];
+		frame->pixel_stride = 1;
+		frame->line_stride = avframe->linesize[0] / sizeof(uint32_t);
+	}
 	
 	return(AV_OK);
 }
@@ -908,18 +1249,18 @@ static int _ffmpeg_close(void *ctx)
 	
 	if(s->video_stream != NULL)
 	{
-		_frame_dbuffer_abort(&s->in_video_buffer);
-		_frame_dbuffer_abort(&s->out_video_buffer);
+		_frame_queue_abort(&s->in_video_queue);
+		_frame_queue_abort(&s->out_video_queue);
 		
 		pthread_join(s->video_decode_thread, NULL);
 		pthread_join(s->video_scaler_thread, NULL);
 		
 		_packet_queue_free(s, &s->video_queue);
-		_frame_dbuffer_free(&s->in_video_buffer);
+		_frame_queue_free(&s->in_video_queue);
+		_frame_queue_free(&s->out_video_queue);
 		
-		av_freep(&s->out_video_buffer.frame[0]->data[0]);
-		av_freep(&s->out_video_buffer.frame[1]->data[0]);
-		_frame_dbuffer_free(&s->out_video_buffer);
+		av_frame_free(&s->video_frame);
+		_frame_pool_free(&s->video_pool);
 		
 		avcodec_free_context(&s->video_codec_ctx);
 		sws_freeContext(s->sws_ctx);
@@ -974,7 +1315,7 @@ int av_ffmpeg_open(av_t *av, char *input_url, char *format, char *options)
 		return(AV_OUT_OF_MEMORY);
 	}
 	
-	s->av = av;
+	s->av = *av;
 	
 	/* Use 'pipe:' for stdin */
 	if(strcmp(input_url, "-") == 0)
@@ -1070,24 +1411,8 @@ int av_ffmpeg_open(av_t *av, char *input_url, char *format, char *options)
 			return(AV_ERROR);
 		}
 		
-		/* Initialise SWS context for software scaling */
-		s->sws_ctx = sws_getContext(
-			s->video_codec_ctx->width,
-			s->video_codec_ctx->height,
-			s->video_codec_ctx->pix_fmt,
-			av->width,
-			av->height,
-			AV_PIX_FMT_RGB32,
-			SWS_BICUBIC,
-			NULL,
-			NULL,
-			NULL
-		);
-		
-		if(!s->sws_ctx)
-		{
-			return(AV_OUT_OF_MEMORY);
-		}
+		/* The software scaler is initialised by the scaler thread */
+		s->sws_ctx = NULL;
 		
 		s->video_eof = 0;
 	}
@@ -1199,6 +1524,33 @@ int av_ffmpeg_open(av_t *av, char *input_url, char *format, char *options)
 		s->audio_start_time = av_rescale_q(start_time, time_base, s->audio_time_base);
 	}
 	
+	if(av->start > 0)
+	{
+		AVRational frame_time_base = { av->frame_rate.den, av->frame_rate.num };
+		int64_t ts;
+		
+		/* Move the start times forward. Any frames decoded
+		 * before the new start times are dropped */
+		if(s->video_stream != NULL)
+		{
+			s->video_start_time += av->start;
+		}
+		
+		if(s->audio_stream != NULL)
+		{
+			s->audio_start_time += av_rescale_q(av->start, frame_time_base, s->audio_time_base);
+		}
+		
+		/* Seek to the nearest point before the start */
+		ts  = av_rescale_q(start_time, time_base, AV_TIME_BASE_Q);
+		ts += av_rescale_q(av->start, frame_time_base, AV_TIME_BASE_Q);
+		
+		if(avformat_seek_file(s->format_ctx, -1, INT64_MIN, ts, ts, 0) < 0)
+		{
+			fprintf(stderr, "Unable to seek, decoding from the start.\n");
+		}
+	}
+	
 	/* Register the callback functions */
 	av->av_source_ctx = s;
 	av->read_video = s->video_stream != NULL ? _ffmpeg_read_video : NULL;
@@ -1214,23 +1566,22 @@ int av_ffmpeg_open(av_t *av, char *input_url, char *format, char *options)
 	
 	if(s->video_stream != NULL)
 	{
-		_frame_dbuffer_init(&s->in_video_buffer);
-		_frame_dbuffer_init(&s->out_video_buffer);
-		
-		/* Allocate memory for the output frame buffers */
-		for(i = 0; i < 2; i++)
+		/* Each queue holds up to video_buffers frames. The pool also
+		 * needs one for the renderer and one for the scaler */
+		i = av->video_buffers > 0 ? av->video_buffers : 1;
+		s->video_pool.count = i + 2;
+		
+		if(_frame_queue_init(&s->in_video_queue, i) != 0 ||
+		   _frame_queue_init(&s->out_video_queue, i) != 0 ||
+		   (s->video_frame = av_frame_alloc()) == NULL ||
+		   _frame_pool_get(&s->video_pool, s->video_frame, av->width, av->height, AV_PIX_FMT_RGB32) != 0)
 		{
-			s->out_video_buffer.frame[i]->width = av->width;
-			s->out_video_buffer.frame[i]->height = av->height;
-			
-			r = av_image_alloc(
-				s->out_video_buffer.frame[i]->data,
-				s->out_video_buffer.frame[i]->linesize,
-				av->width, av->height,
-				AV_PIX_FMT_RGB32, av_cpu_max_align()
-			);
+			return(AV_OUT_OF_MEMORY);
 		}
 		
+		/* Start with a black frame, shown until the first is decoded */
+		memset(s->video_frame->buf[0]->data, 0, s->video_frame->buf[0]->size);
+		
 		r = pthread_create(&s->video_decode_thread, NULL, &_video_decode_thread, (void *) s);
 		if(r != 0)
 		{
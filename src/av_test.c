@@ -41,6 +41,7 @@ typedef struct {
 	uint32_t *video;
 	int16_t *audio;
 	size_t audio_samples;
+	size_t audio_offset;
 } av_test_t;
 
 static int _test_read_video(void *ctx, av_frame_t *frame)
@@ -54,8 +55,9 @@ static int _test_read_video(void *ctx, av_frame_t *frame)
 static int _test_read_audio(void *ctx, int16_t **samples, size_t *nsamples)
 {
 	av_test_t *s = ctx;
-	*samples = s->audio;
-	*nsamples = s->audio_samples;
+	*samples = s->audio + s->audio_offset * 2;
+	*nsamples = s->audio_samples - s->audio_offset;
+	s->audio_offset = 0;
 	return(AV_OK);
 }
 
@@ -195,6 +197,11 @@ int av_test_open(av_t *av)
 		}
 	}
 	
+	/* The video is static, only the audio depends on the start position */
+	s->audio_offset = av->start * av->sample_rate.num * av->frame_rate.den
+	                / (av->sample_rate.den * av->frame_rate.num)
+	                % s->audio_samples;
+	
 	/* Register the callback functions */
 	av->av_source_ctx = s;
 	av->read_video = _test_read_video;
@@ -0,0 +1,493 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2026 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* hacktv-bench - Encoder throughput benchmark
+ *
+ * Renders a fixed duration of the test pattern (and optionally a clip
+ * through ffmpeg) in every mode to a null output, once for the mode's
+ * default configuration and once for each applicable variant. Each run
+ * takes place in its own process so the peak RSS can be measured.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "hacktv.h"
+#include "av.h"
+#include "rf.h"
+
+/* Benchmark settings */
+typedef struct {
+	double seconds;
+	unsigned int samplerate;
+	int threads;
+	char *teletext;
+	char *input;
+	char *mode;
+	int variants;
+	int json;
+} _bench_t;
+
+/* Results of a single run */
+typedef struct {
+	int status;
+	uint64_t samples;
+	uint64_t elapsed;
+	long peak_rss;
+} _result_t;
+
+/* Configuration variants. apply() modifies the configuration and
+ * returns 0 if the variant is not available in this mode */
+typedef struct {
+	const char *name;
+	int (*apply)(const _bench_t *b, vid_config_t *conf);
+} _variant_t;
+
+static int _variant_none(const _bench_t *b, vid_config_t *conf)
+{
+	return(1);
+}
+
+static int _variant_filter(const _bench_t *b, vid_config_t *conf)
+{
+	conf->vfilter = 1;
+	return(1);
+}
+
+static int _variant_teletext(const _bench_t *b, vid_config_t *conf)
+{
+	if(conf->lines != 625) return(0);
+	
+	conf->teletext = b->teletext;
+	return(1);
+}
+
+static int _variant_videocrypt(const _bench_t *b, vid_config_t *conf)
+{
+	if(conf->type != VID_RASTER_625 || conf->colour_mode != VID_PAL) return(0);
+	
+	conf->videocrypt = "free";
+	return(1);
+}
+
+static int _variant_nicam(const _bench_t *b, vid_config_t *conf)
+{
+	/* NICAM is disabled for the other rows, see _run() */
+	return(conf->nicam_carrier != 0);
+}
+
+static int _variant_offset(const _bench_t *b, vid_config_t *conf)
+{
+	if(conf->output_type != RF_INT16_COMPLEX) return(0);
+	
+	conf->offset = 1000000;
+	return(1);
+}
+
+static int _variant_subcarrier(const _bench_t *b, vid_config_t *conf)
+{
+	if(conf->colour_mode != VID_PAL && conf->colour_mode != VID_NTSC) return(0);
+	
+	conf->subcarrier_mode = VID_SUBCARRIER_LINE;
+	return(1);
+}
+
+static const _variant_t _variants[] = {
+	{ "",           _variant_none },
+	{ "filter",     _variant_filter },
+	{ "teletext",   _variant_teletext },
+	{ "videocrypt", _variant_videocrypt },
+	{ "nicam",      _variant_nicam },
+	{ "offset",     _variant_offset },
+	{ "subcarrier", _variant_subcarrier },
+	{ NULL },
+};
+
+/* Null RF sink */
+static int _null_write(void *ctx, const int16_t *iq_data, size_t samples)
+{
+	return(RF_OK);
+}
+
+static int _null_close(void *ctx)
+{
+	return(RF_OK);
+}
+
+static void _null_open(rf_t *rf)
+{
+	rf->ctx = NULL;
+	rf->write = _null_write;
+	rf->write_audio = _null_write;
+	rf->close = _null_close;
+}
+
+/* Render one row. Runs in the child process */
+static int _run(const _bench_t *b, const vid_configs_t *vc, const _variant_t *v, char *input, _result_t *res)
+{
+	vid_config_t conf;
+	vid_t vid;
+	rf_t rf;
+	uint64_t start;
+	int64_t i, n;
+	int r;
+	
+	memcpy(&conf, vc->conf, sizeof(vid_config_t));
+	
+	/* NICAM has its own row */
+	if(v->apply != _variant_nicam)
+	{
+		conf.nicam_level = 0;
+		conf.nicam_carrier = 0;
+	}
+	
+	v->apply(b, &conf);
+	conf.threads = b->threads;
+	
+	if(vid_init(&vid, b->samplerate, 0, &conf) != VID_OK)
+	{
+		return(-1);
+	}
+	
+	vid_av_defaults(&vid);
+	
+	r = input ? av_ffmpeg_open(&vid.av, input, NULL, NULL) : av_test_open(&vid.av);
+	if(r != AV_OK)
+	{
+		vid_free(&vid);
+		return(-1);
+	}
+	
+	_null_open(&rf);
+	
+	n = b->seconds * conf.frame_rate.num / conf.frame_rate.den * conf.lines;
+	start = prof_now();
+	
+	for(i = 0; i < n; i++)
+	{
+		vid_line_t *line = vid_next_line(&vid);
+		
+		/* The clip may be shorter than the requested duration */
+		if(line == NULL) break;
+		
+		rf_write(&rf, line->output, line->width);
+		if(line->audio_len) rf_write_audio(&rf, line->audio, line->audio_len);
+		
+		res->samples += line->width;
+	}
+	
+	res->elapsed = prof_now() - start;
+	
+	vid_pause(&vid);
+	av_close(&vid.av);
+	rf_close(&rf);
+	vid_free(&vid);
+	
+	return(0);
+}
+
+/* Run a row in a child process and collect the results */
+static int _fork_run(const _bench_t *b, const vid_configs_t *vc, const _variant_t *v, char *input, _result_t *res)
+{
+	struct rusage ru;
+	pid_t pid;
+	int fd[2];
+	int status;
+	ssize_t l;
+	
+	memset(res, 0, sizeof(_result_t));
+	
+	if(pipe(fd) != 0)
+	{
+		perror("pipe");
+		return(-1);
+	}
+	
+	fflush(stdout);
+	fflush(stderr);
+	
+	pid = fork();
+	if(pid < 0)
+	{
+		perror("fork");
+		close(fd[0]);
+		close(fd[1]);
+		return(-1);
+	}
+	
+	if(pid == 0)
+	{
+		close(fd[0]);
+		
+		res->status = _run(b, vc, v, input, res);
+		
+		getrusage(RUSAGE_SELF, &ru);
+		res->peak_rss = ru.ru_maxrss;
+		
+		l = write(fd[1], res, sizeof(_result_t));
+		_exit(l == sizeof(_result_t) ? 0 : 1);
+	}
+	
+	close(fd[1]);
+	
+	l = read(fd[0], res, sizeof(_result_t));
+	close(fd[0]);
+	
+	waitpid(pid, &status, 0);
+	
+	if(l != sizeof(_result_t) || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	{
+		res->status = -1;
+	}
+	
+	return(res->status);
+}
+
+static void _print_result(const _bench_t *b, const vid_configs_t *vc, const _variant_t *v, const char *source, const _result_t *res, int first)
+{
+	double seconds = res->elapsed / 1e9;
+	double sps = seconds > 0 ? res->samples / seconds : 0;
+	double rt = sps / b->samplerate;
+	
+	if(b->json)
+	{
+		printf("%s  {\n", first ? "" : ",\n");
+		printf("    \"mode\": \"%s\",\n", vc->id);
+		printf("    \"variant\": \"%s\",\n", v->name);
+		printf("    \"source\": \"%s\",\n", source);
+		printf("    \"sample_rate\": %u,\n", b->samplerate);
+		printf("    \"samples\": %llu,\n", (unsigned long long) res->samples);
+		printf("    \"elapsed_ns\": %llu,\n", (unsigned long long) res->elapsed);
+		printf("    \"samples_per_second\": %.0f,\n", sps);
+		printf("    \"realtime_factor\": %.3f,\n", rt);
+		printf("    \"peak_rss_kb\": %ld\n", res->peak_rss);
+		printf("  }");
+	}
+	else
+	{
+		printf("%-14s %-11s %-7s %14.0f %9.3f %12ld\n",
+			vc->id, v->name[0] ? v->name : "-", source,
+			sps, rt, res->peak_rss
+		);
+	}
+	
+	fflush(stdout);
+}
+
+static void print_usage(void)
+{
+	printf(
+		"\n"
+		"Usage: hacktv-bench [options]\n"
+		"\n"
+		"  -d, --duration <seconds>       Length of video to render in each run. Default: 2\n"
+		"  -s, --samplerate <value>       Set the sample rate in Hz. Default: 16MHz\n"
+		"  -m, --mode <name>              Only benchmark this mode.\n"
+		"  -i, --input <file>             Also benchmark each mode with this clip.\n"
+		"      --teletext <path>          Teletext source for the teletext rows.\n"
+		"                                 Default: demo.tti\n"
+		"      --threads <n>              Run the line processes on <n> worker threads.\n"
+		"      --novariants               Only benchmark the default configurations.\n"
+		"      --json                     Output the results as a JSON array.\n"
+		"\n"
+		"Each mode is rendered to a null output with its default configuration\n"
+		"(without NICAM), then once for each of the filter, teletext, videocrypt,\n"
+		"nicam, offset and subcarrier (--subcarrier-mode line) variants where the\n"
+		"mode supports it. The samples per second, realtime factor and peak RSS\n"
+		"in kB are reported for each run.\n"
+		"\n"
+	);
+}
+
+enum {
+	_OPT_TELETEXT = 1000,
+	_OPT_THREADS,
+	_OPT_NOVARIANTS,
+	_OPT_JSON,
+};
+
+int main(int argc, char *argv[])
+{
+	int c;
+	int option_index;
+	static struct option long_options[] = {
+		{ "duration",       required_argument, 0, 'd' },
+		{ "samplerate",     required_argument, 0, 's' },
+		{ "mode",           required_argument, 0, 'm' },
+		{ "input",          required_argument, 0, 'i' },
+		{ "teletext",       required_argument, 0, _OPT_TELETEXT },
+		{ "threads",        required_argument, 0, _OPT_THREADS },
+		{ "novariants",     no_argument,       0, _OPT_NOVARIANTS },
+		{ "json",           no_argument,       0, _OPT_JSON },
+		{ "help",           no_argument,       0, 'h' },
+		{ 0,                0,                 0,  0  }
+	};
+	const vid_configs_t *vc;
+	const _variant_t *v;
+	_result_t res;
+	_bench_t b;
+	int first = 1;
+	int found = 0;
+	int i;
+	
+	b.seconds = 2;
+	b.samplerate = 16000000;
+	b.threads = 0;
+	b.teletext = "demo.tti";
+	b.input = NULL;
+	b.mode = NULL;
+	b.variants = 1;
+	b.json = 0;
+	
+	opterr = 0;
+	while((c = getopt_long(argc, argv, "d:s:m:i:h", long_options, &option_index)) != -1)
+	{
+		switch(c)
+		{
+		case 'd': /* -d, --duration <seconds> */
+			b.seconds = atof(optarg);
+			
+			if(b.seconds <= 0)
+			{
+				fprintf(stderr, "Invalid duration.\n");
+				return(-1);
+			}
+			
+			break;
+		
+		case 's': /* -s, --samplerate <value> */
+			b.samplerate = atoi(optarg);
+			break;
+		
+		case 'm': /* -m, --mode <name> */
+			b.mode = optarg;
+			break;
+		
+		case 'i': /* -i, --input <file> */
+			b.input = optarg;
+			break;
+		
+		case _OPT_TELETEXT: /* --teletext <path> */
+			b.teletext = optarg;
+			break;
+		
+		case _OPT_THREADS: /* --threads <n> */
+			b.threads = atoi(optarg);
+			
+			if(b.threads < 0)
+			{
+				fprintf(stderr, "Invalid number of threads.\n");
+				return(-1);
+			}
+			
+			break;
+		
+		case _OPT_NOVARIANTS: /* --novariants */
+			b.variants = 0;
+			break;
+		
+		case _OPT_JSON: /* --json */
+			b.json = 1;
+			break;
+		
+		case 'h': /* -h, --help */
+			print_usage();
+			return(0);
+		
+		case '?':
+		default:
+			print_usage();
+			return(-1);
+		}
+	}
+	
+	if(b.samplerate < 1)
+	{
+		fprintf(stderr, "Invalid sample rate.\n");
+		return(-1);
+	}
+	
+	if(b.input)
+	{
+		av_ffmpeg_init();
+	}
+	
+	if(b.json)
+	{
+		printf("[\n");
+	}
+	else
+	{
+		printf("%-14s %-11s %-7s %14s %9s %12s\n",
+			"mode", "variant", "source", "samples/s", "realtime", "peak RSS kB"
+		);
+	}
+	
+	for(vc = vid_configs; vc->id != NULL; vc++)
+	{
+		if(b.mode && strcmp(b.mode, vc->id) != 0) continue;
+		
+		found = 1;
+		
+		for(v = _variants; v->name != NULL; v++)
+		{
+			vid_config_t conf;
+			
+			if(!b.variants && v != _variants) break;
+			
+			/* Skip variants that don't apply to this mode */
+			memcpy(&conf, vc->conf, sizeof(vid_config_t));
+			if(!v->apply(&b, &conf)) continue;
+			
+			for(i = 0; i < (b.input ? 2 : 1); i++)
+			{
+				if(_fork_run(&b, vc, v, i ? b.input : NULL, &res) != 0)
+				{
+					fprintf(stderr, "%s%s%s: Failed to render\n", vc->id, v->name[0] ? " " : "", v->name);
+					continue;
+				}
+				
+				_print_result(&b, vc, v, i ? "ffmpeg" : "test", &res, first);
+				first = 0;
+			}
+		}
+	}
+	
+	if(b.json)
+	{
+		printf("%s]\n", first ? "" : "\n");
+	}
+	
+	if(b.input)
+	{
+		av_ffmpeg_deinit();
+	}
+	
+	if(!found)
+	{
+		fprintf(stderr, "Unrecognised TV mode.\n");
+		return(-1);
+	}
+	
+	return(0);
+}
+
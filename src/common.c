@@ -19,6 +19,14 @@
 #include <stdlib.h>
 #include <math.h>
 #include <ctype.h>
+#include <pthread.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define _COMMON_X86
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define _COMMON_NEON
+#endif
 #include "common.h"
 
 int64_t gcd(int64_t a, int64_t b)
@@ -277,3 +285,300 @@ double rrc(double x, double b, double t)
 	return(r);
 }
 
+/* fputs() a string with JSON-style escape sequences */
+int fputs_json(const char *str, FILE *stream)
+{
+	int c;
+	
+	for(c = 0; *str; str++)
+	{
+		const char *s = NULL;
+		int r;
+		
+		switch(*str)
+		{
+		case '"': s = "\\\""; break;
+		case '\\': s = "\\\\"; break;
+		//case '/': s = "\\/"; break;
+		case '\b': s = "\\b"; break;
+		case '\f': s = "\\f"; break;
+		case '\n': s = "\\n"; break;
+		case '\r': s = "\\r"; break;
+		case '\t': s = "\\t"; break;
+		}
+		
+		if(s) r = fputs(s, stream);
+		else r = fputc(*str, stream) == EOF ? EOF : 1;
+		
+		if(r == EOF)
+		{
+			return(c > 0 ? c : EOF);
+		}
+		
+		c += r;
+	}
+	
+	return(c);
+}
+
+
+/* Complex int16 array multiply. The scalar versions
+ * also handle the remainder for the vector versions */
+
+typedef void (*_cint16_array_t)(cint16_t *r, const cint16_t *a, const cint16_t *b, size_t n);
+
+static void _cint16_mul_scalar(cint16_t *r, const cint16_t *a, const cint16_t *b, size_t n)
+{
+	size_t x;
+	
+	for(x = 0; x < n; x++)
+	{
+		cint16_mul(&r[x], &a[x], &b[x]);
+	}
+}
+
+static void _cint16_mula_scalar(cint16_t *r, const cint16_t *a, const cint16_t *b, size_t n)
+{
+	size_t x;
+	
+	for(x = 0; x < n; x++)
+	{
+		cint16_mula(&r[x], &a[x], &b[x]);
+	}
+}
+
+#ifdef _COMMON_X86
+
+/* Multiply 4 complex values. The I and Q products are formed with
+ * pmaddwd and truncated to 16 bits as in cint16_mul() */
+__attribute__((target("sse4.1")))
+static inline __m128i _cint16_mul_sse41(__m128i a, __m128i b)
+{
+	const __m128i m = _mm_set1_epi32(0x0000FFFF);
+	__m128i i, q;
+	
+	/* a.i * b.i - a.q * b.q */
+	i = _mm_sub_epi32(
+		_mm_madd_epi16(a, _mm_and_si128(b, m)),
+		_mm_madd_epi16(a, _mm_andnot_si128(m, b))
+	);
+	
+	/* a.i * b.q + a.q * b.i */
+	q = _mm_madd_epi16(a, _mm_shufflehi_epi16(_mm_shufflelo_epi16(b, 0xB1), 0xB1));
+	
+	return(_mm_blend_epi16(_mm_srai_epi32(i, 15), _mm_slli_epi32(_mm_srai_epi32(q, 15), 16), 0xAA));
+}
+
+__attribute__((target("sse4.1")))
+static void _cint16_mul_sse41_array(cint16_t *r, const cint16_t *a, const cint16_t *b, size_t n)
+{
+	size_t x;
+	
+	for(x = 0; x + 4 <= n; x += 4)
+	{
+		_mm_storeu_si128((__m128i *) &r[x], _cint16_mul_sse41(
+			_mm_loadu_si128((const __m128i *) &a[x]),
+			_mm_loadu_si128((const __m128i *) &b[x])
+		));
+	}
+	
+	_cint16_mul_scalar(&r[x], &a[x], &b[x], n - x);
+}
+
+__attribute__((target("sse4.1")))
+static void _cint16_mula_sse41_array(cint16_t *r, const cint16_t *a, const cint16_t *b, size_t n)
+{
+	size_t x;
+	
+	for(x = 0; x + 4 <= n; x += 4)
+	{
+		_mm_storeu_si128((__m128i *) &r[x], _mm_add_epi16(
+			_mm_loadu_si128((const __m128i *) &r[x]),
+			_cint16_mul_sse41(
+				_mm_loadu_si128((const __m128i *) &a[x]),
+				_mm_loadu_si128((const __m128i *) &b[x])
+			)
+		));
+	}
+	
+	_cint16_mula_scalar(&r[x], &a[x], &b[x], n - x);
+}
+
+/* Multiply 8 complex values */
+__attribute__((target("avx2")))
+static inline __m256i _cint16_mul_avx2(__m256i a, __m256i b)
+{
+	const __m256i m = _mm256_set1_epi32(0x0000FFFF);
+	__m256i i, q;
+	
+	i = _mm256_sub_epi32(
+		_mm256_madd_epi16(a, _mm256_and_si256(b, m)),
+		_mm256_madd_epi16(a, _mm256_andnot_si256(m, b))
+	);
+	
+	q = _mm256_madd_epi16(a, _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(b, 0xB1), 0xB1));
+	
+	return(_mm256_blend_epi16(_mm256_srai_epi32(i, 15), _mm256_slli_epi32(_mm256_srai_epi32(q, 15), 16), 0xAA));
+}
+
+__attribute__((target("avx2")))
+static void _cint16_mul_avx2_array(cint16_t *r, const cint16_t *a, const cint16_t *b, size_t n)
+{
+	size_t x;
+	
+	for(x = 0; x + 8 <= n; x += 8)
+	{
+		_mm256_storeu_si256((__m256i *) &r[x], _cint16_mul_avx2(
+			_mm256_loadu_si256((const __m256i *) &a[x]),
+			_mm256_loadu_si256((const __m256i *) &b[x])
+		));
+	}
+	
+	_cint16_mul_scalar(&r[x], &a[x], &b[x], n - x);
+}
+
+__attribute__((target("avx2")))
+static void _cint16_mula_avx2_array(cint16_t *r, const cint16_t *a, const cint16_t *b, size_t n)
+{
+	size_t x;
+	
+	for(x = 0; x + 8 <= n; x += 8)
+	{
+		_mm256_storeu_si256((__m256i *) &r[x], _mm256_add_epi16(
+			_mm256_loadu_si256((const __m256i *) &r[x]),
+			_cint16_mul_avx2(
+				_mm256_loadu_si256((const __m256i *) &a[x]),
+				_mm256_loadu_si256((const __m256i *) &b[x])
+			)
+		));
+	}
+	
+	_cint16_mula_scalar(&r[x], &a[x], &b[x], n - x);
+}
+
+#endif
+
+#ifdef _COMMON_NEON
+
+/* Multiply 8 complex values, deinterleaved into I and Q vectors */
+static inline int16x8x2_t _cint16_mul_neon(int16x8x2_t a, int16x8x2_t b)
+{
+	int16x8x2_t r;
+	
+	/* a.i * b.i - a.q * b.q */
+	r.val[0] = vcombine_s16(
+		vshrn_n_s32(vmlsl_s16(vmull_s16(vget_low_s16(a.val[0]), vget_low_s16(b.val[0])), vget_low_s16(a.val[1]), vget_low_s16(b.val[1])), 15),
+		vshrn_n_s32(vmlsl_s16(vmull_s16(vget_high_s16(a.val[0]), vget_high_s16(b.val[0])), vget_high_s16(a.val[1]), vget_high_s16(b.val[1])), 15)
+	);
+	
+	/* a.i * b.q + a.q * b.i */
+	r.val[1] = vcombine_s16(
+		vshrn_n_s32(vmlal_s16(vmull_s16(vget_low_s16(a.val[0]), vget_low_s16(b.val[1])), vget_low_s16(a.val[1]), vget_low_s16(b.val[0])), 15),
+		vshrn_n_s32(vmlal_s16(vmull_s16(vget_high_s16(a.val[0]), vget_high_s16(b.val[1])), vget_high_s16(a.val[1]), vget_high_s16(b.val[0])), 15)
+	);
+	
+	return(r);
+}
+
+static void _cint16_mul_neon_array(cint16_t *r, const cint16_t *a, const cint16_t *b, size_t n)
+{
+	size_t x;
+	
+	for(x = 0; x + 8 <= n; x += 8)
+	{
+		vst2q_s16((int16_t *) &r[x], _cint16_mul_neon(
+			vld2q_s16((const int16_t *) &a[x]),
+			vld2q_s16((const int16_t *) &b[x])
+		));
+	}
+	
+	_cint16_mul_scalar(&r[x], &a[x], &b[x], n - x);
+}
+
+static void _cint16_mula_neon_array(cint16_t *r, const cint16_t *a, const cint16_t *b, size_t n)
+{
+	int16x8x2_t v, p;
+	size_t x;
+	
+	for(x = 0; x + 8 <= n; x += 8)
+	{
+		v = vld2q_s16((const int16_t *) &r[x]);
+		p = _cint16_mul_neon(
+			vld2q_s16((const int16_t *) &a[x]),
+			vld2q_s16((const int16_t *) &b[x])
+		);
+		
+		v.val[0] = vaddq_s16(v.val[0], p.val[0]);
+		v.val[1] = vaddq_s16(v.val[1], p.val[1]);
+		vst2q_s16((int16_t *) &r[x], v);
+	}
+	
+	_cint16_mula_scalar(&r[x], &a[x], &b[x], n - x);
+}
+
+#endif
+
+static struct {
+	_cint16_array_t mul;
+	_cint16_array_t mula;
+} _cint16_array;
+
+static pthread_once_t _cint16_array_once = PTHREAD_ONCE_INIT;
+
+static void _cint16_array_init(void)
+{
+	/* Select the best implementation for this CPU */
+	_cint16_array.mul = _cint16_mul_scalar;
+	_cint16_array.mula = _cint16_mula_scalar;
+	
+#if defined(_COMMON_X86)
+	__builtin_cpu_init();
+	
+	if(__builtin_cpu_supports("avx2"))
+	{
+		_cint16_array.mul = _cint16_mul_avx2_array;
+		_cint16_array.mula = _cint16_mula_avx2_array;
+	}
+	else if(__builtin_cpu_supports("sse4.1"))
+	{
+		_cint16_array.mul = _cint16_mul_sse41_array;
+		_cint16_array.mula = _cint16_mula_sse41_array;
+	}
+#elif defined(_COMMON_NEON)
+	_cint16_array.mul = _cint16_mul_neon_array;
+	_cint16_array.mula = _cint16_mula_neon_array;
+#endif
+}
+
+void cint16_mul_array(cint16_t *r, const cint16_t *a, const cint16_t *b, size_t n)
+{
+	pthread_once(&_cint16_array_once, _cint16_array_init);
+	_cint16_array.mul(r, a, b, n);
+}
+
+void cint16_mula_array(cint16_t *r, const cint16_t *a, const cint16_t *b, size_t n)
+{
+	pthread_once(&_cint16_array_once, _cint16_array_init);
+	_cint16_array.mula(r, a, b, n);
+}
+
+unsigned int cint16_rotate_array(cint16_t *r, const cint16_t *lut, unsigned int length, unsigned int pos, size_t n)
+{
+	size_t i;
+	
+	pthread_once(&_cint16_array_once, _cint16_array_init);
+	
+	/* Multiply in runs up to the end of the table */
+	for(; n > 0; n -= i, r += i)
+	{
+		i = length - pos;
+		if(i > n) i = n;
+		
+		_cint16_array.mul(r, r, &lut[pos], i);
+		
+		pos += i;
+		if(pos == length) pos = 0;
+	}
+	
+	return(pos);
+}
@@ -18,6 +18,8 @@
 #ifndef _COMMON_H
 #define _COMMON_H
 
+#include <stdio.h>
+#include <stddef.h>
 #include <stdint.h>
 
 /* These factors where calculated with: f = M_PI / 2.0 / asin(0.9 - 0.1); */
@@ -49,6 +51,24 @@ extern r64_t r64_parse(const char *str, const char **endptr);
 extern cint16_t *sin_cint16(unsigned int length, unsigned int cycles, double level);
 extern double rc_window(double t, double left, double width, double rise);
 extern double rrc(double x, double b, double t);
+extern int fputs_json(const char *str, FILE *stream);
+
+/* Complex int16 array multiply
+ *
+ * These give the same result as cint16_mul() / cint16_mula() over
+ * n values, using the fastest implementation for the CPU. r may be
+ * the same array as a or b.
+*/
+
+/* r = a * b */
+extern void cint16_mul_array(cint16_t *r, const cint16_t *a, const cint16_t *b, size_t n);
+
+/* r += a * b */
+extern void cint16_mula_array(cint16_t *r, const cint16_t *a, const cint16_t *b, size_t n);
+
+/* r *= lut, stepping through a periodic table of length values
+ * starting from pos. Returns the table position after n values */
+extern unsigned int cint16_rotate_array(cint16_t *r, const cint16_t *lut, unsigned int length, unsigned int pos, size_t n);
 
 static inline void cint16_mul(cint16_t *r, const cint16_t *a, const cint16_t *b)
 {
@@ -0,0 +1,792 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2026 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define _CONV_X86
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define _CONV_NEON
+#endif
+#include "conv.h"
+
+typedef void (*_conv_t)(void *dst, const int16_t *src, size_t n, int stride);
+typedef void (*_scale_t)(int16_t *dst, const int16_t *src, size_t n, int scale);
+typedef void (*_add_t)(int16_t *dst, const int16_t *src, size_t n);
+typedef void (*_mix_t)(int16_t *dst, const int16_t *src, size_t n, int scale);
+
+/* Scalar reference implementations. These also handle
+ * the remainder for the vector versions */
+
+static void _uint8_scalar(void *dst, const int16_t *src, size_t n, int stride)
+{
+	uint8_t *d = dst;
+	size_t i;
+	
+	for(i = 0; i < n; i++, src += stride)
+	{
+		d[i] = (src[0] - INT16_MIN) >> 8;
+	}
+}
+
+static void _int8_scalar(void *dst, const int16_t *src, size_t n, int stride)
+{
+	int8_t *d = dst;
+	size_t i;
+	
+	for(i = 0; i < n; i++, src += stride)
+	{
+		d[i] = src[0] >> 8;
+	}
+}
+
+static void _uint16_scalar(void *dst, const int16_t *src, size_t n, int stride)
+{
+	uint16_t *d = dst;
+	size_t i;
+	
+	for(i = 0; i < n; i++, src += stride)
+	{
+		d[i] = src[0] - INT16_MIN;
+	}
+}
+
+static void _int16_scalar(void *dst, const int16_t *src, size_t n, int stride)
+{
+	int16_t *d = dst;
+	size_t i;
+	
+	if(stride == 1)
+	{
+		memcpy(d, src, n * sizeof(int16_t));
+		return;
+	}
+	
+	for(i = 0; i < n; i++, src += stride)
+	{
+		d[i] = src[0];
+	}
+}
+
+static void _int32_scalar(void *dst, const int16_t *src, size_t n, int stride)
+{
+	int32_t *d = dst;
+	size_t i;
+	
+	for(i = 0; i < n; i++, src += stride)
+	{
+		d[i] = (src[0] << 16) + src[0];
+	}
+}
+
+static void _float_scalar(void *dst, const int16_t *src, size_t n, int stride)
+{
+	float *d = dst;
+	size_t i;
+	
+	for(i = 0; i < n; i++, src += stride)
+	{
+		d[i] = (float) src[0] * (1.0 / 32767.0);
+	}
+}
+
+static void _scale_scalar(int16_t *dst, const int16_t *src, size_t n, int scale)
+{
+	size_t i;
+	
+	for(i = 0; i < n; i++)
+	{
+		dst[i] = src[i] * scale / INT16_MAX;
+	}
+}
+
+static void _add_scalar(int16_t *dst, const int16_t *src, size_t n)
+{
+	size_t i;
+	
+	for(i = 0; i < n; i++)
+	{
+		dst[i] += src[i];
+	}
+}
+
+static void _mix_scalar(int16_t *dst, const int16_t *src, size_t n, int scale)
+{
+	int32_t v;
+	size_t i;
+	
+	for(i = 0; i < n; i++)
+	{
+		v = dst[i] + (src[i] * scale >> 15);
+		dst[i] = v > INT16_MAX ? INT16_MAX : (v < INT16_MIN ? INT16_MIN : v);
+	}
+}
+
+#ifdef _CONV_X86
+
+/* Load 8 values, dropping the Q values if stride is 2 */
+__attribute__((target("sse2")))
+static inline __m128i _load_sse2(const int16_t *src, int stride)
+{
+	__m128i a, b;
+	
+	a = _mm_loadu_si128((const __m128i *) src);
+	if(stride == 1) return(a);
+	
+	b = _mm_loadu_si128((const __m128i *) (src + 8));
+	
+	/* Sign extend the I values to 32 bits, then pack them back */
+	a = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+	b = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+	
+	return(_mm_packs_epi32(a, b));
+}
+
+__attribute__((target("sse2")))
+static void _uint8_sse2(void *dst, const int16_t *src, size_t n, int stride)
+{
+	uint8_t *d = dst;
+	__m128i a, b;
+	size_t i;
+	
+	for(i = 0; i + 16 <= n; i += 16, src += 16 * stride)
+	{
+		a = _mm_srai_epi16(_load_sse2(src, stride), 8);
+		b = _mm_srai_epi16(_load_sse2(src + 8 * stride, stride), 8);
+		a = _mm_xor_si128(_mm_packs_epi16(a, b), _mm_set1_epi8((char) 0x80));
+		_mm_storeu_si128((__m128i *) &d[i], a);
+	}
+	
+	_uint8_scalar(&d[i], src, n - i, stride);
+}
+
+__attribute__((target("sse2")))
+static void _int8_sse2(void *dst, const int16_t *src, size_t n, int stride)
+{
+	int8_t *d = dst;
+	__m128i a, b;
+	size_t i;
+	
+	for(i = 0; i + 16 <= n; i += 16, src += 16 * stride)
+	{
+		a = _mm_srai_epi16(_load_sse2(src, stride), 8);
+		b = _mm_srai_epi16(_load_sse2(src + 8 * stride, stride), 8);
+		_mm_storeu_si128((__m128i *) &d[i], _mm_packs_epi16(a, b));
+	}
+	
+	_int8_scalar(&d[i], src, n - i, stride);
+}
+
+__attribute__((target("sse2")))
+static void _uint16_sse2(void *dst, const int16_t *src, size_t n, int stride)
+{
+	uint16_t *d = dst;
+	__m128i a;
+	size_t i;
+	
+	for(i = 0; i + 8 <= n; i += 8, src += 8 * stride)
+	{
+		a = _mm_xor_si128(_load_sse2(src, stride), _mm_set1_epi16(INT16_MIN));
+		_mm_storeu_si128((__m128i *) &d[i], a);
+	}
+	
+	_uint16_scalar(&d[i], src, n - i, stride);
+}
+
+__attribute__((target("sse2")))
+static void _int16_sse2(void *dst, const int16_t *src, size_t n, int stride)
+{
+	int16_t *d = dst;
+	size_t i;
+	
+	if(stride == 1)
+	{
+		memcpy(d, src, n * sizeof(int16_t));
+		return;
+	}
+	
+	for(i = 0; i + 8 <= n; i += 8, src += 8 * stride)
+	{
+		_mm_storeu_si128((__m128i *) &d[i], _load_sse2(src, stride));
+	}
+	
+	_int16_scalar(&d[i], src, n - i, stride);
+}
+
+__attribute__((target("sse2")))
+static void _int32_sse2(void *dst, const int16_t *src, size_t n, int stride)
+{
+	int32_t *d = dst;
+	__m128i a, lo, hi;
+	size_t i;
+	
+	for(i = 0; i + 8 <= n; i += 8, src += 8 * stride)
+	{
+		a = _load_sse2(src, stride);
+		lo = _mm_srai_epi32(_mm_unpacklo_epi16(a, a), 16);
+		hi = _mm_srai_epi32(_mm_unpackhi_epi16(a, a), 16);
+		_mm_storeu_si128((__m128i *) &d[i + 0], _mm_add_epi32(_mm_slli_epi32(lo, 16), lo));
+		_mm_storeu_si128((__m128i *) &d[i + 4], _mm_add_epi32(_mm_slli_epi32(hi, 16), hi));
+	}
+	
+	_int32_scalar(&d[i], src, n - i, stride);
+}
+
+/* Convert 4 int32 values to float via double, as the scalar version does */
+__attribute__((target("sse2")))
+static inline __m128 _float4_sse2(__m128i v)
+{
+	const __m128d k = _mm_set1_pd(1.0 / 32767.0);
+	__m128 lo, hi;
+	
+	lo = _mm_cvtpd_ps(_mm_mul_pd(_mm_cvtepi32_pd(v), k));
+	hi = _mm_cvtpd_ps(_mm_mul_pd(_mm_cvtepi32_pd(_mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2))), k));
+	
+	return(_mm_movelh_ps(lo, hi));
+}
+
+__attribute__((target("sse2")))
+static void _float_sse2(void *dst, const int16_t *src, size_t n, int stride)
+{
+	float *d = dst;
+	__m128i a;
+	size_t i;
+	
+	for(i = 0; i + 8 <= n; i += 8, src += 8 * stride)
+	{
+		a = _load_sse2(src, stride);
+		_mm_storeu_ps(&d[i + 0], _float4_sse2(_mm_srai_epi32(_mm_unpacklo_epi16(a, a), 16)));
+		_mm_storeu_ps(&d[i + 4], _float4_sse2(_mm_srai_epi32(_mm_unpackhi_epi16(a, a), 16)));
+	}
+	
+	_float_scalar(&d[i], src, n - i, stride);
+}
+
+/* Divide 4 int32 values by INT16_MAX, rounding towards zero. The
+ * division is exact enough in double precision to give the same
+ * result as integer division */
+__attribute__((target("sse2")))
+static inline __m128i _div4_sse2(__m128i v)
+{
+	const __m128d k = _mm_set1_pd(INT16_MAX);
+	__m128i lo, hi;
+	
+	lo = _mm_cvttpd_epi32(_mm_div_pd(_mm_cvtepi32_pd(v), k));
+	hi = _mm_cvttpd_epi32(_mm_div_pd(_mm_cvtepi32_pd(_mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2))), k));
+	
+	return(_mm_unpacklo_epi64(lo, hi));
+}
+
+__attribute__((target("sse2")))
+static void _scale_sse2(int16_t *dst, const int16_t *src, size_t n, int scale)
+{
+	const __m128i s = _mm_set1_epi16(scale);
+	__m128i a, lo, hi;
+	size_t i;
+	
+	for(i = 0; i + 8 <= n; i += 8)
+	{
+		a = _mm_loadu_si128((const __m128i *) &src[i]);
+		
+		/* Full 32-bit products */
+		lo = _mm_mullo_epi16(a, s);
+		hi = _mm_mulhi_epi16(a, s);
+		a = _mm_packs_epi32(
+			_div4_sse2(_mm_unpacklo_epi16(lo, hi)),
+			_div4_sse2(_mm_unpackhi_epi16(lo, hi))
+		);
+		
+		_mm_storeu_si128((__m128i *) &dst[i], a);
+	}
+	
+	_scale_scalar(&dst[i], &src[i], n - i, scale);
+}
+
+__attribute__((target("sse2")))
+static void _add_sse2(int16_t *dst, const int16_t *src, size_t n)
+{
+	size_t i;
+	
+	for(i = 0; i + 8 <= n; i += 8)
+	{
+		_mm_storeu_si128((__m128i *) &dst[i], _mm_add_epi16(
+			_mm_loadu_si128((const __m128i *) &dst[i]),
+			_mm_loadu_si128((const __m128i *) &src[i])
+		));
+	}
+	
+	_add_scalar(&dst[i], &src[i], n - i);
+}
+
+__attribute__((target("sse2")))
+static void _mix_sse2(int16_t *dst, const int16_t *src, size_t n, int scale)
+{
+	const __m128i s = _mm_set1_epi16(scale);
+	__m128i a, lo, hi;
+	size_t i;
+	
+	for(i = 0; i + 8 <= n; i += 8)
+	{
+		a = _mm_loadu_si128((const __m128i *) &src[i]);
+		
+		/* Bits 15-30 of the 32-bit products */
+		lo = _mm_mullo_epi16(a, s);
+		hi = _mm_mulhi_epi16(a, s);
+		a = _mm_or_si128(_mm_slli_epi16(hi, 1), _mm_srli_epi16(lo, 15));
+		
+		_mm_storeu_si128((__m128i *) &dst[i], _mm_adds_epi16(
+			_mm_loadu_si128((const __m128i *) &dst[i]),
+			a
+		));
+	}
+	
+	_mix_scalar(&dst[i], &src[i], n - i, scale);
+}
+
+/* Load 16 values, dropping the Q values if stride is 2 */
+__attribute__((target("avx2")))
+static inline __m256i _load_avx2(const int16_t *src, int stride)
+{
+	__m256i a, b;
+	
+	a = _mm256_loadu_si256((const __m256i *) src);
+	if(stride == 1) return(a);
+	
+	b = _mm256_loadu_si256((const __m256i *) (src + 16));
+	
+	a = _mm256_srai_epi32(_mm256_slli_epi32(a, 16), 16);
+	b = _mm256_srai_epi32(_mm256_slli_epi32(b, 16), 16);
+	
+	/* The pack works within each 128-bit lane, restore the order */
+	return(_mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), _MM_SHUFFLE(3, 1, 2, 0)));
+}
+
+__attribute__((target("avx2")))
+static void _uint8_avx2(void *dst, const int16_t *src, size_t n, int stride)
+{
+	uint8_t *d = dst;
+	__m256i a, b;
+	size_t i;
+	
+	for(i = 0; i + 32 <= n; i += 32, src += 32 * stride)
+	{
+		a = _mm256_srai_epi16(_load_avx2(src, stride), 8);
+		b = _mm256_srai_epi16(_load_avx2(src + 16 * stride, stride), 8);
+		a = _mm256_permute4x64_epi64(_mm256_packs_epi16(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+		a = _mm256_xor_si256(a, _mm256_set1_epi8((char) 0x80));
+		_mm256_storeu_si256((__m256i *) &d[i], a);
+	}
+	
+	_uint8_sse2(&d[i], src, n - i, stride);
+}
+
+__attribute__((target("avx2")))
+static void _int8_avx2(void *dst, const int16_t *src, size_t n, int stride)
+{
+	int8_t *d = dst;
+	__m256i a, b;
+	size_t i;
+	
+	for(i = 0; i + 32 <= n; i += 32, src += 32 * stride)
+	{
+		a = _mm256_srai_epi16(_load_avx2(src, stride), 8);
+		b = _mm256_srai_epi16(_load_avx2(src + 16 * stride, stride), 8);
+		a = _mm256_permute4x64_epi64(_mm256_packs_epi16(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+		_mm256_storeu_si256((__m256i *) &d[i], a);
+	}
+	
+	_int8_sse2(&d[i], src, n - i, stride);
+}
+
+__attribute__((target("avx2")))
+static void _uint16_avx2(void *dst, const int16_t *src, size_t n, int stride)
+{
+	uint16_t *d = dst;
+	__m256i a;
+	size_t i;
+	
+	for(i = 0; i + 16 <= n; i += 16, src += 16 * stride)
+	{
+		a = _mm256_xor_si256(_load_avx2(src, stride), _mm256_set1_epi16(INT16_MIN));
+		_mm256_storeu_si256((__m256i *) &d[i], a);
+	}
+	
+	_uint16_sse2(&d[i], src, n - i, stride);
+}
+
+__attribute__((target("avx2")))
+static void _int16_avx2(void *dst, const int16_t *src, size_t n, int stride)
+{
+	int16_t *d = dst;
+	size_t i;
+	
+	if(stride == 1)
+	{
+		memcpy(d, src, n * sizeof(int16_t));
+		return;
+	}
+	
+	for(i = 0; i + 16 <= n; i += 16, src += 16 * stride)
+	{
+		_mm256_storeu_si256((__m256i *) &d[i], _load_avx2(src, stride));
+	}
+	
+	_int16_sse2(&d[i], src, n - i, stride);
+}
+
+__attribute__((target("avx2")))
+static void _int32_avx2(void *dst, const int16_t *src, size_t n, int stride)
+{
+	int32_t *d = dst;
+	__m256i v;
+	size_t i;
+	
+	for(i = 0; i + 8 <= n; i += 8, src += 8 * stride)
+	{
+		v = _mm256_cvtepi16_epi32(_load_sse2(src, stride));
+		_mm256_storeu_si256((__m256i *) &d[i], _mm256_add_epi32(_mm256_slli_epi32(v, 16), v));
+	}
+	
+	_int32_scalar(&d[i], src, n - i, stride);
+}
+
+__attribute__((target("avx2")))
+static void _float_avx2(void *dst, const int16_t *src, size_t n, int stride)
+{
+	const __m256d k = _mm256_set1_pd(1.0 / 32767.0);
+	float *d = dst;
+	__m256i v;
+	size_t i;
+	
+	for(i = 0; i + 8 <= n; i += 8, src += 8 * stride)
+	{
+		v = _mm256_cvtepi16_epi32(_load_sse2(src, stride));
+		_mm_storeu_ps(&d[i + 0], _mm256_cvtpd_ps(_mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(v)), k)));
+		_mm_storeu_ps(&d[i + 4], _mm256_cvtpd_ps(_mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(v, 1)), k)));
+	}
+	
+	_float_scalar(&d[i], src, n - i, stride);
+}
+
+__attribute__((target("avx2")))
+static void _scale_avx2(int16_t *dst, const int16_t *src, size_t n, int scale)
+{
+	const __m256i s = _mm256_set1_epi32(scale);
+	const __m256d k = _mm256_set1_pd(INT16_MAX);
+	__m256i v;
+	__m128i lo, hi;
+	size_t i;
+	
+	for(i = 0; i + 8 <= n; i += 8)
+	{
+		v = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) &src[i]));
+		v = _mm256_mullo_epi32(v, s);
+		
+		lo = _mm256_cvttpd_epi32(_mm256_div_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(v)), k));
+		hi = _mm256_cvttpd_epi32(_mm256_div_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(v, 1)), k));
+		
+		_mm_storeu_si128((__m128i *) &dst[i], _mm_packs_epi32(lo, hi));
+	}
+	
+	_scale_scalar(&dst[i], &src[i], n - i, scale);
+}
+
+__attribute__((target("avx2")))
+static void _add_avx2(int16_t *dst, const int16_t *src, size_t n)
+{
+	size_t i;
+	
+	for(i = 0; i + 16 <= n; i += 16)
+	{
+		_mm256_storeu_si256((__m256i *) &dst[i], _mm256_add_epi16(
+			_mm256_loadu_si256((const __m256i *) &dst[i]),
+			_mm256_loadu_si256((const __m256i *) &src[i])
+		));
+	}
+	
+	_add_scalar(&dst[i], &src[i], n - i);
+}
+
+__attribute__((target("avx2")))
+static void _mix_avx2(int16_t *dst, const int16_t *src, size_t n, int scale)
+{
+	const __m256i s = _mm256_set1_epi16(scale);
+	__m256i a, lo, hi;
+	size_t i;
+	
+	for(i = 0; i + 16 <= n; i += 16)
+	{
+		a = _mm256_loadu_si256((const __m256i *) &src[i]);
+		
+		lo = _mm256_mullo_epi16(a, s);
+		hi = _mm256_mulhi_epi16(a, s);
+		a = _mm256_or_si256(_mm256_slli_epi16(hi, 1), _mm256_srli_epi16(lo, 15));
+		
+		_mm256_storeu_si256((__m256i *) &dst[i], _mm256_adds_epi16(
+			_mm256_loadu_si256((const __m256i *) &dst[i]),
+			a
+		));
+	}
+	
+	_mix_scalar(&dst[i], &src[i], n - i, scale);
+}
+
+#endif
+
+#ifdef _CONV_NEON
+
+/* Load 8 values, dropping the Q values if stride is 2 */
+static inline int16x8_t _load_neon(const int16_t *src, int stride)
+{
+	return(stride == 1 ? vld1q_s16(src) : vld2q_s16(src).val[0]);
+}
+
+static void _uint8_neon(void *dst, const int16_t *src, size_t n, int stride)
+{
+	uint8_t *d = dst;
+	int8x16_t a;
+	size_t i;
+	
+	for(i = 0; i + 16 <= n; i += 16, src += 16 * stride)
+	{
+		a = vcombine_s8(
+			vshrn_n_s16(_load_neon(src, stride), 8),
+			vshrn_n_s16(_load_neon(src + 8 * stride, stride), 8)
+		);
+		vst1q_u8(&d[i], veorq_u8(vreinterpretq_u8_s8(a), vdupq_n_u8(0x80)));
+	}
+	
+	_uint8_scalar(&d[i], src, n - i, stride);
+}
+
+static void _int8_neon(void *dst, const int16_t *src, size_t n, int stride)
+{
+	int8_t *d = dst;
+	size_t i;
+	
+	for(i = 0; i + 16 <= n; i += 16, src += 16 * stride)
+	{
+		vst1q_s8(&d[i], vcombine_s8(
+			vshrn_n_s16(_load_neon(src, stride), 8),
+			vshrn_n_s16(_load_neon(src + 8 * stride, stride), 8)
+		));
+	}
+	
+	_int8_scalar(&d[i], src, n - i, stride);
+}
+
+static void _uint16_neon(void *dst, const int16_t *src, size_t n, int stride)
+{
+	uint16_t *d = dst;
+	size_t i;
+	
+	for(i = 0; i + 8 <= n; i += 8, src += 8 * stride)
+	{
+		vst1q_u16(&d[i], veorq_u16(vreinterpretq_u16_s16(_load_neon(src, stride)), vdupq_n_u16(0x8000)));
+	}
+	
+	_uint16_scalar(&d[i], src, n - i, stride);
+}
+
+static void _int16_neon(void *dst, const int16_t *src, size_t n, int stride)
+{
+	int16_t *d = dst;
+	size_t i;
+	
+	if(stride == 1)
+	{
+		memcpy(d, src, n * sizeof(int16_t));
+		return;
+	}
+	
+	for(i = 0; i + 8 <= n; i += 8, src += 8 * stride)
+	{
+		vst1q_s16(&d[i], _load_neon(src, stride));
+	}
+	
+	_int16_scalar(&d[i], src, n - i, stride);
+}
+
+static void _int32_neon(void *dst, const int16_t *src, size_t n, int stride)
+{
+	int32_t *d = dst;
+	int16x8_t a;
+	int32x4_t lo, hi;
+	size_t i;
+	
+	for(i = 0; i + 8 <= n; i += 8, src += 8 * stride)
+	{
+		a = _load_neon(src, stride);
+		lo = vmovl_s16(vget_low_s16(a));
+		hi = vmovl_s16(vget_high_s16(a));
+		vst1q_s32(&d[i + 0], vaddq_s32(vshlq_n_s32(lo, 16), lo));
+		vst1q_s32(&d[i + 4], vaddq_s32(vshlq_n_s32(hi, 16), hi));
+	}
+	
+	_int32_scalar(&d[i], src, n - i, stride);
+}
+
+static void _add_neon(int16_t *dst, const int16_t *src, size_t n)
+{
+	size_t i;
+	
+	for(i = 0; i + 8 <= n; i += 8)
+	{
+		vst1q_s16(&dst[i], vaddq_s16(vld1q_s16(&dst[i]), vld1q_s16(&src[i])));
+	}
+	
+	_add_scalar(&dst[i], &src[i], n - i);
+}
+
+static void _mix_neon(int16_t *dst, const int16_t *src, size_t n, int scale)
+{
+	const int16x8_t s = vdupq_n_s16(scale);
+	size_t i;
+	
+	for(i = 0; i + 8 <= n; i += 8)
+	{
+		/* (2 * x * scale) >> 16, scale is never INT16_MIN so this can't saturate */
+		vst1q_s16(&dst[i], vqaddq_s16(vld1q_s16(&dst[i]), vqdmulhq_s16(vld1q_s16(&src[i]), s)));
+	}
+	
+	_mix_scalar(&dst[i], &src[i], n - i, scale);
+}
+
+#endif
+
+static struct {
+	_conv_t uint8;
+	_conv_t int8;
+	_conv_t uint16;
+	_conv_t int16;
+	_conv_t int32;
+	_conv_t f32;
+	_scale_t scale;
+	_add_t add;
+	_mix_t mix;
+} _conv;
+
+static pthread_once_t _conv_once = PTHREAD_ONCE_INIT;
+
+static void _conv_init(void)
+{
+	/* Select the best implementation for this CPU */
+	_conv.uint8 = _uint8_scalar;
+	_conv.int8 = _int8_scalar;
+	_conv.uint16 = _uint16_scalar;
+	_conv.int16 = _int16_scalar;
+	_conv.int32 = _int32_scalar;
+	_conv.f32 = _float_scalar;
+	_conv.scale = _scale_scalar;
+	_conv.add = _add_scalar;
+	_conv.mix = _mix_scalar;
+	
+#if defined(_CONV_X86)
+	__builtin_cpu_init();
+	
+	if(__builtin_cpu_supports("avx2"))
+	{
+		_conv.uint8 = _uint8_avx2;
+		_conv.int8 = _int8_avx2;
+		_conv.uint16 = _uint16_avx2;
+		_conv.int16 = _int16_avx2;
+		_conv.int32 = _int32_avx2;
+		_conv.f32 = _float_avx2;
+		_conv.scale = _scale_avx2;
+		_conv.add = _add_avx2;
+		_conv.mix = _mix_avx2;
+	}
+	else if(__builtin_cpu_supports("sse2"))
+	{
+		_conv.uint8 = _uint8_sse2;
+		_conv.int8 = _int8_sse2;
+		_conv.uint16 = _uint16_sse2;
+		_conv.int16 = _int16_sse2;
+		_conv.int32 = _int32_sse2;
+		_conv.f32 = _float_sse2;
+		_conv.scale = _scale_sse2;
+		_conv.add = _add_sse2;
+		_conv.mix = _mix_sse2;
+	}
+#elif defined(_CONV_NEON)
+	_conv.uint8 = _uint8_neon;
+	_conv.int8 = _int8_neon;
+	_conv.uint16 = _uint16_neon;
+	_conv.int16 = _int16_neon;
+	_conv.int32 = _int32_neon;
+	_conv.add = _add_neon;
+	_conv.mix = _mix_neon;
+#endif
+}
+
+void conv_int16_to_uint8(uint8_t *dst, const int16_t *src, size_t n, int stride)
+{
+	pthread_once(&_conv_once, _conv_init);
+	_conv.uint8(dst, src, n, stride);
+}
+
+void conv_int16_to_int8(int8_t *dst, const int16_t *src, size_t n, int stride)
+{
+	pthread_once(&_conv_once, _conv_init);
+	_conv.int8(dst, src, n, stride);
+}
+
+void conv_int16_to_uint16(uint16_t *dst, const int16_t *src, size_t n, int stride)
+{
+	pthread_once(&_conv_once, _conv_init);
+	_conv.uint16(dst, src, n, stride);
+}
+
+void conv_int16_to_int16(int16_t *dst, const int16_t *src, size_t n, int stride)
+{
+	pthread_once(&_conv_once, _conv_init);
+	_conv.int16(dst, src, n, stride);
+}
+
+void conv_int16_to_int32(int32_t *dst, const int16_t *src, size_t n, int stride)
+{
+	pthread_once(&_conv_once, _conv_init);
+	_conv.int32(dst, src, n, stride);
+}
+
+void conv_int16_to_float(float *dst, const int16_t *src, size_t n, int stride)
+{
+	pthread_once(&_conv_once, _conv_init);
+	_conv.f32(dst, src, n, stride);
+}
+
+void conv_int16_scale(int16_t *dst, const int16_t *src, size_t n, int scale)
+{
+	pthread_once(&_conv_once, _conv_init);
+	_conv.scale(dst, src, n, scale);
+}
+
+void conv_int16_add(int16_t *dst, const int16_t *src, size_t n)
+{
+	pthread_once(&_conv_once, _conv_init);
+	_conv.add(dst, src, n);
+}
+
+void conv_int16_mix(int16_t *dst, const int16_t *src, size_t n, int scale)
+{
+	pthread_once(&_conv_once, _conv_init);
+	_conv.mix(dst, src, n, scale);
+}
+
@@ -0,0 +1,62 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2026 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _CONV_H
+#define _CONV_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* int16 sample format conversion
+ *
+ * Each function converts n values from src to dst. A stride of 1
+ * converts every value, for complex output. A stride of 2 converts
+ * every other value, taking the I channel only for real output.
+ *
+ * The fastest implementation for the CPU is selected on first use,
+ * and all give the same result as the scalar versions.
+*/
+
+/* (x - INT16_MIN) >> 8 */
+extern void conv_int16_to_uint8(uint8_t *dst, const int16_t *src, size_t n, int stride);
+
+/* x >> 8 */
+extern void conv_int16_to_int8(int8_t *dst, const int16_t *src, size_t n, int stride);
+
+/* x - INT16_MIN */
+extern void conv_int16_to_uint16(uint16_t *dst, const int16_t *src, size_t n, int stride);
+
+/* x, unchanged */
+extern void conv_int16_to_int16(int16_t *dst, const int16_t *src, size_t n, int stride);
+
+/* (x << 16) + x */
+extern void conv_int16_to_int32(int32_t *dst, const int16_t *src, size_t n, int stride);
+
+/* x / 32767.0 */
+extern void conv_int16_to_float(float *dst, const int16_t *src, size_t n, int stride);
+
+/* x * scale / INT16_MAX, where 0 < scale < INT16_MAX. Stride is always 1 */
+extern void conv_int16_scale(int16_t *dst, const int16_t *src, size_t n, int scale);
+
+/* dst + src, wrapping on overflow. Stride is always 1 */
+extern void conv_int16_add(int16_t *dst, const int16_t *src, size_t n);
+
+/* dst + (x * scale >> 15), saturating, where 0 <= scale <= INT16_MAX. Stride is always 1 */
+extern void conv_int16_mix(int16_t *dst, const int16_t *src, size_t n, int scale);
+
+#endif
+
@@ -33,6 +33,7 @@
 #include <string.h>
 #include <math.h>
 #include "dance.h"
+#include "conv.h"
 
 /* Pre-calculated 50/10 μs pre-emphasis filter taps, 32kHz sample rate */
 static const int16_t _50_10_us_a_taps[DANCE_A_50_10_US_NTAPS] = {
@@ -55,6 +56,9 @@ static const int16_t _50_10_us_b_taps[DANCE_B_50_10_US_NTAPS] = {
 static const int _step[4] = { 0, 3, 1, 2 };
 static const int _syms[4] = { 0, 1, 3, 2 };
 
+/* Length of the baseband buffer, in symbol waveforms */
+#define _BB_SYMS 8
+
 /* Ranges */
 typedef struct {
 	uint16_t mask;
@@ -389,9 +393,26 @@ int dance_mod_init(dance_mod_t *s, uint8_t mode, unsigned int sample_rate, unsig
 		s->taps[x + n] = lround(r);
 	}
 	
-	/* Allocate memory for the baseband buffer */
-	s->bb_start = calloc(s->ntaps, sizeof(cint16_t));
-	s->bb_end   = s->bb_start + s->ntaps;
+	/* Pre-calculate the shaped waveform for each symbol */
+	s->syms = malloc(sizeof(cint16_t) * s->ntaps * 4);
+	if(!s->syms)
+	{
+		return(-1);
+	}
+	
+	for(n = 0; n < 4; n++)
+	{
+		for(x = 0; x < s->ntaps; x++)
+		{
+			s->syms[n * s->ntaps + x].i = (_syms[n] & 1 ? s->taps[x] : -s->taps[x]);
+			s->syms[n * s->ntaps + x].q = (_syms[n] & 2 ? s->taps[x] : -s->taps[x]);
+		}
+	}
+	
+	/* Allocate memory for the baseband buffer. This is linear, with
+	 * room for several symbols before it needs to be moved back */
+	s->bb_start = calloc(s->ntaps * _BB_SYMS, sizeof(cint16_t));
+	s->bb_end   = s->bb_start + s->ntaps * _BB_SYMS;
 	s->bb       = s->bb_start;
 	s->bb_len   = 0;
 	
@@ -431,6 +452,7 @@ int dance_mod_free(dance_mod_t *s)
 {
 	free(s->cc_start);
 	free(s->bb_start);
+	free(s->syms);
 	free(s->taps);
 	
 	return(0);
@@ -441,28 +463,51 @@ void dance_mod_input(dance_mod_t *s, const int16_t *audio)
 	memcpy(s->audio, audio, sizeof(int16_t) * DANCE_AUDIO_LEN * 2);
 }
 
+void dance_mod_copy(dance_mod_t *dst, const dance_mod_t *src)
+{
+	/* The symbol encoder and framing */
+	dst->enc = src->enc;
+	memcpy(dst->audio, src->audio, sizeof(dst->audio));
+	memcpy(dst->frame, src->frame, sizeof(dst->frame));
+	dst->frame_bit = src->frame_bit;
+	dst->dsym = src->dsym;
+	
+	/* The shaped baseband not yet sent, and the sample clock */
+	memcpy(dst->bb_start, src->bb_start, sizeof(cint16_t) * (src->bb_end - src->bb_start));
+	dst->bb = dst->bb_start + (src->bb - src->bb_start);
+	dst->bb_len = src->bb_len;
+	dst->ds = src->ds;
+	
+	/* The carrier phase */
+	dst->cc = dst->cc_start + (src->cc - src->cc_start);
+}
+
 int dance_mod_output(dance_mod_t *s, int16_t *iq, size_t samples)
 {
 	cint16_t *ciq = (cint16_t *) iq;
-	int x, i;
-	int16_t r;
+	int x, i, n;
 	
 	for(x = 0; x < samples;)
 	{
-		/* Output and clear the buffer */
-		for(; x < samples && s->bb_len; x++, s->bb_len--)
+		/* Mix the buffered baseband up to the carrier */
+		for(n = (samples - x < s->bb_len ? samples - x : s->bb_len); n > 0; n -= i)
 		{
-			cint16_mula(ciq++, s->bb, s->cc);
+			i = s->cc_end - s->cc;
+			if(i > n) i = n;
 			
-			s->bb->i = 0;
-			s->bb->q = 0;
+			x += i;
+			s->bb_len -= i;
 			
-			if(++s->bb == s->bb_end)
+			if(ciq)
 			{
-				s->bb = s->bb_start;
+				cint16_mula_array(ciq, s->bb, s->cc, i);
+				ciq += i;
 			}
 			
-			if(++s->cc == s->cc_end)
+			s->bb += i;
+			s->cc += i;
+			
+			if(s->cc == s->cc_end)
 			{
 				s->cc = s->cc_start;
 			}
@@ -490,19 +535,18 @@ int dance_mod_output(dance_mod_t *s, int16_t *iq, size_t samples)
 		s->dsym &= 0x03;
 		s->frame_bit += 2;
 		
-		/* Encode the symbol */
-		for(i = 0; i < s->ntaps; i++)
+		if(s->bb + s->ntaps > s->bb_end)
 		{
-			r = s->taps[i];
-			s->bb->i += (_syms[s->dsym] & 1 ? r : -r);
-			s->bb->q += (_syms[s->dsym] & 2 ? r : -r);
-			
-			if(++s->bb == s->bb_end)
-			{
-				s->bb = s->bb_start;
-			}
+			/* Move the unsent baseband back to the start of the buffer */
+			n = s->bb_end - s->bb;
+			memmove(s->bb_start, s->bb, sizeof(cint16_t) * n);
+			memset(s->bb_start + n, 0, sizeof(cint16_t) * (s->bb_end - s->bb_start - n));
+			s->bb = s->bb_start;
 		}
 		
+		/* Encode the symbol */
+		conv_int16_add((int16_t *) s->bb, (const int16_t *) &s->syms[s->dsym * s->ntaps], s->ntaps * 2);
+		
 		/* Calculate length of the next block */
 		s->bb_len = s->sps;
 		
@@ -85,6 +85,9 @@ typedef struct {
 	int16_t *taps;
 	int16_t *hist;
 	
+	/* Shaped waveform for each symbol */
+	cint16_t *syms;
+	
 	int dsym; /* Differential symbol */
 	
 	cint16_t *bb;
@@ -122,7 +125,15 @@ extern void dance_encode_frame_b(
 
 extern int dance_mod_init(dance_mod_t *s, uint8_t mode, unsigned int sample_rate, unsigned int frequency, double beta, double level);
 extern void dance_mod_input(dance_mod_t *s, const int16_t *audio);
+
+/* Add the modulated carrier for the next samples to iq. If iq is
+ * NULL the modulator is advanced without producing any output */
 extern int dance_mod_output(dance_mod_t *s, int16_t *iq, size_t samples);
+
+/* Copy the modulator state of src into dst, which must
+ * have been initialised with the same settings */
+extern void dance_mod_copy(dance_mod_t *dst, const dance_mod_t *src);
+
 extern int dance_mod_free(dance_mod_t *s);
 
 #endif
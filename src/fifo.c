@@ -18,9 +18,79 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <pthread.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
 #include "fifo.h"
 
+static int _block_ready(fifo_block_t *block)
+{
+	/* A block can be read once the writer has finished with it,
+	 * or if it marks the end of the stream */
+	return(__atomic_load_n(&block->writing, __ATOMIC_ACQUIRE) == 0 ||
+	       __atomic_load_n(&block->length, __ATOMIC_ACQUIRE) == 0);
+}
+
+static int _block_free(fifo_block_t *block)
+{
+	/* A block can be written once all readers have left it */
+	return(__atomic_load_n(&block->readers, __ATOMIC_ACQUIRE) == 0);
+}
+
+static void _block_wait(fifo_block_t *block, int (*cond)(fifo_block_t *))
+{
+	int event;
+	
+	for(;;)
+	{
+		/* Sample the event counter before testing the condition,
+		 * any change after this point will cause the wait to fail */
+		event = __atomic_load_n(&block->event, __ATOMIC_SEQ_CST);
+		if(cond(block)) break;
+		
+		__atomic_add_fetch(&block->waiters, 1, __ATOMIC_SEQ_CST);
+		
+		if(!cond(block))
+		{
+#ifdef __linux__
+			syscall(SYS_futex, &block->event, FUTEX_WAIT_PRIVATE, event, NULL, NULL, 0);
+#else
+			pthread_mutex_lock(&block->mutex);
+			while(__atomic_load_n(&block->event, __ATOMIC_SEQ_CST) == event)
+			{
+				pthread_cond_wait(&block->cond, &block->mutex);
+			}
+			pthread_mutex_unlock(&block->mutex);
+#endif
+		}
+		
+		__atomic_sub_fetch(&block->waiters, 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+static void _block_wake(fifo_block_t *block)
+{
+	__atomic_add_fetch(&block->event, 1, __ATOMIC_SEQ_CST);
+	
+	/* Only enter the kernel if somebody is sleeping on this block */
+	if(__atomic_load_n(&block->waiters, __ATOMIC_SEQ_CST) == 0)
+	{
+		return;
+	}
+	
+#ifdef __linux__
+	syscall(SYS_futex, &block->event, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#else
+	pthread_mutex_lock(&block->mutex);
+	pthread_cond_broadcast(&block->cond);
+	pthread_mutex_unlock(&block->mutex);
+#endif
+}
+
 int fifo_init(fifo_t *fifo, size_t count, size_t length)
 {
 	int i;
@@ -29,26 +99,35 @@ int fifo_init(fifo_t *fifo, size_t count, size_t length)
 	if(count < 3) return(-1);
 	if(length < 1) return(-1);
 	
+	/* Allocate one extra block to allow for cache line alignment */
 	fifo->count = count;
-	fifo->blocks = calloc(sizeof(fifo_block_t), count);
-	if(!fifo->blocks)
+	fifo->alloc = calloc(sizeof(fifo_block_t), count + 1);
+	if(!fifo->alloc)
 	{
 		return(-1);
 	}
 	
-	fifo->blocks->data = calloc(length, count);
-	if(!fifo->blocks->data)
+	fifo->blocks = (fifo_block_t *) (((uintptr_t) fifo->alloc + FIFO_CACHE_LINE - 1) & ~(uintptr_t) (FIFO_CACHE_LINE - 1));
+	
+	fifo->data = calloc(length * count + FIFO_DATA_ALIGN - 1, 1);
+	if(!fifo->data)
 	{
-		free(fifo->blocks);
+		free(fifo->alloc);
 		return(-1);
 	}
 	
+	fifo->blocks->data = (void *) (((uintptr_t) fifo->data + FIFO_DATA_ALIGN - 1) & ~(uintptr_t) (FIFO_DATA_ALIGN - 1));
+	
 	for(i = 0; i < count; i++)
 	{
+#ifndef __linux__
 		pthread_mutex_init(&fifo->blocks[i].mutex, NULL);
 		pthread_cond_init(&fifo->blocks[i].cond, NULL);
+#endif
 		fifo->blocks[i].readers = 0;
 		fifo->blocks[i].writing = 1;
+		fifo->blocks[i].event = 0;
+		fifo->blocks[i].waiters = 0;
 		fifo->blocks[i].data = (uint8_t *) fifo->blocks->data + (length * i);
 		fifo->blocks[i].length = length;
 		fifo->blocks[i].prev = &fifo->blocks[(i + count - 1) % count];
@@ -67,7 +146,7 @@ void fifo_reader_init(fifo_reader_t *reader, fifo_t *fifo, int prefill)
 {
 	/* Readers start on the last (empty) block, waiting for the writer */
 	reader->block = fifo->block->prev;
-	reader->block->readers++;
+	__atomic_add_fetch(&reader->block->readers, 1, __ATOMIC_SEQ_CST);
 	reader->offset = reader->block->length;
 	reader->eof = 0;
 	reader->prefill = NULL;
@@ -87,10 +166,8 @@ void fifo_reader_close(fifo_reader_t *reader)
 	
 	if(reader->block != NULL && reader->eof == 0)
 	{
-		pthread_mutex_lock(&block->mutex);
-		block->readers--;
-		pthread_cond_signal(&block->cond);
-		pthread_mutex_unlock(&block->mutex);
+		__atomic_sub_fetch(&block->readers, 1, __ATOMIC_RELEASE);
+		_block_wake(block);
 		
 		reader->block = NULL;
 		reader->eof = 1;
@@ -103,31 +180,23 @@ void fifo_close(fifo_t *fifo)
 	
 	if(block == NULL) return;
 	
-	block->length = fifo->offset;
+	__atomic_store_n(&block->length, fifo->offset, __ATOMIC_RELEASE);
 	
-	if(block->length > 0)
+	if(fifo->offset > 0)
 	{
 		fifo_block_t *next = block->next;
 		
-		pthread_mutex_lock(&next->mutex);
-		
 		/* Wait for the next block to be read */
-		while(next->readers > 0)
-		{
-			pthread_cond_wait(&next->cond, &next->mutex);
-		}
+		_block_wait(next, _block_free);
 		
-		next->writing = 0;
-		next->length = 0;
-		
-		pthread_mutex_unlock(&next->mutex);
+		__atomic_store_n(&next->length, 0, __ATOMIC_RELEASE);
+		__atomic_store_n(&next->writing, 0, __ATOMIC_RELEASE);
+		_block_wake(next);
 	}
 	
 	/* Mark current block as ready */
-	pthread_mutex_lock(&block->mutex);
-	block->writing = 0;
-	pthread_cond_signal(&block->cond);
-	pthread_mutex_unlock(&block->mutex);
+	__atomic_store_n(&block->writing, 0, __ATOMIC_RELEASE);
+	_block_wake(block);
 	
 	fifo->block = (block->length == 0 ? block : block->next);
 	fifo->offset = 0;
@@ -145,32 +214,28 @@ void fifo_free(fifo_t *fifo)
 	block = fifo->block->next;
 	
 	/* TODO: Wait for all readers to end */
-	while(block->length > 0)
+	while(__atomic_load_n(&block->length, __ATOMIC_ACQUIRE) > 0)
 	{
-		pthread_mutex_lock(&block->mutex);
-		
-		while(block->readers > 0)
-		{
-			pthread_cond_wait(&block->cond, &block->mutex);
-		}
+		_block_wait(block, _block_free);
 		
-		block->writing = 0;
-		block->length = 0;
-		
-		pthread_mutex_unlock(&block->mutex);
+		__atomic_store_n(&block->length, 0, __ATOMIC_RELEASE);
+		__atomic_store_n(&block->writing, 0, __ATOMIC_RELEASE);
+		_block_wake(block);
 		
 		block = block->next;
 	}
 	
 	/* Tear down the FIFO */
+#ifndef __linux__
 	for(int i = 0; i < fifo->count; i++)
 	{
 		pthread_cond_destroy(&fifo->blocks[i].cond);
 		pthread_mutex_destroy(&fifo->blocks[i].mutex);
 	}
+#endif
 	
-	free(fifo->blocks->data);
-	free(fifo->blocks);
+	free(fifo->data);
+	free(fifo->alloc);
 	
 	fifo->block = NULL;
 }
@@ -187,25 +252,15 @@ size_t fifo_read(fifo_reader_t *reader, void **ptr, size_t length, int wait)
 	
 	if(reader->prefill)
 	{
-		pthread_mutex_lock(&reader->prefill->mutex);
-		
-		if(wait)
-		{
-			/* Wait until the next block is written to */
-			while(reader->prefill->writing == 1 && reader->prefill->length != 0)
-			{
-				pthread_cond_wait(&reader->prefill->cond, &reader->prefill->mutex);
-			}
-		}
-		else if(reader->prefill->writing == 1 && reader->prefill->length != 0)
+		if(!_block_ready(reader->prefill))
 		{
 			/* Non-blocking */
-			pthread_mutex_unlock(&reader->prefill->mutex);
-			return(0);
+			if(!wait) return(0);
+			
+			/* Wait until the prefill block is written to */
+			_block_wait(reader->prefill, _block_ready);
 		}
 		
-		pthread_mutex_unlock(&reader->prefill->mutex);
-		
 		reader->prefill = NULL;
 	}
 	
@@ -213,39 +268,29 @@ size_t fifo_read(fifo_reader_t *reader, void **ptr, size_t length, int wait)
 	{
 		fifo_block_t *next = block->next;
 		
-		pthread_mutex_lock(&next->mutex);
-		
-		if(wait)
-		{
-			/* Wait until the next block is written to */
-			while(next->writing == 1 && next->length != 0)
-			{
-				pthread_cond_wait(&next->cond, &next->mutex);
-			}
-		}
-		else if(next->writing == 1 && next->length != 0)
+		if(!_block_ready(next))
 		{
 			/* Non-blocking */
-			pthread_mutex_unlock(&next->mutex);
-			return(0);
+			if(!wait) return(0);
+			
+			/* Wait until the next block is written to */
+			_block_wait(next, _block_ready);
 		}
 		
-		if(next->length == 0)
+		if(__atomic_load_n(&next->length, __ATOMIC_ACQUIRE) == 0)
 		{
 			/* End of stream */
 			reader->eof = 1;
 		}
 		else
 		{
-			next->readers++;
+			/* The writer cannot reclaim the next block while
+			 * this reader still holds the current one */
+			__atomic_add_fetch(&next->readers, 1, __ATOMIC_SEQ_CST);
 		}
 		
-		pthread_mutex_unlock(&next->mutex);
-		
-		pthread_mutex_lock(&block->mutex);
-		block->readers--;
-		pthread_cond_signal(&block->cond);
-		pthread_mutex_unlock(&block->mutex);
+		__atomic_sub_fetch(&block->readers, 1, __ATOMIC_RELEASE);
+		_block_wake(block);
 		
 		/* Move to the next block */
 		reader->block = block = next;
@@ -279,31 +324,19 @@ size_t fifo_write_ptr(fifo_t *fifo, void **ptr, int wait)
 	{
 		fifo_block_t *next = block->next;
 		
-		pthread_mutex_lock(&next->mutex);
-		
-		if(wait)
+		if(!_block_free(next))
 		{
+			if(!wait) return(0);
+			
 			/* Wait for the next block to be read */
-			while(next->readers > 0)
-			{
-				pthread_cond_wait(&next->cond, &next->mutex);
-			}
+			_block_wait(next, _block_free);
 		}
-		else if(next->readers > 0)
-		{
-			pthread_mutex_unlock(&next->mutex);
-			return(0);
-		}
-		
-		next->writing = 1;
 		
-		pthread_mutex_unlock(&next->mutex);
+		__atomic_store_n(&next->writing, 1, __ATOMIC_RELAXED);
 		
 		/* Mark current block as ready */
-		pthread_mutex_lock(&block->mutex);
-		block->writing = 0;
-		pthread_cond_signal(&block->cond);
-		pthread_mutex_unlock(&block->mutex);
+		__atomic_store_n(&block->writing, 0, __ATOMIC_RELEASE);
+		_block_wake(block);
 		
 		fifo->block = block = next;
 		fifo->offset = 0;
@@ -18,27 +18,49 @@
 #ifndef _FIFO_H
 #define _FIFO_H
 
-/* Single writer / multi reader FIFO */
+/* Single writer / multi reader FIFO
+ *
+ * The block state is updated with atomic operations and no locks
+ * are taken on the fast path. Threads only sleep when asked to
+ * wait on a block that is not ready, using a futex on Linux and
+ * a mutex / condition pair elsewhere. Each block is padded to its
+ * own cache line so readers and the writer working on neighbouring
+ * blocks do not contend with each other.
+*/
+
+#define FIFO_CACHE_LINE 64
+
+/* Block data is aligned to this boundary, making the blocks
+ * suitable for O_DIRECT I/O when the length is a multiple of it */
+#define FIFO_DATA_ALIGN 4096
 
 typedef struct _fifo_block_t {
 	
-	pthread_mutex_t mutex;
-	pthread_cond_t cond;
-	
 	int readers;
 	int writing;
+	size_t length;
+	
+	/* Wake-up counter and number of sleeping threads */
+	int event;
+	int waiters;
+	
+#ifndef __linux__
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+#endif
 	
 	void *data;
-	size_t length;
 	
 	struct _fifo_block_t *prev, *next;
 	
-} fifo_block_t;
+} __attribute__((aligned(FIFO_CACHE_LINE))) fifo_block_t;
 
 typedef struct {
 	
 	size_t count;
 	fifo_block_t *blocks;
+	void *alloc;
+	void *data;
 	
 	fifo_block_t *block;
 	size_t offset;
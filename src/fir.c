@@ -19,9 +19,20 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <pthread.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define _FIR_X86
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define _FIR_NEON
+#endif
 #include "fir.h"
 #include "common.h"
 
+/* Padding after the int16 taps and window for the vector kernels */
+#define _FIR_PAD 16
+
 
 
 /* Some of the filter design functions contained within here where taken
@@ -220,11 +231,225 @@ void fir_complex_band_pass(double *taps, size_t ntaps, double sample_rate, doubl
 
 
 
+/* int16 dot product kernels. The sum is accumulated modulo 2^32, so the
+ * order of the additions doesn't matter and each implementation gives
+ * the same result as the scalar version */
+
+static int32_t _dot_int16_scalar(const int16_t *a, const int16_t *b, int n)
+{
+	int32_t r;
+	int i;
+	
+	for(r = i = 0; i < n; i++)
+	{
+		r += *(a++) * *(b++);
+	}
+	
+	return(r);
+}
+
+#ifdef _FIR_X86
+
+__attribute__((target("sse2")))
+static int32_t _dot_int16_sse2(const int16_t *a, const int16_t *b, int n)
+{
+	__m128i acc = _mm_setzero_si128();
+	uint32_t r;
+	int i;
+	
+	for(i = 0; i + 8 <= n; i += 8)
+	{
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(
+			_mm_loadu_si128((const __m128i *) &a[i]),
+			_mm_loadu_si128((const __m128i *) &b[i])
+		));
+	}
+	
+	acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+	acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+	r = _mm_cvtsi128_si32(acc);
+	
+	for(; i < n; i++)
+	{
+		r += a[i] * b[i];
+	}
+	
+	return(r);
+}
+
+__attribute__((target("avx2")))
+static int32_t _dot_int16_avx2(const int16_t *a, const int16_t *b, int n)
+{
+	__m256i acc = _mm256_setzero_si256();
+	__m128i acc4;
+	uint32_t r;
+	int i;
+	
+	for(i = 0; i + 16 <= n; i += 16)
+	{
+		acc = _mm256_add_epi32(acc, _mm256_madd_epi16(
+			_mm256_loadu_si256((const __m256i *) &a[i]),
+			_mm256_loadu_si256((const __m256i *) &b[i])
+		));
+	}
+	
+	if(i + 8 <= n)
+	{
+		acc = _mm256_add_epi32(acc, _mm256_castsi128_si256(_mm_madd_epi16(
+			_mm_loadu_si128((const __m128i *) &a[i]),
+			_mm_loadu_si128((const __m128i *) &b[i])
+		)));
+		i += 8;
+	}
+	
+	acc4 = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+	acc4 = _mm_add_epi32(acc4, _mm_shuffle_epi32(acc4, _MM_SHUFFLE(1, 0, 3, 2)));
+	acc4 = _mm_add_epi32(acc4, _mm_shuffle_epi32(acc4, _MM_SHUFFLE(2, 3, 0, 1)));
+	r = _mm_cvtsi128_si32(acc4);
+	
+	for(; i < n; i++)
+	{
+		r += a[i] * b[i];
+	}
+	
+	return(r);
+}
+
+#endif
+
+#ifdef _FIR_NEON
+
+static int32_t _dot_int16_neon(const int16_t *a, const int16_t *b, int n)
+{
+	int32x4_t acc = vdupq_n_s32(0);
+	int32x2_t acc2;
+	uint32_t r;
+	int i;
+	
+	for(i = 0; i + 8 <= n; i += 8)
+	{
+		int16x8_t va = vld1q_s16(&a[i]);
+		int16x8_t vb = vld1q_s16(&b[i]);
+		
+		acc = vmlal_s16(acc, vget_low_s16(va), vget_low_s16(vb));
+		acc = vmlal_s16(acc, vget_high_s16(va), vget_high_s16(vb));
+	}
+	
+	acc2 = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+	r = vget_lane_s32(vpadd_s32(acc2, acc2), 0);
+	
+	for(; i < n; i++)
+	{
+		r += a[i] * b[i];
+	}
+	
+	return(r);
+}
+
+#endif
+
+/* Eight dot products of the same "a" against rows of "b" spaced
+ * "stride" apart. An interpolating filter produces several outputs
+ * from each window, using a different phase of the taps for each */
+
+static void _dot8_int16_scalar(const int16_t *a, const int16_t *b, size_t stride, int n, int32_t *r);
+
+#ifdef _FIR_X86
+
+__attribute__((target("avx2")))
+static void _dot8_int16_avx2(const int16_t *a, const int16_t *b, size_t stride, int n, int32_t *r)
+{
+	__m256i acc[8];
+	__m256i w, u, v;
+	int i, k;
+	
+	for(k = 0; k < 8; k++)
+	{
+		acc[k] = _mm256_setzero_si256();
+	}
+	
+	for(i = 0; i < n; i += 16)
+	{
+		w = _mm256_loadu_si256((const __m256i *) &a[i]);
+		
+		if(i + 16 > n)
+		{
+			/* Clear the window past the last tap, the taps
+			 * loaded beyond the end of each row are ignored */
+			w = _mm256_and_si256(w, _mm256_cmpgt_epi16(
+				_mm256_set1_epi16(n - i),
+				_mm256_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15)
+			));
+		}
+		
+		for(k = 0; k < 8; k++)
+		{
+			acc[k] = _mm256_add_epi32(acc[k], _mm256_madd_epi16(w,
+				_mm256_loadu_si256((const __m256i *) &b[stride * k + i])
+			));
+		}
+	}
+	
+	/* Sum each accumulator, leaving the eight results in order */
+	u = _mm256_hadd_epi32(_mm256_hadd_epi32(acc[0], acc[1]), _mm256_hadd_epi32(acc[2], acc[3]));
+	v = _mm256_hadd_epi32(_mm256_hadd_epi32(acc[4], acc[5]), _mm256_hadd_epi32(acc[6], acc[7]));
+	
+	w = _mm256_add_epi32(
+		_mm256_permute2x128_si256(u, v, 0x20),
+		_mm256_permute2x128_si256(u, v, 0x31)
+	);
+	
+	_mm256_storeu_si256((__m256i *) r, w);
+}
+
+#endif
+
+static struct {
+	int32_t (*dot)(const int16_t *a, const int16_t *b, int n);
+	void (*dot8)(const int16_t *a, const int16_t *b, size_t stride, int n, int32_t *r);
+} _dot_int16;
+
+static pthread_once_t _dot_int16_once = PTHREAD_ONCE_INIT;
+
+static void _dot8_int16_scalar(const int16_t *a, const int16_t *b, size_t stride, int n, int32_t *r)
+{
+	int k;
+	
+	for(k = 0; k < 8; k++)
+	{
+		r[k] = _dot_int16.dot(a, &b[stride * k], n);
+	}
+}
+
+static void _dot_int16_init(void)
+{
+	/* Select the best implementation for this CPU */
+	_dot_int16.dot = _dot_int16_scalar;
+	_dot_int16.dot8 = _dot8_int16_scalar;
+	
+#if defined(_FIR_X86)
+	__builtin_cpu_init();
+	
+	if(__builtin_cpu_supports("avx2"))
+	{
+		_dot_int16.dot = _dot_int16_avx2;
+		_dot_int16.dot8 = _dot8_int16_avx2;
+	}
+	else if(__builtin_cpu_supports("sse2"))
+	{
+		_dot_int16.dot = _dot_int16_sse2;
+	}
+#elif defined(_FIR_NEON)
+	_dot_int16.dot = _dot_int16_neon;
+#endif
+}
+
 int fir_int16_init(fir_int16_t *s, const double *taps, int ntaps, int interpolation, int decimation, int delay)
 {
 	int i, j;
 	
 	s->type = 1;
+	pthread_once(&_dot_int16_once, _dot_int16_init);
 	
 	s->interpolation = interpolation;
 	s->decimation = decimation;
@@ -233,8 +458,12 @@ int fir_int16_init(fir_int16_t *s, const double *taps, int ntaps, int interpolat
 	s->ataps = (ntaps + interpolation - 1) / interpolation;
 	s->ntaps = s->ataps * interpolation;
 	
-	s->itaps = calloc(s->ntaps, sizeof(int16_t));
+	/* The taps and window are padded for the vector kernels,
+	 * which may read up to 15 samples past the end of either */
+	s->itaps = calloc(s->ntaps + _FIR_PAD, sizeof(int16_t));
 	s->qtaps = NULL;
+	s->citaps = NULL;
+	s->cqtaps = NULL;
 	
 	/* Copy taps into the order they will be applied */
 	j = s->ntaps - s->ataps;
@@ -246,7 +475,7 @@ int fir_int16_init(fir_int16_t *s, const double *taps, int ntaps, int interpolat
 	}
 	
 	s->lwin = s->ataps + delay;
-	s->win = calloc(s->ataps * 2 + delay, sizeof(int16_t));
+	s->win = calloc(s->ataps * 2 + delay + _FIR_PAD, sizeof(int16_t));
 	s->owin = 0;
 	s->d = s->interpolation;
 	s->in_samples = 0;
@@ -263,8 +492,9 @@ void fir_int16_feed(fir_int16_t *s, const int16_t *in, size_t samples, size_t st
 
 size_t fir_int16_process(fir_int16_t *s, int16_t *out, size_t samples, size_t step)
 {
+	int32_t a8[8];
 	int a;
-	int x, y;
+	int i, x;
 	const int16_t *win, *taps;
 	
 	if(s->type == 0) return(0);
@@ -293,17 +523,32 @@ size_t fir_int16_process(fir_int16_t *s, int16_t *out, size_t samples, size_t st
 			s->in_samples--;
 		}
 		
-		for(; s->d < s->interpolation && x < samples; s->d += s->decimation)
+		win = &s->win[s->owin];
+		
+		/* Calculate eight outputs at a time while they share a window */
+		for(; s->d + s->decimation * 7 < s->interpolation && x + 8 <= samples; s->d += s->decimation * 8)
 		{
-			win = &s->win[s->owin];
 			taps = &s->itaps[s->d * s->ataps];
 			
-			/* Calculate the next output sample */
-			for(a = y = 0; y < s->ataps; y++)
+			_dot_int16.dot8(win, taps, (size_t) s->decimation * s->ataps, s->ataps, a8);
+			
+			for(i = 0; i < 8; i++)
 			{
-				a += *(win++) * *(taps++);
+				a = a8[i] >> 15;
+				*out = a < INT16_MIN ? INT16_MIN : (a > INT16_MAX ? INT16_MAX : a);
+				out += step;
 			}
 			
+			x += 8;
+		}
+		
+		for(; s->d < s->interpolation && x < samples; s->d += s->decimation)
+		{
+			taps = &s->itaps[s->d * s->ataps];
+			
+			/* Calculate the next output sample */
+			a = _dot_int16.dot(win, taps, s->ataps);
+			
 			a >>= 15;
 			*out = a < INT16_MIN ? INT16_MIN : (a > INT16_MAX ? INT16_MAX : a);
 			out += step;
@@ -346,9 +591,26 @@ void fir_int16_free(fir_int16_t *s)
 	free(s->win);
 	free(s->itaps);
 	free(s->qtaps);
+	free(s->citaps);
+	free(s->cqtaps);
 	memset(s, 0, sizeof(fir_int16_t));
 }
 
+void fir_int16_copy(fir_int16_t *dst, const fir_int16_t *src)
+{
+	size_t n;
+	
+	/* Copy the window and phase of src into dst. Both
+	 * filters must have been initialised the same way */
+	if(src->type == 0) return;
+	
+	n = (src->lwin + src->ataps) * (src->type == 2 ? 2 : 1);
+	memcpy(dst->win, src->win, n * sizeof(int16_t));
+	dst->owin = src->owin;
+	dst->d = src->d;
+	dst->in_samples = 0;
+}
+
 /* Initialise int16 FIR filter r64 resampler */
 int fir_int16_resampler_init(fir_int16_t *s, r64_t out_rate, r64_t in_rate)
 {
@@ -398,6 +660,7 @@ int fir_int16_complex_init(fir_int16_t *s, const double *taps, int ntaps, int in
 	int i, j;
 	
 	s->type = 2;
+	pthread_once(&_dot_int16_once, _dot_int16_init);
 	
 	s->interpolation = interpolation;
 	s->decimation = decimation;
@@ -419,6 +682,29 @@ int fir_int16_complex_init(fir_int16_t *s, const double *taps, int ntaps, int in
 		if(j < 0) j += s->ntaps + 1;
 	}
 	
+	/* Interleave the taps to match the window, so each output
+	 * is two dot products: I = [i,-q].[wi,wq], Q = [q,i].[wi,wq] */
+	s->citaps = calloc(s->ntaps, sizeof(int16_t) * 2);
+	s->cqtaps = calloc(s->ntaps, sizeof(int16_t) * 2);
+	
+	for(i = 0; i < s->ntaps; i++)
+	{
+		if(s->qtaps[i] == INT16_MIN)
+		{
+			/* -q doesn't fit, use the scalar version */
+			free(s->citaps);
+			free(s->cqtaps);
+			s->citaps = NULL;
+			s->cqtaps = NULL;
+			break;
+		}
+		
+		s->citaps[i * 2 + 0] = s->itaps[i];
+		s->citaps[i * 2 + 1] = -s->qtaps[i];
+		s->cqtaps[i * 2 + 0] = s->qtaps[i];
+		s->cqtaps[i * 2 + 1] = s->itaps[i];
+	}
+	
 	s->lwin = s->ataps + delay;
 	s->win = calloc(s->ataps * 2 + delay, sizeof(int16_t) * 2);
 	s->owin = 0;
@@ -464,14 +750,23 @@ size_t fir_int16_complex_process(fir_int16_t *s, int16_t *out, size_t samples, s
 		for(; s->d < s->interpolation && x < samples; s->d += s->decimation)
 		{
 			win = &s->win[s->owin * 2];
-			itaps = &s->itaps[s->d * s->ataps];
-			qtaps = &s->qtaps[s->d * s->ataps];
 			
 			/* Calculate the next output sample */
-			for(ai = aq = y = 0; y < s->ataps; y++, win += 2, itaps++, qtaps++)
+			if(s->citaps)
 			{
-				ai += win[0] * *itaps - win[1] * *qtaps;
-				aq += win[0] * *qtaps + win[1] * *itaps;
+				ai = _dot_int16.dot(win, &s->citaps[s->d * s->ataps * 2], s->ataps * 2);
+				aq = _dot_int16.dot(win, &s->cqtaps[s->d * s->ataps * 2], s->ataps * 2);
+			}
+			else
+			{
+				itaps = &s->itaps[s->d * s->ataps];
+				qtaps = &s->qtaps[s->d * s->ataps];
+				
+				for(ai = aq = y = 0; y < s->ataps; y++, win += 2, itaps++, qtaps++)
+				{
+					ai += win[0] * *itaps - win[1] * *qtaps;
+					aq += win[0] * *qtaps + win[1] * *itaps;
+				}
 			}
 			
 			ai >>= 15;
@@ -491,6 +786,7 @@ int fir_int16_scomplex_init(fir_int16_t *s, const double *taps, int ntaps, int i
 	int i, j;
 	
 	s->type = 3;
+	pthread_once(&_dot_int16_once, _dot_int16_init);
 	
 	s->interpolation = interpolation;
 	s->decimation = decimation;
@@ -501,6 +797,8 @@ int fir_int16_scomplex_init(fir_int16_t *s, const double *taps, int ntaps, int i
 	
 	s->itaps = calloc(s->ntaps, sizeof(int16_t));
 	s->qtaps = calloc(s->ntaps, sizeof(int16_t));
+	s->citaps = NULL;
+	s->cqtaps = NULL;
 	
 	/* Copy the taps in the order and format they are to be used */
 	j = s->ntaps - s->ataps;
@@ -524,7 +822,7 @@ int fir_int16_scomplex_init(fir_int16_t *s, const double *taps, int ntaps, int i
 size_t fir_int16_scomplex_process(fir_int16_t *s, int16_t *out, size_t samples, size_t step)
 {
 	int32_t ai, aq;
-	int x, y;
+	int x;
 	const int16_t *win, *itaps, *qtaps;
 	
 	if(samples <= 0)
@@ -556,11 +854,8 @@ size_t fir_int16_scomplex_process(fir_int16_t *s, int16_t *out, size_t samples,
 			qtaps = &s->qtaps[s->d * s->ataps];
 			
 			/* Calculate the next output sample */
-			for(ai = aq = y = 0; y < s->ataps; y++)
-			{
-				ai += *win     * *(itaps++);
-				aq += *(win++) * *(qtaps++);
-			}
+			ai = _dot_int16.dot(win, itaps, s->ataps);
+			aq = _dot_int16.dot(win, qtaps, s->ataps);
 			
 			ai >>= 15;
 			aq >>= 15;
@@ -661,6 +956,15 @@ void fir_int32_free(fir_int32_t *s)
 	memset(s, 0, sizeof(fir_int32_t));
 }
 
+void fir_int32_copy(fir_int32_t *dst, const fir_int32_t *src)
+{
+	if(src->type == 0) return;
+	
+	memcpy(dst->win, src->win, (src->lwin + src->ataps) * sizeof(int32_t));
+	dst->owin = src->owin;
+	dst->d = src->d;
+}
+
 
 
 /* IIR filter */
@@ -829,3 +1133,17 @@ void limiter_process(limiter_t *s, int16_t *out, const int16_t *vin, const int16
 	}
 }
 
+void limiter_copy(limiter_t *dst, const limiter_t *src)
+{
+	if(src->width == 0) return;
+	
+	fir_int32_copy(&dst->vfir, &src->vfir);
+	fir_int32_copy(&dst->ffir, &src->ffir);
+	
+	memcpy(dst->att, src->att, sizeof(int16_t) * src->width);
+	memcpy(dst->fix, src->fix, sizeof(int32_t) * src->width);
+	memcpy(dst->var, src->var, sizeof(int32_t) * src->width);
+	dst->p = src->p;
+	dst->h = src->h;
+}
+
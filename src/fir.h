@@ -32,6 +32,10 @@ typedef struct {
 	int16_t *itaps;
 	int16_t *qtaps;
 	
+	/* Interleaved taps for the complex (type 2) dot product */
+	int16_t *citaps;
+	int16_t *cqtaps;
+	
 	int owin;
 	int lwin;
 	int16_t *win;
@@ -75,6 +79,10 @@ extern size_t fir_int16_process_block(fir_int16_t *s, int16_t *out, const int16_
 extern size_t fir_int16_output_size(fir_int16_t *s, size_t samples);
 extern void fir_int16_free(fir_int16_t *s);
 
+/* Copy the filter state (window and phase) of src into dst,
+ * which must have been initialised with the same settings */
+extern void fir_int16_copy(fir_int16_t *dst, const fir_int16_t *src);
+
 extern int fir_int16_resampler_init(fir_int16_t *s, r64_t out_rate, r64_t in_rate);
 
 extern int fir_int16_complex_init(fir_int16_t *s, const double *taps, int ntaps, int interpolation, int decimation, int delay);
@@ -86,6 +94,7 @@ extern size_t fir_int16_scomplex_process(fir_int16_t *s, int16_t *out, size_t sa
 extern int fir_int32_init(fir_int32_t *s, const double *taps, int ntaps, int interpolation, int decimation, int delay);
 extern size_t fir_int32_process(fir_int32_t *s, int32_t *out, const int32_t *in, size_t samples);
 extern void fir_int32_free(fir_int32_t *s);
+extern void fir_int32_copy(fir_int32_t *dst, const fir_int32_t *src);
 
 typedef struct {
 	double a[2];
@@ -122,5 +131,9 @@ extern void limiter_free(limiter_t *s);
 extern int limiter_init(limiter_t *s, int16_t level, int width, const double *vtaps, const double *ftaps, int ntaps);
 extern void limiter_process(limiter_t *s, int16_t *out, const int16_t *vin, const int16_t *fin, int samples, int step);
 
+/* Copy the limiter state of src into dst, which must
+ * have been initialised with the same settings */
+extern void limiter_copy(limiter_t *dst, const limiter_t *src);
+
 #endif
 
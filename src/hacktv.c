@@ -18,12 +18,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <pthread.h>
 #include <getopt.h>
 #include <signal.h>
 #include <dirent.h>
+#include <math.h>
+#include <inttypes.h>
 #include "hacktv.h"
 #include "av.h"
 #include "rf.h"
+#include "conv.h"
+#include "fifo.h"
 #include "testsignal.h"
 
 static volatile sig_atomic_t _abort = 0;
@@ -61,6 +67,9 @@ static void print_usage(void)
 		"  -r, --repeat                   Repeat the inputs forever.\n"
 		"      --shuffle                  Randomly shuffle the inputs.\n"
 		"  -v, --verbose                  Enable verbose output.\n"
+		"      --stats <file>             Record timing statistics for each processing\n"
+		"                                 stage and write them to <file> as JSON every\n"
+		"                                 few seconds. Use - to print a table to stderr.\n"
 		"      --teletext <path>          Enable teletext output. (625 line modes only)\n"
 		"      --wss <mode>               Enable WSS output. (625 line modes only)\n"
 		"      --videocrypt <mode>        Enable Videocrypt I scrambling. (PAL only)\n"
@@ -72,6 +81,18 @@ static void print_usage(void)
 		"      --vits                     Enable VITS test signals.\n"
 		"      --vitc                     Enable VITC time code.\n"
 		"      --filter                   Enable experimental VSB modulation filter.\n"
+		"      --threads <n>              Run the line processes on <n> worker threads.\n"
+		"                                 Default: 0 (disabled)\n"
+		"      --shards <n>               Render to a file on <n> threads, each working\n"
+		"                                 on its own segment of the input. Not\n"
+		"                                 available with MAC or SiS.\n"
+		"      --shard-frames <n>         Length of each segment in frames. Default: 250\n"
+		"      --yuv-mode <mode>          Set the RGB to YUV conversion mode (auto, table\n"
+		"                                 or matrix). Default: auto\n"
+		"      --subcarrier-mode <mode>   Set how the PAL/NTSC colour subcarrier is\n"
+		"                                 generated (table or line). Default: table\n"
+		"      --frame-cache              Replay the rendered active video while the\n"
+		"                                 source frame is unchanged.\n"
 		"      --nocolour                 Disable the colour subcarrier (PAL, SECAM, NTSC only).\n"
 		"      --s-video                  Output colour subcarrier on second channel.\n"
 		"                                 (PAL, NTSC, SECAM baseband modes only).\n"
@@ -100,6 +121,14 @@ static void print_usage(void)
 		"                                 Applied before offset and passthru. (Complex modes only).\n"
 		"      --offset <value>           Add a frequency offset in Hz (Complex modes only).\n"
 		"      --passthru <file>          Read and add an int16 complex signal.\n"
+		"      --channel <offset>:<mode>:<input>\n"
+		"                                 Add another channel at a frequency offset in Hz,\n"
+		"                                 mixed into the output. May be repeated.\n"
+		"                                 Signal options such as --noaudio, --filter\n"
+		"                                 and --teletext apply to every channel.\n"
+		"                                 (Complex modes only).\n"
+		"      --mix-headroom <dB>        Reduce the level of each channel below the\n"
+		"                                 level that cannot clip. Default: 0\n"
 		"      --invert-video             Invert the composite video signal sync and\n"
 		"                                 white levels.\n"
 		"      --secam-field-id           Enable SECAM field identification.\n"
@@ -120,6 +149,13 @@ static void print_usage(void)
 		"      --ffmt <format>            Force input file format.\n"
 		"      --fopts <option=value[:option2=value]>\n"
 		"                                 Pass option(s) to ffmpeg.\n"
+		"      --scaler <algorithm>       Set the video scaling algorithm (point,\n"
+		"                                 fast-bilinear, bilinear, bicubic, lanczos).\n"
+		"                                 Default: bicubic\n"
+		"      --scaler-threads <n>       Set the number of video scaler threads.\n"
+		"                                 Default: 0 (auto)\n"
+		"      --video-buffers <n>        Set the number of decoded and scaled frames\n"
+		"                                 buffered ahead of the output. Default: 4\n"
 		"\n"
 		"HackRF output options\n"
 		"\n"
@@ -163,6 +199,9 @@ static void print_usage(void)
 		"\n"
 		"  -o, --output file:<filename>   Open a file for output. Use - for stdout.\n"
 		"  -t, --type <type>              Set the file data type.\n"
+		"      --file-writer <writer>     Set how the file is written. Default: stdio\n"
+		"      --file-buffer <bytes>      Set the writer buffer size. Default: 4M\n"
+		"      --file-index <filename>    Write a frame index for the output file.\n"
 		"\n"
 		"Supported file types:\n"
 		"\n"
@@ -178,6 +217,22 @@ static void print_usage(void)
 		"\n"
 		"  If no valid output prefix is provided, file: is assumed.\n"
 		"\n"
+		"  -o, --output sigmf:<name>      Write a SigMF recording to <name>.sigmf-data\n"
+		"                                 and <name>.sigmf-meta. The file options\n"
+		"                                 above also apply. The metadata records the\n"
+		"                                 start of each frame or field.\n"
+		"\n"
+		"File writers:\n"
+		"\n"
+		"  stdio  = Buffered writes on the render thread.\n"
+		"  thread = Writes large blocks from a separate writer thread.\n"
+		"  direct = As thread, but bypasses the page cache with O_DIRECT.\n"
+		"  mmap   = Preallocates the file and renders into a sliding memory\n"
+		"           mapped window of --file-buffer bytes.\n"
+		"\n"
+		"  The buffer size may end in K, M or G. For the thread and direct\n"
+		"  writers it is the size of each of the four queued blocks.\n"
+		"\n"
 		"NOTE: The number of samples per line is rounded to the nearest integer,\n"
 		"which may result in a slight frame rate error.\n"
 		"\n"
@@ -292,67 +347,1265 @@ static void print_usage(void)
 	);
 }
 
-/* fputs() a string with JSON-style escape sequences */
-static int _fputs_json(const char *str, FILE *stream)
+/* List all avaliable modes, optionally formatted as a JSON array */
+static void _list_modes(int json)
 {
-	int c;
+	const vid_configs_t *vc;
+	
+	if(json) printf("[\n");
+	
+	/* Load the mode configuration */
+	for(vc = vid_configs; vc->id != NULL; vc++)
+	{
+		if(json)
+		{
+			printf("  {\n    \"id\": \"");
+			fputs_json(vc->id, stdout);
+			printf("\",\n    \"description\": \"");
+			fputs_json(vc->desc ? vc->desc : "", stdout);
+			printf("\"\n  }%s\n", vc[1].id != NULL ? "," : "");
+		}
+		else
+		{
+			printf("  %-14s = %s\n", vc->id, vc->desc ? vc->desc : "");
+		}
+	}
+	
+	if(json) printf("]\n");
+}
+
+static void _configure_av(hacktv_t *s, vid_t *vid)
+{
+	/* Configure AV source settings */
+	vid_av_defaults(vid);
+	
+	vid->av.fit_mode = s->fit_mode;
+	vid->av.scaler = s->scaler;
+	vid->av.scaler_threads = s->scaler_threads;
+	vid->av.video_buffers = s->video_buffers;
+	vid->av.min_display_aspect_ratio = s->min_aspect;
+	vid->av.max_display_aspect_ratio = s->max_aspect;
+}
+
+static int _open_input(hacktv_t *s, av_t *av, char *input)
+{
+	char *pre, *sub;
+	int l;
+	
+	/* Get a pointer to the output prefix and target */
+	pre = input;
+	sub = strchr(pre, ':');
+	
+	if(sub != NULL)
+	{
+		l = sub - pre;
+		sub++;
+	}
+	else
+	{
+		l = strlen(pre);
+	}
+	
+	if(strncmp(pre, "test", l) == 0)
+	{
+		return(av_test_open(av));
+	}
+	else if(strncmp(pre, "ffmpeg", l) == 0)
+	{
+		return(av_ffmpeg_open(av, sub, s->ffmt, s->fopts));
+	}
+	
+	return(av_ffmpeg_open(av, pre, s->ffmt, s->fopts));
+}
+
+/* The next input is opened on a background thread while the current
+ * one plays, so the demuxer probe and decoder start up don't leave a
+ * gap in the output between inputs */
+
+static void *_open_next_thread(void *arg)
+{
+	hacktv_t *s = arg;
+	
+	s->next_r = _open_input(s, &s->next_av, s->next_input);
+	
+	return(NULL);
+}
+
+static void _open_next(hacktv_t *s, char *input)
+{
+	s->next_input = input;
+	s->next_r = AV_ERROR;
+	
+	if(input == NULL) return;
+	
+	if(pthread_create(&s->next_thread, NULL, _open_next_thread, s) != 0)
+	{
+		/* Open it here instead */
+		_open_next_thread(s);
+		return;
+	}
+	
+	s->next_running = 1;
+}
+
+static int _take_next(hacktv_t *s, av_t *av)
+{
+	if(s->next_running)
+	{
+		pthread_join(s->next_thread, NULL);
+		s->next_running = 0;
+	}
+	
+	if(s->next_r == AV_OK)
+	{
+		av_move(av, &s->next_av);
+	}
+	
+	return(s->next_r);
+}
+
+static void _close_next(hacktv_t *s)
+{
+	if(s->next_running)
+	{
+		pthread_join(s->next_thread, NULL);
+		s->next_running = 0;
+	}
+	
+	if(s->next_r == AV_OK)
+	{
+		av_close(&s->next_av);
+	}
+	
+	s->next_input = NULL;
+	s->next_r = AV_ERROR;
+}
+
+static void _shuffle_inputs(int first, int argc, char *argv[])
+{
+	char *p;
+	int c, l;
+	
+	/* Avoids moving the last entry to the start
+	 * to prevent it repeating immediately */
+	for(c = first; c < argc - 1; c++)
+	{
+		l = c + (rand() % (argc - c - (c == first ? 1 : 0)));
+		p = argv[c];
+		argv[c] = argv[l];
+		argv[l] = p;
+	}
+}
+
+/* Interval between timing statistics updates, in nanoseconds */
+#define _STATS_INTERVAL 5000000000ULL
+
+static void _write_stats(hacktv_t *s)
+{
+	prof_t *stages[64];
+	uint64_t elapsed;
+	FILE *f;
+	int n;
+	
+	elapsed = prof_now() - s->stats_start;
+	
+	n = vid_get_stats(&s->vid, stages, 63);
+	stages[n++] = &s->prof_rf;
+	
+	if(strcmp(s->stats, "-") == 0)
+	{
+		fprintf(stderr, "\n");
+		prof_print(stderr, stages, n, elapsed);
+		return;
+	}
+	
+	/* The file is replaced with the latest totals on each update */
+	f = fopen(s->stats, "w");
+	if(!f)
+	{
+		perror("fopen");
+		return;
+	}
+	
+	prof_print_json(f, stages, n, elapsed);
+	fclose(f);
+}
+
+/* Sharded file rendering
+ *
+ * The input is split into segments of shard_frames frames, each rendered
+ * by its own encoder. vid_seek() restores the encoder state at the start
+ * of each segment, and each segment is written directly to its position
+ * in the output file.
+ *
+ * The audio carriers depend on all of the earlier audio. For these a
+ * tracker thread runs only the audio of another encoder from the start
+ * of the input. When it reaches the start of a segment it copies its
+ * audio state into a new encoder for the segment, and feeds that the
+ * audio from then on. The output matches a serial render exactly.
+ *
+ * FM video segments start from zero carrier phase. Once all the segments
+ * before one are written, it is rotated in the file to continue from the
+ * phase they end on. This is exact but for rounding.
+*/
+
+typedef struct {
+	
+	/* The encoder, prepared by the tracker when there is one */
+	vid_t vid;
+	int started;
+	int done;
+	
+	/* Audio from the tracker, fed until frame feed_end */
+	vid_audio_feed_t feed;
+	int64_t feed_end;
+	int fed;
+	
+	/* Samples written, and the FM video carrier phase at the
+	 * first line written and at the line after the segment */
+	int64_t samples;
+	uint32_t fm_phase[2];
+	
+} _shard_segment_t;
+
+typedef struct {
+	
+	hacktv_t *s;
+	const vid_config_t *conf;
+	char *input;
+	int complex;
+	int64_t frame_samples;
+	
+	/* Audio tracker */
+	int track;
+	int tracking;
+	
+	/* FM video segments still to be rotated */
+	int fm;
+	int stitched;
+	uint32_t stitch_phase;
+	
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	_shard_segment_t **segments;
+	int nsegments;
+	int asegments;
+	int next;
+	int end;
+	int error;
+	
+} _shards_t;
+
+static int _shard_segment_add(_shards_t *sh, _shard_segment_t *seg)
+{
+	_shard_segment_t **p;
+	
+	/* Called with the mutex held */
+	if(sh->nsegments == sh->asegments)
+	{
+		p = realloc(sh->segments, sizeof(_shard_segment_t *) * (sh->asegments + 64));
+		if(!p) return(-1);
+		
+		sh->segments = p;
+		sh->asegments += 64;
+	}
+	
+	sh->segments[sh->nsegments++] = seg;
+	
+	return(0);
+}
+
+static void _shard_fed(_shards_t *sh, _shard_segment_t *seg)
+{
+	vid_audio_feed_close(&seg->feed);
+	
+	/* The feed is freed by the last of the tracker and encoder */
+	pthread_mutex_lock(&sh->mutex);
+	seg->fed = 1;
+	if(seg->done) vid_audio_feed_free(&seg->feed);
+	pthread_cond_broadcast(&sh->cond);
+	pthread_mutex_unlock(&sh->mutex);
+}
+
+static int _shard_tracker_wait(_shards_t *sh, int first)
+{
+	int i;
+	
+	/* Called with the mutex held. The tracker waits once enough
+	 * segments are queued, unless a running segment needs audio */
+	if(sh->error || _abort) return(0);
+	if(sh->nsegments - sh->next < sh->s->shards) return(0);
+	
+	for(i = first; i < sh->next; i++)
+	{
+		if(!sh->segments[i]->done && !sh->segments[i]->fed) return(0);
+	}
+	
+	return(1);
+}
+
+static void *_shard_tracker_thread(void *arg)
+{
+	_shards_t *sh = arg;
+	hacktv_t *s = sh->s;
+	_shard_segment_t *seg;
+	const int16_t *audio;
+	vid_t vid;
+	int64_t lines, frame;
+	int first, start, end, k, i, n;
+	int stop;
+	
+	if(vid_init(&vid, s->samplerate, s->pixelrate, sh->conf) != VID_OK)
+	{
+		fprintf(stderr, "Unable to initialise video encoder.\n");
+		pthread_mutex_lock(&sh->mutex);
+		sh->error = 1;
+		sh->tracking = 0;
+		pthread_cond_broadcast(&sh->cond);
+		pthread_mutex_unlock(&sh->mutex);
+		return(NULL);
+	}
+	
+	_configure_av(s, &vid);
+	
+	first = k = 0;
+	
+	if(_open_input(s, &vid.av, sh->input) == AV_OK)
+	{
+		for(lines = 0; !_abort; lines++)
+		{
+			frame = lines / vid.conf.lines;
+			
+			if(lines % vid.conf.lines == 0)
+			{
+				pthread_mutex_lock(&sh->mutex);
+				
+				while(_shard_tracker_wait(sh, first))
+				{
+					pthread_cond_wait(&sh->cond, &sh->mutex);
+				}
+				
+				/* Stop once every segment up to the end has its audio */
+				end = sh->end;
+				stop = sh->error || (k >= end && first >= end);
+				pthread_mutex_unlock(&sh->mutex);
+				
+				if(stop) break;
+				
+				/* Prepare the encoder of each segment starting here */
+				for(; k < end && vid_seek_start(&vid, k * s->shard_frames) == frame; k++)
+				{
+					seg = calloc(1, sizeof(_shard_segment_t));
+					
+					if(seg == NULL || vid_init(&seg->vid, s->samplerate, s->pixelrate, sh->conf) != VID_OK)
+					{
+						fprintf(stderr, "Unable to initialise video encoder.\n");
+						free(seg);
+						stop = 1;
+						break;
+					}
+					
+					vid_audio_copy(&seg->vid, &vid);
+					vid_audio_feed_init(&seg->feed);
+					
+					/* Feed it past the end of the segment, to cover
+					 * the lines its filters and pipeline read ahead */
+					start = (k + 1) * s->shard_frames;
+					seg->feed_end = start * 2 - vid_seek_start(&vid, start) + 1;
+					
+					pthread_mutex_lock(&sh->mutex);
+					
+					if(_shard_segment_add(sh, seg) != 0)
+					{
+						pthread_mutex_unlock(&sh->mutex);
+						vid_audio_feed_free(&seg->feed);
+						vid_free(&seg->vid);
+						free(seg);
+						stop = 1;
+						break;
+					}
+					
+					pthread_cond_broadcast(&sh->cond);
+					pthread_mutex_unlock(&sh->mutex);
+				}
+				
+				if(stop)
+				{
+					pthread_mutex_lock(&sh->mutex);
+					sh->error = 1;
+					pthread_mutex_unlock(&sh->mutex);
+					break;
+				}
+			}
+			
+			n = vid_track(&vid, &audio);
+			if(n < 0) break;
+			
+			for(i = first; i < k; i++)
+			{
+				seg = sh->segments[i];
+				
+				if(seg->fed) continue;
+				
+				if(frame >= seg->feed_end)
+				{
+					_shard_fed(sh, seg);
+				}
+				else if(vid_audio_feed_write(&seg->feed, audio, n) != VID_OK)
+				{
+					fprintf(stderr, "Out of memory.\n");
+					_shard_fed(sh, seg);
+					
+					pthread_mutex_lock(&sh->mutex);
+					sh->error = 1;
+					pthread_mutex_unlock(&sh->mutex);
+				}
+			}
+			
+			while(first < k && sh->segments[first]->fed)
+			{
+				first++;
+			}
+		}
+		
+		av_close(&vid.av);
+	}
+	
+	/* The remaining segments get what audio there was */
+	for(i = first; i < k; i++)
+	{
+		if(!sh->segments[i]->fed)
+		{
+			_shard_fed(sh, sh->segments[i]);
+		}
+	}
+	
+	vid_free(&vid);
+	
+	/* Segments not prepared by now are past the end of the input */
+	pthread_mutex_lock(&sh->mutex);
+	if(k < sh->end) sh->end = k;
+	sh->tracking = 0;
+	pthread_cond_broadcast(&sh->cond);
+	pthread_mutex_unlock(&sh->mutex);
+	
+	return(NULL);
+}
+
+static int _render_shard(_shards_t *sh, _shard_segment_t *seg, int segment)
+{
+	hacktv_t *s = sh->s;
+	vid_t *vid = &seg->vid;
+	vid_line_t *line;
+	rf_t rf;
+	int64_t frame = (int64_t) segment * s->shard_frames;
+	int64_t i, n;
+	
+	if(!sh->track && vid_init(vid, s->samplerate, s->pixelrate, sh->conf) != VID_OK)
+	{
+		fprintf(stderr, "Unable to initialise video encoder.\n");
+		return(-1);
+	}
+	
+	_configure_av(s, vid);
+	
+	if(sh->track)
+	{
+		vid->audio_feed = &seg->feed;
+	}
+	
+	if(vid_seek(vid, frame) != VID_OK)
+	{
+		fprintf(stderr, "This mode cannot be rendered in segments.\n");
+		vid_free(vid);
+		return(-1);
+	}
+	
+	if(rf_file_open_at(&rf, s->output, s->file_type, sh->complex, frame * sh->frame_samples, s->file_writer, s->file_buffer) != RF_OK)
+	{
+		vid_free(vid);
+		return(-1);
+	}
+	
+	n = (int64_t) s->shard_frames * vid->conf.lines;
+	i = 0;
+	
+	if(_open_input(s, &vid->av, sh->input) == AV_OK)
+	{
+		for(; i < n && !_abort; i++)
+		{
+			line = vid_next_line(vid);
+			
+			if(line == NULL) break;
+			
+			if(i == 0) seg->fm_phase[0] = line->fm_phase;
+			
+			if(rf_write(&rf, line->output, line->width) != RF_OK) break;
+			
+			seg->samples += line->width;
+		}
+		
+		if(sh->fm && i == n)
+		{
+			/* The FM carrier phase the next segment continues from */
+			line = vid_next_line(vid);
+			if(line) seg->fm_phase[1] = line->fm_phase;
+		}
+		
+		vid_pause(vid);
+		av_close(&vid->av);
+	}
+	
+	rf_close(&rf);
+	vid_free(vid);
+	
+	/* A short segment marks the end of the input */
+	return(i < n ? 1 : 0);
+}
+
+static int _shard_stitch(_shards_t *sh)
+{
+	_shard_segment_t *seg;
+	uint32_t phase;
+	double a;
+	int k;
+	
+	/* Rotate each FM video segment once those before it are done */
+	while(1)
+	{
+		pthread_mutex_lock(&sh->mutex);
+		
+		if(sh->stitched >= sh->nsegments || sh->stitched > sh->end ||
+		   !sh->segments[sh->stitched]->done)
+		{
+			pthread_mutex_unlock(&sh->mutex);
+			return(0);
+		}
+		
+		k = sh->stitched++;
+		seg = sh->segments[k];
+		
+		if(k == 0) sh->stitch_phase = seg->fm_phase[0];
+		phase = sh->stitch_phase - seg->fm_phase[0];
+		sh->stitch_phase += seg->fm_phase[1] - seg->fm_phase[0];
+		
+		pthread_mutex_unlock(&sh->mutex);
+		
+		if(phase == 0 || seg->samples == 0) continue;
+		
+		/* Swapping I and Q reverses the rotation */
+		a = 2.0 * M_PI * phase / 4294967296.0;
+		if(sh->conf->swap_iq) a = -a;
+		
+		if(rf_file_rotate(sh->s->output, sh->s->file_type, (int64_t) k * sh->s->shard_frames * sh->frame_samples, seg->samples, a) != RF_OK)
+		{
+			return(-1);
+		}
+	}
+}
+
+static void *_shard_thread(void *arg)
+{
+	_shards_t *sh = arg;
+	_shard_segment_t *seg;
+	int segment;
+	int r;
+	
+	while(!_abort)
+	{
+		pthread_mutex_lock(&sh->mutex);
+		
+		/* Wait for the tracker to prepare the next segment */
+		while(sh->track && sh->tracking && !sh->error &&
+		      sh->next < sh->end && sh->next >= sh->nsegments)
+		{
+			pthread_cond_wait(&sh->cond, &sh->mutex);
+		}
+		
+		if(!sh->track && !sh->error && sh->next < sh->end && sh->next == sh->nsegments)
+		{
+			/* Without a tracker the segments are added here */
+			seg = calloc(1, sizeof(_shard_segment_t));
+			
+			if(seg == NULL || _shard_segment_add(sh, seg) != 0)
+			{
+				free(seg);
+				sh->error = 1;
+			}
+		}
+		
+		seg = NULL;
+		
+		if(!sh->error && sh->next < sh->end && sh->next < sh->nsegments)
+		{
+			segment = sh->next++;
+			seg = sh->segments[segment];
+			seg->started = 1;
+			pthread_cond_broadcast(&sh->cond);
+		}
+		
+		pthread_mutex_unlock(&sh->mutex);
+		
+		if(seg == NULL) break;
+		
+		r = _render_shard(sh, seg, segment);
+		
+		pthread_mutex_lock(&sh->mutex);
+		if(r < 0) sh->error = 1;
+		else if(r > 0 && segment < sh->end) sh->end = segment;
+		seg->done = 1;
+		if(sh->track && seg->fed) vid_audio_feed_free(&seg->feed);
+		pthread_cond_broadcast(&sh->cond);
+		pthread_mutex_unlock(&sh->mutex);
+		
+		if(sh->fm && _shard_stitch(sh) != 0)
+		{
+			pthread_mutex_lock(&sh->mutex);
+			sh->error = 1;
+			pthread_cond_broadcast(&sh->cond);
+			pthread_mutex_unlock(&sh->mutex);
+		}
+	}
+	
+	return(NULL);
+}
+
+static int _render_shards(hacktv_t *s, const vid_config_t *conf, char *input)
+{
+	_shards_t sh;
+	_shard_segment_t *seg;
+	pthread_t *threads;
+	pthread_t tracker;
+	int tracker_running = 0;
+	FILE *f;
+	int i, n;
+	
+	/* Create or truncate the output file */
+	f = fopen(s->output, "wb");
+	if(!f)
+	{
+		perror("fopen");
+		return(-1);
+	}
+	
+	fclose(f);
+	
+	threads = calloc(s->shards, sizeof(pthread_t));
+	if(!threads)
+	{
+		return(-1);
+	}
+	
+	sh.s = s;
+	sh.conf = conf;
+	sh.input = input;
+	sh.complex = s->vid.conf.output_type == RF_INT16_COMPLEX || s->vid.conf.s_video;
+	sh.frame_samples = (int64_t) s->vid.sample_rate * s->vid.conf.frame_rate.den / s->vid.conf.frame_rate.num;
+	sh.track = vid_seek_tracked(&s->vid);
+	sh.tracking = sh.track;
+	sh.fm = s->vid.conf.modulation == VID_FM;
+	sh.stitched = 0;
+	sh.stitch_phase = 0;
+	sh.segments = NULL;
+	sh.nsegments = 0;
+	sh.asegments = 0;
+	sh.next = 0;
+	sh.end = INT_MAX;
+	sh.error = 0;
+	pthread_mutex_init(&sh.mutex, NULL);
+	pthread_cond_init(&sh.cond, NULL);
+	
+	if(sh.track)
+	{
+		if(pthread_create(&tracker, NULL, &_shard_tracker_thread, &sh) != 0)
+		{
+			fprintf(stderr, "Error starting the audio tracker thread.\n");
+			sh.error = 1;
+			sh.tracking = 0;
+		}
+		else
+		{
+			tracker_running = 1;
+		}
+	}
+	
+	for(n = 0; n < s->shards && !sh.error; n++)
+	{
+		if(pthread_create(&threads[n], NULL, &_shard_thread, &sh) != 0)
+		{
+			fprintf(stderr, "Error starting render thread.\n");
+			break;
+		}
+	}
+	
+	if(n == 0)
+	{
+		/* Nothing will take the segments, stop the tracker */
+		pthread_mutex_lock(&sh.mutex);
+		sh.error = 1;
+		pthread_cond_broadcast(&sh.cond);
+		pthread_mutex_unlock(&sh.mutex);
+	}
+	
+	for(i = 0; i < n; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+	
+	if(tracker_running)
+	{
+		pthread_join(tracker, NULL);
+	}
+	
+	/* Release the segments that were never rendered */
+	for(i = 0; i < sh.nsegments; i++)
+	{
+		seg = sh.segments[i];
+		
+		if(sh.track && !seg->started) vid_free(&seg->vid);
+		if(sh.track && !(seg->done && seg->fed)) vid_audio_feed_free(&seg->feed);
+		
+		free(seg);
+	}
+	
+	free(sh.segments);
+	pthread_cond_destroy(&sh.cond);
+	pthread_mutex_destroy(&sh.mutex);
+	free(threads);
+	
+	return(sh.error || n == 0 ? -1 : 0);
+}
+
+/* Multi-channel output
+ * 
+ * Each additional channel has its own video encoder and input, and
+ * renders on its own thread into a FIFO. The main loop mixes the
+ * samples from each FIFO into the output of the main channel. All
+ * channels share the sample rate and are placed within the output
+ * by their frequency offset.
+*/
+
+#define _CHANNEL_BLOCKS 4
+#define _CHANNEL_BLOCK  (256 * 1024)
+
+typedef struct {
+	
+	hacktv_t *s;
+	const hacktv_channel_t *conf;
+	
+	/* Video encoder state */
+	vid_t vid;
+	
+	/* Rendered samples, read by the mixer */
+	fifo_t fifo;
+	fifo_reader_t reader;
+	int eof;
+	
+	pthread_t thread;
+	int abort;
+	
+} _channel_t;
+
+typedef struct {
+	
+	_channel_t *channels;
+	int nchannels;
+	
+	/* Level of each channel in the mix, 1.0 = 32768 */
+	int scale;
+	
+	int16_t *mix;
+	size_t length;
+	
+} _mixer_t;
+
+/* Apply the signal options to a mode configuration. These apply to
+ * every channel, and each must be supported by the channel's mode */
+static int _apply_options(hacktv_t *s, vid_config_t *conf)
+{
+	if(s->deviation > 0)
+	{
+		/* Override the FM deviation value */
+		conf->fm_deviation = s->deviation;
+	}
+	
+	if(s->gamma > 0)
+	{
+		/* Override the gamma value */
+		conf->gamma = s->gamma;
+	}
+	
+	if(s->interlace)
+	{
+		conf->interlace = 1;
+	}
+	
+	if(s->nocolour)
+	{
+		if(conf->colour_mode == VID_PAL ||
+		   conf->colour_mode == VID_SECAM ||
+		   conf->colour_mode == VID_NTSC)
+		{
+			conf->colour_mode = VID_NONE;
+		}
+	}
+	
+	if(s->s_video)
+	{
+		if((conf->colour_mode != VID_PAL &&
+		   conf->colour_mode != VID_SECAM &&
+		   conf->colour_mode != VID_NTSC) ||
+		   conf->output_type != RF_INT16_REAL)
+		{
+			fprintf(stderr, "S-Video is only available with PAL, SECAM, or NTSC baseband modes.\n");
+			return(-1);
+		}
+		
+		conf->s_video = 1;
+	}
+	
+	if(s->noaudio > 0)
+	{
+		/* Disable all audio sub-carriers */
+		conf->fm_mono_level = 0;
+		conf->fm_left_level = 0;
+		conf->fm_right_level = 0;
+		conf->am_audio_level = 0;
+		conf->nicam_level = 0;
+		conf->dance_level = 0;
+		conf->fm_mono_carrier = 0;
+		conf->fm_left_carrier = 0;
+		conf->fm_right_carrier = 0;
+		conf->nicam_carrier = 0;
+		conf->dance_carrier = 0;
+		conf->am_mono_carrier = 0;
+	}
+	
+	if(s->nonicam > 0)
+	{
+		/* Disable the NICAM sub-carrier */
+		conf->nicam_level = 0;
+		conf->nicam_carrier = 0;
+	}
+	
+	if(s->a2stereo > 0)
+	{
+		conf->a2stereo = 1;
+	}
+	
+	conf->scramble_video = s->scramble_video;
+	conf->scramble_audio = s->scramble_audio;
+	
+	conf->level *= s->level;
+	
+	if(s->teletext)
+	{
+		if(conf->lines != 625)
+		{
+			fprintf(stderr, "Teletext is only available with 625 line modes.\n");
+			return(-1);
+		}
+		
+		conf->teletext = s->teletext;
+	}
+	
+	if(s->wss)
+	{
+		if(conf->type != VID_RASTER_625)
+		{
+			fprintf(stderr, "WSS is only supported for 625 line raster modes.\n");
+			return(-1);
+		}
+		
+		conf->wss = s->wss;
+	}
+	
+	if(s->videocrypt)
+	{
+		if(conf->lines != 625 && conf->colour_mode != VID_PAL)
+		{
+			fprintf(stderr, "Videocrypt I is only compatible with 625 line PAL modes.\n");
+			return(-1);
+		}
+		
+		conf->videocrypt = s->videocrypt;
+	}
+	
+	if(s->videocrypt2)
+	{
+		if(conf->lines != 625 && conf->colour_mode != VID_PAL)
+		{
+			fprintf(stderr, "Videocrypt II is only compatible with 625 line PAL modes.\n");
+			return(-1);
+		}
+		
+		/* Only allow both VC1 and VC2 if both are in free-access mode */
+		if(s->videocrypt && !(strcmp(s->videocrypt, "free") == 0 && strcmp(s->videocrypt2, "free") == 0))
+		{
+			fprintf(stderr, "Videocrypt I and II cannot be used together except in free-access mode.\n");
+			return(-1);
+		}
+		
+		conf->videocrypt2 = s->videocrypt2;
+	}
+	
+	if(s->videocrypts)
+	{
+		if(conf->lines != 625 && conf->colour_mode != VID_PAL)
+		{
+			fprintf(stderr, "Videocrypt S is only compatible with 625 line PAL modes.\n");
+			return(-1);
+		}
+		
+		if(s->videocrypt || s->videocrypt2)
+		{
+			fprintf(stderr, "Using multiple scrambling modes is not supported.\n");
+			return(-1);
+		}
+		
+		conf->videocrypts = s->videocrypts;
+	}
+	
+	if(s->syster)
+	{
+		if(conf->lines != 625 && conf->colour_mode != VID_PAL)
+		{
+			fprintf(stderr, "Nagravision Syster is only compatible with 625 line PAL modes.\n");
+			return(-1);
+		}
+		
+		if(conf->videocrypt || conf->videocrypt2 || conf->videocrypts)
+		{
+			fprintf(stderr, "Using multiple scrambling modes is not supported.\n");
+			return(-1);
+		}
+		
+		conf->syster = 1;
+		conf->systeraudio = s->systeraudio;
+	}
+	
+	if(s->eurocrypt)
+	{
+		if(conf->type != VID_MAC)
+		{
+			fprintf(stderr, "Eurocrypt is only compatible with D/D2-MAC modes.\n");
+			return(-1);
+		}
+		
+		if(conf->scramble_video == 0)
+		{
+			/* Default to single-cut scrambling if none was specified */
+			conf->scramble_video = 1;
+		}
+		
+		conf->eurocrypt = s->eurocrypt;
+	}
+	
+	if(s->acp)
+	{
+		if(conf->lines != 625 && conf->lines != 525)
+		{
+			fprintf(stderr, "Analogue Copy Protection is only compatible with 525 and 625 line modes.\n");
+			return(-1);
+		}
+		
+		if(conf->videocrypt || conf->videocrypt2 || conf->videocrypts || conf->syster)
+		{
+			fprintf(stderr, "Analogue Copy Protection cannot be used with video scrambling enabled.\n");
+			return(-1);
+		}
+		
+		conf->acp = 1;
+	}
 	
-	for(c = 0; *str; str++)
+	if(s->vits)
 	{
-		const char *s = NULL;
-		int r;
+		if(conf->type != VID_RASTER_625 &&
+		   conf->type != VID_RASTER_525)
+		{
+			fprintf(stderr, "VITS is only currently supported for 625 and 525 line raster modes.\n");
+			return(-1);
+		}
 		
-		switch(*str)
+		conf->vits = 1;
+	}
+	
+	if(s->vitc)
+	{
+		if(conf->type != VID_RASTER_625 &&
+		   conf->type != VID_RASTER_525)
 		{
-		case '"': s = "\\\""; break;
-		case '\\': s = "\\\\"; break;
-		//case '/': s = "\\/"; break;
-		case '\b': s = "\\b"; break;
-		case '\f': s = "\\f"; break;
-		case '\n': s = "\\n"; break;
-		case '\r': s = "\\r"; break;
-		case '\t': s = "\\t"; break;
+			fprintf(stderr, "VITC is only currently supported for 625 and 525 line raster modes.\n");
+			return(-1);
 		}
 		
-		if(s) r = fputs(s, stream);
-		else r = fputc(*str, stream) == EOF ? EOF : 1;
+		conf->vitc = 1;
+	}
+	
+	if(conf->type == VID_MAC)
+	{
+		if(s->chid >= 0)
+		{
+			conf->chid = (uint16_t) s->chid;
+		}
 		
-		if(r == EOF)
+		conf->mac_audio_stereo = s->mac_audio_stereo;
+		conf->mac_audio_quality = s->mac_audio_quality;
+		conf->mac_audio_protection = s->mac_audio_protection;
+		conf->mac_audio_companded = s->mac_audio_companded;
+	}
+	
+	if(s->filter)
+	{
+		conf->vfilter = 1;
+	}
+	
+	if(s->sis)
+	{
+		if(conf->lines != 625)
 		{
-			return(c > 0 ? c : EOF);
+			fprintf(stderr, "SiS is only available with 625 line modes.\n");
+			return(-1);
 		}
 		
-		c += r;
+		conf->sis = s->sis;
 	}
 	
-	return(c);
+	conf->threads = s->threads;
+	conf->yuv_mode = s->yuv_mode;
+	conf->subcarrier_mode = s->subcarrier_mode;
+	conf->frame_cache = s->frame_cache;
+	conf->swap_iq = s->swap_iq;
+	conf->volume = s->volume * 256 + 0.5;
+	conf->invert_video = s->invert_video;
+	conf->secam_field_id = s->secam_field_id;
+	conf->secam_field_id_lines = s->secam_field_id_lines;
+	
+	conf->testsignal_type = s->testsignal_type;
+	conf->testsignal_clock_mode = s->testsignal_clock_mode;
+	strcpy(conf->testsignals_path, s->testsignals_path);
+	strcpy(conf->testsignal_text1, s->testsignal_text1);
+	strcpy(conf->testsignal_text2, s->testsignal_text2);
+	
+	return(0);
 }
 
-/* List all avaliable modes, optionally formatted as a JSON array */
-static void _list_modes(int json)
+static int _channel_config(hacktv_t *s, const hacktv_channel_t *ch, vid_config_t *conf)
 {
 	const vid_configs_t *vc;
 	
-	if(json) printf("[\n");
-	
-	/* Load the mode configuration */
 	for(vc = vid_configs; vc->id != NULL; vc++)
 	{
-		if(json)
+		if(strcmp(ch->mode, vc->id) == 0) break;
+	}
+	
+	if(vc->id == NULL)
+	{
+		fprintf(stderr, "Unrecognised TV mode '%s'.\n", ch->mode);
+		return(-1);
+	}
+	
+	memcpy(conf, vc->conf, sizeof(vid_config_t));
+	
+	if(conf->output_type != RF_INT16_COMPLEX)
+	{
+		fprintf(stderr, "Mode '%s' cannot be used as an additional channel, only complex modes can be mixed.\n", ch->mode);
+		return(-1);
+	}
+	
+	if(ch->offset <= -(int64_t) s->vid.sample_rate / 2 ||
+	   ch->offset >= (int64_t) s->vid.sample_rate / 2)
+	{
+		fprintf(stderr, "Warning: Channel offset %" PRId64 " Hz is outside the output bandwidth.\n", ch->offset);
+	}
+	
+	if(_apply_options(s, conf) != 0)
+	{
+		fprintf(stderr, "Signal options apply to every channel, including mode '%s'.\n", ch->mode);
+		return(-1);
+	}
+	
+	conf->offset = ch->offset;
+	
+	return(0);
+}
+
+static void *_channel_thread(void *arg)
+{
+	_channel_t *ch = arg;
+	hacktv_t *s = ch->s;
+	const uint8_t *data;
+	void *ptr;
+	size_t l, n;
+	
+	do
+	{
+		if(_open_input(s, &ch->vid.av, ch->conf->input) != AV_OK)
 		{
-			printf("  {\n    \"id\": \"");
-			_fputs_json(vc->id, stdout);
-			printf("\",\n    \"description\": \"");
-			_fputs_json(vc->desc ? vc->desc : "", stdout);
-			printf("\"\n  }%s\n", vc[1].id != NULL ? "," : "");
+			break;
 		}
-		else
+		
+		while(!_abort && !__atomic_load_n(&ch->abort, __ATOMIC_ACQUIRE))
 		{
-			printf("  %-14s = %s\n", vc->id, vc->desc ? vc->desc : "");
+			vid_line_t *line = vid_next_line(&ch->vid);
+			
+			if(line == NULL) break;
+			
+			data = (const uint8_t *) line->output;
+			n = line->width * sizeof(int16_t) * 2;
+			
+			while(n > 0 && (l = fifo_write_ptr(&ch->fifo, &ptr, 1)) != -1)
+			{
+				if(l > n) l = n;
+				
+				memcpy(ptr, data, l);
+				fifo_write(&ch->fifo, l);
+				
+				data += l;
+				n -= l;
+			}
 		}
+		
+		vid_pause(&ch->vid);
+		av_close(&ch->vid.av);
 	}
+	while(s->repeat && !_abort && !__atomic_load_n(&ch->abort, __ATOMIC_ACQUIRE));
 	
-	if(json) printf("]\n");
+	/* The mixer treats a closed channel as silence */
+	fifo_close(&ch->fifo);
+	
+	return(NULL);
+}
+
+static void _mixer_free(_mixer_t *m)
+{
+	int i;
+	
+	for(i = 0; i < m->nchannels; i++)
+	{
+		_channel_t *ch = &m->channels[i];
+		
+		/* Releasing the reader unblocks the writer */
+		__atomic_store_n(&ch->abort, 1, __ATOMIC_RELEASE);
+		fifo_reader_close(&ch->reader);
+		pthread_join(ch->thread, NULL);
+		
+		fifo_free(&ch->fifo);
+		vid_free(&ch->vid);
+	}
+	
+	free(m->channels);
+	free(m->mix);
+}
+
+static int _mixer_init(hacktv_t *s, _mixer_t *m)
+{
+	vid_config_t conf;
+	double level;
+	int i;
+	
+	memset(m, 0, sizeof(_mixer_t));
+	
+	m->channels = calloc(s->nchannels, sizeof(_channel_t));
+	if(!m->channels)
+	{
+		perror("calloc");
+		return(-1);
+	}
+	
+	/* Scale each channel so the sum can't clip, less the headroom */
+	level = 1.0 / (s->nchannels + 1) * pow(10, -s->mix_headroom / 20);
+	m->scale = lround(level * 32768);
+	if(m->scale > INT16_MAX) m->scale = INT16_MAX;
+	
+	for(i = 0; i < s->nchannels; i++)
+	{
+		_channel_t *ch = &m->channels[i];
+		
+		ch->s = s;
+		ch->conf = &s->channels[i];
+		
+		if(_channel_config(s, ch->conf, &conf) != 0)
+		{
+			_mixer_free(m);
+			return(-1);
+		}
+		
+		if(vid_init(&ch->vid, s->vid.sample_rate, s->pixelrate, &conf) != VID_OK)
+		{
+			fprintf(stderr, "Unable to initialise video encoder for mode '%s'.\n", ch->conf->mode);
+			_mixer_free(m);
+			return(-1);
+		}
+		
+		_configure_av(s, &ch->vid);
+		
+		if(fifo_init(&ch->fifo, _CHANNEL_BLOCKS, _CHANNEL_BLOCK) != 0)
+		{
+			perror("fifo_init");
+			vid_free(&ch->vid);
+			_mixer_free(m);
+			return(-1);
+		}
+		
+		fifo_reader_init(&ch->reader, &ch->fifo, 0);
+		
+		if(pthread_create(&ch->thread, NULL, &_channel_thread, ch) != 0)
+		{
+			fprintf(stderr, "Error starting channel thread.\n");
+			fifo_reader_close(&ch->reader);
+			fifo_free(&ch->fifo);
+			vid_free(&ch->vid);
+			_mixer_free(m);
+			return(-1);
+		}
+		
+		m->nchannels++;
+	}
+	
+	return(0);
+}
+
+/* Mix the channels into a copy of the main channel's line */
+static const int16_t *_mixer_mix(_mixer_t *m, const vid_line_t *line)
+{
+	size_t n = line->width * 2;
+	int16_t *src;
+	size_t l, r;
+	int i;
+	
+	if(n > m->length)
+	{
+		int16_t *mix = realloc(m->mix, sizeof(int16_t) * n);
+		if(!mix) return(NULL);
+		
+		m->mix = mix;
+		m->length = n;
+	}
+	
+	memset(m->mix, 0, sizeof(int16_t) * n);
+	conv_int16_mix(m->mix, line->output, n, m->scale);
+	
+	for(i = 0; i < m->nchannels; i++)
+	{
+		_channel_t *ch = &m->channels[i];
+		
+		for(r = 0; r < n && !ch->eof; r += l)
+		{
+			l = fifo_read(&ch->reader, (void **) &src, (n - r) * sizeof(int16_t), 1);
+			
+			if(l == -1)
+			{
+				ch->eof = 1;
+				break;
+			}
+			
+			l /= sizeof(int16_t);
+			conv_int16_mix(&m->mix[r], src, l, m->scale);
+		}
+	}
+	
+	return(m->mix);
 }
 
 enum {
@@ -368,6 +1621,12 @@ enum {
 	_OPT_VITS,
 	_OPT_VITC,
 	_OPT_FILTER,
+	_OPT_THREADS,
+	_OPT_SHARDS,
+	_OPT_SHARD_FRAMES,
+	_OPT_YUV_MODE,
+	_OPT_SUBCARRIER_MODE,
+	_OPT_FRAME_CACHE,
 	_OPT_NOCOLOUR,
 	_OPT_S_VIDEO,
 	_OPT_VOLUME,
@@ -403,6 +1662,9 @@ enum {
 	_OPT_SECAM_FIELD_ID_LINES,
 	_OPT_FFMT,
 	_OPT_FOPTS,
+	_OPT_SCALER,
+	_OPT_SCALER_THREADS,
+	_OPT_VIDEO_BUFFERS,
 	_OPT_PIXELRATE,
 	_OPT_LIST_MODES,
 	_OPT_JSON,
@@ -413,6 +1675,12 @@ enum {
 	_OPT_LETTERBOX,
 	_OPT_PILLARBOX,
 	_OPT_FL2K_AUDIO,
+	_OPT_FILE_WRITER,
+	_OPT_FILE_BUFFER,
+	_OPT_FILE_INDEX,
+	_OPT_STATS,
+	_OPT_CHANNEL,
+	_OPT_MIX_HEADROOM,
 	_OPT_VERSION,
 };
 
@@ -438,6 +1706,9 @@ int main(int argc, char *argv[])
 		{ "repeat",         no_argument,       0, 'r' },
 		{ "shuffle",        no_argument,       0, _OPT_SHUFFLE },
 		{ "verbose",        no_argument,       0, 'v' },
+		{ "stats",          required_argument, 0, _OPT_STATS },
+		{ "channel",        required_argument, 0, _OPT_CHANNEL },
+		{ "mix-headroom",   required_argument, 0, _OPT_MIX_HEADROOM },
 		{ "teletext",       required_argument, 0, _OPT_TELETEXT },
 		{ "wss",            required_argument, 0, _OPT_WSS },
 		{ "videocrypt",     required_argument, 0, _OPT_VIDEOCRYPT },
@@ -449,6 +1720,12 @@ int main(int argc, char *argv[])
 		{ "vits",           no_argument,       0, _OPT_VITS },
 		{ "vitc",           no_argument,       0, _OPT_VITC },
 		{ "filter",         no_argument,       0, _OPT_FILTER },
+		{ "threads",        required_argument, 0, _OPT_THREADS },
+		{ "shards",         required_argument, 0, _OPT_SHARDS },
+		{ "shard-frames",   required_argument, 0, _OPT_SHARD_FRAMES },
+		{ "yuv-mode",       required_argument, 0, _OPT_YUV_MODE },
+		{ "subcarrier-mode", required_argument, 0, _OPT_SUBCARRIER_MODE },
+		{ "frame-cache",    no_argument,       0, _OPT_FRAME_CACHE },
 		{ "nocolour",       no_argument,       0, _OPT_NOCOLOUR },
 		{ "nocolor",        no_argument,       0, _OPT_NOCOLOUR },
 		{ "s-video",        no_argument,       0, _OPT_S_VIDEO },
@@ -487,11 +1764,17 @@ int main(int argc, char *argv[])
 		{ "json",           no_argument,       0, _OPT_JSON },
 		{ "ffmt",           required_argument, 0, _OPT_FFMT },
 		{ "fopts",          required_argument, 0, _OPT_FOPTS },
+		{ "scaler",         required_argument, 0, _OPT_SCALER },
+		{ "scaler-threads", required_argument, 0, _OPT_SCALER_THREADS },
+		{ "video-buffers",  required_argument, 0, _OPT_VIDEO_BUFFERS },
 		{ "frequency",      required_argument, 0, 'f' },
 		{ "amp",            no_argument,       0, 'a' },
 		{ "gain",           required_argument, 0, 'g' },
 		{ "antenna",        required_argument, 0, 'A' },
 		{ "type",           required_argument, 0, 't' },
+		{ "file-writer",    required_argument, 0, _OPT_FILE_WRITER },
+		{ "file-buffer",    required_argument, 0, _OPT_FILE_BUFFER },
+		{ "file-index",     required_argument, 0, _OPT_FILE_INDEX },
 		{ "fl2k-audio",     required_argument, 0, _OPT_FL2K_AUDIO },
 		{ "version",        no_argument,       0, _OPT_VERSION },
 		{ 0,                0,                 0,  0  }
@@ -499,8 +1782,8 @@ int main(int argc, char *argv[])
 	static hacktv_t s;
 	const vid_configs_t *vid_confs;
 	vid_config_t vid_conf;
+	_mixer_t mixer;
 	char *pre, *sub;
-	int l;
 	int r;
 	
 	/* Disable console output buffer in Windows */
@@ -523,9 +1806,16 @@ int main(int argc, char *argv[])
 	s.gamma = -1;
 	s.interlace = 0;
 	s.fit_mode = AV_FIT_STRETCH;
+	s.scaler = AV_SCALER_BICUBIC;
+	s.scaler_threads = 0;
+	s.video_buffers = AV_DEFAULT_VIDEO_BUFFERS;
 	s.repeat = 0;
 	s.shuffle = 0;
 	s.verbose = 0;
+	s.stats = NULL;
+	s.channels = NULL;
+	s.nchannels = 0;
+	s.mix_headroom = 0;
 	s.teletext = NULL;
 	s.wss = NULL;
 	s.videocrypt = NULL;
@@ -537,6 +1827,12 @@ int main(int argc, char *argv[])
 	s.vits = 0;
 	s.vitc = 0;
 	s.filter = 0;
+	s.threads = 0;
+	s.shards = 0;
+	s.shard_frames = 250;
+	s.yuv_mode = VID_YUV_AUTO;
+	s.subcarrier_mode = VID_SUBCARRIER_TABLE;
+	s.frame_cache = 0;
 	s.nocolour = 0;
 	s.volume = 1.0;
 	s.noaudio = 0;
@@ -554,6 +1850,9 @@ int main(int argc, char *argv[])
 	s.gain = 0;
 	s.antenna = NULL;
 	s.file_type = RF_INT16;
+	s.file_writer = RF_FILE_STDIO;
+	s.file_buffer = 0;
+	s.file_index = NULL;
 	s.raw_bb_blanking_level = 0;
 	s.raw_bb_white_level = INT16_MAX;
 	s.fl2k_audio = FL2K_AUDIO_NONE;
@@ -597,6 +1896,11 @@ int main(int argc, char *argv[])
 				s.output_type = "fl2k";
 				s.output = sub;
 			}
+			else if(strcmp(pre, "sigmf") == 0)
+			{
+				s.output_type = "sigmf";
+				s.output = sub;
+			}
 			else
 			{
 				/* Unrecognised output type, default to file */
@@ -707,6 +2011,48 @@ int main(int argc, char *argv[])
 			s.verbose = 1;
 			break;
 		
+		case _OPT_STATS: /* --stats <file> */
+			s.stats = optarg;
+			break;
+		
+		case _OPT_CHANNEL: /* --channel <offset>:<mode>:<input> */
+			{
+				hacktv_channel_t *ch;
+				char *mode, *input;
+				
+				/* The input may contain further colons */
+				mode = strchr(optarg, ':');
+				input = mode ? strchr(mode + 1, ':') : NULL;
+				
+				if(input == NULL)
+				{
+					fprintf(stderr, "Invalid channel '%s'. Expected <offset>:<mode>:<input>\n", optarg);
+					return(-1);
+				}
+				
+				*mode++ = '\0';
+				*input++ = '\0';
+				
+				ch = realloc(s.channels, sizeof(hacktv_channel_t) * (s.nchannels + 1));
+				if(!ch)
+				{
+					perror("realloc");
+					return(-1);
+				}
+				
+				s.channels = ch;
+				ch = &s.channels[s.nchannels++];
+				ch->offset = (int64_t) strtod(optarg, NULL);
+				ch->mode = mode;
+				ch->input = input;
+			}
+			
+			break;
+		
+		case _OPT_MIX_HEADROOM: /* --mix-headroom <dB> */
+			s.mix_headroom = atof(optarg);
+			break;
+		
 		case _OPT_TELETEXT: /* --teletext <path> */
 			s.teletext = optarg;
 			break;
@@ -751,6 +2097,54 @@ int main(int argc, char *argv[])
 			s.filter = 1;
 			break;
 		
+		case _OPT_THREADS: /* --threads <n> */
+			s.threads = atoi(optarg);
+			break;
+		
+		case _OPT_SHARDS: /* --shards <n> */
+			s.shards = atoi(optarg);
+			break;
+		
+		case _OPT_SHARD_FRAMES: /* --shard-frames <n> */
+			s.shard_frames = atoi(optarg);
+			
+			if(s.shard_frames < 1)
+			{
+				fprintf(stderr, "Invalid segment length.\n");
+				return(-1);
+			}
+			
+			break;
+		
+		case _OPT_YUV_MODE: /* --yuv-mode <mode> */
+			
+			if(strcmp(optarg, "auto") == 0) s.yuv_mode = VID_YUV_AUTO;
+			else if(strcmp(optarg, "table") == 0) s.yuv_mode = VID_YUV_TABLE;
+			else if(strcmp(optarg, "matrix") == 0) s.yuv_mode = VID_YUV_MATRIX;
+			else
+			{
+				fprintf(stderr, "Unrecognised YUV mode '%s'.\n", optarg);
+				return(-1);
+			}
+			
+			break;
+		
+		case _OPT_SUBCARRIER_MODE: /* --subcarrier-mode <mode> */
+			
+			if(strcmp(optarg, "table") == 0) s.subcarrier_mode = VID_SUBCARRIER_TABLE;
+			else if(strcmp(optarg, "line") == 0) s.subcarrier_mode = VID_SUBCARRIER_LINE;
+			else
+			{
+				fprintf(stderr, "Unrecognised subcarrier mode '%s'.\n", optarg);
+				return(-1);
+			}
+			
+			break;
+		
+		case _OPT_FRAME_CACHE: /* --frame-cache */
+			s.frame_cache = 1;
+			break;
+		
 		case _OPT_NOCOLOUR: /* --nocolour / --nocolor */
 			s.nocolour = 1;
 			break;
@@ -930,6 +2324,45 @@ int main(int argc, char *argv[])
 			s.fopts = optarg;
 			break;
 		
+		case _OPT_SCALER: /* --scaler <algorithm> */
+			
+			if(strcmp(optarg, "point") == 0) s.scaler = AV_SCALER_POINT;
+			else if(strcmp(optarg, "fast-bilinear") == 0) s.scaler = AV_SCALER_FAST_BILINEAR;
+			else if(strcmp(optarg, "bilinear") == 0) s.scaler = AV_SCALER_BILINEAR;
+			else if(strcmp(optarg, "bicubic") == 0) s.scaler = AV_SCALER_BICUBIC;
+			else if(strcmp(optarg, "lanczos") == 0) s.scaler = AV_SCALER_LANCZOS;
+			else
+			{
+				fprintf(stderr, "Unrecognised scaler '%s'.\n", optarg);
+				return(-1);
+			}
+			
+			break;
+		
+		case _OPT_SCALER_THREADS: /* --scaler-threads <n> */
+			
+			s.scaler_threads = strtol(optarg, NULL, 0);
+			
+			if(s.scaler_threads < 0)
+			{
+				fprintf(stderr, "Invalid number of scaler threads.\n");
+				return(-1);
+			}
+			
+			break;
+		
+		case _OPT_VIDEO_BUFFERS: /* --video-buffers <n> */
+			
+			s.video_buffers = strtol(optarg, NULL, 0);
+			
+			if(s.video_buffers < 1)
+			{
+				fprintf(stderr, "At least one video buffer is required.\n");
+				return(-1);
+			}
+			
+			break;
+		
 		case 'f': /* -f, --frequency <value> */
 			s.frequency = (uint64_t) strtod(optarg, NULL);
 			break;
@@ -980,6 +2413,43 @@ int main(int argc, char *argv[])
 			
 			break;
 		
+		case _OPT_FILE_WRITER: /* --file-writer <writer> */
+			
+			if(strcmp(optarg, "stdio") == 0) s.file_writer = RF_FILE_STDIO;
+			else if(strcmp(optarg, "thread") == 0) s.file_writer = RF_FILE_THREAD;
+			else if(strcmp(optarg, "direct") == 0) s.file_writer = RF_FILE_DIRECT;
+			else if(strcmp(optarg, "mmap") == 0) s.file_writer = RF_FILE_MMAP;
+			else
+			{
+				fprintf(stderr, "Unrecognised file writer.\n");
+				return(-1);
+			}
+			
+			break;
+		
+		case _OPT_FILE_BUFFER: /* --file-buffer <bytes> */
+			{
+				char *end;
+				
+				s.file_buffer = strtoull(optarg, &end, 10);
+				
+				if(*end == 'K' || *end == 'k') { s.file_buffer <<= 10; end++; }
+				else if(*end == 'M' || *end == 'm') { s.file_buffer <<= 20; end++; }
+				else if(*end == 'G' || *end == 'g') { s.file_buffer <<= 30; end++; }
+				
+				if(*end != '\0' || s.file_buffer < 1)
+				{
+					fprintf(stderr, "Invalid file buffer size.\n");
+					return(-1);
+				}
+			}
+			
+			break;
+		
+		case _OPT_FILE_INDEX: /* --file-index <filename> */
+			s.file_index = optarg;
+			break;
+		
 		case _OPT_FL2K_AUDIO: /* --fl2k-audio <mode> */
 			
 			if(strcmp(optarg, "none") == 0)
@@ -1056,281 +2526,105 @@ int main(int argc, char *argv[])
 	
 	memcpy(&vid_conf, vid_confs->conf, sizeof(vid_config_t));
 	
-	if(s.deviation > 0)
-	{
-		/* Override the FM deviation value */
-		vid_conf.fm_deviation = s.deviation;
-	}
-	
-	if(s.gamma > 0)
-	{
-		/* Override the gamma value */
-		vid_conf.gamma = s.gamma;
-	}
-	
-	if(s.interlace)
-	{
-		vid_conf.interlace = 1;
-	}
-	
-	if(s.nocolour)
-	{
-		if(vid_conf.colour_mode == VID_PAL ||
-		   vid_conf.colour_mode == VID_SECAM ||
-		   vid_conf.colour_mode == VID_NTSC)
-		{
-			vid_conf.colour_mode = VID_NONE;
-		}
-	}
-	
-	if(s.s_video)
-	{
-		if((vid_conf.colour_mode != VID_PAL &&
-		   vid_conf.colour_mode != VID_SECAM &&
-		   vid_conf.colour_mode != VID_NTSC) ||
-		   vid_conf.output_type != RF_INT16_REAL)
-		{
-			fprintf(stderr, "S-Video is only available with PAL, SECAM, or NTSC baseband modes.\n");
-			return(-1);
-		}
-		
-		vid_conf.s_video = 1;
-	}
-	
-	if(s.noaudio > 0)
-	{
-		/* Disable all audio sub-carriers */
-		vid_conf.fm_mono_level = 0;
-		vid_conf.fm_left_level = 0;
-		vid_conf.fm_right_level = 0;
-		vid_conf.am_audio_level = 0;
-		vid_conf.nicam_level = 0;
-		vid_conf.dance_level = 0;
-		vid_conf.fm_mono_carrier = 0;
-		vid_conf.fm_left_carrier = 0;
-		vid_conf.fm_right_carrier = 0;
-		vid_conf.nicam_carrier = 0;
-		vid_conf.dance_carrier = 0;
-		vid_conf.am_mono_carrier = 0;
-	}
-	
-	if(s.nonicam > 0)
-	{
-		/* Disable the NICAM sub-carrier */
-		vid_conf.nicam_level = 0;
-		vid_conf.nicam_carrier = 0;
-	}
-	
-	if(s.a2stereo > 0)
+	if(_apply_options(&s, &vid_conf) != 0)
 	{
-		vid_conf.a2stereo = 1;
+		return(-1);
 	}
 	
-	vid_conf.scramble_video = s.scramble_video;
-	vid_conf.scramble_audio = s.scramble_audio;
-	
-	vid_conf.level *= s.level;
-	
-	if(s.teletext)
-	{
-		if(vid_conf.lines != 625)
-		{
-			fprintf(stderr, "Teletext is only available with 625 line modes.\n");
-			return(-1);
-		}
-		
-		vid_conf.teletext = s.teletext;
-	}
+	/* These options only apply to the main channel */
+	vid_conf.profile = s.stats != NULL;
+	vid_conf.offset = s.offset;
+	vid_conf.passthru = s.passthru;
+	vid_conf.raw_bb_file = s.raw_bb_file;
+	vid_conf.raw_bb_blanking_level = s.raw_bb_blanking_level;
+	vid_conf.raw_bb_white_level = s.raw_bb_white_level;
 	
-	if(s.wss)
+	/* Setup video encoder */
+	r = vid_init(&s.vid, s.samplerate, s.pixelrate, &vid_conf);
+	if(r != VID_OK)
 	{
-		if(vid_conf.type != VID_RASTER_625)
-		{
-			fprintf(stderr, "WSS is only supported for 625 line raster modes.\n");
-			return(-1);
-		}
-		
-		vid_conf.wss = s.wss;
+		fprintf(stderr, "Unable to initialise video encoder.\n");
+		return(-1);
 	}
 	
-	if(s.videocrypt)
-	{
-		if(vid_conf.lines != 625 && vid_conf.colour_mode != VID_PAL)
-		{
-			fprintf(stderr, "Videocrypt I is only compatible with 625 line PAL modes.\n");
-			return(-1);
-		}
-		
-		vid_conf.videocrypt = s.videocrypt;
-	}
+	vid_info(&s.vid);
 	
-	if(s.videocrypt2)
+	if(s.nchannels > 0 && vid_conf.output_type != RF_INT16_COMPLEX)
 	{
-		if(vid_conf.lines != 625 && vid_conf.colour_mode != VID_PAL)
-		{
-			fprintf(stderr, "Videocrypt II is only compatible with 625 line PAL modes.\n");
-			return(-1);
-		}
-		
-		/* Only allow both VC1 and VC2 if both are in free-access mode */
-		if(s.videocrypt && !(strcmp(s.videocrypt, "free") == 0 && strcmp(s.videocrypt2, "free") == 0))
-		{
-			fprintf(stderr, "Videocrypt I and II cannot be used together except in free-access mode.\n");
-			return(-1);
-		}
-		
-		vid_conf.videocrypt2 = s.videocrypt2;
+		fprintf(stderr, "Additional channels are only available with complex modes.\n");
+		vid_free(&s.vid);
+		return(-1);
 	}
 	
-	if(s.videocrypts)
+	if(s.shards > 0)
 	{
-		if(vid_conf.lines != 625 && vid_conf.colour_mode != VID_PAL)
-		{
-			fprintf(stderr, "Videocrypt S is only compatible with 625 line PAL modes.\n");
-			return(-1);
-		}
-		
-		if(s.videocrypt || s.videocrypt2)
+		if(s.stats)
 		{
-			fprintf(stderr, "Using multiple scrambling modes is not supported.\n");
+			fprintf(stderr, "Timing statistics are not available with sharded rendering.\n");
+			vid_free(&s.vid);
 			return(-1);
 		}
 		
-		vid_conf.videocrypts = s.videocrypts;
-	}
-	
-	if(s.syster)
-	{
-		if(vid_conf.lines != 625 && vid_conf.colour_mode != VID_PAL)
+		if(s.file_index)
 		{
-			fprintf(stderr, "Nagravision Syster is only compatible with 625 line PAL modes.\n");
+			fprintf(stderr, "A frame index is not available with sharded rendering.\n");
+			vid_free(&s.vid);
 			return(-1);
 		}
 		
-		if(vid_conf.videocrypt || vid_conf.videocrypt2 || vid_conf.videocrypts)
+		if(s.nchannels > 0)
 		{
-			fprintf(stderr, "Using multiple scrambling modes is not supported.\n");
+			fprintf(stderr, "Additional channels are not available with sharded rendering.\n");
+			vid_free(&s.vid);
 			return(-1);
 		}
 		
-		vid_conf.syster = 1;
-		vid_conf.systeraudio = s.systeraudio;
-	}
-	
-	if(s.eurocrypt)
-	{
-		if(vid_conf.type != VID_MAC)
+		if(strcmp(s.output_type, "file") != 0 || s.output == NULL || strcmp(s.output, "-") == 0)
 		{
-			fprintf(stderr, "Eurocrypt is only compatible with D/D2-MAC modes.\n");
+			fprintf(stderr, "Sharded rendering requires a file output.\n");
+			vid_free(&s.vid);
 			return(-1);
 		}
 		
-		if(vid_conf.scramble_video == 0)
-		{
-			/* Default to single-cut scrambling if none was specified */
-			vid_conf.scramble_video = 1;
-		}
-		
-		vid_conf.eurocrypt = s.eurocrypt;
-	}
-	
-	if(s.acp)
-	{
-		if(vid_conf.lines != 625 && vid_conf.lines != 525)
+		if(argc - optind != 1 || s.repeat || s.shuffle)
 		{
-			fprintf(stderr, "Analogue Copy Protection is only compatible with 525 and 625 line modes.\n");
+			fprintf(stderr, "Sharded rendering requires a single input.\n");
+			vid_free(&s.vid);
 			return(-1);
 		}
 		
-		if(vid_conf.videocrypt || vid_conf.videocrypt2 || vid_conf.videocrypts || vid_conf.syster)
+		if(!vid_seekable(&s.vid))
 		{
-			fprintf(stderr, "Analogue Copy Protection cannot be used with video scrambling enabled.\n");
+			fprintf(stderr, "This mode cannot be rendered in segments. MAC, SiS, raw baseband\n"
+			                "and passthru input require a serial render.\n");
+			vid_free(&s.vid);
 			return(-1);
 		}
 		
-		vid_conf.acp = 1;
-	}
-	
-	if(s.vits)
-	{
-		if(vid_conf.type != VID_RASTER_625 &&
-		   vid_conf.type != VID_RASTER_525)
+		if(s.vid.conf.modulation == VID_FM && s.vid.conf.output_type != RF_INT16_COMPLEX)
 		{
-			fprintf(stderr, "VITS is only currently supported for 625 and 525 line raster modes.\n");
+			fprintf(stderr, "FM video can only be rendered in segments with a complex output.\n");
+			vid_free(&s.vid);
 			return(-1);
 		}
 		
-		vid_conf.vits = 1;
-	}
-	
-	if(s.vitc)
-	{
-		if(vid_conf.type != VID_RASTER_625 &&
-		   vid_conf.type != VID_RASTER_525)
-		{
-			fprintf(stderr, "VITC is only currently supported for 625 and 525 line raster modes.\n");
-			return(-1);
-		}
+		av_ffmpeg_init();
 		
-		vid_conf.vitc = 1;
-	}
-	
-	if(vid_conf.type == VID_MAC)
-	{
-		if(s.chid >= 0)
-		{
-			vid_conf.chid = (uint16_t) s.chid;
-		}
+		r = _render_shards(&s, &vid_conf, argv[optind]);
 		
-		vid_conf.mac_audio_stereo = s.mac_audio_stereo;
-		vid_conf.mac_audio_quality = s.mac_audio_quality;
-		vid_conf.mac_audio_protection = s.mac_audio_protection;
-		vid_conf.mac_audio_companded = s.mac_audio_companded;
-	}
-	
-	if(s.filter)
-	{
-		vid_conf.vfilter = 1;
-	}
-	
-	if(s.sis)
-	{
-		if(vid_conf.lines != 625)
-		{
-			fprintf(stderr, "SiS is only available with 625 line modes.\n");
-			return(-1);
-		}
+		vid_free(&s.vid);
+		av_ffmpeg_deinit();
 		
-		vid_conf.sis = s.sis;
+		return(r);
 	}
 	
-	vid_conf.swap_iq = s.swap_iq;
-	vid_conf.offset = s.offset;
-	vid_conf.passthru = s.passthru;
-	vid_conf.volume = s.volume * 256 + 0.5;
-	vid_conf.invert_video = s.invert_video;
-	vid_conf.raw_bb_file = s.raw_bb_file;
-	vid_conf.raw_bb_blanking_level = s.raw_bb_blanking_level;
-	vid_conf.raw_bb_white_level = s.raw_bb_white_level;
-	vid_conf.secam_field_id = s.secam_field_id;
-	vid_conf.secam_field_id_lines = s.secam_field_id_lines;
-
-	vid_conf.testsignal_type = s.testsignal_type;
-	vid_conf.testsignal_clock_mode = s.testsignal_clock_mode;
-	strcpy(vid_conf.testsignals_path, s.testsignals_path);
-	strcpy(vid_conf.testsignal_text1, s.testsignal_text1);
-	strcpy(vid_conf.testsignal_text2, s.testsignal_text2);
-	
-	/* Setup video encoder */
-	r = vid_init(&s.vid, s.samplerate, s.pixelrate, &vid_conf);
-	if(r != VID_OK)
+	if(s.file_index && strcmp(s.output_type, "file") != 0)
 	{
-		fprintf(stderr, "Unable to initialise video encoder.\n");
+		fprintf(stderr, "A frame index requires a file output.\n");
+		vid_free(&s.vid);
 		return(-1);
 	}
 	
-	vid_info(&s.vid);
-	
 	if(strcmp(s.output_type, "hackrf") == 0)
 	{
 #ifdef HAVE_HACKRF
@@ -1375,7 +2669,34 @@ int main(int argc, char *argv[])
 	}
 	else if(strcmp(s.output_type, "file") == 0)
 	{
-		if(rf_file_open(&s.rf, s.output, s.file_type, s.vid.conf.output_type == RF_INT16_COMPLEX || s.vid.conf.s_video) != RF_OK)
+		if(rf_file_open(&s.rf, s.output, s.file_type, s.vid.conf.output_type == RF_INT16_COMPLEX || s.vid.conf.s_video, s.file_writer, s.file_buffer) != RF_OK)
+		{
+			vid_free(&s.vid);
+			return(-1);
+		}
+		
+		if(s.file_index != NULL)
+		{
+			r64_t pts_rate = {
+				s.vid.conf.frame_rate.num * (s.vid.conf.interlace ? 2 : 1),
+				s.vid.conf.frame_rate.den
+			};
+			
+			if(rf_file_index(&s.rf, s.file_index, s.vid.conf.hline > 0 ? 2 : 1, s.vid.sample_rate, s.vid.conf.frame_rate, pts_rate) != RF_OK)
+			{
+				rf_close(&s.rf);
+				vid_free(&s.vid);
+				return(-1);
+			}
+		}
+	}
+	else if(strcmp(s.output_type, "sigmf") == 0)
+	{
+		char desc[256];
+		
+		snprintf(desc, sizeof(desc), "%s: %s", vid_confs->id, vid_confs->desc ? vid_confs->desc : "");
+		
+		if(rf_sigmf_open(&s.rf, s.output, s.file_type, s.vid.conf.output_type == RF_INT16_COMPLEX || s.vid.conf.s_video, s.file_writer, s.file_buffer, s.vid.sample_rate, s.frequency, desc) != RF_OK)
 		{
 			vid_free(&s.vid);
 			return(-1);
@@ -1384,106 +2705,111 @@ int main(int argc, char *argv[])
 	
 	av_ffmpeg_init();
 	
-	/* Configure AV source settings */
-	s.vid.av = (av_t) {
-		.frame_rate = (r64_t) {
-			.num = s.vid.conf.frame_rate.num * (s.vid.conf.interlace ? 2 : 1),
-			.den = s.vid.conf.frame_rate.den,
-		},
-		.display_aspect_ratios = {
-			s.vid.conf.frame_aspects[0],
-			s.vid.conf.frame_aspects[1]
-		},
-		.fit_mode = s.fit_mode,
-		.min_display_aspect_ratio = s.min_aspect,
-		.max_display_aspect_ratio = s.max_aspect,
-		.width = s.vid.active_width,
-		.height = s.vid.conf.active_lines,
-		.sample_rate = (r64_t) { HACKTV_AUDIO_SAMPLE_RATE, 1 },
-	};
+	_configure_av(&s, &s.vid);
 	
-	if((s.vid.conf.frame_orientation & 3) == VID_ROTATE_90 ||
-	   (s.vid.conf.frame_orientation & 3) == VID_ROTATE_270)
+	if(s.nchannels > 0 && _mixer_init(&s, &mixer) != 0)
 	{
-		/* Flip dimensions if the lines are scanned vertically */
-		s.vid.av.width = s.vid.conf.active_lines;
-		s.vid.av.height = s.vid.active_width;
+		rf_close(&s.rf);
+		vid_free(&s.vid);
+		av_ffmpeg_deinit();
+		return(-1);
 	}
 	
-	do
+	prof_init(&s.prof_rf, "rf_write");
+	s.stats_start = prof_now();
+	s.stats_next = s.stats_start + _STATS_INTERVAL;
+	
+	/* The sources share the settings of the video's av_t */
+	s.next_av = s.vid.av;
+	
+	c = optind;
+	if(s.shuffle) _shuffle_inputs(optind, argc, argv);
+	_open_next(&s, argv[c]);
+	
+	while(s.next_input != NULL && !_abort)
 	{
-		if(s.shuffle)
+		r = _take_next(&s, &s.vid.av);
+		
+		/* Start opening the input that follows this one */
+		if(++c == argc && s.repeat)
 		{
-			/* Shuffle the input source list */
-			/* Avoids moving the last entry to the start
-			 * to prevent it repeating immediately */
-			for(c = optind; c < argc - 1; c++)
-			{
-				l = c + (rand() % (argc - c - (c == optind ? 1 : 0)));
-				pre = argv[c];
-				argv[c] = argv[l];
-				argv[l] = pre;
-			}
+			c = optind;
+			if(s.shuffle) _shuffle_inputs(optind, argc, argv);
 		}
 		
-		for(c = optind; c < argc && !_abort; c++)
+		_open_next(&s, c < argc ? argv[c] : NULL);
+		
+		if(r != AV_OK)
 		{
-			/* Get a pointer to the output prefix and target */
-			pre = argv[c];
-			sub = strchr(pre, ':');
+			/* Error opening this source. Move to the next */
+			continue;
+		}
+		
+		while(!_abort)
+		{
+			vid_line_t *line = vid_next_line(&s.vid);
+			const int16_t *output;
 			
-			if(sub != NULL)
-			{
-				l = sub - pre;
-				sub++;
-			}
-			else
-			{
-				l = strlen(pre);
-			}
+			if(line == NULL) break;
 			
-			if(strncmp(pre, "test", l) == 0)
-			{
-				r = av_test_open(&s.vid.av);
-			}
-			else if(strncmp(pre, "ffmpeg", l) == 0)
-			{
-				r = av_ffmpeg_open(&s.vid.av, sub, s.ffmt, s.fopts);
-			}
-			else
+			output = line->output;
+			
+			if(s.nchannels > 0 && (output = _mixer_mix(&mixer, line)) == NULL)
 			{
-				r = av_ffmpeg_open(&s.vid.av, pre, s.ffmt, s.fopts);
+				break;
 			}
 			
-			if(r != AV_OK)
+			/* Mark the start of each frame, or each field of interlaced modes */
+			if(line->line == 1 || line->line == s.vid.conf.hline)
 			{
-				/* Error opening this source. Move to the next */
-				continue;
+				if(rf_field(&s.rf, line->frame, s.vid.conf.hline > 0 ? (line->line == 1 ? 1 : 2) : 0, line->line, line->pts) != RF_OK) break;
 			}
 			
-			while(!_abort)
+			if(s.stats)
 			{
-				vid_line_t *line = vid_next_line(&s.vid);
+				uint64_t t = prof_now();
 				
-				if(line == NULL) break;
+				r = rf_write(&s.rf, output, line->width);
+				prof_add(&s.prof_rf, prof_now() - t);
 				
-				if(rf_write(&s.rf, line->output, line->width) != RF_OK) break;
-				if(line->audio_len && rf_write_audio(&s.rf, line->audio, line->audio_len) != RF_OK) break;
-			}
-			
-			if(_signal)
-			{
-				fprintf(stderr, "Caught signal %d\n", _signal);
-				_signal = 0;
+				if(t >= s.stats_next)
+				{
+					_write_stats(&s);
+					s.stats_next = t + _STATS_INTERVAL;
+				}
+				
+				if(r != RF_OK) break;
 			}
+			else if(rf_write(&s.rf, output, line->width) != RF_OK) break;
 			
-			av_close(&s.vid.av);
+			if(line->audio_len && rf_write_audio(&s.rf, line->audio, line->audio_len) != RF_OK) break;
+		}
+		
+		if(_signal)
+		{
+			fprintf(stderr, "Caught signal %d\n", _signal);
+			_signal = 0;
 		}
+		
+		vid_pause(&s.vid);
+		av_close(&s.vid.av);
+	}
+	
+	_close_next(&s);
+	
+	if(s.nchannels > 0)
+	{
+		_mixer_free(&mixer);
+	}
+	
+	if(s.stats)
+	{
+		_write_stats(&s);
 	}
-	while(s.repeat && !_abort);
 	
 	rf_close(&s.rf);
 	vid_free(&s.vid);
+	free(s.channels);
 	
 	av_ffmpeg_deinit();
 	
@@ -30,6 +30,13 @@
 /* Standard audio sample rate */
 #define HACKTV_AUDIO_SAMPLE_RATE 32000
 
+/* An additional channel, mixed into the output of the main channel */
+typedef struct {
+	int64_t offset;
+	char *mode;
+	char *input;
+} hacktv_channel_t;
+
 /* Program state */
 typedef struct {
 	
@@ -61,6 +68,12 @@ typedef struct {
 	int vits;
 	int vitc;
 	int filter;
+	int threads;
+	int shards;
+	int shard_frames;
+	int yuv_mode;
+	int subcarrier_mode;
+	int frame_cache;
 	int nocolour;
 	int s_video;
 	float volume;
@@ -74,6 +87,9 @@ typedef struct {
 	int gain;
 	char *antenna;
 	int file_type;
+	int file_writer;
+	size_t file_buffer;
+	char *file_index;
 	int chid;
 	int mac_audio_stereo;
 	int mac_audio_quality;
@@ -98,10 +114,30 @@ typedef struct {
 	int json;
 	char *ffmt;
 	char *fopts;
+	av_scaler_t scaler;
+	int scaler_threads;
+	int video_buffers;
 	int fl2k_audio;
+	char *stats;
+	hacktv_channel_t *channels;
+	int nchannels;
+	float mix_headroom;
+	
+	/* Timing statistics */
+	uint64_t stats_start;
+	uint64_t stats_next;
+	prof_t prof_rf;
+	
 	/* Video encoder state */
 	vid_t vid;
 	
+	/* The next input, opened in the background */
+	char *next_input;
+	pthread_t next_thread;
+	int next_running;
+	int next_r;
+	av_t next_av;
+	
 	/* RF sink interface */
 	rf_t rf;
 	
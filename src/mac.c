@@ -1769,8 +1769,6 @@ int mac_next_line(vid_t *s, void *arg, int nlines, vid_line_t **lines)
 	if(y >= 0)
 	{
 		uint32_t rgb = 0x000000;
-		uint32_t *px = &rgb;
-		int stride = 0;
 		
 		/* Centre the video vertically */
 		vy = y - s->vframe_y;
@@ -1778,25 +1776,24 @@ int mac_next_line(vid_t *s, void *arg, int nlines, vid_line_t **lines)
 		/* Check for out of bounds */
 		if(vy < 0 || vy >= s->vframe.height) vy = -1;
 		
-		if(vy >= 0 && s->vframe.framebuffer != NULL)
+		for(x = s->active_left; x < s->active_left + s->vframe_x; x++)
 		{
-			px = &s->vframe.framebuffer[vy * s->vframe.line_stride];
-			stride = s->vframe.pixel_stride;
+			l->output[x * 2] = s->yuv_black.y;
 		}
 		
-		for(x = s->active_left; x < s->active_left + s->vframe_x; x++)
+		if(vy >= 0 && !av_frame_empty(&s->vframe))
 		{
-			l->output[x * 2] = s->yuv_level_lookup[0x000000].y;
+			vid_frame_to_yuv(s, &l->output[x * 2], NULL, NULL, 2, 0, vy, 1, s->vframe.width);
 		}
-		
-		for(; x < s->active_left + s->vframe_x + s->vframe.width; x++, px += stride)
+		else
 		{
-			l->output[x * 2] = s->yuv_level_lookup[*px & 0xFFFFFF].y;
+			vid_rgb_to_yuv(s, &l->output[x * 2], NULL, NULL, 2, &rgb, 0, s->vframe.width);
 		}
+		x += s->vframe.width;
 		
 		for(; x < s->active_left + s->active_width; x++)
 		{
-			l->output[x * 2] = s->yuv_level_lookup[0x000000].y;
+			l->output[x * 2] = s->yuv_black.y;
 		}
 	}
 	
@@ -1806,18 +1803,30 @@ int mac_next_line(vid_t *s, void *arg, int nlines, vid_line_t **lines)
 	if(vy >= 0)
 	{
 		uint32_t rgb = 0x000000;
-		uint32_t *px = &rgb;
-		int stride = 0;
+		int16_t c[64];
+		int i, n, w, vx;
 		
-		if(s->vframe.framebuffer != NULL)
-		{
-			px = &s->vframe.framebuffer[vy * s->vframe.line_stride];
-			stride = s->vframe.pixel_stride * 2;
-		}
+		/* Convert in blocks, the chrominance is added to the luminance */
+		x = s->mac.chrominance_left + s->vframe_x / 2;
+		w = s->mac.chrominance_left + (s->vframe_x + s->vframe.width) / 2;
 		
-		for(x = s->mac.chrominance_left + s->vframe_x / 2; x < s->mac.chrominance_left + (s->vframe_x + s->vframe.width) / 2; x++, px += stride)
+		for(vx = 0; x < w; x += n, vx += n * 2)
 		{
-			l->output[x * 2] += (l->line & 1 ? s->yuv_level_lookup[*px & 0xFFFFFF].u : s->yuv_level_lookup[*px & 0xFFFFFF].v);
+			n = w - x < 64 ? w - x : 64;
+			
+			if(!av_frame_empty(&s->vframe))
+			{
+				vid_frame_to_yuv(s, NULL, l->line & 1 ? c : NULL, l->line & 1 ? NULL : c, 1, vx, vy, 2, n);
+			}
+			else
+			{
+				vid_rgb_to_yuv(s, NULL, l->line & 1 ? c : NULL, l->line & 1 ? NULL : c, 1, &rgb, 0, n);
+			}
+			
+			for(i = 0; i < n; i++)
+			{
+				l->output[(x + i) * 2] += c[i];
+			}
 		}
 	}
 	
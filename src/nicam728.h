@@ -73,6 +73,9 @@ typedef struct {
 	int16_t *taps;
 	int16_t *hist;
 	
+	/* Shaped waveform for each symbol */
+	cint16_t *syms;
+	
 	int dsym; /* Differential symbol */
 	
 	cint16_t *bb;
@@ -99,7 +102,15 @@ extern void nicam_encode_frame(nicam_enc_t *s, uint8_t frame[NICAM_FRAME_BYTES],
 
 extern int nicam_mod_init(nicam_mod_t *s, uint8_t mode, uint8_t reserve, unsigned int sample_rate, unsigned int frequency, double beta, double level);
 extern void nicam_mod_input(nicam_mod_t *s, const int16_t audio[NICAM_AUDIO_LEN * 2]);
+
+/* Add the modulated carrier for the next samples to iq. If iq is
+ * NULL the modulator is advanced without producing any output */
 extern int nicam_mod_output(nicam_mod_t *s, int16_t *iq, size_t samples);
+
+/* Copy the modulator state of src into dst, which must
+ * have been initialised with the same settings */
+extern void nicam_mod_copy(nicam_mod_t *dst, const nicam_mod_t *src);
+
 extern int nicam_mod_free(nicam_mod_t *s);
 
 #endif
@@ -0,0 +1,184 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2026 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "prof.h"
+
+static int _bucket(uint64_t ns)
+{
+	int e;
+	
+	if(ns < 8) return(ns);
+	
+	/* Position of the highest set bit, and the three bits below it */
+	e = 63 - __builtin_clzll(ns);
+	
+	return((e - 2) * 8 + ((ns >> (e - 3)) & 7));
+}
+
+static uint64_t _bucket_value(int b)
+{
+	int e;
+	
+	if(b < 8) return(b);
+	
+	/* The middle of the range covered by this bucket */
+	e = b / 8 + 2;
+	
+	return(((uint64_t) (8 + (b & 7)) << (e - 3)) + ((uint64_t) 1 << (e - 3)) / 2);
+}
+
+uint64_t prof_now(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return((uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+void prof_init(prof_t *p, const char *name)
+{
+	memset(p, 0, sizeof(prof_t));
+	p->name = name;
+}
+
+void prof_add(prof_t *p, uint64_t ns)
+{
+	uint64_t max;
+	
+	/* Line process workers share the stage statistics */
+	__atomic_fetch_add(&p->count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&p->total, ns, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&p->hist[_bucket(ns)], 1, __ATOMIC_RELAXED);
+	
+	max = __atomic_load_n(&p->max, __ATOMIC_RELAXED);
+	while(ns > max && !__atomic_compare_exchange_n(&p->max, &max, ns, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+void prof_snapshot(prof_t *dst, const prof_t *src)
+{
+	int b;
+	
+	dst->name = src->name;
+	dst->total = __atomic_load_n(&src->total, __ATOMIC_RELAXED);
+	dst->max = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+	
+	/* Count the histogram copy so the percentiles are consistent */
+	dst->count = 0;
+	
+	for(b = 0; b < PROF_BUCKETS; b++)
+	{
+		dst->hist[b] = __atomic_load_n(&src->hist[b], __ATOMIC_RELAXED);
+		dst->count += dst->hist[b];
+	}
+}
+
+uint64_t prof_percentile(const prof_t *p, double pc)
+{
+	uint64_t c, n;
+	int b;
+	
+	if(p->count == 0) return(0);
+	
+	/* Number of calls at or below the percentile */
+	n = p->count * pc / 100.0 + 0.5;
+	if(n < 1) n = 1;
+	
+	for(c = 0, b = 0; b < PROF_BUCKETS - 1; b++)
+	{
+		c += p->hist[b];
+		if(c >= n) break;
+	}
+	
+	/* Don't report more than the longest call */
+	c = _bucket_value(b);
+	
+	return(c < p->max ? c : p->max);
+}
+
+void prof_print(FILE *f, prof_t * const *stages, int n, uint64_t elapsed)
+{
+	prof_t snap;
+	int i;
+	
+	fprintf(f, "%-16s %12s %12s %10s %10s %10s %10s %6s\n",
+		"stage", "calls", "total ms", "mean ns", "p50 ns", "p99 ns", "max ns", "%"
+	);
+	
+	for(i = 0; i < n; i++)
+	{
+		const prof_t *p = &snap;
+		
+		prof_snapshot(&snap, stages[i]);
+		
+		fprintf(f, "%-16s %12llu %12.1f %10llu %10llu %10llu %10llu %6.1f\n",
+			p->name,
+			(unsigned long long) p->count,
+			p->total / 1e6,
+			(unsigned long long) (p->count ? p->total / p->count : 0),
+			(unsigned long long) prof_percentile(p, 50),
+			(unsigned long long) prof_percentile(p, 99),
+			(unsigned long long) p->max,
+			elapsed ? 100.0 * p->total / elapsed : 0.0
+		);
+	}
+	
+	fflush(f);
+}
+
+void prof_print_json(FILE *f, prof_t * const *stages, int n, uint64_t elapsed)
+{
+	prof_t snap;
+	int i;
+	
+	fprintf(f, "{\n  \"elapsed_ns\": %llu,\n  \"stages\": [\n", (unsigned long long) elapsed);
+	
+	for(i = 0; i < n; i++)
+	{
+		const prof_t *p = &snap;
+		
+		prof_snapshot(&snap, stages[i]);
+		
+		fprintf(f,
+			"    {\n"
+			"      \"name\": \"%s\",\n"
+			"      \"calls\": %llu,\n"
+			"      \"total_ns\": %llu,\n"
+			"      \"mean_ns\": %llu,\n"
+			"      \"p50_ns\": %llu,\n"
+			"      \"p99_ns\": %llu,\n"
+			"      \"max_ns\": %llu\n"
+			"    }%s\n",
+			p->name,
+			(unsigned long long) p->count,
+			(unsigned long long) p->total,
+			(unsigned long long) (p->count ? p->total / p->count : 0),
+			(unsigned long long) prof_percentile(p, 50),
+			(unsigned long long) prof_percentile(p, 99),
+			(unsigned long long) p->max,
+			i < n - 1 ? "," : ""
+		);
+	}
+	
+	fprintf(f, "  ]\n}\n");
+	fflush(f);
+}
+
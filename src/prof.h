@@ -0,0 +1,70 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2026 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _PROF_H
+#define _PROF_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* Timing statistics
+ *
+ * Durations are recorded in a log scale histogram with eight
+ * buckets per power of two, giving percentiles to within 12.5%.
+ *
+ * prof_add() may be called from any thread. Other threads should
+ * read the statistics through prof_snapshot().
+*/
+
+#define PROF_BUCKETS 512
+
+typedef struct {
+	
+	const char *name;
+	
+	uint64_t count;
+	uint64_t total;
+	uint64_t max;
+	uint64_t hist[PROF_BUCKETS];
+	
+} prof_t;
+
+/* Returns a monotonic time in nanoseconds */
+extern uint64_t prof_now(void);
+
+/* Clear the statistics. name must remain valid while in use */
+extern void prof_init(prof_t *p, const char *name);
+
+/* Record one call of ns nanoseconds */
+extern void prof_add(prof_t *p, uint64_t ns);
+
+/* Copy the statistics of src into dst while they may be updated */
+extern void prof_snapshot(prof_t *dst, const prof_t *src);
+
+/* Returns the approximate duration below which pc percent of calls
+ * completed, or 0 if there are no calls recorded */
+extern uint64_t prof_percentile(const prof_t *p, double pc);
+
+/* Write a table of the statistics for n stages, with each stage's
+ * share of elapsed nanoseconds of wall time */
+extern void prof_print(FILE *f, prof_t * const *stages, int n, uint64_t elapsed);
+
+/* As prof_print(), but writes a JSON document */
+extern void prof_print_json(FILE *f, prof_t * const *stages, int n, uint64_t elapsed);
+
+#endif
+
@@ -40,6 +40,16 @@ int rf_write_audio(rf_t *s, const int16_t *audio, size_t samples)
 	return(RF_OK);
 }
 
+int rf_field(rf_t *s, int frame, int field, int line, int64_t pts)
+{
+	if(s->field)
+	{
+		return(s->field(s->ctx, frame, field, line, pts));
+	}
+	
+	return(RF_OK);
+}
+
 int rf_close(rf_t *s)
 {
 	if(s->close)
@@ -38,6 +38,7 @@
 /* RF output function prototypes */
 typedef int (*rf_write_t)(void *ctx, const int16_t *iq_data, size_t samples);
 typedef int (*rf_write_audio_t)(void *ctx, const int16_t *audio, size_t samples);
+typedef int (*rf_field_t)(void *ctx, int frame, int field, int line, int64_t pts);
 typedef int (*rf_close_t)(void *ctx);
 
 typedef struct {
@@ -45,15 +46,19 @@ typedef struct {
 	void *ctx;
 	rf_write_t write;
 	rf_write_t write_audio;
+	rf_field_t field;
 	rf_close_t close;
 	
 } rf_t;
 
 extern int rf_write(rf_t *s, const int16_t *iq_data, size_t samples);
 extern int rf_write_audio(rf_t *s, const int16_t *audio, size_t samples);
+extern int rf_field(rf_t *s, int frame, int field, int line, int64_t pts);
 extern int rf_close(rf_t *s);
 
+#include "rf_index.h"
 #include "rf_file.h"
+#include "rf_sigmf.h"
 #include "rf_hackrf.h"
 #include "rf_soapysdr.h"
 #include "rf_fl2k.h"
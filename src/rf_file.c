@@ -15,38 +15,250 @@
 /* You should have received a copy of the GNU General Public License     */
 /* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
 
+/* Needed for O_DIRECT */
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdint.h>
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
 #include "rf.h"
+#include "fifo.h"
+#include "conv.h"
+
+#ifdef WIN32
+#define fseeko _fseeki64
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+/* Number of blocks queued for the writer thread */
+#define _BLOCKS 4
 
 /* File sink */
 typedef struct {
 	FILE *f;
+	int fd;
+	int writer;
 	void *data;
 	size_t data_size;
 	size_t samples;
 	int complex;
 	int type;
+	
+	/* Writer thread */
+	fifo_t fifo;
+	fifo_reader_t reader;
+	pthread_t thread;
+	int thread_running;
+	int direct;
+	int error;
+	
+	/* Memory mapped output window */
+	uint8_t *map;
+	int64_t map_offset;
+	size_t map_length;
+	int64_t pos;
+	
+	/* Frame index */
+	rf_index_t *index;
+	rf_write_t write;
+	int64_t position;
+	
 } rf_file_t;
 
+static int _write_all(rf_file_t *rf, const uint8_t *data, size_t length)
+{
+	ssize_t r;
+	
+#ifdef O_DIRECT
+	if(rf->direct && length % RF_FILE_ALIGN != 0)
+	{
+		/* The final block may be any length, which
+		 * O_DIRECT does not allow. Write it normally */
+		fcntl(rf->fd, F_SETFL, fcntl(rf->fd, F_GETFL) & ~O_DIRECT);
+		rf->direct = 0;
+	}
+#endif
+	
+	while(length > 0)
+	{
+		r = write(rf->fd, data, length);
+		
+		if(r < 0)
+		{
+			if(errno == EINTR) continue;
+			
+			perror("write");
+			return(RF_ERROR);
+		}
+		
+		data += r;
+		length -= r;
+	}
+	
+	return(RF_OK);
+}
+
+static void *_writer_thread(void *arg)
+{
+	rf_file_t *rf = arg;
+	void *data;
+	size_t l;
+	
+	/* Write out each block as the render thread completes it */
+	while((l = fifo_read(&rf->reader, &data, SIZE_MAX, 1)) != -1)
+	{
+		if(_write_all(rf, data, l) != RF_OK)
+		{
+			__atomic_store_n(&rf->error, 1, __ATOMIC_RELEASE);
+			break;
+		}
+	}
+	
+	/* Releases any blocks held, so the render thread can't stall */
+	fifo_reader_close(&rf->reader);
+	
+	return(NULL);
+}
+
+#ifndef WIN32
+static int _map_window(rf_file_t *rf)
+{
+	int r;
+	
+	if(rf->map)
+	{
+		munmap(rf->map, rf->map_length);
+		rf->map = NULL;
+	}
+	
+	/* The window starts on the page containing the next sample */
+	rf->map_offset = rf->pos - rf->pos % sysconf(_SC_PAGESIZE);
+	
+	/* Reserve the space before mapping it, writing to a mapping
+	 * beyond the end of the file raises SIGBUS */
+	r = posix_fallocate(rf->fd, rf->map_offset, rf->map_length);
+	if(r != 0)
+	{
+		fprintf(stderr, "posix_fallocate: %s\n", strerror(r));
+		return(RF_ERROR);
+	}
+	
+	rf->map = mmap(NULL, rf->map_length, PROT_READ | PROT_WRITE, MAP_SHARED, rf->fd, rf->map_offset);
+	if(rf->map == MAP_FAILED)
+	{
+		perror("mmap");
+		rf->map = NULL;
+		return(RF_ERROR);
+	}
+	
+	madvise(rf->map, rf->map_length, MADV_SEQUENTIAL);
+	
+	return(RF_OK);
+}
+#endif
+
+/* Returns a pointer to space for up to *samples converted samples,
+ * or NULL on error. Submit them with _commit() */
+static void *_buffer(rf_file_t *rf, size_t *samples)
+{
+	void *ptr;
+	size_t r;
+	
+	switch(rf->writer)
+	{
+	case RF_FILE_THREAD:
+	case RF_FILE_DIRECT:
+		
+		if(__atomic_load_n(&rf->error, __ATOMIC_ACQUIRE))
+		{
+			return(NULL);
+		}
+		
+		r = fifo_write_ptr(&rf->fifo, &ptr, 1);
+		if(r == -1 || r == 0)
+		{
+			return(NULL);
+		}
+		
+		*samples = r / rf->data_size;
+		return(ptr);
+	
+#ifndef WIN32
+	case RF_FILE_MMAP:
+		
+		if(rf->map == NULL || rf->pos == rf->map_offset + rf->map_length)
+		{
+			if(_map_window(rf) != RF_OK)
+			{
+				return(NULL);
+			}
+		}
+		
+		*samples = (rf->map_offset + rf->map_length - rf->pos) / rf->data_size;
+		return(rf->map + (rf->pos - rf->map_offset));
+#endif
+	}
+	
+	*samples = rf->samples;
+	return(rf->data);
+}
+
+static int _commit(rf_file_t *rf, size_t samples)
+{
+	switch(rf->writer)
+	{
+	case RF_FILE_THREAD:
+	case RF_FILE_DIRECT:
+		fifo_write(&rf->fifo, samples * rf->data_size);
+		break;
+	
+	case RF_FILE_MMAP:
+		rf->pos += samples * rf->data_size;
+		break;
+	
+	default:
+		if(fwrite(rf->data, rf->data_size, samples, rf->f) != samples)
+		{
+			return(RF_ERROR);
+		}
+		break;
+	}
+	
+	return(RF_OK);
+}
+
 static int _rf_file_write_uint8_real(void *private, const int16_t *iq_data, size_t samples)
 {
 	rf_file_t *rf = private;
-	uint8_t *u8 = rf->data;
-	int i;
+	uint8_t *u8;
+	size_t n;
 	
 	while(samples)
 	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
-		{
-			u8[i] = (iq_data[0] - INT16_MIN) >> 8;
-		}
+		u8 = _buffer(rf, &n);
+		if(u8 == NULL) return(RF_ERROR);
+		
+		if(n > samples) n = samples;
+		
+		conv_int16_to_uint8(u8, iq_data, n, 2);
 		
-		fwrite(rf->data, rf->data_size, i, rf->f);
+		if(_commit(rf, n) != RF_OK) return(RF_ERROR);
 		
-		samples -= i;
+		iq_data += n * 2;
+		samples -= n;
 	}
 	
 	return(RF_OK);
@@ -55,19 +267,22 @@ static int _rf_file_write_uint8_real(void *private, const int16_t *iq_data, size
 static int _rf_file_write_int8_real(void *private, const int16_t *iq_data, size_t samples)
 {
 	rf_file_t *rf = private;
-	int8_t *i8 = rf->data;
-	int i;
+	int8_t *i8;
+	size_t n;
 	
 	while(samples)
 	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
-		{
-			i8[i] = iq_data[0] >> 8;
-		}
+		i8 = _buffer(rf, &n);
+		if(i8 == NULL) return(RF_ERROR);
+		
+		if(n > samples) n = samples;
 		
-		fwrite(rf->data, rf->data_size, i, rf->f);
+		conv_int16_to_int8(i8, iq_data, n, 2);
 		
-		samples -= i;
+		if(_commit(rf, n) != RF_OK) return(RF_ERROR);
+		
+		iq_data += n * 2;
+		samples -= n;
 	}
 	
 	return(RF_OK);
@@ -76,19 +291,22 @@ static int _rf_file_write_int8_real(void *private, const int16_t *iq_data, size_
 static int _rf_file_write_uint16_real(void *private, const int16_t *iq_data, size_t samples)
 {
 	rf_file_t *rf = private;
-	uint16_t *u16 = rf->data;
-	int i;
+	uint16_t *u16;
+	size_t n;
 	
 	while(samples)
 	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
-		{
-			u16[i] = (iq_data[0] - INT16_MIN);
-		}
+		u16 = _buffer(rf, &n);
+		if(u16 == NULL) return(RF_ERROR);
+		
+		if(n > samples) n = samples;
 		
-		fwrite(rf->data, rf->data_size, i, rf->f);
+		conv_int16_to_uint16(u16, iq_data, n, 2);
 		
-		samples -= i;
+		if(_commit(rf, n) != RF_OK) return(RF_ERROR);
+		
+		iq_data += n * 2;
+		samples -= n;
 	}
 	
 	return(RF_OK);
@@ -97,19 +315,22 @@ static int _rf_file_write_uint16_real(void *private, const int16_t *iq_data, siz
 static int _rf_file_write_int16_real(void *private, const int16_t *iq_data, size_t samples)
 {
 	rf_file_t *rf = private;
-	int16_t *i16 = rf->data;
-	int i;
+	int16_t *i16;
+	size_t n;
 	
 	while(samples)
 	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
-		{
-			i16[i] = iq_data[0];
-		}
+		i16 = _buffer(rf, &n);
+		if(i16 == NULL) return(RF_ERROR);
+		
+		if(n > samples) n = samples;
+		
+		conv_int16_to_int16(i16, iq_data, n, 2);
 		
-		fwrite(rf->data, rf->data_size, i, rf->f);
+		if(_commit(rf, n) != RF_OK) return(RF_ERROR);
 		
-		samples -= i;
+		iq_data += n * 2;
+		samples -= n;
 	}
 	
 	return(RF_OK);
@@ -118,19 +339,22 @@ static int _rf_file_write_int16_real(void *private, const int16_t *iq_data, size
 static int _rf_file_write_int32_real(void *private, const int16_t *iq_data, size_t samples)
 {
 	rf_file_t *rf = private;
-	int32_t *i32 = rf->data;
-	int i;
+	int32_t *i32;
+	size_t n;
 	
 	while(samples)
 	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
-		{
-			i32[i] = (iq_data[0] << 16) + iq_data[0];
-		}
+		i32 = _buffer(rf, &n);
+		if(i32 == NULL) return(RF_ERROR);
 		
-		fwrite(rf->data, rf->data_size, i, rf->f);
+		if(n > samples) n = samples;
 		
-		samples -= i;
+		conv_int16_to_int32(i32, iq_data, n, 2);
+		
+		if(_commit(rf, n) != RF_OK) return(RF_ERROR);
+		
+		iq_data += n * 2;
+		samples -= n;
 	}
 	
 	return(RF_OK);
@@ -139,19 +363,22 @@ static int _rf_file_write_int32_real(void *private, const int16_t *iq_data, size
 static int _rf_file_write_float_real(void *private, const int16_t *iq_data, size_t samples)
 {
 	rf_file_t *rf = private;
-	float *f32 = rf->data;
-	int i;
+	float *f32;
+	size_t n;
 	
 	while(samples)
 	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
-		{
-			f32[i] = (float) iq_data[0] * (1.0 / 32767.0);
-		}
+		f32 = _buffer(rf, &n);
+		if(f32 == NULL) return(RF_ERROR);
+		
+		if(n > samples) n = samples;
 		
-		fwrite(rf->data, rf->data_size, i, rf->f);
+		conv_int16_to_float(f32, iq_data, n, 2);
 		
-		samples -= i;
+		if(_commit(rf, n) != RF_OK) return(RF_ERROR);
+		
+		iq_data += n * 2;
+		samples -= n;
 	}
 	
 	return(RF_OK);
@@ -160,20 +387,22 @@ static int _rf_file_write_float_real(void *private, const int16_t *iq_data, size
 static int _rf_file_write_uint8_complex(void *private, const int16_t *iq_data, size_t samples)
 {
 	rf_file_t *rf = private;
-	uint8_t *u8 = rf->data;
-	int i;
+	uint8_t *u8;
+	size_t n;
 	
 	while(samples)
 	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
-		{
-			u8[i * 2 + 0] = (iq_data[0] - INT16_MIN) >> 8;
-			u8[i * 2 + 1] = (iq_data[1] - INT16_MIN) >> 8;
-		}
+		u8 = _buffer(rf, &n);
+		if(u8 == NULL) return(RF_ERROR);
+		
+		if(n > samples) n = samples;
+		
+		conv_int16_to_uint8(u8, iq_data, n * 2, 1);
 		
-		fwrite(rf->data, rf->data_size, i, rf->f);
+		if(_commit(rf, n) != RF_OK) return(RF_ERROR);
 		
-		samples -= i;
+		iq_data += n * 2;
+		samples -= n;
 	}
 	
 	return(RF_OK);
@@ -182,20 +411,22 @@ static int _rf_file_write_uint8_complex(void *private, const int16_t *iq_data, s
 static int _rf_file_write_int8_complex(void *private, const int16_t *iq_data, size_t samples)
 {
 	rf_file_t *rf = private;
-	int8_t *i8 = rf->data;
-	int i;
+	int8_t *i8;
+	size_t n;
 	
 	while(samples)
 	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
-		{
-			i8[i * 2 + 0] = iq_data[0] >> 8;
-			i8[i * 2 + 1] = iq_data[1] >> 8;
-		}
+		i8 = _buffer(rf, &n);
+		if(i8 == NULL) return(RF_ERROR);
+		
+		if(n > samples) n = samples;
+		
+		conv_int16_to_int8(i8, iq_data, n * 2, 1);
 		
-		fwrite(rf->data, rf->data_size, i, rf->f);
+		if(_commit(rf, n) != RF_OK) return(RF_ERROR);
 		
-		samples -= i;
+		iq_data += n * 2;
+		samples -= n;
 	}
 	
 	return(RF_OK);
@@ -204,20 +435,22 @@ static int _rf_file_write_int8_complex(void *private, const int16_t *iq_data, si
 static int _rf_file_write_uint16_complex(void *private, const int16_t *iq_data, size_t samples)
 {
 	rf_file_t *rf = private;
-	uint16_t *u16 = rf->data;
-	int i;
+	uint16_t *u16;
+	size_t n;
 	
 	while(samples)
 	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
-		{
-			u16[i * 2 + 0] = (iq_data[0] - INT16_MIN);
-			u16[i * 2 + 1] = (iq_data[1] - INT16_MIN);
-		}
+		u16 = _buffer(rf, &n);
+		if(u16 == NULL) return(RF_ERROR);
+		
+		if(n > samples) n = samples;
 		
-		fwrite(rf->data, rf->data_size, i, rf->f);
+		conv_int16_to_uint16(u16, iq_data, n * 2, 1);
 		
-		samples -= i;
+		if(_commit(rf, n) != RF_OK) return(RF_ERROR);
+		
+		iq_data += n * 2;
+		samples -= n;
 	}
 	
 	return(RF_OK);
@@ -226,8 +459,34 @@ static int _rf_file_write_uint16_complex(void *private, const int16_t *iq_data,
 static int _rf_file_write_int16_complex(void *private, const int16_t *iq_data, size_t samples)
 {
 	rf_file_t *rf = private;
+	int16_t *i16;
+	size_t n;
 	
-	fwrite(iq_data, sizeof(int16_t) * 2, samples, rf->f);
+	if(rf->writer == RF_FILE_STDIO)
+	{
+		/* No conversion needed, write the samples directly */
+		if(fwrite(iq_data, sizeof(int16_t) * 2, samples, rf->f) != samples)
+		{
+			return(RF_ERROR);
+		}
+		
+		return(RF_OK);
+	}
+	
+	while(samples)
+	{
+		i16 = _buffer(rf, &n);
+		if(i16 == NULL) return(RF_ERROR);
+		
+		if(n > samples) n = samples;
+		
+		conv_int16_to_int16(i16, iq_data, n * 2, 1);
+		
+		if(_commit(rf, n) != RF_OK) return(RF_ERROR);
+		
+		iq_data += n * 2;
+		samples -= n;
+	}
 	
 	return(RF_OK);
 }
@@ -235,20 +494,22 @@ static int _rf_file_write_int16_complex(void *private, const int16_t *iq_data, s
 static int _rf_file_write_int32_complex(void *private, const int16_t *iq_data, size_t samples)
 {
 	rf_file_t *rf = private;
-	int32_t *i32 = rf->data;
-	int i;
+	int32_t *i32;
+	size_t n;
 	
 	while(samples)
 	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
-		{
-			i32[i * 2 + 0] = (iq_data[0] << 16) + iq_data[0];
-			i32[i * 2 + 1] = (iq_data[1] << 16) + iq_data[1];
-		}
+		i32 = _buffer(rf, &n);
+		if(i32 == NULL) return(RF_ERROR);
+		
+		if(n > samples) n = samples;
+		
+		conv_int16_to_int32(i32, iq_data, n * 2, 1);
 		
-		fwrite(rf->data, rf->data_size, i, rf->f);
+		if(_commit(rf, n) != RF_OK) return(RF_ERROR);
 		
-		samples -= i;
+		iq_data += n * 2;
+		samples -= n;
 	}
 	
 	return(RF_OK);
@@ -257,37 +518,170 @@ static int _rf_file_write_int32_complex(void *private, const int16_t *iq_data, s
 static int _rf_file_write_float_complex(void *private, const int16_t *iq_data, size_t samples)
 {
 	rf_file_t *rf = private;
-	float *f32 = rf->data;
-	int i;
+	float *f32;
+	size_t n;
 	
 	while(samples)
 	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
-		{
-			f32[i * 2 + 0] = (float) iq_data[0] * (1.0 / 32767.0);
-			f32[i * 2 + 1] = (float) iq_data[1] * (1.0 / 32767.0);
-		}
+		f32 = _buffer(rf, &n);
+		if(f32 == NULL) return(RF_ERROR);
 		
-		fwrite(rf->data, rf->data_size, i, rf->f);
+		if(n > samples) n = samples;
 		
-		samples -= i;
+		conv_int16_to_float(f32, iq_data, n * 2, 1);
+		
+		if(_commit(rf, n) != RF_OK) return(RF_ERROR);
+		
+		iq_data += n * 2;
+		samples -= n;
 	}
 	
 	return(RF_OK);
 }
 
+static int _rf_file_write_indexed(void *private, const int16_t *iq_data, size_t samples)
+{
+	rf_file_t *rf = private;
+	
+	/* Track the output position for the index */
+	rf->position += samples;
+	
+	return(rf->write(rf, iq_data, samples));
+}
+
+static int _rf_file_field(void *private, int frame, int field, int line, int64_t pts)
+{
+	rf_file_t *rf = private;
+	rf_index_record_t r = {
+		.frame = frame,
+		.line = line,
+		.offset = rf->position * rf->data_size,
+		.pts = pts,
+	};
+	
+	return(rf_index_write(rf->index, &r));
+}
+
 static int _rf_file_close(void *private)
 {
 	rf_file_t *rf = private;
+	int r = RF_OK;
 	
+	if(rf->thread_running)
+	{
+		/* Flush the remaining blocks and wait for the writer */
+		fifo_close(&rf->fifo);
+		pthread_join(rf->thread, NULL);
+		fifo_free(&rf->fifo);
+		
+		if(rf->error) r = RF_ERROR;
+	}
+	
+#ifndef WIN32
+	if(rf->writer == RF_FILE_MMAP && rf->fd >= 0)
+	{
+		if(rf->map) munmap(rf->map, rf->map_length);
+		
+		/* Trim the unused part of the last window */
+		if(ftruncate(rf->fd, rf->pos) != 0)
+		{
+			perror("ftruncate");
+			r = RF_ERROR;
+		}
+	}
+#endif
+	
+	if(rf->index)
+	{
+		if(rf_index_close(rf->index) != RF_OK)
+		{
+			fprintf(stderr, "Error writing the frame index.\n");
+			r = RF_ERROR;
+		}
+		
+		free(rf->index);
+	}
+	
+	if(rf->fd >= 0 && rf->fd != STDOUT_FILENO) close(rf->fd);
 	if(rf->f && rf->f != stdout) fclose(rf->f);
 	if(rf->data) free(rf->data);
 	free(rf);
 	
+	return(r);
+}
+
+static int _open_fd(rf_file_t *rf, char *filename, int64_t offset)
+{
+	int flags = O_BINARY;
+	
+	if(strcmp(filename, "-") == 0 && offset < 0)
+	{
+		if(rf->writer != RF_FILE_THREAD)
+		{
+			fprintf(stderr, "The direct and mmap file writers cannot write to stdout.\n");
+			return(RF_ERROR);
+		}
+		
+		rf->fd = STDOUT_FILENO;
+		return(RF_OK);
+	}
+	
+	flags |= (rf->writer == RF_FILE_MMAP ? O_RDWR : O_WRONLY);
+	flags |= (offset < 0 ? O_CREAT | O_TRUNC : 0);
+	
+	if(rf->writer == RF_FILE_DIRECT)
+	{
+#ifdef O_DIRECT
+		/* O_DIRECT requires an aligned file position */
+		if(offset < 0 || offset * rf->data_size % RF_FILE_ALIGN == 0)
+		{
+			rf->fd = open(filename, flags | O_DIRECT, 0666);
+			
+			if(rf->fd >= 0)
+			{
+				rf->direct = 1;
+			}
+			else if(errno != EINVAL)
+			{
+				perror("open");
+				return(RF_ERROR);
+			}
+			else
+			{
+				fprintf(stderr, "Warning: O_DIRECT is not supported here, using buffered writes.\n");
+			}
+		}
+#else
+		fprintf(stderr, "Warning: O_DIRECT is not supported on this platform, using buffered writes.\n");
+#endif
+	}
+	
+	if(rf->fd < 0)
+	{
+		rf->fd = open(filename, flags, 0666);
+		
+		if(rf->fd < 0)
+		{
+			perror("open");
+			return(RF_ERROR);
+		}
+	}
+	
+	if(offset > 0)
+	{
+		rf->pos = offset * rf->data_size;
+		
+		if(rf->writer != RF_FILE_MMAP && lseek(rf->fd, rf->pos, SEEK_SET) < 0)
+		{
+			perror("lseek");
+			return(RF_ERROR);
+		}
+	}
+	
 	return(RF_OK);
 }
 
-int rf_file_open(rf_t *s, char *filename, int type, int complex)
+int rf_file_open_at(rf_t *s, char *filename, int type, int complex, int64_t offset, int writer, size_t buffer)
 {
 	rf_file_t *rf = calloc(1, sizeof(rf_file_t));
 	
@@ -297,8 +691,11 @@ int rf_file_open(rf_t *s, char *filename, int type, int complex)
 		return(RF_ERROR);
 	}
 	
+	rf->fd = -1;
+	rf->position = offset > 0 ? offset : 0;
 	rf->complex = complex != 0;
 	rf->type = type;
+	rf->writer = writer;
 	
 	if(filename == NULL)
 	{
@@ -306,21 +703,6 @@ int rf_file_open(rf_t *s, char *filename, int type, int complex)
 		_rf_file_close(rf);
 		return(RF_ERROR);
 	}
-	else if(strcmp(filename, "-") == 0)
-	{
-		rf->f = stdout;
-	}
-	else
-	{
-		rf->f = fopen(filename, "wb");	
-		
-		if(!rf->f)
-		{
-			perror("fopen");
-			_rf_file_close(rf);
-			return(RF_ERROR);
-		}
-	}
 	
 	/* Find the size of the output data type */
 	switch(type)
@@ -340,19 +722,110 @@ int rf_file_open(rf_t *s, char *filename, int type, int complex)
 	/* Double the size for complex types */
 	if(rf->complex) rf->data_size *= 2;
 	
-	/* Number of samples in the temporary buffer */
-	rf->samples = 4096;
+#ifdef WIN32
+	if(rf->writer == RF_FILE_MMAP)
+	{
+		fprintf(stderr, "The mmap file writer is not supported on this platform.\n");
+		_rf_file_close(rf);
+		return(RF_ERROR);
+	}
+#endif
+	
+	if(rf->writer == RF_FILE_MMAP && offset >= 0)
+	{
+		/* Other writers may be extending the same file, and
+		 * the final size of the file is not known here */
+		rf->writer = RF_FILE_THREAD;
+	}
 	
-	/* Allocate the memory, unless the output is int16 complex */
-	if(rf->type != RF_INT16 || !rf->complex)
+	if(rf->writer == RF_FILE_STDIO)
+	{
+		if(strcmp(filename, "-") == 0 && offset < 0)
+		{
+			rf->f = stdout;
+		}
+		else
+		{
+			rf->f = fopen(filename, offset < 0 ? "wb" : "r+b");
+			
+			if(!rf->f)
+			{
+				perror("fopen");
+				_rf_file_close(rf);
+				return(RF_ERROR);
+			}
+		}
+		
+		if(offset > 0 && fseeko(rf->f, offset * rf->data_size, SEEK_SET) != 0)
+		{
+			perror("fseeko");
+			_rf_file_close(rf);
+			return(RF_ERROR);
+		}
+		
+		/* Only resize the stdio buffer if asked to */
+		if(buffer > 0)
+		{
+			setvbuf(rf->f, NULL, _IOFBF, buffer);
+		}
+		
+		/* Number of samples in the temporary buffer */
+		rf->samples = 4096;
+		
+		/* Allocate the memory, unless the output is int16 complex */
+		if(rf->type != RF_INT16 || !rf->complex)
+		{
+			rf->data = malloc(rf->data_size * rf->samples);
+			if(!rf->data)
+			{
+				perror("malloc");
+				_rf_file_close(rf);
+				return(RF_ERROR);
+			}
+		}
+	}
+	else
 	{
-		rf->data = malloc(rf->data_size * rf->samples);
-		if(!rf->data)
+		if(buffer == 0)
+		{
+			buffer = RF_FILE_BUFFER;
+		}
+		
+		/* Round the buffer up to a whole number of pages */
+		buffer = (buffer + RF_FILE_ALIGN - 1) / RF_FILE_ALIGN * RF_FILE_ALIGN;
+		
+		if(_open_fd(rf, filename, offset) != RF_OK)
 		{
-			perror("malloc");
 			_rf_file_close(rf);
 			return(RF_ERROR);
 		}
+		
+		if(rf->writer == RF_FILE_MMAP)
+		{
+			rf->map_length = buffer;
+		}
+		else
+		{
+			if(fifo_init(&rf->fifo, _BLOCKS, buffer) != 0)
+			{
+				perror("fifo_init");
+				_rf_file_close(rf);
+				return(RF_OUT_OF_MEMORY);
+			}
+			
+			fifo_reader_init(&rf->reader, &rf->fifo, 0);
+			
+			if(pthread_create(&rf->thread, NULL, &_writer_thread, (void *) rf) != 0)
+			{
+				perror("pthread_create");
+				fifo_reader_close(&rf->reader);
+				fifo_free(&rf->fifo);
+				_rf_file_close(rf);
+				return(RF_ERROR);
+			}
+			
+			rf->thread_running = 1;
+		}
 	}
 	
 	/* Register the callback functions */
@@ -372,3 +845,143 @@ int rf_file_open(rf_t *s, char *filename, int type, int complex)
 	return(RF_OK);
 }
 
+int rf_file_open(rf_t *s, char *filename, int type, int complex, int writer, size_t buffer)
+{
+	return(rf_file_open_at(s, filename, type, complex, -1, writer, buffer));
+}
+
+int rf_file_index(rf_t *s, const char *filename, int fields, unsigned int sample_rate, r64_t frame_rate, r64_t pts_rate)
+{
+	rf_file_t *rf = s->ctx;
+	
+	rf->index = malloc(sizeof(rf_index_t));
+	if(!rf->index)
+	{
+		perror("malloc");
+		return(RF_ERROR);
+	}
+	
+	if(rf_index_create(rf->index, filename, fields, rf->data_size, sample_rate, frame_rate, pts_rate) != RF_OK)
+	{
+		free(rf->index);
+		rf->index = NULL;
+		return(RF_ERROR);
+	}
+	
+	/* Count the samples written ahead of the real writer */
+	rf->write = s->write;
+	s->write = _rf_file_write_indexed;
+	s->field = _rf_file_field;
+	
+	return(RF_OK);
+}
+
+int rf_file_rotate(const char *filename, int type, int64_t offset, int64_t samples, double angle)
+{
+	FILE *f;
+	void *data;
+	int16_t *iq;
+	size_t size, n, x;
+	double c, sn, i, q;
+	int r = RF_OK;
+	
+	switch(type)
+	{
+	case RF_UINT8:  size = sizeof(uint8_t);  break;
+	case RF_INT8:   size = sizeof(int8_t);   break;
+	case RF_UINT16: size = sizeof(uint16_t); break;
+	case RF_INT16:  size = sizeof(int16_t);  break;
+	case RF_INT32:  size = sizeof(int32_t);  break;
+	case RF_FLOAT:  size = sizeof(float);    break;
+	default:
+		fprintf(stderr, "%s: Unrecognised data type %d\n", __func__, type);
+		return(RF_ERROR);
+	}
+	
+	/* Complex samples only */
+	size *= 2;
+	
+	f = fopen(filename, "r+b");
+	if(!f)
+	{
+		perror("fopen");
+		return(RF_ERROR);
+	}
+	
+	data = malloc(size * 4096);
+	iq = malloc(sizeof(int16_t) * 2 * 4096);
+	
+	if(!data || !iq)
+	{
+		free(data);
+		free(iq);
+		fclose(f);
+		return(RF_OUT_OF_MEMORY);
+	}
+	
+	c = cos(angle);
+	sn = sin(angle);
+	
+	for(; samples > 0 && r == RF_OK; offset += n, samples -= n)
+	{
+		n = samples < 4096 ? samples : 4096;
+		
+		if(fseeko(f, offset * size, SEEK_SET) != 0 ||
+		   (n = fread(data, size, n, f)) == 0)
+		{
+			break;
+		}
+		
+		/* Back to int16, the reverse of the write conversions */
+		for(x = 0; x < n * 2; x++)
+		{
+			switch(type)
+			{
+			case RF_UINT8:  iq[x] = (((const uint8_t *) data)[x] << 8) + INT16_MIN; break;
+			case RF_INT8:   iq[x] = ((const int8_t *) data)[x] * 256; break;
+			case RF_UINT16: iq[x] = ((const uint16_t *) data)[x] + INT16_MIN; break;
+			case RF_INT16:  iq[x] = ((const int16_t *) data)[x]; break;
+			case RF_INT32:  iq[x] = ((const int32_t *) data)[x] / 65537; break;
+			case RF_FLOAT:  iq[x] = lround(((const float *) data)[x] * 32767.0); break;
+			}
+		}
+		
+		for(x = 0; x < n * 2; x += 2)
+		{
+			i = iq[x + 0] * c - iq[x + 1] * sn;
+			q = iq[x + 0] * sn + iq[x + 1] * c;
+			
+			iq[x + 0] = lround(i < INT16_MIN ? INT16_MIN : (i > INT16_MAX ? INT16_MAX : i));
+			iq[x + 1] = lround(q < INT16_MIN ? INT16_MIN : (q > INT16_MAX ? INT16_MAX : q));
+		}
+		
+		switch(type)
+		{
+		case RF_UINT8:  conv_int16_to_uint8(data, iq, n * 2, 1);  break;
+		case RF_INT8:   conv_int16_to_int8(data, iq, n * 2, 1);   break;
+		case RF_UINT16: conv_int16_to_uint16(data, iq, n * 2, 1); break;
+		case RF_INT16:  conv_int16_to_int16(data, iq, n * 2, 1);  break;
+		case RF_INT32:  conv_int16_to_int32(data, iq, n * 2, 1);  break;
+		case RF_FLOAT:  conv_int16_to_float(data, iq, n * 2, 1);  break;
+		}
+		
+		if(fseeko(f, offset * size, SEEK_SET) != 0 ||
+		   fwrite(data, size, n, f) != n)
+		{
+			perror("fwrite");
+			r = RF_ERROR;
+		}
+	}
+	
+	free(data);
+	free(iq);
+	
+	if(fclose(f) != 0)
+	{
+		perror("fclose");
+		r = RF_ERROR;
+	}
+	
+	return(r);
+}
+
@@ -18,7 +18,34 @@
 #ifndef _FILE_H
 #define _FILE_H
 
-extern int rf_file_open(rf_t *s, char *filename, int type, int complex);
+/* File writers */
+#define RF_FILE_STDIO  0 /* Buffered stdio writes on the render thread */
+#define RF_FILE_THREAD 1 /* Large aligned buffers written by a writer thread */
+#define RF_FILE_DIRECT 2 /* As RF_FILE_THREAD, bypassing the page cache with O_DIRECT */
+#define RF_FILE_MMAP   3 /* Samples are written into a sliding mmap window over
+                          * the preallocated file. Not available for stdout */
+
+/* Buffer alignment, and the default buffer size in bytes. For the
+ * thread and direct writers this is the size of each of the queued
+ * blocks, for mmap it is the size of the window. A buffer of 0
+ * selects the default */
+#define RF_FILE_ALIGN  4096
+#define RF_FILE_BUFFER (4 * 1024 * 1024)
+
+extern int rf_file_open(rf_t *s, char *filename, int type, int complex, int writer, size_t buffer);
+
+/* As rf_file_open(), but opens an existing file and starts writing
+ * at offset samples, or creates / truncates the file if offset < 0.
+ * The mmap writer falls back to the thread writer when offset >= 0 */
+extern int rf_file_open_at(rf_t *s, char *filename, int type, int complex, int64_t offset, int writer, size_t buffer);
+
+/* Write a frame index alongside the file. A record is added
+ * for each frame or field start passed to rf_field() */
+extern int rf_file_index(rf_t *s, const char *filename, int fields, unsigned int sample_rate, r64_t frame_rate, r64_t pts_rate);
+
+/* Rotate the phase of samples already written to a complex file, from
+ * offset samples. Used to join FM video rendered in separate segments */
+extern int rf_file_rotate(const char *filename, int type, int64_t offset, int64_t samples, double angle);
 
 #endif
 
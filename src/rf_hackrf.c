@@ -25,6 +25,7 @@
 #include "rf.h"
 #include "fifo.h"
 #include "fir.h"
+#include "conv.h"
 
 /* Value from host/libhackrf/src/hackrf.c */
 #define TRANSFER_BUFFER_SIZE 262144
@@ -261,10 +262,8 @@ static int _rf_write(void *private, const int16_t *iq_data, size_t samples)
 		
 		if(r < 0) break;
 		
-		for(i = 0; i < r && i < samples; i++)
-		{
-			iq8[i] = iq_data[i] >> 8;
-		}
+		i = r < samples ? r : samples;
+		conv_int16_to_int8(iq8, iq_data, i, 1);
 		
 		fifo_write(&rf->buffers, i);
 		
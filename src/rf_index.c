@@ -0,0 +1,268 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2026 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "rf.h"
+
+#ifdef WIN32
+#define fseeko _fseeki64
+#define ftello _ftelli64
+#endif
+
+static void _put32(uint8_t *b, uint32_t v)
+{
+	b[0] = v;
+	b[1] = v >> 8;
+	b[2] = v >> 16;
+	b[3] = v >> 24;
+}
+
+static void _put64(uint8_t *b, uint64_t v)
+{
+	_put32(b, v);
+	_put32(b + 4, v >> 32);
+}
+
+static uint32_t _get32(const uint8_t *b)
+{
+	return((uint32_t) b[0] | (uint32_t) b[1] << 8 | (uint32_t) b[2] << 16 | (uint32_t) b[3] << 24);
+}
+
+static uint64_t _get64(const uint8_t *b)
+{
+	return((uint64_t) _get32(b) | (uint64_t) _get32(b + 4) << 32);
+}
+
+static int _write_header(rf_index_t *s)
+{
+	uint8_t b[RF_INDEX_HEADER];
+	
+	memset(b, 0, sizeof(b));
+	memcpy(b, RF_INDEX_MAGIC, 8);
+	_put32(&b[8], RF_INDEX_VERSION);
+	_put32(&b[12], RF_INDEX_RECORD);
+	_put32(&b[16], s->fields);
+	_put32(&b[20], s->sample_size);
+	_put32(&b[24], s->sample_rate);
+	_put64(&b[32], s->first_frame);
+	_put32(&b[40], s->frame_rate.num);
+	_put32(&b[44], s->frame_rate.den);
+	_put32(&b[48], s->pts_rate.num);
+	_put32(&b[52], s->pts_rate.den);
+	_put64(&b[56], s->records);
+	
+	if(fseeko(s->f, 0, SEEK_SET) != 0 ||
+	   fwrite(b, sizeof(b), 1, s->f) != 1)
+	{
+		return(RF_ERROR);
+	}
+	
+	return(RF_OK);
+}
+
+int rf_index_create(rf_index_t *s, const char *filename, int fields, int sample_size, unsigned int sample_rate, r64_t frame_rate, r64_t pts_rate)
+{
+	memset(s, 0, sizeof(rf_index_t));
+	
+	s->write = 1;
+	s->fields = fields;
+	s->sample_size = sample_size;
+	s->sample_rate = sample_rate;
+	s->first_frame = -1;
+	s->frame_rate = frame_rate;
+	s->pts_rate = pts_rate;
+	
+	s->f = fopen(filename, "wb");
+	if(!s->f)
+	{
+		perror(filename);
+		return(RF_ERROR);
+	}
+	
+	/* The header is rewritten with the first frame and
+	 * the number of records when the index is closed */
+	if(_write_header(s) != RF_OK || fflush(s->f) != 0)
+	{
+		perror(filename);
+		fclose(s->f);
+		s->f = NULL;
+		return(RF_ERROR);
+	}
+	
+	return(RF_OK);
+}
+
+int rf_index_write(rf_index_t *s, const rf_index_record_t *r)
+{
+	uint8_t b[RF_INDEX_RECORD];
+	
+	if(s->records == 0)
+	{
+		/* The index must start on the first field of a frame */
+		if(s->fields > 1 && r->line != 1) return(RF_OK);
+		
+		s->first_frame = r->frame;
+	}
+	
+	memset(b, 0, sizeof(b));
+	_put64(&b[0], r->frame);
+	_put32(&b[8], r->line);
+	_put64(&b[16], r->offset);
+	_put64(&b[24], r->pts);
+	
+	if(fwrite(b, sizeof(b), 1, s->f) != 1)
+	{
+		return(RF_ERROR);
+	}
+	
+	s->records++;
+	
+	return(RF_OK);
+}
+
+int rf_index_open(rf_index_t *s, const char *filename)
+{
+	uint8_t b[RF_INDEX_HEADER];
+	int64_t length;
+	
+	memset(s, 0, sizeof(rf_index_t));
+	
+	s->f = fopen(filename, "rb");
+	if(!s->f)
+	{
+		perror(filename);
+		return(RF_ERROR);
+	}
+	
+	if(fread(b, sizeof(b), 1, s->f) != 1 ||
+	   memcmp(b, RF_INDEX_MAGIC, 8) != 0 ||
+	   _get32(&b[8]) != RF_INDEX_VERSION ||
+	   _get32(&b[12]) != RF_INDEX_RECORD)
+	{
+		fprintf(stderr, "%s: Not a hacktv frame index\n", filename);
+		rf_index_close(s);
+		return(RF_ERROR);
+	}
+	
+	s->fields = _get32(&b[16]);
+	s->sample_size = _get32(&b[20]);
+	s->sample_rate = _get32(&b[24]);
+	s->first_frame = _get64(&b[32]);
+	s->frame_rate = (r64_t) { (int32_t) _get32(&b[40]), (int32_t) _get32(&b[44]) };
+	s->pts_rate = (r64_t) { (int32_t) _get32(&b[48]), (int32_t) _get32(&b[52]) };
+	s->records = _get64(&b[56]);
+	
+	if(s->records == 0)
+	{
+		/* The writer didn't finish, count the complete records */
+		if(fseeko(s->f, 0, SEEK_END) != 0 || (length = ftello(s->f)) < 0)
+		{
+			perror(filename);
+			rf_index_close(s);
+			return(RF_ERROR);
+		}
+		
+		s->records = (length - RF_INDEX_HEADER) / RF_INDEX_RECORD;
+		
+		/* The first frame is only known once the first record is read */
+		if(s->records > 0)
+		{
+			rf_index_record_t r;
+			
+			s->first_frame = 0;
+			
+			if(rf_index_read(s, 0, &r) != RF_OK)
+			{
+				rf_index_close(s);
+				return(RF_ERROR);
+			}
+			
+			s->first_frame = r.frame;
+		}
+	}
+	
+	return(RF_OK);
+}
+
+int rf_index_read(rf_index_t *s, int64_t n, rf_index_record_t *r)
+{
+	uint8_t b[RF_INDEX_RECORD];
+	
+	if(n < 0 || n >= s->records)
+	{
+		return(RF_ERROR);
+	}
+	
+	if(fseeko(s->f, RF_INDEX_HEADER + n * RF_INDEX_RECORD, SEEK_SET) != 0 ||
+	   fread(b, sizeof(b), 1, s->f) != 1)
+	{
+		return(RF_ERROR);
+	}
+	
+	r->frame = _get64(&b[0]);
+	r->line = (int32_t) _get32(&b[8]);
+	r->offset = _get64(&b[16]);
+	r->pts = _get64(&b[24]);
+	
+	return(RF_OK);
+}
+
+int rf_index_find(rf_index_t *s, int64_t frame, int field, rf_index_record_t *r)
+{
+	if(field < 0 || field >= s->fields)
+	{
+		return(RF_ERROR);
+	}
+	
+	if(rf_index_read(s, (frame - s->first_frame) * s->fields + field, r) != RF_OK)
+	{
+		return(RF_ERROR);
+	}
+	
+	/* Only a broken index would fail this */
+	return(r->frame == frame ? RF_OK : RF_ERROR);
+}
+
+int rf_index_close(rf_index_t *s)
+{
+	int r = RF_OK;
+	
+	if(s->f == NULL)
+	{
+		return(RF_OK);
+	}
+	
+	if(s->write)
+	{
+		if(ferror(s->f) || _write_header(s) != RF_OK)
+		{
+			r = RF_ERROR;
+		}
+	}
+	
+	if(fclose(s->f) != 0)
+	{
+		r = RF_ERROR;
+	}
+	
+	s->f = NULL;
+	
+	return(r);
+}
+
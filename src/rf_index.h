@@ -0,0 +1,97 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2026 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _INDEX_H
+#define _INDEX_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "common.h"
+
+/* Frame index sidecar
+ *
+ * A 64-byte header followed by one 32-byte record for the start of
+ * each frame, or each field for interlaced modes. Records are written
+ * in order starting with frame first_frame, so the record for any
+ * frame is found without reading the rest of the index. All values
+ * are stored little-endian.
+ *
+ * Header:
+ *   0  char[8] "HTVINDEX"
+ *   8  uint32  Version (1)
+ *  12  uint32  Record size in bytes (32)
+ *  16  uint32  Records per frame (1 or 2)
+ *  20  uint32  Bytes per sample in the IQ file
+ *  24  uint32  Sample rate
+ *  28  uint32  Reserved (0)
+ *  32  int64   First frame number
+ *  40  int32   Frame rate numerator
+ *  44  int32   Frame rate denominator
+ *  48  int32   PTS rate numerator
+ *  52  int32   PTS rate denominator
+ *  56  int64   Number of records, or 0 if the index was not closed
+ *
+ * Record:
+ *   0  int64   Frame number
+ *   8  int32   Line number
+ *  12  int32   Reserved (0)
+ *  16  int64   Byte offset of the line in the IQ file
+ *  24  int64   Source position in units of the PTS rate, or -1
+*/
+
+#define RF_INDEX_MAGIC   "HTVINDEX"
+#define RF_INDEX_VERSION 1
+#define RF_INDEX_HEADER  64
+#define RF_INDEX_RECORD  32
+
+typedef struct {
+	int64_t frame;
+	int line;
+	int64_t offset;
+	int64_t pts;
+} rf_index_record_t;
+
+typedef struct {
+	
+	FILE *f;
+	int write;
+	
+	/* Header */
+	int fields;
+	int sample_size;
+	unsigned int sample_rate;
+	int64_t first_frame;
+	r64_t frame_rate;
+	r64_t pts_rate;
+	int64_t records;
+	
+} rf_index_t;
+
+/* Writer */
+extern int rf_index_create(rf_index_t *s, const char *filename, int fields, int sample_size, unsigned int sample_rate, r64_t frame_rate, r64_t pts_rate);
+extern int rf_index_write(rf_index_t *s, const rf_index_record_t *r);
+
+/* Reader. rf_index_find() looks up the record for a frame and field
+ * (0 or 1) directly, rf_index_read() returns record n */
+extern int rf_index_open(rf_index_t *s, const char *filename);
+extern int rf_index_read(rf_index_t *s, int64_t n, rf_index_record_t *r);
+extern int rf_index_find(rf_index_t *s, int64_t frame, int field, rf_index_record_t *r);
+
+extern int rf_index_close(rf_index_t *s);
+
+#endif
+
@@ -0,0 +1,283 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2026 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "common.h"
+#include "rf.h"
+
+/* SigMF sink */
+typedef struct {
+	
+	/* The .sigmf-data file */
+	rf_t data;
+	
+	/* The .sigmf-meta file */
+	FILE *meta;
+	char *meta_name;
+	
+	/* Samples written so far */
+	uint64_t samples;
+	
+	/* The open annotation */
+	int annotations;
+	int frame;
+	int field;
+	uint64_t start;
+	
+} rf_sigmf_t;
+
+static const char *_extensions[] = { ".sigmf-data", ".sigmf-meta", ".sigmf", NULL };
+
+static const char *_datatype(int type, int complex)
+{
+	const uint16_t e = 1;
+	int le = *(const uint8_t *) &e == 1;
+	
+	switch(type)
+	{
+	case RF_UINT8:  return(complex ? "cu8" : "ru8");
+	case RF_INT8:   return(complex ? "ci8" : "ri8");
+	case RF_UINT16: return(complex ? (le ? "cu16_le" : "cu16_be") : (le ? "ru16_le" : "ru16_be"));
+	case RF_INT16:  return(complex ? (le ? "ci16_le" : "ci16_be") : (le ? "ri16_le" : "ri16_be"));
+	case RF_INT32:  return(complex ? (le ? "ci32_le" : "ci32_be") : (le ? "ri32_le" : "ri32_be"));
+	case RF_FLOAT:  return(complex ? (le ? "cf32_le" : "cf32_be") : (le ? "rf32_le" : "rf32_be"));
+	}
+	
+	return(NULL);
+}
+
+/* Write the annotation for the open frame or field, ending at the current sample */
+static void _annotate(rf_sigmf_t *rf)
+{
+	if(rf->frame < 0) return;
+	
+	fprintf(rf->meta,
+		"%s\n"
+		"    {\n"
+		"      \"core:sample_start\": %" PRIu64 ",\n"
+		"      \"core:sample_count\": %" PRIu64 ",\n",
+		rf->annotations > 0 ? "," : "",
+		rf->start,
+		rf->samples - rf->start
+	);
+	
+	if(rf->field > 0)
+	{
+		fprintf(rf->meta, "      \"core:label\": \"frame %d field %d\"\n", rf->frame, rf->field);
+	}
+	else
+	{
+		fprintf(rf->meta, "      \"core:label\": \"frame %d\"\n", rf->frame);
+	}
+	
+	fprintf(rf->meta, "    }");
+	
+	rf->annotations++;
+}
+
+static int _rf_sigmf_write(void *private, const int16_t *iq_data, size_t samples)
+{
+	rf_sigmf_t *rf = private;
+	
+	/* The samples are passed to the file writer untouched */
+	rf->samples += samples;
+	
+	return(rf_write(&rf->data, iq_data, samples));
+}
+
+static int _rf_sigmf_field(void *private, int frame, int field, int line, int64_t pts)
+{
+	rf_sigmf_t *rf = private;
+	
+	_annotate(rf);
+	
+	rf->frame = frame;
+	rf->field = field;
+	rf->start = rf->samples;
+	
+	return(ferror(rf->meta) ? RF_ERROR : RF_OK);
+}
+
+static int _rf_sigmf_close(void *private)
+{
+	rf_sigmf_t *rf = private;
+	int r = RF_OK;
+	
+	if(rf->data.close)
+	{
+		r = rf_close(&rf->data);
+	}
+	
+	if(rf->meta)
+	{
+		/* Close the last annotation and the document */
+		if(rf->samples > rf->start) _annotate(rf);
+		
+		fprintf(rf->meta, "\n  ]\n}\n");
+		
+		if(ferror(rf->meta))
+		{
+			fprintf(stderr, "%s: Error writing metadata\n", rf->meta_name);
+			r = RF_ERROR;
+		}
+		
+		if(fclose(rf->meta) != 0)
+		{
+			perror(rf->meta_name);
+			r = RF_ERROR;
+		}
+	}
+	
+	free(rf->meta_name);
+	free(rf);
+	
+	return(r);
+}
+
+int rf_sigmf_open(rf_t *s, const char *filename, int type, int complex, int writer, size_t buffer, unsigned int sample_rate, uint64_t frequency, const char *description)
+{
+	rf_sigmf_t *rf;
+	const char *datatype;
+	char *data_name;
+	size_t l;
+	int i;
+	
+	if(filename == NULL || *filename == '\0' || strcmp(filename, "-") == 0)
+	{
+		fprintf(stderr, "SigMF output requires a filename.\n");
+		return(RF_ERROR);
+	}
+	
+	datatype = _datatype(type, complex);
+	if(datatype == NULL)
+	{
+		fprintf(stderr, "%s: Unrecognised data type %d\n", __func__, type);
+		return(RF_ERROR);
+	}
+	
+	rf = calloc(1, sizeof(rf_sigmf_t));
+	if(!rf)
+	{
+		perror("calloc");
+		return(RF_ERROR);
+	}
+	
+	rf->frame = -1;
+	
+	/* Strip any SigMF extension from the base name */
+	l = strlen(filename);
+	
+	for(i = 0; _extensions[i] != NULL; i++)
+	{
+		size_t e = strlen(_extensions[i]);
+		
+		if(l > e && strcmp(filename + l - e, _extensions[i]) == 0)
+		{
+			l -= e;
+			break;
+		}
+	}
+	
+	data_name = malloc(l + 12);
+	rf->meta_name = malloc(l + 12);
+	
+	if(!data_name || !rf->meta_name)
+	{
+		perror("malloc");
+		free(data_name);
+		_rf_sigmf_close(rf);
+		return(RF_ERROR);
+	}
+	
+	sprintf(data_name, "%.*s.sigmf-data", (int) l, filename);
+	sprintf(rf->meta_name, "%.*s.sigmf-meta", (int) l, filename);
+	
+	if(rf_file_open(&rf->data, data_name, type, complex, writer, buffer) != RF_OK)
+	{
+		free(data_name);
+		_rf_sigmf_close(rf);
+		return(RF_ERROR);
+	}
+	
+	free(data_name);
+	
+	rf->meta = fopen(rf->meta_name, "w");
+	if(!rf->meta)
+	{
+		perror(rf->meta_name);
+		_rf_sigmf_close(rf);
+		return(RF_ERROR);
+	}
+	
+	/* The global and capture segments are known up front. The
+	 * annotations are streamed as each frame or field completes */
+	fprintf(rf->meta,
+		"{\n"
+		"  \"global\": {\n"
+		"    \"core:datatype\": \"%s\",\n"
+		"    \"core:sample_rate\": %u,\n"
+		"    \"core:version\": \"1.0.0\",\n"
+		"    \"core:recorder\": \"hacktv %s\",\n"
+		"    \"core:description\": \"",
+		datatype,
+		sample_rate,
+		VERSION
+	);
+	
+	fputs_json(description ? description : "", rf->meta);
+	
+	fprintf(rf->meta,
+		"\"\n"
+		"  },\n"
+		"  \"captures\": [\n"
+		"    {\n"
+		"      \"core:sample_start\": 0"
+	);
+	
+	if(frequency > 0)
+	{
+		fprintf(rf->meta, ",\n      \"core:frequency\": %" PRIu64, frequency);
+	}
+	
+	fprintf(rf->meta,
+		"\n"
+		"    }\n"
+		"  ],\n"
+		"  \"annotations\": ["
+	);
+	
+	if(ferror(rf->meta))
+	{
+		perror(rf->meta_name);
+		_rf_sigmf_close(rf);
+		return(RF_ERROR);
+	}
+	
+	/* Register the callback functions */
+	s->ctx = rf;
+	s->write = _rf_sigmf_write;
+	s->write_audio = NULL;
+	s->field = _rf_sigmf_field;
+	s->close = _rf_sigmf_close;
+	
+	return(RF_OK);
+}
+
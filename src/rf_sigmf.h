@@ -0,0 +1,28 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2026 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _SIGMF_H
+#define _SIGMF_H
+
+/* Writes the samples to <base>.sigmf-data with the file writer, and a
+ * SigMF description of the recording to <base>.sigmf-meta. The start
+ * of each frame or field is recorded as an annotation. A .sigmf-data,
+ * .sigmf-meta or .sigmf extension on filename is ignored */
+extern int rf_sigmf_open(rf_t *s, const char *filename, int type, int complex, int writer, size_t buffer, unsigned int sample_rate, uint64_t frequency, const char *description);
+
+#endif
+
@@ -23,6 +23,7 @@
 #include <SoapySDR/Formats.h>
 #include <SoapySDR/Version.h>
 #include "rf.h"
+#include "conv.h"
 
 #define BUF_LEN 4096
 
@@ -52,10 +53,7 @@ static int _rf_write(void *private, const int16_t *iq_data, size_t samples)
 			buffs[0] = rf->txbuf;
 			l = (samples > BUF_LEN ? BUF_LEN : samples);
 			
-			for(r = 0; r < 2 * l; r++)
-			{
-				rf->txbuf[r] = iq_data[r] * rf->scale / INT16_MAX;
-			}
+			conv_int16_scale(rf->txbuf, iq_data, 2 * l, rf->scale);
 		}
 		else
 		{
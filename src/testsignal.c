@@ -1179,6 +1179,15 @@ int testsignal_next_line(vid_t *s, void *arg, int nlines, vid_line_t **lines)
 	return(1);
 }
 
+void testsignal_seek(testsignal_t *tc, uint64_t samples)
+{
+	/* Skip ahead, drawing the text the skipped line 0 would have */
+	tc->pos = (tc->pos + samples % tc->nsamples) % tc->nsamples;
+	
+	if(tc->pos)
+		_testsignal_text_process(tc);
+}
+
 static int _testsignal_configure(testsignal_t* tc, vid_t *vid)
 {
 	const testsignal_params_t *params = NULL;
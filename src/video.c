@@ -19,6 +19,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "video.h"
 #include "nicam728.h"
 #include "dance.h"
@@ -34,9 +37,9 @@
  * 
  * The encoder makes liberal use of lookup tables:
  * 
- * - 3x for RGB > gamma corrected Y, I and Q levels.
- * 
- * - A temporary gamma table used while generating the above.
+ * - 3x for RGB > gamma corrected Y, I and Q levels. This
+ *   table is 96 MB, so by default the levels are calculated
+ *   for each pixel instead using a small gamma table.
  * 
  * - PAL colour carrier (4 full frames in length + 1 line) or
  *   NTSC colour carrier (2 full lines + 1 line).
@@ -47,6 +50,30 @@
 #define SECAM_CB_FREQ 4250000 /* 272 fH */
 #define SECAM_CR_FREQ 4406250 /* 282 fH */
 
+/* Number of lines the threaded pipeline may render ahead */
+#define _PIPELINE_DEPTH 32
+
+/* Size of the FM modulator sine table, as a power of 2 */
+#define _FM_LUT_BITS 10
+
+/* Limit on the number of phases in the audio resamplers */
+#define _AUDIO_MAX_PHASES 16384
+
+/* Longest periodic offset rotator table, and the size of the
+ * phase accumulator table used beyond that, as a power of 2 */
+#define _OFFSET_MAX_PERIOD 65536
+#define _OFFSET_LUT_BITS   16
+
+/* Short periods are repeated up to this length, so
+ * each line is multiplied in long runs */
+#define _OFFSET_MIN_LENGTH 4096
+
+/* Samples per block in phase accumulator mode */
+#define _OFFSET_BLOCK      256
+
+/* Pixels of chrominance rendered and modulated at a time */
+#define _CHROMA_BLOCK      256
+
 const vid_config_t vid_config_pal_i = {
 	
 	/* System I (PAL) */
@@ -2353,29 +2380,32 @@ static int16_t *_burstwin(unsigned int sample_rate, double width, double rise, d
 }
 
 /* FM modulator
- * deviation = peak deviation in Hz (+/-) from frequency */
+ * deviation = peak deviation in Hz (+/-) from frequency
+ * 
+ * The carrier phase is a 32-bit accumulator, advanced each sample by
+ * the carrier frequency plus the sample times the deviation. The top
+ * bits index a small sine table, with linear interpolation between
+ * the entries using the next 16 bits. */
 static int _init_fm_modulator(_mod_fm_t *fm, int sample_rate, double frequency, double deviation, double level)
 {
-	int r;
-	double d;
+	int i;
 	
-	fm->level   = round(INT16_MAX * level);
-	fm->counter = INT16_MAX;
-	fm->phase.i = INT32_MAX;
-	fm->phase.q = 0;
-	fm->lut     = malloc(sizeof(cint32_t) * (UINT16_MAX + 1));
+	fm->level     = round(INT16_MAX * level);
+	fm->phase     = 0;
+	fm->delta     = (uint32_t) llround(frequency / sample_rate * 4294967296.0);
+	fm->deviation = llround(deviation / sample_rate * 4294967296.0 * 65536.0 / INT16_MAX);
 	
+	/* One and a quarter cycles plus one entry, so the cosine
+	 * is at a fixed offset and interpolation doesn't wrap */
+	fm->lut = malloc(sizeof(int16_t) * ((1 << _FM_LUT_BITS) * 5 / 4 + 1));
 	if(!fm->lut)
 	{
 		return(VID_OUT_OF_MEMORY);
 	}
 	
-	for(r = INT16_MIN; r <= INT16_MAX; r++)
+	for(i = 0; i <= (1 << _FM_LUT_BITS) * 5 / 4; i++)
 	{
-		d = 2.0 * M_PI / sample_rate * (frequency + (double) r / INT16_MAX * deviation);
-		
-		fm->lut[r - INT16_MIN].i = lround(cos(d) * INT32_MAX);
-		fm->lut[r - INT16_MIN].q = lround(sin(d) * INT32_MAX);
+		fm->lut[i] = lround(sin(2.0 * M_PI * i / (1 << _FM_LUT_BITS)) * INT16_MAX);
 	}
 	
 	return(VID_OK);
@@ -2395,87 +2425,93 @@ static int _init_fm_energy_dispersal(_mod_fm_t *fm, int sample_rate, r64_t frequ
 	return(VID_OK);
 }
 
-static void inline _fm_modulator_add(_mod_fm_t *fm, int16_t *dst, int16_t sample)
+static inline void _fm_modulator_next(_mod_fm_t *fm, int16_t sample, int *i, int *q)
 {
-	cint32_mul(&fm->phase, &fm->phase, &fm->lut[sample - INT16_MIN]);
+	const int16_t *lut;
+	int f;
 	
-	dst[0] += ((fm->phase.i >> 16) * fm->level) >> 15;
-	dst[1] += ((fm->phase.q >> 16) * fm->level) >> 15;
+	fm->phase += fm->delta + (uint32_t) ((sample * fm->deviation) >> 16);
 	
-	/* Correct the amplitude after INT16_MAX samples */
-	if(--fm->counter == 0)
-	{
-		double ra = atan2(fm->phase.q, fm->phase.i);
-		
-		fm->phase.i = lround(cos(ra) * INT32_MAX);
-		fm->phase.q = lround(sin(ra) * INT32_MAX);
-		
-		fm->counter = INT16_MAX;
-	}
+	lut = &fm->lut[fm->phase >> (32 - _FM_LUT_BITS)];
+	f = (fm->phase >> (16 - _FM_LUT_BITS)) & 0xFFFF;
+	
+	*q = lut[0] + (((lut[1] - lut[0]) * f) >> 16);
+	lut += 1 << (_FM_LUT_BITS - 2);
+	*i = lut[0] + (((lut[1] - lut[0]) * f) >> 16);
+	
+	*i = (*i * fm->level) >> 15;
+	*q = (*q * fm->level) >> 15;
 }
 
-static void inline _fm_modulator_cgain(_mod_fm_t *fm, int16_t *dst, int16_t sample, const cint16_t *g)
+static void _fm_mod_block(_mod_fm_t *fm, int16_t *out, const int16_t *in, int n)
 {
-	/* Only used by SECAM */
+	int16_t sample;
+	int x, i, q;
 	
-	cint32_mul(&fm->phase, &fm->phase, &fm->lut[sample - INT16_MIN]);
+	/* Modulates n samples of in, with a step of 2 (interleaved).
+	 * May be used in-place */
 	
-	dst[0] = (((((fm->phase.i >> 16) * fm->level) >> 15) * g->i) >> 15)
-	       - (((((fm->phase.q >> 16) * fm->level) >> 15) * g->q) >> 15);
-	
-	/* Correct the amplitude after INT16_MAX samples */
-	if(--fm->counter == 0)
+	for(x = 0; x < n; x++, out += 2, in += 2)
 	{
-		double ra = atan2(fm->phase.q, fm->phase.i);
+		sample = *in;
+		
+		if(fm->ed_overflow.quot != 0)
+		{
+			sample += abs(fm->ed_counter.quot + -fm->ed_overflow.quot / 2) - fm->ed_overflow.quot / 4;
+			
+			fm->ed_counter.quot += fm->ed_delta.quot;
+			fm->ed_counter.rem  += fm->ed_delta.rem;
+			
+			if(fm->ed_counter.rem >= fm->ed_overflow.rem)
+			{
+				fm->ed_counter.quot++;
+				fm->ed_counter.rem -= fm->ed_overflow.rem;
+			}
+			
+			if(fm->ed_counter.quot >= fm->ed_overflow.quot)
+			{
+				fm->ed_counter.quot -= fm->ed_overflow.quot;
+			}
+		}
 		
-		fm->phase.i = lround(cos(ra) * INT32_MAX);
-		fm->phase.q = lround(sin(ra) * INT32_MAX);
+		_fm_modulator_next(fm, sample, &i, &q);
 		
-		fm->counter = INT16_MAX;
+		out[0] = i;
+		out[1] = q;
 	}
 }
 
-static void inline _fm_modulator(_mod_fm_t *fm, int16_t *dst, int16_t sample)
+static void _fm_mod_block_add(_mod_fm_t *fm, int16_t *out, const int16_t *in, int n)
 {
-	if(fm->ed_overflow.quot != 0)
+	int x, i, q;
+	
+	/* As _fm_mod_block(), but adds the carrier to out and the
+	 * input is not interleaved. Only the phase is advanced
+	 * if out is NULL */
+	
+	if(out == NULL)
 	{
-		sample += abs(fm->ed_counter.quot + -fm->ed_overflow.quot / 2) - fm->ed_overflow.quot / 4;
-		
-		fm->ed_counter.quot += fm->ed_delta.quot;
-		fm->ed_counter.rem  += fm->ed_delta.rem;
-		
-		if(fm->ed_counter.rem >= fm->ed_overflow.rem)
+		for(x = 0; x < n; x++)
 		{
-			fm->ed_counter.quot++;
-			fm->ed_counter.rem -= fm->ed_overflow.rem;
+			fm->phase += fm->delta + (uint32_t) ((in[x] * fm->deviation) >> 16);
 		}
 		
-		if(fm->ed_counter.quot >= fm->ed_overflow.quot)
-		{
-			fm->ed_counter.quot -= fm->ed_overflow.quot;
-		}
+		return;
 	}
 	
-	cint32_mul(&fm->phase, &fm->phase, &fm->lut[sample - INT16_MIN]);
-	
-	dst[0] = ((fm->phase.i >> 16) * fm->level) >> 15;
-	dst[1] = ((fm->phase.q >> 16) * fm->level) >> 15;
-	
-	/* Correct the amplitude after INT16_MAX samples */
-	if(--fm->counter == 0)
+	for(x = 0; x < n; x++, out += 2)
 	{
-		double ra = atan2(fm->phase.q, fm->phase.i);
-		
-		fm->phase.i = lround(cos(ra) * INT32_MAX);
-		fm->phase.q = lround(sin(ra) * INT32_MAX);
+		_fm_modulator_next(fm, in[x], &i, &q);
 		
-		fm->counter = INT16_MAX;
+		out[0] += i;
+		out[1] += q;
 	}
 }
 
 static void _free_fm_modulator(_mod_fm_t *fm)
 {
 	free(fm->lut);
+	fir_int16_free(&fm->resampler);
 }
 
 /* AM modulator */
@@ -2516,9 +2552,70 @@ static void inline _am_modulator_add(_mod_am_t *am, int16_t *dst, int16_t sample
 	}
 }
 
+static void _am_modulator_skip(_mod_am_t *am, int n)
+{
+	/* As _am_modulator_add(), without any output */
+	for(; n > 0; n--)
+	{
+		cint32_mul(&am->phase, &am->phase, &am->delta);
+		
+		if(--am->counter == 0)
+		{
+			double ra = atan2(am->phase.q, am->phase.i);
+			
+			am->phase.i = lround(cos(ra) * INT32_MAX);
+			am->phase.q = lround(sin(ra) * INT32_MAX);
+			
+			am->counter = INT16_MAX;
+		}
+	}
+}
+
 static void _free_am_modulator(_mod_am_t *am)
 {
-	/* Nothing */
+	fir_int16_free(&am->resampler);
+}
+
+/* Audio resamplers */
+static void _vid_audio_ratio(vid_t *s)
+{
+	r64_t r;
+	int64_t h0 = 0, h1 = 1, k0 = 1, k1 = 0;
+	int64_t a, h, k, p, q;
+	
+	r = r64_div((r64_t) { s->sample_rate, 1 }, (r64_t) { HACKTV_AUDIO_SAMPLE_RATE, 1 });
+	
+	/* Each phase of the resampler has its own set of taps. For sample
+	 * rates that need too many phases the ratio is replaced with the
+	 * nearest continued fraction convergent that doesn't. The audio
+	 * rate is then slightly off, typically by a few parts per million */
+	for(p = r.num, q = r.den; q != 0; p = q, q = a)
+	{
+		a = p / q;
+		h = a * h1 + h0;
+		k = a * k1 + k0;
+		
+		if(h > _AUDIO_MAX_PHASES && k1 != 0) break;
+		
+		h0 = h1; h1 = h;
+		k0 = k1; k1 = k;
+		a = p % q;
+	}
+	
+	s->audio_interpolation = h1;
+	s->audio_decimation = k1;
+}
+
+static int _init_audio_resampler(vid_t *s, fir_int16_t *fir)
+{
+	int r;
+	
+	r = fir_int16_resampler_init(fir,
+		(r64_t) { s->audio_interpolation, s->audio_decimation },
+		(r64_t) { 1, 1 }
+	);
+	
+	return(r == 0 ? VID_OK : VID_OUT_OF_MEMORY);
 }
 
 void _test_sample_rate(const vid_config_t *conf, unsigned int sample_rate)
@@ -2550,6 +2647,7 @@ static int _vid_next_line_rawbb(vid_t *s, void *arg, int nlines, vid_line_t **li
 	l->width     = s->width;
 	l->frame     = s->bframe;
 	l->line      = s->bline;
+	l->pts       = s->vframe_pts;
 	l->vbialloc  = 0;
 	l->lut       = NULL;
 	l->audio     = NULL;
@@ -2583,124 +2681,643 @@ static int _vid_next_line_rawbb(vid_t *s, void *arg, int nlines, vid_line_t **li
 	return(1);
 }
 
-static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **lines)
+static _yuv16_t _rgb_to_yuv(const vid_t *s, uint32_t c)
 {
-	const char *seq;
-	int x;
-	int vy;
-	int pal = 0;
-	int fsc = 0;
-	uint8_t sc = 0;
-	int al, ar;
-	vid_line_t *l = lines[1];
+	_yuv16_t yuv;
+	double r, g, b;
+	double y, u, v;
+	double d;
 	
-	l->width     = s->width;
-	l->frame     = s->bframe;
-	l->line      = s->bline;
-	l->vbialloc  = 0;
-	l->lut       = NULL;
-	l->audio     = NULL;
-	l->audio_len = 0;
+	/* Calculate RGB 0..1 values */
+	r = s->yuv_glut[(c & 0xFF0000) >> 16];
+	g = s->yuv_glut[(c & 0x00FF00) >> 8];
+	b = s->yuv_glut[(c & 0x0000FF) >> 0];
 	
-	/* Sequence codes: abcd
-	 * 
-	 * a: first sync
-	 *    h = horizontal sync pulse
-	 *    v = short vertical sync pulse
-	 *    V = long vertical sync pulse
-	 *    _ = no sync pulse
-	 * 
-	 * b: colour burst
-	 *    0 = line always has a colour burst
-	 *    _ = line never has a colour burst
-	 *    1 = line has a colour burst on odd frames
-	 *    2 = line has a colour burst on even frames
-	 * 
-	 * c: left content
-	 *    _ = blanking
-	 *    a = active video
-	 * 
-	 * d: right content
-	 *    _ = blanking
-	 *    a = active video
-	 *    v = short vertical sync pulse
-	 *    V = long vertical sync pulse
-	 * 
-	 **** I don't like this code, it's overly complicated for all it does.
-	*/
+	/* Calculate Y, Cb and Cr values */
+	y = r * s->conf.rw_co
+	  + g * s->conf.gw_co
+	  + b * s->conf.bw_co;
+	u = (b - y) * s->conf.eu_co;
+	v = (r - y) * s->conf.ev_co;
 	
-	vy = -1;
-	seq = "____";
+	/* Limit magnitude of D/D2-MAC chrominance to -0.5 >= 0.5 */
+	if(s->conf.type == VID_MAC)
+	{
+		d = fabs(u) > fabs(v) ? fabs(u) : fabs(v);
+		if(d > 0.5)
+		{
+			d = 0.5 / d;
+			u *= d;
+			v *= d;
+		}
+	}
 	
-	if(s->conf.type == VID_RASTER_625)
+	/* Adjust values to correct signal level */
+	y = (s->conf.black_level + (y * (s->conf.white_level - s->conf.black_level))) * s->yuv_level;
+	
+	if(s->conf.colour_mode != VID_SECAM)
+	{
+		u *= (s->conf.white_level - s->conf.black_level) * s->yuv_level;
+		v *= (s->conf.white_level - s->conf.black_level) * s->yuv_level;
+	}
+	else
+	{
+		u = (u + SECAM_CB_FREQ - SECAM_FM_FREQ) / SECAM_FM_DEV;
+		v = (v + SECAM_CR_FREQ - SECAM_FM_FREQ) / SECAM_FM_DEV;
+	}
+	
+	/* Convert to INT16 range */
+	yuv.y = round(_dlimit(y, -1, 1) * INT16_MAX);
+	yuv.u = round(_dlimit(u, -1, 1) * INT16_MAX);
+	yuv.v = round(_dlimit(v, -1, 1) * INT16_MAX);
+	
+	return(yuv);
+}
+
+static void _yuv_matrix(const vid_t *s, int16_t *py, int16_t *pu, int16_t *pv, float r, float g, float b)
+{
+	const float (*m)[3] = s->yuv_matrix;
+	float y, u, v;
+	float d;
+	
+	y = r * m[0][0] + g * m[0][1] + b * m[0][2];
+	u = r * m[1][0] + g * m[1][1] + b * m[1][2];
+	v = r * m[2][0] + g * m[2][1] + b * m[2][2];
+	
+	if(s->conf.type == VID_MAC)
 	{
-		switch(l->line)
+		d = fabsf(u) > fabsf(v) ? fabsf(u) : fabsf(v);
+		if(d > 0.5f)
 		{
-		case 1:   seq = "V__V"; break;
-		case 2:   seq = "V__V"; break;
-		case 3:   seq = "V__v"; break;
-		case 4:   seq = "v__v"; break;
-		case 5:   seq = "v__v"; break;
-		case 6:   seq = "h1__"; break;
-		case 7:   seq = "h0__"; break;
-		case 8:   seq = "h0__"; break;
-		case 9:   seq = "h0__"; break;
-		case 10:  seq = "h0__"; break;
-		case 11:  seq = "h0__"; break;
-		case 12:  seq = "h0__"; break;
-		case 13:  seq = "h0__"; break;
-		case 14:  seq = "h0__"; break;
-		case 15:  seq = "h0__"; break;
-		case 16:  seq = "h0__"; break;
-		case 17:  seq = "h0__"; break;
-		case 18:  seq = "h0__"; break;
-		case 19:  seq = "h0__"; break;
-		case 20:  seq = "h0__"; break;
-		case 21:  seq = "h0__"; break;
-		case 22:  seq = "h0__"; break;
-		case 23:  seq = "h0_a"; break;
+			d = 0.5f / d;
+			u *= d;
+			v *= d;
+		}
+	}
+	
+	y = y * s->yuv_scale[0] + s->yuv_offset[0];
+	u = u * s->yuv_scale[1] + s->yuv_offset[1];
+	v = v * s->yuv_scale[2] + s->yuv_offset[2];
+	
+	if(py) *py = lrintf(y < -INT16_MAX ? -INT16_MAX : (y > INT16_MAX ? INT16_MAX : y));
+	if(pu) *pu = lrintf(u < -INT16_MAX ? -INT16_MAX : (u > INT16_MAX ? INT16_MAX : u));
+	if(pv) *pv = lrintf(v < -INT16_MAX ? -INT16_MAX : (v > INT16_MAX ? INT16_MAX : v));
+}
+
+static void _rgb_to_yuv_matrix(const vid_t *s, int16_t *py, int16_t *pu, int16_t *pv, uint32_t c)
+{
+	_yuv_matrix(s, py, pu, pv,
+		s->yuv_gamma[(c >> 16) & 0xFF],
+		s->yuv_gamma[(c >>  8) & 0xFF],
+		s->yuv_gamma[(c >>  0) & 0xFF]
+	);
+}
+
+static float _ycc_gamma(const vid_t *s, float x)
+{
+	x = x < 0.0f ? 0.0f : (x > 1.0f ? 1.0f : x);
+	
+	/* The gamma table is indexed by 8-bit R'G'B' values */
+	return(s->conf.gamma == 1.0 ? x : s->yuv_gamma[lrintf(x * 255.0f)]);
+}
+
+static void _ycc_to_yuv_matrix(const vid_t *s, int16_t *py, int16_t *pu, int16_t *pv, const uint8_t *p[3], int o)
+{
+	const float (*m)[3] = s->ycc_matrix;
+	float y = p[0][o], cb = p[1][o], cr = p[2][o];
+	
+	_yuv_matrix(s, py, pu, pv,
+		_ycc_gamma(s, y * m[0][0] + cb * m[0][1] + cr * m[0][2] + s->ycc_offset[0]),
+		_ycc_gamma(s, y * m[1][0] + cb * m[1][1] + cr * m[1][2] + s->ycc_offset[1]),
+		_ycc_gamma(s, y * m[2][0] + cb * m[2][1] + cr * m[2][2] + s->ycc_offset[2])
+	);
+}
+
+#ifdef __SSE2__
+
+static void _yuv_store_ps(int16_t *p, int step, __m128 x)
+{
+	int16_t t[8];
+	
+	x = _mm_max_ps(_mm_min_ps(x, _mm_set1_ps(INT16_MAX)), _mm_set1_ps(-INT16_MAX));
+	_mm_storeu_si128((__m128i *) t, _mm_packs_epi32(_mm_cvtps_epi32(x), _mm_setzero_si128()));
+	
+	p[0 * step] = t[0];
+	p[1 * step] = t[1];
+	p[2 * step] = t[2];
+	p[3 * step] = t[3];
+}
+
+/* Four pixels at a time version of _yuv_matrix() */
+static void _yuv_matrix_sse2(const vid_t *s, int16_t *py, int16_t *pu, int16_t *pv, int step, __m128 r, __m128 g, __m128 b)
+{
+	const float (*m)[3] = s->yuv_matrix;
+	__m128 y, u, v;
+	
+	if(py)
+	{
+		y = _mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(r, _mm_set1_ps(m[0][0])),
+			_mm_mul_ps(g, _mm_set1_ps(m[0][1]))),
+			_mm_mul_ps(b, _mm_set1_ps(m[0][2]))
+		);
 		
-		case 310: seq = "h1aa"; break;
-		case 311: seq = "v__v"; break;
-		case 312: seq = "v__v"; break;
-		case 313: seq = "v__V"; break;
-		case 314: seq = "V__V"; break;
-		case 315: seq = "V__V"; break;
-		case 316: seq = "v__v"; break;
-		case 317: seq = "v__v"; break;
-		case 318: seq = "v___"; break;
-		case 319: seq = "h2__"; break;
-		case 320: seq = "h0__"; break;
-		case 321: seq = "h0__"; break;
-		case 322: seq = "h0__"; break;
-		case 323: seq = "h0__"; break;
-		case 324: seq = "h0__"; break;
-		case 325: seq = "h0__"; break;
-		case 326: seq = "h0__"; break;
-		case 327: seq = "h0__"; break;
-		case 328: seq = "h0__"; break;
-		case 329: seq = "h0__"; break;
-		case 330: seq = "h0__"; break;
-		case 331: seq = "h0__"; break;
-		case 332: seq = "h0__"; break;
-		case 333: seq = "h0__"; break;
-		case 334: seq = "h0__"; break;
-		case 335: seq = "h0__"; break;
+		y = _mm_add_ps(_mm_mul_ps(y, _mm_set1_ps(s->yuv_scale[0])), _mm_set1_ps(s->yuv_offset[0]));
+		_yuv_store_ps(py, step, y);
+	}
+	
+	if(pu || pv)
+	{
+		u = _mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(r, _mm_set1_ps(m[1][0])),
+			_mm_mul_ps(g, _mm_set1_ps(m[1][1]))),
+			_mm_mul_ps(b, _mm_set1_ps(m[1][2]))
+		);
 		
-		case 622: seq = "h1aa"; break;
-		case 623: seq = "h_av"; break;
-		case 624: seq = "v__v"; break;
-		case 625: seq = "v__v"; break;
+		v = _mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(r, _mm_set1_ps(m[2][0])),
+			_mm_mul_ps(g, _mm_set1_ps(m[2][1]))),
+			_mm_mul_ps(b, _mm_set1_ps(m[2][2]))
+		);
 		
-		default:  seq = "h0aa"; break;
+		if(s->conf.type == VID_MAC)
+		{
+			/* Limit magnitude of the chrominance to 0.5 */
+			const __m128 abs = _mm_castsi128_ps(_mm_set1_epi32(INT32_MAX));
+			__m128 d, k;
+			
+			d = _mm_max_ps(_mm_and_ps(u, abs), _mm_and_ps(v, abs));
+			k = _mm_cmpgt_ps(d, _mm_set1_ps(0.5f));
+			d = _mm_div_ps(_mm_set1_ps(0.5f), d);
+			d = _mm_or_ps(_mm_and_ps(k, d), _mm_andnot_ps(k, _mm_set1_ps(1.0f)));
+			u = _mm_mul_ps(u, d);
+			v = _mm_mul_ps(v, d);
 		}
 		
-		/* Calculate the active line number */
-		vy = (l->line < 313 ? (l->line - 23) * 2 : (l->line - 336) * 2 + 1);
+		if(pu)
+		{
+			u = _mm_add_ps(_mm_mul_ps(u, _mm_set1_ps(s->yuv_scale[1])), _mm_set1_ps(s->yuv_offset[1]));
+			_yuv_store_ps(pu, step, u);
+		}
+		
+		if(pv)
+		{
+			v = _mm_add_ps(_mm_mul_ps(v, _mm_set1_ps(s->yuv_scale[2])), _mm_set1_ps(s->yuv_offset[2]));
+			_yuv_store_ps(pv, step, v);
+		}
 	}
-	else if(s->conf.type == VID_RASTER_525)
+}
+
+/* Four pixels at a time version of _rgb_to_yuv_matrix() */
+static int _rgb_to_yuv_sse2(const vid_t *s, int16_t *py, int16_t *pu, int16_t *pv, int step, const uint32_t *prgb, int stride, int n)
+{
+	const float *gl = s->yuv_gamma;
+	__m128 r, g, b;
+	uint32_t c0, c1, c2, c3;
+	int x;
+	
+	for(x = 0; x + 4 <= n; x += 4, prgb += stride * 4)
+	{
+		c0 = prgb[0];
+		c1 = prgb[stride];
+		c2 = prgb[stride * 2];
+		c3 = prgb[stride * 3];
+		
+		r = _mm_setr_ps(gl[(c0 >> 16) & 0xFF], gl[(c1 >> 16) & 0xFF], gl[(c2 >> 16) & 0xFF], gl[(c3 >> 16) & 0xFF]);
+		g = _mm_setr_ps(gl[(c0 >>  8) & 0xFF], gl[(c1 >>  8) & 0xFF], gl[(c2 >>  8) & 0xFF], gl[(c3 >>  8) & 0xFF]);
+		b = _mm_setr_ps(gl[(c0 >>  0) & 0xFF], gl[(c1 >>  0) & 0xFF], gl[(c2 >>  0) & 0xFF], gl[(c3 >>  0) & 0xFF]);
+		
+		_yuv_matrix_sse2(s, py, pu, pv, step, r, g, b);
+		
+		if(py) py += step * 4;
+		if(pu) pu += step * 4;
+		if(pv) pv += step * 4;
+	}
+	
+	return(x);
+}
+
+static __m128 _ycc_load_ps(const uint8_t *p, int stride)
+{
+	return(_mm_cvtepi32_ps(_mm_setr_epi32(p[0], p[stride], p[stride * 2], p[stride * 3])));
+}
+
+static __m128 _ycc_gamma_ps(const vid_t *s, __m128 x)
+{
+	int32_t i[4];
+	
+	x = _mm_max_ps(_mm_min_ps(x, _mm_set1_ps(1.0f)), _mm_setzero_ps());
+	if(s->conf.gamma == 1.0) return(x);
+	
+	_mm_storeu_si128((__m128i *) i, _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(255.0f))));
+	
+	return(_mm_setr_ps(s->yuv_gamma[i[0]], s->yuv_gamma[i[1]], s->yuv_gamma[i[2]], s->yuv_gamma[i[3]]));
+}
+
+/* Four pixels at a time version of _ycc_to_yuv_matrix() */
+static int _ycc_to_yuv_sse2(const vid_t *s, int16_t *py, int16_t *pu, int16_t *pv, int step, const uint8_t *p[3], int stride, int n)
+{
+	const float (*m)[3] = s->ycc_matrix;
+	__m128 y, cb, cr;
+	__m128 c[3];
+	int x, i, o;
+	
+	for(x = 0, o = 0; x + 4 <= n; x += 4, o += stride * 4)
 	{
-		switch(l->line)
+		y  = _ycc_load_ps(p[0] + o, stride);
+		cb = _ycc_load_ps(p[1] + o, stride);
+		cr = _ycc_load_ps(p[2] + o, stride);
+		
+		for(i = 0; i < 3; i++)
+		{
+			c[i] = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+				_mm_mul_ps(y,  _mm_set1_ps(m[i][0])),
+				_mm_mul_ps(cb, _mm_set1_ps(m[i][1]))),
+				_mm_mul_ps(cr, _mm_set1_ps(m[i][2]))),
+				_mm_set1_ps(s->ycc_offset[i])
+			);
+			
+			c[i] = _ycc_gamma_ps(s, c[i]);
+		}
+		
+		_yuv_matrix_sse2(s, py, pu, pv, step, c[0], c[1], c[2]);
+		
+		if(py) py += step * 4;
+		if(pu) pu += step * 4;
+		if(pv) pv += step * 4;
+	}
+	
+	return(x);
+}
+
+#endif
+
+void vid_rgb_to_yuv(const vid_t *s, int16_t *py, int16_t *pu, int16_t *pv, int step, const uint32_t *prgb, int stride, int n)
+{
+	_yuv16_t yuv;
+	int x = 0;
+	
+	if(s->yuv_level_lookup)
+	{
+		for(; x < n; x++, prgb += stride)
+		{
+			yuv = s->yuv_level_lookup[*prgb & 0xFFFFFF];
+			if(py) { *py = yuv.y; py += step; }
+			if(pu) { *pu = yuv.u; pu += step; }
+			if(pv) { *pv = yuv.v; pv += step; }
+		}
+		
+		return;
+	}
+	
+#ifdef __SSE2__
+	x = _rgb_to_yuv_sse2(s, py, pu, pv, step, prgb, stride, n);
+	prgb += stride * x;
+	if(py) py += step * x;
+	if(pu) pu += step * x;
+	if(pv) pv += step * x;
+#endif
+	
+	for(; x < n; x++, prgb += stride)
+	{
+		_rgb_to_yuv_matrix(s, py, pu, pv, *prgb);
+		if(py) py += step;
+		if(pu) pu += step;
+		if(pv) pv += step;
+	}
+}
+
+static void _ycc_to_yuv(const vid_t *s, int16_t *py, int16_t *pu, int16_t *pv, int step, const uint8_t *p[3], int stride, int n)
+{
+	int x = 0;
+	
+#ifdef __SSE2__
+	x = _ycc_to_yuv_sse2(s, py, pu, pv, step, p, stride, n);
+	if(py) py += step * x;
+	if(pu) pu += step * x;
+	if(pv) pv += step * x;
+#endif
+	
+	for(; x < n; x++)
+	{
+		_ycc_to_yuv_matrix(s, py, pu, pv, p, x * stride);
+		if(py) py += step;
+		if(pu) pu += step;
+		if(pv) pv += step;
+	}
+}
+
+void vid_frame_to_yuv(const vid_t *s, int16_t *py, int16_t *pu, int16_t *pv, int step, int x, int y, int xstep, int n)
+{
+	const av_frame_t *f = &s->vframe;
+	const uint8_t *p[3];
+	int o = y * f->line_stride + x * f->pixel_stride;
+	
+	if(f->format == AV_FRAME_YCC444)
+	{
+		p[0] = f->ycc[0] + o;
+		p[1] = f->ycc[1] + o;
+		p[2] = f->ycc[2] + o;
+		
+		_ycc_to_yuv(s, py, pu, pv, step, p, f->pixel_stride * xstep, n);
+	}
+	else
+	{
+		vid_rgb_to_yuv(s, py, pu, pv, step, &f->framebuffer[o], f->pixel_stride * xstep, n);
+	}
+}
+
+static void _vid_ycc_init(vid_t *s)
+{
+	double kr, kb, kg;
+	double ys, yo, cs;
+	double m[3][3];
+	int i, j;
+	
+	/* Calculate the Y'CbCr > R'G'B' matrix for the current frame */
+	if(s->vframe.ycc_matrix == AV_YCC_BT709)
+	{
+		kr = 0.2126;
+		kb = 0.0722;
+	}
+	else
+	{
+		kr = 0.299;
+		kb = 0.114;
+	}
+	
+	kg = 1.0 - kr - kb;
+	
+	if(s->vframe.ycc_full_range)
+	{
+		ys = 1.0 / 255;
+		yo = 0;
+		cs = 1.0 / 255;
+	}
+	else
+	{
+		ys = 1.0 / 219;
+		yo = -16.0 / 219;
+		cs = 1.0 / 224;
+	}
+	
+	m[0][0] = ys;
+	m[0][1] = 0;
+	m[0][2] = 2.0 * (1.0 - kr) * cs;
+	m[1][0] = ys;
+	m[1][1] = -2.0 * kb * (1.0 - kb) / kg * cs;
+	m[1][2] = -2.0 * kr * (1.0 - kr) / kg * cs;
+	m[2][0] = ys;
+	m[2][1] = 2.0 * (1.0 - kb) * cs;
+	m[2][2] = 0;
+	
+	for(i = 0; i < 3; i++)
+	{
+		for(j = 0; j < 3; j++)
+		{
+			s->ycc_matrix[i][j] = m[i][j];
+		}
+		
+		/* Cb and Cr are offset by 128 */
+		s->ycc_offset[i] = yo - (m[i][1] + m[i][2]) * 128;
+	}
+}
+
+/* Frame cache
+ * 
+ * With a still source the active video of each line only changes with the
+ * colour subcarrier phase, which repeats after a few frames. The cache holds
+ * the rendered luma and chrominance of the active video for every line of
+ * that sequence, and is replayed while the source frame hash is unchanged.
+ * The syncs, colour burst and all the later line processes still run.
+*/
+
+#define _FRAME_CACHE_MAX_FRAMES 8
+
+static int _vid_frame_cache_init(vid_t *s)
+{
+	int64_t f = 1;
+	int64_t r;
+	size_t n;
+	
+	if(s->colour_lookup_width > 0)
+	{
+		/* Number of frames before the subcarrier phase repeats */
+		r = (int64_t) s->conf.lines * s->width % s->colour_lookup_width;
+		if(r > 0) f = s->colour_lookup_width / gcd(s->colour_lookup_width, r);
+		
+		/* The PAL V-switch and burst blanking alternate every frame */
+		if(f & 1) f *= 2;
+	}
+	
+	if(f > _FRAME_CACHE_MAX_FRAMES)
+	{
+		fprintf(stderr, "Warning: The colour subcarrier repeats every %d frames, frame cache disabled.\n", (int) f);
+		return(VID_OK);
+	}
+	
+	n = (size_t) f * s->conf.lines;
+	
+	s->frame_cache_lines = calloc(n, sizeof(_vid_cache_line_t));
+	s->frame_cache = malloc(sizeof(int16_t) * 2 * s->active_width * n);
+	if(!s->frame_cache_lines || !s->frame_cache)
+	{
+		return(VID_OUT_OF_MEMORY);
+	}
+	
+	/* Generation 0 marks an empty entry */
+	s->frame_cache_frames = f;
+	s->frame_cache_hash = 0;
+	s->frame_cache_gen = 1;
+	
+	return(VID_OK);
+}
+
+static void _vid_frame_cache_update(vid_t *s)
+{
+	const uint32_t *p;
+	const uint8_t *c;
+	uint64_t h = 0xCBF29CE484222325ULL;
+	int x, y, i;
+	
+	/* FNV-1a over the frame geometry and visible pixels. Each
+	 * step is reversible, so a single changed word always
+	 * changes the hash */
+	h = (h ^ s->vframe.width) * 0x100000001B3ULL;
+	h = (h ^ s->vframe.height) * 0x100000001B3ULL;
+	h = (h ^ s->vframe.interlaced) * 0x100000001B3ULL;
+	h = (h ^ (uint32_t) s->vframe_x) * 0x100000001B3ULL;
+	h = (h ^ (uint32_t) s->vframe_y) * 0x100000001B3ULL;
+	h = (h ^ s->vframe.format) * 0x100000001B3ULL;
+	h = (h ^ s->vframe.ycc_matrix) * 0x100000001B3ULL;
+	h = (h ^ s->vframe.ycc_full_range) * 0x100000001B3ULL;
+	h = (h ^ av_frame_empty(&s->vframe)) * 0x100000001B3ULL;
+	
+	for(y = 0; s->vframe.framebuffer && y < s->vframe.height; y++)
+	{
+		p = &s->vframe.framebuffer[y * s->vframe.line_stride];
+		
+		for(x = 0; x < s->vframe.width; x++, p += s->vframe.pixel_stride)
+		{
+			h = (h ^ *p) * 0x100000001B3ULL;
+		}
+	}
+	
+	for(i = 0; s->vframe.ycc[0] && i < 3; i++)
+	{
+		for(y = 0; y < s->vframe.height; y++)
+		{
+			c = &s->vframe.ycc[i][y * s->vframe.line_stride];
+			
+			for(x = 0; x < s->vframe.width; x++, c += s->vframe.pixel_stride)
+			{
+				h = (h ^ *c) * 0x100000001B3ULL;
+			}
+		}
+	}
+	
+	if(h != s->frame_cache_hash)
+	{
+		/* Invalidate the whole cache */
+		s->frame_cache_hash = h;
+		s->frame_cache_gen++;
+	}
+}
+
+static int16_t *_vid_frame_cache_line(vid_t *s, const vid_line_t *l, unsigned int lut, int vy, int pal, int *hit)
+{
+	_vid_cache_line_t *c;
+	
+	*hit = 0;
+	
+	if(s->frame_cache == NULL)
+	{
+		return(NULL);
+	}
+	
+	c = &s->frame_cache_lines[(l->frame % s->frame_cache_frames) * s->conf.lines + l->line - 1];
+	
+	if(c->gen == s->frame_cache_gen && c->lut == lut && c->pal == pal && c->vy == vy)
+	{
+		*hit = 1;
+	}
+	else
+	{
+		/* The caller replaces this entry with the line it renders */
+		c->gen = s->frame_cache_gen;
+		c->lut = lut;
+		c->pal = pal;
+		c->vy = vy;
+	}
+	
+	return(&s->frame_cache[(size_t) (c - s->frame_cache_lines) * s->active_width * 2]);
+}
+
+/* Returns the sequence code and active line number of a raster line,
+ * vid_init() uses these to build the line descriptors and templates */
+static const char *_vid_raster_seq(const vid_t *s, int line, int *vy)
+{
+	const char *seq;
+	
+	/* Sequence codes: abcd
+	 * 
+	 * a: first sync
+	 *    h = horizontal sync pulse
+	 *    v = short vertical sync pulse
+	 *    V = long vertical sync pulse
+	 *    _ = no sync pulse
+	 * 
+	 * b: colour burst
+	 *    0 = line always has a colour burst
+	 *    _ = line never has a colour burst
+	 *    1 = line has a colour burst on odd frames
+	 *    2 = line has a colour burst on even frames
+	 * 
+	 * c: left content
+	 *    _ = blanking
+	 *    a = active video
+	 * 
+	 * d: right content
+	 *    _ = blanking
+	 *    a = active video
+	 *    v = short vertical sync pulse
+	 *    V = long vertical sync pulse
+	 * 
+	 **** I don't like this code, it's overly complicated for all it does.
+	*/
+	
+	*vy = -1;
+	seq = "____";
+	
+	if(s->conf.type == VID_RASTER_625)
+	{
+		switch(line)
+		{
+		case 1:   seq = "V__V"; break;
+		case 2:   seq = "V__V"; break;
+		case 3:   seq = "V__v"; break;
+		case 4:   seq = "v__v"; break;
+		case 5:   seq = "v__v"; break;
+		case 6:   seq = "h1__"; break;
+		case 7:   seq = "h0__"; break;
+		case 8:   seq = "h0__"; break;
+		case 9:   seq = "h0__"; break;
+		case 10:  seq = "h0__"; break;
+		case 11:  seq = "h0__"; break;
+		case 12:  seq = "h0__"; break;
+		case 13:  seq = "h0__"; break;
+		case 14:  seq = "h0__"; break;
+		case 15:  seq = "h0__"; break;
+		case 16:  seq = "h0__"; break;
+		case 17:  seq = "h0__"; break;
+		case 18:  seq = "h0__"; break;
+		case 19:  seq = "h0__"; break;
+		case 20:  seq = "h0__"; break;
+		case 21:  seq = "h0__"; break;
+		case 22:  seq = "h0__"; break;
+		case 23:  seq = "h0_a"; break;
+		
+		case 310: seq = "h1aa"; break;
+		case 311: seq = "v__v"; break;
+		case 312: seq = "v__v"; break;
+		case 313: seq = "v__V"; break;
+		case 314: seq = "V__V"; break;
+		case 315: seq = "V__V"; break;
+		case 316: seq = "v__v"; break;
+		case 317: seq = "v__v"; break;
+		case 318: seq = "v___"; break;
+		case 319: seq = "h2__"; break;
+		case 320: seq = "h0__"; break;
+		case 321: seq = "h0__"; break;
+		case 322: seq = "h0__"; break;
+		case 323: seq = "h0__"; break;
+		case 324: seq = "h0__"; break;
+		case 325: seq = "h0__"; break;
+		case 326: seq = "h0__"; break;
+		case 327: seq = "h0__"; break;
+		case 328: seq = "h0__"; break;
+		case 329: seq = "h0__"; break;
+		case 330: seq = "h0__"; break;
+		case 331: seq = "h0__"; break;
+		case 332: seq = "h0__"; break;
+		case 333: seq = "h0__"; break;
+		case 334: seq = "h0__"; break;
+		case 335: seq = "h0__"; break;
+		
+		case 622: seq = "h1aa"; break;
+		case 623: seq = "h_av"; break;
+		case 624: seq = "v__v"; break;
+		case 625: seq = "v__v"; break;
+		
+		default:  seq = "h0aa"; break;
+		}
+		
+		/* Calculate the active line number */
+		*vy = (line < 313 ? (line - 23) * 2 : (line - 336) * 2 + 1);
+	}
+	else if(s->conf.type == VID_RASTER_525)
+	{
+		switch(line)
 		{
 		case 1:   seq = "v__v"; break;
 		case 2:   seq = "v__v"; break;
@@ -2756,11 +3373,11 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 		 * Practice RP-202. Lines 23-262 from the first field and
 		 * 286-525 from the second. */
 		
-		vy = (l->line < 265 ? (l->line - 23) * 2 : (l->line - 286) * 2 + 1);
+		*vy = (line < 265 ? (line - 23) * 2 : (line - 286) * 2 + 1);
 	}
 	else if(s->conf.type == VID_RASTER_819)
 	{
-		switch(l->line)
+		switch(line)
 		{
 		case 817: seq = "h___"; break;
 		case 818: seq = "h___"; break;
@@ -2851,11 +3468,11 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 		}
 		
 		/* Calculate the active line number */
-		vy = (l->line < 406 ? (l->line - 48) * 2 : (l->line - 457) * 2 + 1);
+		*vy = (line < 406 ? (line - 48) * 2 : (line - 457) * 2 + 1);
 	}
 	else if(s->conf.type == VID_RASTER_405)
 	{
-		switch(l->line)
+		switch(line)
 		{
 		case 1:   seq = "V__V"; break;
 		case 2:   seq = "V__V"; break;
@@ -2894,11 +3511,11 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 		}
 		
 		/* Calculate the active line number */
-		vy = (l->line < 210 ? (l->line - 16) * 2 : (l->line - 219) * 2 + 1);
+		*vy = (line < 210 ? (line - 16) * 2 : (line - 219) * 2 + 1);
 	}
 	else if(s->conf.type == VID_CBS_405)
 	{
-		switch(l->line)
+		switch(line)
 		{
 		case 1:   seq = "v__v"; break;
 		case 2:   seq = "v__v"; break;
@@ -2935,19 +3552,19 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 		}
 		
 		/* Calculate the active line number */
-		vy = (l->line < 210 ? (l->line - 16) * 2 : (l->line - 219) * 2 + 1);
+		*vy = (line < 210 ? (line - 16) * 2 : (line - 219) * 2 + 1);
 	}
 	else if(s->conf.type == VID_APOLLO_320)
 	{
-		if(l->line <= 8) seq = "V__v";
+		if(line <= 8) seq = "V__v";
 		else seq = "h_aa";
 		
-		vy = l->line - 9;
-		if(vy < 0 || vy >= s->conf.active_lines) vy = -1;
+		*vy = line - 9;
+		if(*vy < 0 || *vy >= s->conf.active_lines) *vy = -1;
 	}
 	else if(s->conf.type == VID_BAIRD_240)
 	{
-		switch(l->line)
+		switch(line)
 		{
 		case 1:   seq = "V__V"; break;
 		case 2:   seq = "V__V"; break;
@@ -2974,171 +3591,462 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 		}
 		
 		/* Calculate the active line number */
-		vy = l->line - 20;
+		*vy = line - 20;
 	}
 	else if(s->conf.type == VID_BAIRD_30)
 	{
 		/* The original Baird 30 line standard has no sync pulses */
 		seq = "__aa";
-		vy = l->line - 1;
+		*vy = line - 1;
 	}
 	else if(s->conf.type == VID_NBTV_32)
 	{
-		switch(l->line)
+		switch(line)
 		{
 		case 1:  seq = "__aa"; break;
 		default: seq = "h_aa"; break;
 		}
 		
-		vy = l->line - 1;
+		*vy = line - 1;
 	}
 	
-	/* Shift the lines by one if the source
-	 * video has the bottom field first */
-	if(vy >= 0 && s->vframe.interlaced == 2) vy += 1;
-	
-	/* Centre the video vertically */
-	vy -= s->vframe_y;
+	return(seq);
+}
+
+static int _vid_raster_init_lines(vid_t *s)
+{
+	_vid_raster_line_t *d;
+	const char *seq;
+	int i;
 	
-	/* Check for out of bounds */
-	if(vy < 0 || vy >= s->vframe.height) vy = -1;
+	s->raster_lines = calloc(s->conf.lines, sizeof(_vid_raster_line_t));
+	if(!s->raster_lines)
+	{
+		return(VID_OUT_OF_MEMORY);
+	}
 	
-	if(s->conf.colour_mode == VID_PAL ||
-	   s->conf.colour_mode == VID_NTSC)
+	for(i = 0; i < s->conf.lines; i++)
 	{
-		/* Does this line use colour? */
-		pal  = seq[1] == '0';
-		pal |= seq[1] == '1' && (l->frame & 1) == 0;
-		pal |= seq[1] == '2' && (l->frame & 1) == 1;
+		d = &s->raster_lines[i];
+		seq = _vid_raster_seq(s, i + 1, &d->vy);
 		
-		/* Calculate colour sub-carrier lookup-positions for the start of this line */
-		l->lut = &s->colour_lookup[s->colour_lookup_offset];
+		d->burst = seq[1];
 		
-		/* Update offset for the next line */
-		s->colour_lookup_offset += s->width;
-		s->colour_lookup_offset %= s->colour_lookup_width;
+		/* Calculate active video portion of this line */
+		d->al = (seq[2] == 'a' ? s->active_left : (seq[3] == 'a' ? s->half_width : 0));
+		d->ar = (seq[3] == 'a' ? s->active_left + s->active_width : (seq[2] == 'a' ? s->half_width : 0));
 		
-		if(s->conf.colour_mode == VID_PAL && pal &&
-		   (l->frame + l->line) & 1)
-		{
-			pal = -1;
-		}
+		/* Left sync pulse */
+		if(seq[0] == 'h')      d->sync |= 1 << 0;
+		else if(seq[0] == 'v') d->sync |= 1 << 1;
+		else if(seq[0] == 'V') d->sync |= 1 << 2;
 		
-		/* Clear the chrominance buffer */
-		if(pal) memset(s->chrominance_buffer, 0, sizeof(int16_t) * 2 * s->width);
+		/* Middle sync pulse */
+		if(seq[3] == 'v')      d->sync |= 1 << 3;
+		else if(seq[3] == 'V') d->sync |= 1 << 4;
 	}
-	else if(s->conf.colour_mode == VID_APOLLO_FSC)
+	
+	return(VID_OK);
+}
+
+/* Pre-render the blanking and sync pulses of each line. The template for
+ * line N + 1 holds the blanking level, the overrun of line N's sync pulses
+ * and line N + 1's own. The raster copies it in while rendering line N,
+ * where it used to blank the line and draw the pulses. The start of a sync
+ * pulse can fall at the end of the previous line, this is kept as a tail */
+static int _vid_raster_init_templates(vid_t *s)
+{
+	_vid_raster_line_t *d;
+	vid_line_t sl[4];
+	int16_t *r, *t;
+	uint8_t sync;
+	int keys[32 * 32];
+	int tails[32][3];
+	int ntemplates, ntails;
+	int i, j, k, x;
+	
+	/* Render the pulses of each code over three scratch lines,
+	 * with a zero width line as a boundary on either side */
+	r = calloc(32 * 3 * 2 * s->width, sizeof(int16_t));
+	if(!r)
 	{
-		/* Apollo Field Sequential Colour */
-		fsc = (l->frame * 2 + (l->line < 264 ? 0 : 1)) % 3;
-		pal = 0;
+		return(VID_OUT_OF_MEMORY);
 	}
-	else if(s->conf.colour_mode == VID_CBS_FSC)
+	
+	ntails = 0;
+	
+	for(i = 0; i < 32; i++)
 	{
-		/* CBS Field Sequential Colour */
-		fsc = (l->frame * 2 + (l->line < 202 ? 0 : 1)) % 3;
-		pal = 0;
+		for(j = 0; j < 4; j++)
+		{
+			sl[j].width = (j == 0 ? 0 : s->width);
+			sl[j].output = &r[(i * 3 + (j == 0 ? 0 : j - 1)) * 2 * s->width];
+			sl[j].previous = &sl[(j + 3) % 4];
+			sl[j].next = &sl[(j + 1) % 4];
+		}
+		
+		sync = i;
+		vbidata_render(s->syncs, &sync, 0, 5, VBIDATA_LSB_FIRST, &sl[2]);
+		
+		/* Find the part of the pulses in the previous line */
+		for(x = 0; x < s->width && sl[1].output[x * 2] == 0; x++);
+		for(k = s->width; k > x && sl[1].output[(k - 1) * 2] == 0; k--);
+		
+		tails[i][0] = x;
+		tails[i][1] = k - x;
+		tails[i][2] = ntails;
+		ntails += k - x;
 	}
 	
-	/* Blank the next line */
-	for(x = 0; x < s->max_width; x++)
+	/* One template is needed for each pair of consecutive codes */
+	for(i = 0; i < 32 * 32; i++)
+	{
+		keys[i] = -1;
+	}
+	
+	for(ntemplates = i = 0; i < s->conf.lines; i++)
+	{
+		d = &s->raster_lines[i];
+		k = d->sync * 32 + s->raster_lines[(i + 1) % s->conf.lines].sync;
+		if(keys[k] < 0) keys[k] = ntemplates++;
+		
+		d->next = keys[k];
+		d->tail_x = tails[d->sync][0];
+		d->tail_n = tails[d->sync][1];
+	}
+	
+	s->raster_templates = malloc(sizeof(int16_t) * 2 * s->max_width * ntemplates);
+	s->raster_tails = malloc(sizeof(int16_t) * (ntails > 0 ? ntails : 1));
+	
+	if(!s->raster_templates || !s->raster_tails)
+	{
+		free(r);
+		return(VID_OUT_OF_MEMORY);
+	}
+	
+	for(k = 0; k < 32 * 32; k++)
+	{
+		if(keys[k] < 0) continue;
+		
+		t = &s->raster_templates[keys[k] * 2 * s->max_width];
+		
+		for(x = 0; x < s->max_width; x++)
+		{
+			t[x * 2 + 0] = s->blanking_level;
+			t[x * 2 + 1] = 0;
+		}
+		
+		for(x = 0; x < s->width; x++)
+		{
+			t[x * 2] += r[((k / 32) * 3 + 2) * 2 * s->width + x * 2];
+			t[x * 2] += r[((k % 32) * 3 + 1) * 2 * s->width + x * 2];
+		}
+	}
+	
+	for(i = 0; i < 32; i++)
+	{
+		for(x = 0; x < tails[i][1]; x++)
+		{
+			s->raster_tails[tails[i][2] + x] = r[i * 3 * 2 * s->width + (tails[i][0] + x) * 2];
+		}
+	}
+	
+	for(i = 0; i < s->conf.lines; i++)
+	{
+		d = &s->raster_lines[i];
+		d->tail = &s->raster_tails[tails[d->sync][2]];
+	}
+	
+	free(r);
+	
+	return(VID_OK);
+}
+
+/* Generate the colour subcarrier for a line starting at position
+ * offset in the subcarrier sequence, the same as the lookup table */
+static const cint16_t *_vid_colour_line(vid_t *s, vid_line_t *l, unsigned int offset)
+{
+	cint16_t *lut = &s->colour_lines[(l - s->oline) * s->width];
+	const double *b = s->colour_line_base;
+	double a, i, q;
+	int x;
+	
+	/* The phase at the start of the line. This is
+	 * calculated exactly, so it never drifts */
+	a = (uint64_t) offset * s->colour_lookup_cycles % s->colour_lookup_width;
+	a = 2.0 * M_PI * a / s->colour_lookup_width;
+	i = cos(a) * INT16_MAX;
+	q = sin(a) * INT16_MAX;
+	
+	for(x = 0; x < s->width; x++, b += 2)
+	{
+		a = i * b[0] - q * b[1];
+		lut[x].i = a + (a < 0 ? -0.5 : 0.5);
+		
+		a = i * b[1] + q * b[0];
+		lut[x].q = a + (a < 0 ? -0.5 : 0.5);
+	}
+	
+	return(lut);
+}
+
+#ifdef __SSE2__
+/* Four pixels at a time version of _vid_chroma_mod(). Returns the
+ * number of pixels processed */
+static int _vid_chroma_mod_sse2(int16_t *o, int q, const cint16_t *lut, const int16_t *uv, int pal, int n)
+{
+	const __m128i m = _mm_set1_epi32(0x0000FFFF);
+	__m128i k, c, t;
+	int x;
+	
+	for(x = 0; x + 4 <= n; x += 4, o += 8, uv += 8)
 	{
-		lines[2]->output[x * 2 + 0] = s->blanking_level;
-		lines[2]->output[x * 2 + 1] = 0;
+		k = _mm_loadu_si128((const __m128i *) &lut[x]);
+		
+		/* Swap U/V to V/U, to line up with the I/Q of the subcarrier */
+		c = _mm_loadu_si128((const __m128i *) uv);
+		c = _mm_shufflehi_epi16(_mm_shufflelo_epi16(c, 0xB1), 0xB1);
+		
+		if(pal > 0)
+		{
+			/* lut.i * v + lut.q * u */
+			t = _mm_madd_epi16(k, c);
+		}
+		else
+		{
+			/* lut.q * u - lut.i * v */
+			t = _mm_sub_epi32(
+				_mm_madd_epi16(k, _mm_andnot_si128(m, c)),
+				_mm_madd_epi16(k, _mm_and_si128(m, c))
+			);
+		}
+		
+		t = _mm_srai_epi32(t, 15);
+		t = q ? _mm_slli_epi32(t, 16) : _mm_and_si128(t, m);
+		
+		_mm_storeu_si128((__m128i *) o, _mm_add_epi16(_mm_loadu_si128((const __m128i *) o), t));
+	}
+	
+	return(x);
+}
+#endif
+
+/* Modulate the colour subcarrier with n pixels of interleaved U/V
+ * starting at pixel x, and add it to the output line. The quadrature /
+ * imaginary result is used. V is inverted when pal is -1 */
+static void _vid_chroma_mod(const vid_t *s, vid_line_t *l, const int16_t *uv, int pal, int x, int n)
+{
+	const cint16_t *lut = &l->lut[x];
+	int16_t *o = &l->output[x * 2];
+	int q = s->conf.s_video ? 1 : 0;
+	int i = 0;
+	
+#ifdef __SSE2__
+	i = _vid_chroma_mod_sse2(o, q, lut, uv, pal, n);
+#endif
+	
+	for(; i < n; i++)
+	{
+		o[i * 2 + q] += (lut[i].i * uv[i * 2 + 1] * pal +
+		                 lut[i].q * uv[i * 2 + 0]) >> 15;
 	}
+}
+
+static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **lines)
+{
+	const _vid_raster_line_t *d;
+	int x;
+	int vy;
+	int pal = 0;
+	int fsc = 0;
+	uint8_t sc = 0;
+	int al = 0, ar = 0;
+	int16_t *cache = NULL;
+	int cached = 0;
+	unsigned int lut = 0;
+	vid_line_t *l = lines[1];
+	int first = l->width == 0;
+	
+	l->width     = s->width;
+	l->frame     = s->bframe;
+	l->line      = s->bline;
+	l->pts       = s->vframe_pts;
+	l->vbialloc  = 0;
+	l->lut       = NULL;
+	l->audio     = NULL;
+	l->audio_len = 0;
 	
-	x = 0;
+	/* Look up the line's descriptor */
+	d = &s->raster_lines[l->line - 1];
+	vy = d->vy;
+	
+	/* Shift the lines by one if the source
+	 * video has the bottom field first */
+	if(vy >= 0 && s->vframe.interlaced == 2) vy += 1;
 	
-	/* Draw the sync pulses */
-	sc = 0x00;
+	/* Centre the video vertically */
+	vy -= s->vframe_y;
 	
-	/* Left sync pulse */
-	if(seq[0] == 'h')      sc |= 1 << 0;
-	else if(seq[0] == 'v') sc |= 1 << 1;
-	else if(seq[0] == 'V') sc |= 1 << 2;
+	/* Check for out of bounds */
+	if(vy < 0 || vy >= s->vframe.height) vy = -1;
 	
-	/* Middle sync pulse */
-	if(seq[3] == 'v')      sc |= 1 << 3;
-	else if(seq[3] == 'V') sc |= 1 << 4;
+	if(s->conf.colour_mode == VID_PAL ||
+	   s->conf.colour_mode == VID_NTSC)
+	{
+		/* Does this line use colour? */
+		pal  = d->burst == '0';
+		pal |= d->burst == '1' && (l->frame & 1) == 0;
+		pal |= d->burst == '2' && (l->frame & 1) == 1;
+		
+		/* Calculate colour sub-carrier lookup-positions for the start of this line */
+		lut = s->colour_lookup_offset;
+		
+		if(s->colour_lookup)
+		{
+			l->lut = &s->colour_lookup[lut];
+		}
+		else
+		{
+			l->lut = _vid_colour_line(s, l, lut);
+		}
+		
+		/* Update offset for the next line */
+		s->colour_lookup_offset += s->width;
+		s->colour_lookup_offset %= s->colour_lookup_width;
+		
+		if(s->conf.colour_mode == VID_PAL && pal &&
+		   (l->frame + l->line) & 1)
+		{
+			pal = -1;
+		}
+	}
+	else if(s->conf.colour_mode == VID_APOLLO_FSC)
+	{
+		/* Apollo Field Sequential Colour */
+		fsc = (l->frame * 2 + (l->line < 264 ? 0 : 1)) % 3;
+		pal = 0;
+	}
+	else if(s->conf.colour_mode == VID_CBS_FSC)
+	{
+		/* CBS Field Sequential Colour */
+		fsc = (l->frame * 2 + (l->line < 202 ? 0 : 1)) % 3;
+		pal = 0;
+	}
 	
-	if(sc)
+	if(first)
 	{
+		/* The first line has no template, draw its sync pulses */
+		sc = d->sync;
 		vbidata_render(s->syncs, &sc, 0, 5, VBIDATA_LSB_FIRST, l);
 	}
+	else if(lines[0]->width > 0)
+	{
+		/* Add the start of this line's sync pulse to the previous line */
+		for(x = 0; x < d->tail_n; x++)
+		{
+			lines[0]->output[(d->tail_x + x) * 2] += d->tail[x];
+		}
+	}
+	
+	/* The next line starts as blanking with its sync pulses, and any
+	 * overrun from this line's. Set its width here so this doesn't
+	 * depend on the line's previous use */
+	memcpy(lines[2]->output, &s->raster_templates[d->next * s->max_width * 2], sizeof(int16_t) * 2 * s->max_width);
+	lines[2]->width = s->width;
 	
 	/* Render the active video if required */
-	if(seq[2] == 'a' || seq[3] == 'a')
+	if(d->ar > d->al)
 	{
 		uint32_t rgb = 0x000000;
 		uint32_t *prgb = &rgb;
 		int stride = 0;
 		int16_t *o, *oc;
+		int n;
 		
-		/* Calculate active video portion of this line */
-		al = (seq[2] == 'a' ? s->active_left : (seq[3] == 'a' ? s->half_width : -1));
-		ar = (seq[3] == 'a' ? s->active_left + s->active_width : (seq[2] == 'a' ? s->half_width : -1));
+		/* The active video portion of this line */
+		al = d->al;
+		ar = d->ar;
 		
-		for(x = al, o = &l->output[al * 2]; x < s->active_left + s->vframe_x; x++, o += 2)
-		{
-			*o = s->yuv_level_lookup[0x000000].y;
-		}
+		cache = _vid_frame_cache_line(s, l, lut, vy, pal, &cached);
 		
-		if(s->vframe.framebuffer && vy >= 0)
+		if(cached)
 		{
-			prgb  = &s->vframe.framebuffer[vy * s->vframe.line_stride];
-			prgb += (x - s->active_left - s->vframe_x) * s->vframe.pixel_stride;
-			stride = s->vframe.pixel_stride;
+			/* Replay the luma and chrominance from the frame cache */
+			memcpy(&l->output[al * 2], &cache[(al - s->active_left) * 2], sizeof(int16_t) * 2 * (ar - al));
 		}
-		
-		oc = &s->chrominance_buffer[x * 2];
-		for(; x < s->active_left + s->vframe_x + s->vframe.width && x < ar; x++, o += 2, oc += 2, prgb += stride)
+		else
 		{
-			rgb = *prgb & 0xFFFFFF;
+			for(x = al, o = &l->output[al * 2]; x < s->active_left + s->vframe_x; x++, o += 2)
+			{
+				*o = s->yuv_black.y;
+			}
 			
-			if(s->conf.colour_mode == VID_APOLLO_FSC ||
-			   s->conf.colour_mode == VID_CBS_FSC)
+			if(s->vframe.framebuffer && vy >= 0)
 			{
-				rgb  = (rgb >> (8 * fsc)) & 0xFF;
-				rgb |= (rgb << 8) | (rgb << 16);
+				prgb  = &s->vframe.framebuffer[vy * s->vframe.line_stride];
+				prgb += (x - s->active_left - s->vframe_x) * s->vframe.pixel_stride;
+				stride = s->vframe.pixel_stride;
 			}
 			
-			*o = s->yuv_level_lookup[rgb].y;
+			n = s->active_left + s->vframe_x + s->vframe.width;
+			if(n > ar) n = ar;
+			n -= x;
+			
+			if(n > 0 &&
+			   (s->conf.colour_mode == VID_APOLLO_FSC ||
+			    s->conf.colour_mode == VID_CBS_FSC))
+			{
+				for(; n > 0; n--, x++, o += 2, prgb += stride)
+				{
+					rgb  = (*prgb >> (8 * fsc)) & 0xFF;
+					rgb |= (rgb << 8) | (rgb << 16);
+					
+					vid_rgb_to_yuv(s, o, NULL, NULL, 2, &rgb, 0, 1);
+				}
+			}
+			else if(n > 0)
+			{
+				int frame = vy >= 0 && !av_frame_empty(&s->vframe);
+				int i;
+				
+				oc = pal ? s->chrominance_buffer : NULL;
+				
+				/* Render the luminance and add the colour subcarrier
+				 * a block at a time, while the chrominance is in cache */
+				for(; n > 0; n -= i, x += i, o += i * 2, prgb += stride * i)
+				{
+					i = n < _CHROMA_BLOCK ? n : _CHROMA_BLOCK;
+					
+					if(frame)
+					{
+						vid_frame_to_yuv(s, o, oc ? &oc[0] : NULL, oc ? &oc[1] : NULL, 2, x - s->active_left - s->vframe_x, vy, 1, i);
+					}
+					else
+					{
+						vid_rgb_to_yuv(s, o, oc ? &oc[0] : NULL, oc ? &oc[1] : NULL, 2, prgb, stride, i);
+					}
+					
+					if(pal) _vid_chroma_mod(s, l, oc, pal, x, i);
+				}
+			}
 			
-			if(pal)
+			for(; x < ar; x++, o += 2)
 			{
-				oc[0] = s->yuv_level_lookup[rgb].u;
-				oc[1] = s->yuv_level_lookup[rgb].v;
+				*o = s->yuv_black.y;
 			}
 		}
-		
-		for(; x < ar; x++, o += 2)
-		{
-			*o = s->yuv_level_lookup[0x000000].y;
-		}
 	}
 	
 	if(pal)
 	{
-		int16_t *o, *oc;
-		
-		/* Render the colour burst */
-		oc = &s->chrominance_buffer[s->burst_left * 2];
-		for(x = 0; x < s->burst_width; x++, oc += 2)
-		{
-			oc[0] = (s->burst_phase.i * s->burst_win[x]) >> 15;
-			oc[1] = (s->burst_phase.q * s->burst_win[x]) >> 15;
-		}
-		
-		/* Render the colour subcarrier */
-		o = l->output + (s->conf.s_video ? 1 : 0);
-		oc = s->chrominance_buffer;
-		for(x = 0; x < s->width; x++, o += 2, oc += 2)
-		{
-			/* The quadrature / imaginary result is used
-			 * to render the sub-carrier */
-			*o += (l->lut[x].i * oc[1] * pal +
-			       l->lut[x].q * oc[0]) >> 15;
-		}
+		/* Add the colour burst */
+		_vid_chroma_mod(s, l, s->burst_chroma, pal, s->burst_left, s->burst_width);
+	}
+	
+	if(cache && !cached)
+	{
+		/* Store the rendered active video in the frame cache */
+		memcpy(&cache[(al - s->active_left) * 2], &l->output[al * 2], sizeof(int16_t) * 2 * (ar - al));
 	}
 	
 	/* Render the Apollo FSC flag */
@@ -3167,6 +4075,7 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 	if(s->conf.colour_mode == VID_SECAM)
 	{
 		const cint16_t *g;
+		int i, q;
 		int16_t dmin, dmax;
 		int sl = 0, sr = 0;
 		
@@ -3180,13 +4089,13 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 			
 			if(((l->frame * s->conf.lines) + l->line) & 1)
 			{
-				level = s->yuv_level_lookup[0x000000].v; // D'r
+				level = s->yuv_black.v; // D'r
 				dev = s->secam_fsync_level;
 				rw = 15e-6;
 			}
 			else
 			{
-				level = s->yuv_level_lookup[0x000000].u; // D'b
+				level = s->yuv_black.u; // D'b
 				dev = -s->secam_fsync_level;
 				rw = 18e-6;
 			}
@@ -3206,17 +4115,10 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 			
 			l->vbialloc = 1;
 		}
-		else if(seq[2] == 'a' || seq[3] == 'a')
+		else if(d->ar > d->al)
 		{
 			uint32_t rgb = 0x000000;
-			uint32_t *prgb = &rgb;
-			int stride = 0;
-			
-			if(s->vframe.framebuffer && vy >= 0)
-			{
-				prgb = &s->vframe.framebuffer[vy * s->vframe.line_stride];
-				stride = s->vframe.pixel_stride;
-			}
+			int frame = vy >= 0 && !av_frame_empty(&s->vframe);
 			
 			if(((l->frame * s->conf.lines) + l->line) & 1)
 			{
@@ -3224,17 +4126,16 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 				
 				for(x = 0; x < s->active_left + s->vframe_x; x++)
 				{
-					s->chrominance_buffer[x] = s->yuv_level_lookup[0x000000].v;
+					s->chrominance_buffer[x] = s->yuv_black.v;
 				}
 				
-				for(; x < s->active_left + s->vframe_x + s->vframe.width; x++, prgb += stride)
-				{
-					s->chrominance_buffer[x] = s->yuv_level_lookup[*prgb & 0xFFFFFF].v;
-				}
+				if(frame) vid_frame_to_yuv(s, NULL, NULL, &s->chrominance_buffer[x], 1, 0, vy, 1, s->vframe.width);
+				else vid_rgb_to_yuv(s, NULL, NULL, &s->chrominance_buffer[x], 1, &rgb, 0, s->vframe.width);
+				x += s->vframe.width;
 				
 				for(; x < s->width; x++)
 				{
-					s->chrominance_buffer[x] = s->yuv_level_lookup[0x000000].v;
+					s->chrominance_buffer[x] = s->yuv_black.v;
 				}
 			}
 			else
@@ -3243,22 +4144,21 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 				
 				for(x = 0; x < s->active_left + s->vframe_x; x++)
 				{
-					s->chrominance_buffer[x] = s->yuv_level_lookup[0x000000].u;
+					s->chrominance_buffer[x] = s->yuv_black.u;
 				}
 				
-				for(; x < s->active_left + s->vframe_x + s->vframe.width; x++, prgb += stride)
-				{
-					s->chrominance_buffer[x] = s->yuv_level_lookup[*prgb & 0xFFFFFF].u;
-				}
+				if(frame) vid_frame_to_yuv(s, NULL, &s->chrominance_buffer[x], NULL, 1, 0, vy, 1, s->vframe.width);
+				else vid_rgb_to_yuv(s, NULL, &s->chrominance_buffer[x], NULL, 1, &rgb, 0, s->vframe.width);
+				x += s->vframe.width;
 				
 				for(; x < s->width; x++)
 				{
-					s->chrominance_buffer[x] = s->yuv_level_lookup[0x000000].u;
+					s->chrominance_buffer[x] = s->yuv_black.u;
 				}
 			}
 			
 			sl = s->burst_left;
-			sr = seq[3] == 'a' ? sl + s->burst_width : s->half_width;
+			sr = d->ar != s->half_width ? sl + s->burst_width : s->half_width;
 		}
 		
 		if(sr > sl)
@@ -3270,9 +4170,7 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 			iir_int16_process(&s->fm_secam_iir, s->chrominance_buffer, s->chrominance_buffer, s->width, 1);
 			
 			/* Reset the SECAM FM phase every line, alternating every third line */
-			s->fm_secam.counter = INT16_MAX;
-			s->fm_secam.phase.i = ((l->frame * s->conf.lines) + l->line) % 3 == 0 ? INT32_MAX : -INT32_MAX;
-			s->fm_secam.phase.q = 0;
+			s->fm_secam.phase = ((l->frame * s->conf.lines) + l->line) % 3 == 0 ? 0 : 0x80000000;
 			
 			/* Limit the FM deviation */
 			dmin = s->fm_secam_dmin[((l->frame * s->conf.lines) + l->line) & 1];
@@ -3285,7 +4183,8 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 				else if(s->chrominance_buffer[x] > dmax) s->chrominance_buffer[x] = dmax;
 				
 				g = &s->fm_secam_bell[(uint16_t) s->chrominance_buffer[x]];
-				_fm_modulator_cgain(&s->fm_secam, &s->chrominance_buffer[x], s->chrominance_buffer[x], g);
+				_fm_modulator_next(&s->fm_secam, s->chrominance_buffer[x], &i, &q);
+				s->chrominance_buffer[x] = ((i * g->i) >> 15) - ((q * g->q) >> 15);
 				
 				o[x * 2] += (s->chrominance_buffer[x] * s->burst_win[x - s->burst_left]) >> 15;
 			}
@@ -3321,178 +4220,310 @@ static void _vid_filter_free(vid_t *s, void *arg)
 	free(p);
 }
 
-static int _vid_audio_process(vid_t *s, void *arg, int nlines, vid_line_t **lines)
+static void _vid_audio_output(vid_t *s, vid_line_t *l)
 {
-	vid_line_t *l = lines[0];
-	int16_t audio[2] = { 0, 0 };
-	int16_t *buf;
-	int x;
+	l->audio_len = fifo_read(&s->audio_reader, (void **) &l->audio, NICAM_AUDIO_LEN * 2 * 10 * sizeof(int16_t), 0);
+	l->audio_len /= sizeof(int16_t);
+	if(l->audio_len == 0) l->audio = NULL;
+}
+
+static int64_t _vid_audio_clock(vid_t *s, int64_t samples)
+{
+	int64_t n;
 	
-	for(x = 0; x < l->width; x++)
+	/* Returns the number of new audio samples the resamplers need to
+	 * produce the next "samples" output samples, and advances the clock.
+	 * This follows fir_int16_process(), which only reads a new input
+	 * sample when it is needed for the next output */
+	if(samples <= 0) return(0);
+	
+	n = (s->audio_phase + (samples - 1) * s->audio_decimation) / s->audio_interpolation;
+	s->audio_phase += samples * s->audio_decimation - n * s->audio_interpolation;
+	
+	return(n);
+}
+
+static void _vid_audio_read(vid_t *s, int16_t *audio, int samples)
+{
+	int i, n;
+	
+	while(samples > 0)
 	{
-		int16_t add[2] = { 0, 0 };
-		
-		/* TODO: Replace this with a real FIR filter... */
-		s->interp += HACKTV_AUDIO_SAMPLE_RATE;
-		if(s->interp >= s->sample_rate)
+		if(s->audiobuffer_samples == 0)
 		{
-			s->interp -= s->sample_rate;
-			
-			if(s->audiobuffer_samples == 0)
-			{
-				av_read_audio(&s->av, &s->audiobuffer, &s->audiobuffer_samples);
-				
-				if(s->conf.systeraudio == 1)
-				{
-					ng_invert_audio(&s->ng, s->audiobuffer, s->audiobuffer_samples);
-				}
-			}
-			
-			if(s->audiobuffer)
-			{
-				/* Fetch next sample */
-				for(int i = 0; i < 2; i++)
-				{
-					int32_t v = ((int32_t) s->audiobuffer[i] * s->conf.volume + 128) >> 8;
-					audio[i] = (v < INT16_MIN ? INT16_MIN : (v > INT16_MAX ? INT16_MAX : v));
-				}
-				s->audiobuffer += 2;
-				s->audiobuffer_samples--;
-			}
-			else
-			{
-				/* No audio from the source */
-				audio[0] = 0;
-				audio[1] = 0;
-			}
-			
-			/* Feed the samples into the audio FIFO */
-			fifo_write_ptr(&s->audiofifo, (void **) &buf, 1);
-			buf[0] = audio[0];
-			buf[1] = audio[1];
-			fifo_write(&s->audiofifo, sizeof(int16_t) * 2);
-			
-			if(s->conf.am_audio_level > 0 && s->conf.am_mono_carrier != 0)
-			{
-				s->am_mono.sample = (audio[0] + audio[1]) / 2;
-			}
+			uint64_t t = s->conf.profile ? prof_now() : 0;
 			
-			if(s->conf.fm_mono_level > 0 && s->conf.fm_mono_carrier != 0)
-			{
-				s->fm_mono.sample = (audio[0] + audio[1]) / 2;
-				if(s->fm_mono.limiter.width)
-				{
-					limiter_process(&s->fm_mono.limiter, &s->fm_mono.sample, &s->fm_mono.sample, &s->fm_mono.sample, 1, 1);
-				}
-				
-				/* Reduce volume of audio in A2 Stereo mode to
-				 * leave room for the pilot/mode signal */
-				if(s->conf.a2stereo) s->fm_mono.sample *= 0.95;
-			}
+			av_read_audio(&s->av, &s->audiobuffer, &s->audiobuffer_samples);
 			
-			if(s->conf.fm_left_level > 0 && s->conf.fm_left_carrier != 0)
+			if(s->conf.profile)
 			{
-				s->fm_left.sample = audio[0];
-				if(s->fm_left.limiter.width)
-				{
-					limiter_process(&s->fm_left.limiter, &s->fm_left.sample, &s->fm_left.sample, &s->fm_left.sample, 1, 1);
-				}
+				prof_add(&s->prof_read_audio, prof_now() - t);
 			}
 			
-			if(s->conf.fm_right_level > 0 && s->conf.fm_right_carrier != 0)
+			if(s->conf.systeraudio == 1)
 			{
-				s->fm_right.sample = audio[1];
-				if(s->fm_right.limiter.width)
-				{
-					limiter_process(&s->fm_right.limiter, &s->fm_right.sample, &s->fm_right.sample, &s->fm_right.sample, 1, 1);
-				}
-				
-				/* Reduce volume of audio in A2 Stereo mode to
-				 * leave room for the pilot/mode signal */
-				if(s->conf.a2stereo) s->fm_right.sample *= 0.95;
-			}
-			
-			if((s->conf.nicam_level > 0 && s->conf.nicam_carrier != 0) ||
-			   s->conf.type == VID_MAC || s->conf.sis)
-			{
-				s->nicam_buf[s->nicam_buf_len++] = audio[0];
-				s->nicam_buf[s->nicam_buf_len++] = audio[1];
-				
-				if(s->nicam_buf_len == NICAM_AUDIO_LEN * 2)
-				{
-					if(s->conf.nicam_level > 0 && s->conf.nicam_carrier != 0)
-					{
-						nicam_mod_input(&s->nicam, s->nicam_buf);
-					}
-					
-					if(s->conf.type == VID_MAC)
-					{
-						mac_write_audio(s, &s->mac.audio, 0, s->nicam_buf, NICAM_AUDIO_LEN * 2);
-					}
-					
-					if(s->conf.sis)
-					{
-						sis_write_audio(&s->sis, s->nicam_buf);
-					}
-					
-					s->nicam_buf_len = 0;
-				}
+				ng_invert_audio(&s->ng, s->audiobuffer, s->audiobuffer_samples);
 			}
+		}
+		
+		if(s->audiobuffer == NULL || s->audiobuffer_samples == 0)
+		{
+			/* No audio from the source */
+			memset(audio, 0, sizeof(int16_t) * 2 * samples);
+			break;
+		}
+		
+		n = samples < s->audiobuffer_samples ? samples : s->audiobuffer_samples;
+		
+		for(i = 0; i < n * 2; i++)
+		{
+			int32_t v = ((int32_t) s->audiobuffer[i] * s->conf.volume + 128) >> 8;
+			audio[i] = (v < INT16_MIN ? INT16_MIN : (v > INT16_MAX ? INT16_MAX : v));
+		}
+		
+		s->audiobuffer += n * 2;
+		s->audiobuffer_samples -= n;
+		audio += n * 2;
+		samples -= n;
+	}
+}
+
+static void _vid_audio_feed_read(vid_audio_feed_t *f, int16_t *audio, int samples)
+{
+	size_t n;
+	
+	pthread_mutex_lock(&f->mutex);
+	
+	while(f->len - f->pos < samples && !f->closed)
+	{
+		pthread_cond_wait(&f->cond, &f->mutex);
+	}
+	
+	n = f->len - f->pos;
+	if(n > samples) n = samples;
+	
+	memcpy(audio, &f->samples[f->pos * 2], sizeof(int16_t) * 2 * n);
+	memset(&audio[n * 2], 0, sizeof(int16_t) * 2 * (samples - n));
+	f->pos += n;
+	
+	pthread_mutex_unlock(&f->mutex);
+}
+
+static void _vid_audio_resample(fir_int16_t *fir, int16_t *out, int width, const int16_t *in, int samples)
+{
+	/* The resampler consumes exactly the samples given
+	 * to it by _vid_audio_clock() for each line */
+	fir_int16_feed(fir, in, samples, 1);
+	fir_int16_process(fir, out, width, 1);
+}
+
+static int _vid_audio_process(vid_t *s, void *arg, int nlines, vid_line_t **lines)
+{
+	vid_line_t *l = lines[0];
+	int16_t *audio = &s->audio_in[s->audio_in_len * 0];
+	int16_t *a = &s->audio_in[s->audio_in_len * 2];
+	int16_t *b = &s->audio_in[s->audio_in_len * 3];
+	int16_t *fm_mono = &s->audio_out[s->max_width * 0];
+	int16_t *fm_left = &s->audio_out[s->max_width * 1];
+	int16_t *fm_right = &s->audio_out[s->max_width * 2];
+	int16_t *am_mono = &s->audio_out[s->max_width * 3];
+	int16_t *buf;
+	size_t len;
+	int i, n, x;
+	
+	/* Fetch the new 32 kHz audio samples for this line. With a feed
+	 * the source audio is still read, to keep the source flowing */
+	n = _vid_audio_clock(s, l->width);
+	_vid_audio_read(s, audio, n);
+	
+	if(s->audio_feed)
+	{
+		_vid_audio_feed_read(s->audio_feed, audio, n);
+	}
+	
+	/* Feed the samples into the audio FIFO. Lines without an output
+	 * buffer are from vid_track(), which only advances the carriers */
+	for(i = 0; i < n && l->output; i += len)
+	{
+		len = fifo_write_ptr(&s->audiofifo, (void **) &buf, 1);
+		if(len == -1) break;
+		
+		len /= sizeof(int16_t) * 2;
+		if(len > n - i) len = n - i;
+		
+		memcpy(buf, &audio[i * 2], sizeof(int16_t) * 2 * len);
+		fifo_write(&s->audiofifo, sizeof(int16_t) * 2 * len);
+	}
+	
+	if((s->conf.nicam_level > 0 && s->conf.nicam_carrier != 0) ||
+	   s->conf.type == VID_MAC || s->conf.sis)
+	{
+		for(i = 0; i < n; i += len)
+		{
+			len = NICAM_AUDIO_LEN - s->nicam_buf_len / 2;
+			if(len > n - i) len = n - i;
+			
+			memcpy(&s->nicam_buf[s->nicam_buf_len], &audio[i * 2], sizeof(int16_t) * 2 * len);
+			s->nicam_buf_len += len * 2;
 			
-			if(s->conf.dance_level > 0 && s->conf.dance_carrier != 0)
+			if(s->nicam_buf_len == NICAM_AUDIO_LEN * 2)
 			{
-				s->dance_buf[s->dance_buf_len++] = audio[0];
-				s->dance_buf[s->dance_buf_len++] = audio[1];
+				if(s->conf.nicam_level > 0 && s->conf.nicam_carrier != 0)
+				{
+					nicam_mod_input(&s->nicam, s->nicam_buf);
+				}
+				
+				if(s->conf.type == VID_MAC)
+				{
+					mac_write_audio(s, &s->mac.audio, 0, s->nicam_buf, NICAM_AUDIO_LEN * 2);
+				}
 				
-				if(s->dance_buf_len == DANCE_A_AUDIO_LEN * 2)
+				if(s->conf.sis)
 				{
-					dance_mod_input(&s->dance, s->dance_buf);
-					s->dance_buf_len = 0;
+					sis_write_audio(&s->sis, s->nicam_buf);
 				}
+				
+				s->nicam_buf_len = 0;
+			}
+		}
+	}
+	
+	if(s->conf.dance_level > 0 && s->conf.dance_carrier != 0)
+	{
+		for(i = 0; i < n; i += len)
+		{
+			len = DANCE_A_AUDIO_LEN - s->dance_buf_len / 2;
+			if(len > n - i) len = n - i;
+			
+			memcpy(&s->dance_buf[s->dance_buf_len], &audio[i * 2], sizeof(int16_t) * 2 * len);
+			s->dance_buf_len += len * 2;
+			
+			if(s->dance_buf_len == DANCE_A_AUDIO_LEN * 2)
+			{
+				dance_mod_input(&s->dance, s->dance_buf);
+				s->dance_buf_len = 0;
+			}
+		}
+	}
+	
+	/* Prepare the input for each analogue carrier at 32 kHz, then
+	 * interpolate it up to the sample rate. The mono input is kept
+	 * in "a" for the System M variant of A2 Stereo */
+	if(s->conf.fm_mono_level > 0 && s->conf.fm_mono_carrier != 0)
+	{
+		for(i = 0; i < n; i++)
+		{
+			a[i] = (audio[i * 2 + 0] + audio[i * 2 + 1]) / 2;
+		}
+		
+		if(s->fm_mono.limiter.width)
+		{
+			limiter_process(&s->fm_mono.limiter, a, a, a, n, 1);
+		}
+		
+		if(s->conf.a2stereo)
+		{
+			/* Reduce volume of audio in A2 Stereo mode to
+			 * leave room for the pilot/mode signal */
+			for(i = 0; i < n; i++)
+			{
+				a[i] *= 0.95;
 			}
 		}
 		
-		if(s->conf.fm_mono_level > 0 && s->conf.fm_mono_carrier != 0)
+		_vid_audio_resample(&s->fm_mono.resampler, fm_mono, l->width, a, n);
+	}
+	
+	if(s->conf.fm_right_level > 0 && s->conf.fm_right_carrier != 0)
+	{
+		for(i = 0; i < n; i++)
 		{
-			_fm_modulator_add(&s->fm_mono, add, s->fm_mono.sample);
+			b[i] = audio[i * 2 + 1];
 		}
 		
-		if(s->conf.fm_left_level > 0 && s->conf.fm_left_carrier != 0)
+		if(s->fm_right.limiter.width)
 		{
-			_fm_modulator_add(&s->fm_left, add, s->fm_left.sample);
+			limiter_process(&s->fm_right.limiter, b, b, b, n, 1);
 		}
 		
-		if(s->conf.fm_right_level > 0 && s->conf.fm_right_carrier != 0)
+		if(s->conf.a2stereo)
 		{
-			int16_t a2 = s->fm_right.sample;
-			
-			if(s->conf.a2stereo)
+			for(i = 0; i < n; i++)
+			{
+				b[i] *= 0.95;
+				
+				/* The System M variant is L-R, not R */
+				if(s->a2stereo_system_m) b[i] = a[i] - b[i];
+			}
+		}
+		
+		_vid_audio_resample(&s->fm_right.resampler, fm_right, l->width, b, n);
+		
+		if(s->conf.a2stereo)
+		{
+			/* Add the pilot tone */
+			for(x = 0; x < l->width; x++)
 			{
 				int16_t s1[2] = { 0, 0 };
 				int16_t s2[2] = { 0, 0 };
 				
-				if(s->a2stereo_system_m)
-				{
-					/* The System M variant is L-R, not R */
-					a2 = s->fm_mono.sample - s->fm_right.sample;
-				}
-				
-				/* Add the pilot tone */
 				_am_modulator_add(&s->a2stereo_signal, s1, 0);
 				_am_modulator_add(&s->a2stereo_pilot, s2, s1[0]);
-				a2 += s2[0];
+				fm_right[x] += s2[0];
 			}
-			
-			_fm_modulator_add(&s->fm_right, add, a2);
+		}
+	}
+	
+	if(s->conf.fm_left_level > 0 && s->conf.fm_left_carrier != 0)
+	{
+		for(i = 0; i < n; i++)
+		{
+			b[i] = audio[i * 2 + 0];
 		}
 		
-		if(s->conf.am_audio_level > 0 && s->conf.am_mono_carrier != 0)
+		if(s->fm_left.limiter.width)
 		{
-			_am_modulator_add(&s->am_mono, add, s->am_mono.sample);
+			limiter_process(&s->fm_left.limiter, b, b, b, n, 1);
 		}
 		
-		l->output[x * 2 + 0] += add[0];
-		l->output[x * 2 + 1] += add[1];
+		_vid_audio_resample(&s->fm_left.resampler, fm_left, l->width, b, n);
+	}
+	
+	if(s->conf.am_audio_level > 0 && s->conf.am_mono_carrier != 0)
+	{
+		for(i = 0; i < n; i++)
+		{
+			b[i] = (audio[i * 2 + 0] + audio[i * 2 + 1]) / 2;
+		}
+		
+		_vid_audio_resample(&s->am_mono.resampler, am_mono, l->width, b, n);
+		
+		if(l->output == NULL)
+		{
+			_am_modulator_skip(&s->am_mono, l->width);
+		}
+		else
+		{
+			for(x = 0; x < l->width; x++)
+			{
+				_am_modulator_add(&s->am_mono, &l->output[x * 2], am_mono[x]);
+			}
+		}
+	}
+	
+	if(s->conf.fm_mono_level > 0 && s->conf.fm_mono_carrier != 0)
+	{
+		_fm_mod_block_add(&s->fm_mono, l->output, fm_mono, l->width);
+	}
+	
+	if(s->conf.fm_left_level > 0 && s->conf.fm_left_carrier != 0)
+	{
+		_fm_mod_block_add(&s->fm_left, l->output, fm_left, l->width);
+	}
+	
+	if(s->conf.fm_right_level > 0 && s->conf.fm_right_carrier != 0)
+	{
+		_fm_mod_block_add(&s->fm_right, l->output, fm_right, l->width);
 	}
 	
 	if(s->conf.nicam_level > 0 && s->conf.nicam_carrier != 0)
@@ -3505,9 +4536,11 @@ static int _vid_audio_process(vid_t *s, void *arg, int nlines, vid_line_t **line
 		dance_mod_output(&s->dance, l->output, l->width);
 	}
 	
-	l->audio_len = fifo_read(&s->audio_reader, (void **) &l->audio, NICAM_AUDIO_LEN * 2 * 10 * sizeof(int16_t), 0);
-	l->audio_len /= sizeof(int16_t);
-	if(l->audio_len == 0) l->audio = NULL;
+	if(s->nworkers == 0 && l->output)
+	{
+		/* In threaded mode the audio is collected by vid_next_line() */
+		_vid_audio_output(s, l);
+	}
 	
 	return(1);
 }
@@ -3515,13 +4548,10 @@ static int _vid_audio_process(vid_t *s, void *arg, int nlines, vid_line_t **line
 static int _vid_fmmod_process(vid_t *s, void *arg, int nlines, vid_line_t **lines)
 {
 	vid_line_t *l = lines[0];
-	int x;
 	
 	/* FM modulate the video and audio if requested */
-	for(x = 0; x < l->width; x++)
-	{
-		_fm_modulator(&s->fm_video, &l->output[x * 2], l->output[x * 2]);
-	}
+	l->fm_phase = s->fm_video.phase;
+	_fm_mod_block(&s->fm_video, l->output, l->output, l->width);
 	
 	return(1);
 }
@@ -3544,34 +4574,33 @@ static int _vid_swap_iq_process(vid_t *s, void *arg, int nlines, vid_line_t **li
 
 static int _vid_offset_process(vid_t *s, void *arg, int nlines, vid_line_t **lines)
 {
+	_mod_offset_t *m = &s->offset;
 	vid_line_t *l = lines[0];
-	int x;
+	cint16_t *o = (cint16_t *) l->output;
+	cint16_t r[_OFFSET_BLOCK];
+	int x, i, n;
 	
-	for(x = 0; x < l->width; x++)
+	if(m->length > 0)
 	{
-		cint16_t a, b;
-		
-		cint32_mul(&s->offset.phase, &s->offset.phase, &s->offset.delta);
-		
-		a.i = l->output[x * 2 + 0];
-		a.q = l->output[x * 2 + 1];
-		b.i = s->offset.phase.i >> 16;
-		b.q = s->offset.phase.q >> 16;
-		cint16_mul(&a, &a, &b);
-		
-		l->output[x * 2 + 0] = a.i;
-		l->output[x * 2 + 1] = a.q;
+		/* Rotate the line by the periodic table */
+		m->pos = cint16_rotate_array(o, m->lut, m->length, m->pos, l->width);
+		return(1);
+	}
+	
+	/* No exact period, look up the rotator with the
+	 * phase accumulator and multiply a block at a time */
+	for(x = 0; x < l->width; x += n)
+	{
+		n = l->width - x;
+		if(n > _OFFSET_BLOCK) n = _OFFSET_BLOCK;
 		
-		/* Correct the amplitude after INT16_MAX samples */
-		if(--s->offset.counter == 0)
+		for(i = 0; i < n; i++)
 		{
-			double ra = atan2(s->offset.phase.q, s->offset.phase.i);
-			
-			s->offset.phase.i = lround(cos(ra) * INT32_MAX);
-			s->offset.phase.q = lround(sin(ra) * INT32_MAX);
-			
-			s->offset.counter = INT16_MAX;
+			r[i] = m->lut[m->phase >> (32 - _OFFSET_LUT_BITS)];
+			m->phase += m->delta;
 		}
+		
+		cint16_mul_array(&o[x], &o[x], r, n);
 	}
 	
 	return(1);
@@ -3832,7 +4861,6 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 	int r, x;
 	int64_t c;
 	double d;
-	double glut[0x100];
 	double width;
 	double level, slevel;
 	vid_line_t *l;
@@ -3846,6 +4874,9 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 	s->sample_rate = sample_rate;
 	s->pixel_rate = pixel_rate ? pixel_rate : sample_rate;
 	
+	prof_init(&s->prof_read_video, "av_read_video");
+	prof_init(&s->prof_read_audio, "av_read_audio");
+	
 	_test_sample_rate(&s->conf, s->pixel_rate);
 	
 	/* Calculate the number of samples per line */
@@ -3902,73 +4933,71 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 		return(VID_OUT_OF_MEMORY);
 	}
 	
-	/* Allocate memory for YUV lookup tables */
-	s->yuv_level_lookup = malloc(0x1000000 * sizeof(_yuv16_t));
-	if(s->yuv_level_lookup == NULL)
+	/* Generate the gamma lookup table */
+	if(s->conf.gamma <= 0)
 	{
-		vid_free(s);
-		return(VID_OUT_OF_MEMORY);
+		s->conf.gamma = 1.0;
 	}
 	
-	/* Generate the gamma lookup table. LUTception */
-	if(s->conf.gamma <= 0)
+	for(c = 0; c < 0x100; c++)
 	{
-		s->conf.gamma = 1.0;
+		s->yuv_glut[c] = pow((double) c / 255, 1 / s->conf.gamma);
 	}
 	
+	s->yuv_level = level;
+	s->yuv_black = _rgb_to_yuv(s, 0x000000);
+	
+	/* Fold the signal levels into a 3x3 matrix, scale and offset
+	 * for converting pixels without the lookup table */
 	for(c = 0; c < 0x100; c++)
 	{
-		glut[c] = pow((double) c / 255, 1 / s->conf.gamma);
+		s->yuv_gamma[c] = s->yuv_glut[c];
 	}
 	
-	/* Generate the RGB > signal level lookup tables */
-	for(c = 0x000000; c <= 0xFFFFFF; c++)
+	s->yuv_matrix[0][0] = s->conf.rw_co;
+	s->yuv_matrix[0][1] = s->conf.gw_co;
+	s->yuv_matrix[0][2] = s->conf.bw_co;
+	s->yuv_matrix[1][0] = -s->conf.rw_co * s->conf.eu_co;
+	s->yuv_matrix[1][1] = -s->conf.gw_co * s->conf.eu_co;
+	s->yuv_matrix[1][2] = (1.0 - s->conf.bw_co) * s->conf.eu_co;
+	s->yuv_matrix[2][0] = (1.0 - s->conf.rw_co) * s->conf.ev_co;
+	s->yuv_matrix[2][1] = -s->conf.gw_co * s->conf.ev_co;
+	s->yuv_matrix[2][2] = -s->conf.bw_co * s->conf.ev_co;
+	
+	d = (s->conf.white_level - s->conf.black_level) * level * INT16_MAX;
+	s->yuv_scale[0] = d;
+	s->yuv_offset[0] = s->conf.black_level * level * INT16_MAX;
+	
+	if(s->conf.colour_mode != VID_SECAM)
 	{
-		double r, g, b;
-		double y, u, v;
-		
-		/* Calculate RGB 0..1 values */
-		r = glut[(c & 0xFF0000) >> 16];
-		g = glut[(c & 0x00FF00) >> 8];
-		b = glut[(c & 0x0000FF) >> 0];
-		
-		/* Calculate Y, Cb and Cr values */
-		y = r * s->conf.rw_co
-		  + g * s->conf.gw_co
-		  + b * s->conf.bw_co;
-		u = (b - y) * s->conf.eu_co;
-		v = (r - y) * s->conf.ev_co;
-		
-		/* Limit magnitude of D/D2-MAC chrominance to -0.5 >= 0.5 */
-		if(s->conf.type == VID_MAC)
+		s->yuv_scale[1] = d;
+		s->yuv_scale[2] = d;
+		s->yuv_offset[1] = 0;
+		s->yuv_offset[2] = 0;
+	}
+	else
+	{
+		s->yuv_scale[1] = INT16_MAX / SECAM_FM_DEV;
+		s->yuv_scale[2] = INT16_MAX / SECAM_FM_DEV;
+		s->yuv_offset[1] = (SECAM_CB_FREQ - SECAM_FM_FREQ) / SECAM_FM_DEV * INT16_MAX;
+		s->yuv_offset[2] = (SECAM_CR_FREQ - SECAM_FM_FREQ) / SECAM_FM_DEV * INT16_MAX;
+	}
+	
+	if(s->conf.yuv_mode == VID_YUV_TABLE)
+	{
+		/* Allocate memory for YUV lookup tables */
+		s->yuv_level_lookup = malloc(0x1000000 * sizeof(_yuv16_t));
+		if(s->yuv_level_lookup == NULL)
 		{
-			d = fabs(u) > fabs(v) ? fabs(u) : fabs(v);
-			if(d > 0.5)
-			{
-				d = 0.5 / d;
-				u *= d;
-				v *= d;
-			}
+			vid_free(s);
+			return(VID_OUT_OF_MEMORY);
 		}
 		
-		/* Adjust values to correct signal level */
-		y = (s->conf.black_level + (y * (s->conf.white_level - s->conf.black_level))) * level;
-		
-		if(s->conf.colour_mode != VID_SECAM)
+		/* Generate the RGB > signal level lookup tables */
+		for(c = 0x000000; c <= 0xFFFFFF; c++)
 		{
-			u *= (s->conf.white_level - s->conf.black_level) * level;
-			v *= (s->conf.white_level - s->conf.black_level) * level;
+			s->yuv_level_lookup[c] = _rgb_to_yuv(s, c);
 		}
-		else
-		{
-			u = (u + SECAM_CB_FREQ - SECAM_FM_FREQ) / SECAM_FM_DEV;
-			v = (v + SECAM_CR_FREQ - SECAM_FM_FREQ) / SECAM_FM_DEV;
-		}
-		
-		/* Convert to INT16 range and store in tables */
-		s->yuv_level_lookup[c].y = round(_dlimit(y, -1, 1) * INT16_MAX);
-		s->yuv_level_lookup[c].u = round(_dlimit(u, -1, 1) * INT16_MAX);
-		s->yuv_level_lookup[c].v = round(_dlimit(v, -1, 1) * INT16_MAX);
 	}
 	
 	if(s->conf.colour_mode == VID_PAL ||
@@ -3979,28 +5008,49 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 		/* Generate the colour subcarrier lookup table */
 		/* This carrier is in phase with the U (B-Y) component */
 		s->colour_lookup_width = a.num;
+		s->colour_lookup_cycles = a.den;
 		d = 2.0 * M_PI * ((double) a.den / a.num);
 		
-		/*  To make overflow easier to handle the length of the table is extended by one line */
-		s->colour_lookup = malloc((s->colour_lookup_width + s->width) * sizeof(cint16_t));
-		if(!s->colour_lookup)
+		if(s->conf.subcarrier_mode == VID_SUBCARRIER_LINE)
 		{
-			vid_free(s);
-			return(VID_OUT_OF_MEMORY);
+			/* Each line is generated as it's rendered, from the
+			 * subcarrier across one line rotated to its start phase */
+			s->colour_line_base = malloc(sizeof(double) * 2 * s->width);
+			if(!s->colour_line_base)
+			{
+				vid_free(s);
+				return(VID_OUT_OF_MEMORY);
+			}
+			
+			for(c = 0; c < s->width; c++)
+			{
+				s->colour_line_base[c * 2 + 0] = cos(d * c);
+				s->colour_line_base[c * 2 + 1] = sin(d * c);
+			}
 		}
-		
-		for(c = 0; c < s->colour_lookup_width + s->width; c++)
+		else
 		{
-			s->colour_lookup[c] = (cint16_t) {
-				round(cos(d * c) * INT16_MAX),
-				round(sin(d * c) * INT16_MAX)
-			};
+			/*  To make overflow easier to handle the length of the table is extended by one line */
+			s->colour_lookup = malloc((s->colour_lookup_width + s->width) * sizeof(cint16_t));
+			if(!s->colour_lookup)
+			{
+				vid_free(s);
+				return(VID_OUT_OF_MEMORY);
+			}
+			
+			for(c = 0; c < s->colour_lookup_width + s->width; c++)
+			{
+				s->colour_lookup[c] = (cint16_t) {
+					round(cos(d * c) * INT16_MAX),
+					round(sin(d * c) * INT16_MAX)
+				};
+			}
 		}
 		
 		s->colour_lookup_offset = 0;
 		
-		/* Allocate memory for the chrominance baseband buffer */
-		s->chrominance_buffer = malloc(sizeof(int16_t) * 2 * s->width);
+		/* Allocate memory for one block of the chrominance baseband */
+		s->chrominance_buffer = malloc(sizeof(int16_t) * 2 * _CHROMA_BLOCK);
 		if(!s->chrominance_buffer)
 		{
 			vid_free(s);
@@ -4039,6 +5089,25 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 			/* NTSC has a 180° burst */
 			s->burst_phase = (cint16_t) { -INT16_MAX, 0 };
 		}
+		
+		if(s->conf.colour_mode == VID_PAL ||
+		   s->conf.colour_mode == VID_NTSC)
+		{
+			/* Pre-render the burst chrominance, the PAL
+			 * swinging burst is applied as it's modulated */
+			s->burst_chroma = malloc(sizeof(int16_t) * 2 * s->burst_width);
+			if(!s->burst_chroma)
+			{
+				vid_free(s);
+				return(VID_OUT_OF_MEMORY);
+			}
+			
+			for(c = 0; c < s->burst_width; c++)
+			{
+				s->burst_chroma[c * 2 + 0] = (s->burst_phase.i * s->burst_win[c]) >> 15;
+				s->burst_chroma[c * 2 + 1] = (s->burst_phase.q * s->burst_win[c]) >> 15;
+			}
+		}
 	}
 	
 	/* Pre-render the FSC pulses */
@@ -4106,7 +5175,7 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 		s->fm_secam_dmin[1] = lround((SECAM_CR_FREQ - SECAM_FM_FREQ - 506e3) / SECAM_FM_DEV * INT16_MAX);
 		s->fm_secam_dmax[1] = lround((SECAM_CR_FREQ - SECAM_FM_FREQ + 350e3) / SECAM_FM_DEV * INT16_MAX);
 		
-		s->fm_secam_bell = malloc(sizeof(cint16_t) * UINT16_MAX);
+		s->fm_secam_bell = malloc(sizeof(cint16_t) * (UINT16_MAX + 1));
 		if(!s->fm_secam_bell)
 		{
 			vid_free(s);
@@ -4145,8 +5214,10 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 			return(VID_OUT_OF_MEMORY);
 		}
 		
-		/* Allocate memory for the chrominance baseband buffer */
-		s->chrominance_buffer = malloc(sizeof(int16_t) * s->width);
+		/* Allocate memory for the chrominance baseband buffer. The
+		 * FIR filter reads half its length past the end of the line,
+		 * so the buffer is padded with zeros */
+		s->chrominance_buffer = calloc(s->width + 32, sizeof(int16_t));
 		if(!s->chrominance_buffer)
 		{
 			vid_free(s);
@@ -4207,9 +5278,35 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 	}
 	else
 	{
+		/* The field sequential colour modes change colour every field */
+		if(s->conf.frame_cache &&
+		   s->conf.colour_mode != VID_APOLLO_FSC &&
+		   s->conf.colour_mode != VID_CBS_FSC)
+		{
+			r = _vid_frame_cache_init(s);
+			
+			if(r != VID_OK)
+			{
+				vid_free(s);
+				return(r);
+			}
+		}
+		
+		r = _vid_raster_init_lines(s);
+		
+		if(r != VID_OK)
+		{
+			vid_free(s);
+			return(r);
+		}
+		
 		_add_lineprocess(s, "raster", 3, NULL, _vid_next_line_raster, NULL);
 	}
 	
+	/* The raster processes share the frame state and
+	 * must always run together in threaded mode */
+	s->pipeline_first = s->nprocesses;
+	
 	/* Initialise VITS inserter */
 	if(s->conf.vits)
 	{
@@ -4332,6 +5429,8 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 		}
 	}
 	
+	s->seek_last = s->nprocesses;
+	
 	if(s->pixel_rate != s->sample_rate)
 	{
 		_init_vresampler(s,
@@ -4531,49 +5630,126 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 		}
 	}
 	
-	/* Add the audio process */
-	_add_lineprocess(s, "audio", 1, NULL, _vid_audio_process, NULL);
+	/* Audio resampler clock and the per-line buffers for the
+	 * 32 kHz audio and the interpolated carrier inputs */
+	_vid_audio_ratio(s);
+	s->audio_phase = s->audio_interpolation;
+	s->audio_in_len = (int64_t) s->max_width * s->audio_decimation / s->audio_interpolation + 2;
+	s->audio_in = malloc(sizeof(int16_t) * 4 * s->audio_in_len);
+	s->audio_out = malloc(sizeof(int16_t) * 4 * s->max_width);
+	if(!s->audio_in || !s->audio_out)
+	{
+		vid_free(s);
+		return(VID_OUT_OF_MEMORY);
+	}
 	
-	/* FM video */
-	if(s->conf.modulation == VID_FM)
+	if(s->conf.fm_mono_level > 0 && s->conf.fm_mono_carrier != 0)
 	{
-		r = _init_fm_modulator(&s->fm_video, s->sample_rate, 0, s->conf.fm_deviation, s->conf.fm_level * s->conf.level);
+		r = _init_audio_resampler(s, &s->fm_mono.resampler);
 		if(r != VID_OK)
 		{
 			vid_free(s);
 			return(r);
 		}
-		
-		if(s->conf.fm_energy_dispersal)
+	}
+	
+	if(s->conf.fm_left_level > 0 && s->conf.fm_left_carrier != 0)
+	{
+		r = _init_audio_resampler(s, &s->fm_left.resampler);
+		if(r != VID_OK)
 		{
-			/* Apply a frame locked triangular wave to the FM baseband signal */
-			_init_fm_energy_dispersal(
-				&s->fm_video,
-				s->sample_rate,
-				(r64_t) { s->sample_rate, s->width * s->conf.lines }, // s->conf.frame_rate
-				round(INT16_MAX * s->conf.fm_energy_dispersal)
-			);
+			vid_free(s);
+			return(r);
 		}
-		
-		_add_lineprocess(s, "fmmod", 1, NULL, _vid_fmmod_process, NULL);
 	}
 	
-	if(s->conf.swap_iq != 0)
+	if(s->conf.fm_right_level > 0 && s->conf.fm_right_carrier != 0)
 	{
-		_add_lineprocess(s, "swap_iq", 1, NULL, _vid_swap_iq_process, NULL);
+		r = _init_audio_resampler(s, &s->fm_right.resampler);
+		if(r != VID_OK)
+		{
+			vid_free(s);
+			return(r);
+		}
 	}
 	
-	if(s->conf.offset != 0)
+	if(s->conf.am_audio_level > 0 && s->conf.am_mono_carrier != 0)
 	{
-		double d;
-		
-		s->offset.counter = INT16_MAX;
-		s->offset.phase.i = INT16_MAX;
-		s->offset.phase.q = 0;
+		r = _init_audio_resampler(s, &s->am_mono.resampler);
+		if(r != VID_OK)
+		{
+			vid_free(s);
+			return(r);
+		}
+	}
+	
+	/* Add the audio process */
+	_add_lineprocess(s, "audio", 1, NULL, _vid_audio_process, NULL);
+	
+	if(s->conf.type == VID_MAC || s->conf.sis)
+	{
+		/* MAC and SiS audio is packed into the video raster,
+		 * the audio process must share the raster's thread */
+		s->pipeline_first = s->nprocesses;
+	}
+	
+	/* FM video */
+	if(s->conf.modulation == VID_FM)
+	{
+		r = _init_fm_modulator(&s->fm_video, s->sample_rate, 0, s->conf.fm_deviation, s->conf.fm_level * s->conf.level);
+		if(r != VID_OK)
+		{
+			vid_free(s);
+			return(r);
+		}
 		
-		d = 2.0 * M_PI / s->sample_rate * s->conf.offset;
-		s->offset.delta.i = lround(cos(d) * INT32_MAX);
-		s->offset.delta.q = lround(sin(d) * INT32_MAX);
+		if(s->conf.fm_energy_dispersal)
+		{
+			/* Apply a frame locked triangular wave to the FM baseband signal */
+			_init_fm_energy_dispersal(
+				&s->fm_video,
+				s->sample_rate,
+				(r64_t) { s->sample_rate, s->width * s->conf.lines }, // s->conf.frame_rate
+				round(INT16_MAX * s->conf.fm_energy_dispersal)
+			);
+		}
+		
+		_add_lineprocess(s, "fmmod", 1, NULL, _vid_fmmod_process, NULL);
+	}
+	
+	if(s->conf.swap_iq != 0)
+	{
+		_add_lineprocess(s, "swap_iq", 1, NULL, _vid_swap_iq_process, NULL);
+	}
+	
+	if(s->conf.offset != 0)
+	{
+		int64_t g, p, q, k;
+		
+		/* The offset repeats every q samples, over p cycles */
+		g = gcd(s->sample_rate, llabs(s->conf.offset));
+		q = s->sample_rate / g;
+		p = s->conf.offset / g % q;
+		if(p < 0) p += q;
+		
+		if(q <= _OFFSET_MAX_PERIOD)
+		{
+			k = (_OFFSET_MIN_LENGTH + q - 1) / q;
+			s->offset.length = q * k;
+			s->offset.lut = sin_cint16(q * k, p * k, 1.0);
+		}
+		else
+		{
+			s->offset.length = 0;
+			s->offset.delta = (uint32_t) llround((double) s->conf.offset / s->sample_rate * 4294967296.0);
+			s->offset.lut = sin_cint16(1 << _OFFSET_LUT_BITS, 1, 1.0);
+		}
+		
+		if(!s->offset.lut)
+		{
+			vid_free(s);
+			return(VID_OUT_OF_MEMORY);
+		}
 		
 		_add_lineprocess(s, "offset", 1, NULL, _vid_offset_process, NULL);
 	}
@@ -4612,6 +5788,24 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 	_add_lineprocess(s, "output", 1, NULL, NULL, NULL);
 	s->output_process = &s->processes[s->nprocesses - 1];
 	
+	if(s->conf.threads > 0)
+	{
+		/* Extra lines to allow the pipeline to run ahead */
+		s->olines += _PIPELINE_DEPTH;
+	}
+	
+	/* The raster line templates need the final line buffer width */
+	if(s->raster_lines)
+	{
+		r = _vid_raster_init_templates(s);
+		
+		if(r != VID_OK)
+		{
+			vid_free(s);
+			return(r);
+		}
+	}
+	
 	/* Output line buffer(s) */
 	s->oline = calloc(sizeof(vid_line_t), s->olines);
 	if(!s->oline)
@@ -4620,6 +5814,18 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 		return(VID_OUT_OF_MEMORY);
 	}
 	
+	if(s->colour_line_base)
+	{
+		/* A line of colour subcarrier for each output line, it
+		 * must stay valid while the line is in the ring */
+		s->colour_lines = malloc(sizeof(cint16_t) * s->width * s->olines);
+		if(!s->colour_lines)
+		{
+			vid_free(s);
+			return(VID_OUT_OF_MEMORY);
+		}
+	}
+	
 	for(r = 0; r < s->olines; r++)
 	{
 		s->oline[r].output = malloc(sizeof(int16_t) * 2 * s->max_width);
@@ -4646,13 +5852,16 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 		s->oline[r].audio_len = 0;
 	}
 	
-	/* Setup lineprocess output windows (non-threaded version) */
+	/* Setup lineprocess output windows. The layout is the same in
+	 * threaded mode, the extra lines are only used as the ring wraps */
 	l = &s->oline[s->olines - 1];
 	
 	for(r = 0; r < s->nprocesses; r++)
 	{
 		_lineprocess_t *p = &s->processes[r];
 		
+		prof_init(&p->prof, p->name);
+		
 		l -= p->nlines - 1;
 		
 		for(x = 0; x < p->nlines; x++)
@@ -4664,10 +5873,357 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 	return(VID_OK);
 }
 
+static int _vid_frame_due(vid_t *s)
+{
+	return(s->bline == 1 || (s->conf.interlace && s->bline == s->conf.hline));
+}
+
+static void _vid_load_frame(vid_t *s)
+{
+	uint64_t t = s->conf.profile ? prof_now() : 0;
+	
+	av_read_video(&s->av, &s->vframe);
+	s->vframe_pts = s->av.start + s->av.frames - 1;
+	
+	if(s->conf.profile)
+	{
+		prof_add(&s->prof_read_video, prof_now() - t);
+	}
+	
+	av_rotate_frame(&s->vframe, s->conf.frame_orientation & 3);
+	if(s->conf.frame_orientation & VID_HFLIP) av_hflip_frame(&s->vframe);
+	if(s->conf.frame_orientation & VID_VFLIP) av_vflip_frame(&s->vframe);
+	
+	/* Crop frame to fit inside active video area */
+	av_crop_frame(&s->vframe,
+		(s->vframe.width - s->active_width) / 2,
+		(s->vframe.height - s->conf.active_lines) / 2,
+		s->active_width,
+		s->conf.active_lines
+	);
+	
+	/* Calculate frame offset from top left */
+	s->vframe_x = (s->active_width - s->vframe.width) / 2;
+	s->vframe_y = (s->conf.active_lines - s->vframe.height) / 2;
+	
+	if(s->vframe.format == AV_FRAME_YCC444)
+	{
+		_vid_ycc_init(s);
+	}
+	
+	if(s->frame_cache)
+	{
+		_vid_frame_cache_update(s);
+	}
+}
+
+static void _vid_run_processes(vid_t *s, int first, int count)
+{
+	uint64_t t;
+	int i, j;
+	
+	for(i = first; i < first + count; i++)
+	{
+		_lineprocess_t *p = &s->processes[i];
+		
+		if(p->process)
+		{
+			t = s->conf.profile ? prof_now() : 0;
+			
+			p->process(p->vid, p->arg, p->nlines, p->lines);
+			
+			if(s->conf.profile)
+			{
+				prof_add(&p->prof, prof_now() - t);
+			}
+		}
+		
+		for(j = 0; j < p->nlines; j++)
+		{
+			p->lines[j] = p->lines[j]->next;
+		}
+	}
+}
+
+static void _vid_advance_line(vid_t *s)
+{
+	/* Advance the next line/frame counter */
+	if(s->bline++ == s->conf.lines)
+	{
+		s->bline = 1;
+		s->bframe++;
+	}
+}
+
+static vid_line_t *_vid_next_line(vid_t *s)
+{
+	vid_line_t *l = s->output_process->lines[0];
+	
+	/* Load the next frame */
+	if(_vid_frame_due(s))
+	{
+		/* Have we reached the end of the video? */
+		if(av_eof(&s->av))
+		{
+			return(NULL);
+		}
+		
+		_vid_load_frame(s);
+	}
+	
+	_vid_run_processes(s, 0, s->nprocesses);
+	_vid_advance_line(s);
+	
+	return(l);
+}
+
+/* Threaded pipeline
+ * 
+ * The line processes are split into groups, each run by its own worker
+ * thread. The line windows are the same as in the non-threaded version,
+ * a worker can process line N once the previous worker has completed it.
+ * The first worker may run up to _PIPELINE_DEPTH lines ahead of the
+ * caller of vid_next_line(), using the extra lines allocated in the ring.
+*/
+
+static void *_vid_worker_thread(void *arg)
+{
+	_vid_worker_t *w = (_vid_worker_t *) arg;
+	vid_t *s = w->vid;
+	_vid_worker_t *prev = (w == s->workers ? NULL : w - 1);
+	_vid_worker_t *next = (w == &s->workers[s->nworkers - 1] ? NULL : w + 1);
+	_vid_worker_t *last = &s->workers[s->nworkers - 1];
+	
+	while(1)
+	{
+		pthread_mutex_lock(&s->pipeline_mutex);
+		
+		if(prev == NULL)
+		{
+			while(!s->pipeline_abort)
+			{
+				if(s->pipeline_pause)
+				{
+					/* Hold here while paused */
+					s->pipeline_hold = 1;
+					pthread_cond_signal(&s->pipeline_cond);
+				}
+				else if(_vid_frame_due(s) && last->lines != w->lines)
+				{
+					/* Let the other workers catch up before loading
+					 * the next frame, the audio process may be the
+					 * one to reach the end of the source */
+				}
+				else if(_vid_frame_due(s) && av_eof(&s->av))
+				{
+					/* Hold here at the end of the video,
+					 * until the caller opens the next source */
+					s->pipeline_hold = 1;
+					pthread_cond_signal(&s->pipeline_cond);
+				}
+				else if(w->lines - s->pipeline_lines <= _PIPELINE_DEPTH)
+				{
+					/* There is space in the line ring */
+					break;
+				}
+				
+				pthread_cond_wait(&w->cond, &s->pipeline_mutex);
+			}
+			
+			s->pipeline_hold = 0;
+		}
+		else
+		{
+			/* Wait for the previous worker to complete the next line */
+			while(!s->pipeline_abort && prev->lines <= w->lines)
+			{
+				pthread_cond_wait(&w->cond, &s->pipeline_mutex);
+			}
+		}
+		
+		if(s->pipeline_abort)
+		{
+			pthread_mutex_unlock(&s->pipeline_mutex);
+			break;
+		}
+		
+		pthread_mutex_unlock(&s->pipeline_mutex);
+		
+		if(prev == NULL && _vid_frame_due(s))
+		{
+			_vid_load_frame(s);
+		}
+		
+		_vid_run_processes(s, w->first, w->count);
+		
+		if(prev == NULL)
+		{
+			_vid_advance_line(s);
+		}
+		
+		pthread_mutex_lock(&s->pipeline_mutex);
+		w->lines++;
+		pthread_cond_signal(next ? &next->cond : &s->pipeline_cond);
+		if(w == last && prev != NULL) pthread_cond_signal(&s->workers[0].cond);
+		pthread_mutex_unlock(&s->pipeline_mutex);
+	}
+	
+	return(NULL);
+}
+
+static void _vid_pipeline_stop(vid_t *s)
+{
+	int i;
+	
+	if(s->workers == NULL) return;
+	
+	pthread_mutex_lock(&s->pipeline_mutex);
+	s->pipeline_abort = 1;
+	for(i = 0; i < s->nworkers; i++)
+	{
+		pthread_cond_signal(&s->workers[i].cond);
+	}
+	pthread_mutex_unlock(&s->pipeline_mutex);
+	
+	for(i = 0; i < s->nworkers; i++)
+	{
+		if(s->workers[i].running)
+		{
+			pthread_join(s->workers[i].thread, NULL);
+		}
+		
+		pthread_cond_destroy(&s->workers[i].cond);
+	}
+	
+	pthread_cond_destroy(&s->pipeline_cond);
+	pthread_mutex_destroy(&s->pipeline_mutex);
+	
+	free(s->workers);
+	s->workers = NULL;
+	s->nworkers = 0;
+}
+
+static int _vid_pipeline_start(vid_t *s)
+{
+	int nprocesses = s->nprocesses - 1;
+	int nworkers = s->conf.threads;
+	int first = s->pipeline_first;
+	int i, p;
+	
+	/* Split the processes (excluding output) into groups. The
+	 * raster and anything sharing its state runs on the first */
+	if(nworkers > 1 + nprocesses - first)
+	{
+		nworkers = 1 + nprocesses - first;
+	}
+	
+	if(nworkers == 1)
+	{
+		first = nprocesses;
+	}
+	
+	s->workers = calloc(nworkers, sizeof(_vid_worker_t));
+	if(!s->workers)
+	{
+		return(VID_OUT_OF_MEMORY);
+	}
+	
+	for(i = 0, p = 0; i < nworkers; i++)
+	{
+		_vid_worker_t *w = &s->workers[i];
+		
+		w->vid = s;
+		w->first = p;
+		w->count = (i == 0 ? first : first + (nprocesses - first) * i / (nworkers - 1) - p);
+		w->lines = 0;
+		w->running = 0;
+		
+		pthread_cond_init(&w->cond, NULL);
+		
+		p += w->count;
+	}
+	
+	pthread_mutex_init(&s->pipeline_mutex, NULL);
+	pthread_cond_init(&s->pipeline_cond, NULL);
+	s->pipeline_lines = 0;
+	s->pipeline_held = 0;
+	s->pipeline_hold = 0;
+	s->pipeline_pause = 0;
+	s->pipeline_abort = 0;
+	s->nworkers = nworkers;
+	
+	for(i = 0; i < nworkers; i++)
+	{
+		if(pthread_create(&s->workers[i].thread, NULL, &_vid_worker_thread, &s->workers[i]) != 0)
+		{
+			/* Stop any threads already started */
+			_vid_pipeline_stop(s);
+			return(VID_ERROR);
+		}
+		
+		s->workers[i].running = 1;
+	}
+	
+	return(VID_OK);
+}
+
+static vid_line_t *_vid_pipeline_next_line(vid_t *s)
+{
+	_vid_worker_t *w = &s->workers[s->nworkers - 1];
+	vid_line_t *l;
+	
+	pthread_mutex_lock(&s->pipeline_mutex);
+	
+	if(s->pipeline_held)
+	{
+		/* Release the line returned by the previous call */
+		s->pipeline_lines++;
+		s->pipeline_held = 0;
+		pthread_cond_signal(&s->workers[0].cond);
+	}
+	
+	if(s->pipeline_pause)
+	{
+		/* Resume rendering, the source may have changed */
+		s->pipeline_pause = 0;
+		s->pipeline_hold = 0;
+		pthread_cond_signal(&s->workers[0].cond);
+	}
+	
+	while(w->lines <= s->pipeline_lines)
+	{
+		if(s->pipeline_hold && s->workers[0].lines == s->pipeline_lines)
+		{
+			/* All lines before the end of the video have been
+			 * output. Pause until the next source is opened */
+			s->pipeline_pause = 1;
+			pthread_mutex_unlock(&s->pipeline_mutex);
+			return(NULL);
+		}
+		
+		pthread_cond_wait(&s->pipeline_cond, &s->pipeline_mutex);
+	}
+	
+	s->pipeline_held = 1;
+	
+	pthread_mutex_unlock(&s->pipeline_mutex);
+	
+	/* The output process is run by the caller */
+	l = s->output_process->lines[0];
+	s->output_process->lines[0] = l->next;
+	
+	_vid_audio_output(s, l);
+	
+	return(l);
+}
+
 void vid_free(vid_t *s)
 {
 	int i;
 	
+	/* Stop any line process worker threads */
+	_vid_pipeline_stop(s);
+	
 	/* Close the AV source */
 	av_close(&s->av);
 	
@@ -4688,6 +6244,8 @@ void vid_free(vid_t *s)
 		free(s->passline);
 	}
 	
+	free(s->offset.lut);
+	
 	if(s->conf.teletext)
 	{
 		tt_free(&s->tt);
@@ -4748,6 +6306,8 @@ void vid_free(vid_t *s)
 	/* Free allocated memory */
 	free(s->yuv_level_lookup);
 	free(s->colour_lookup);
+	free(s->colour_line_base);
+	free(s->colour_lines);
 	fir_int16_free(&s->secam_l_fir);
 	fir_int16_free(&s->fm_secam_fir);
 	iir_int16_free(&s->fm_secam_iir);
@@ -4756,6 +6316,8 @@ void vid_free(vid_t *s)
 	_free_fm_modulator(&s->fm_mono);
 	_free_fm_modulator(&s->fm_left);
 	_free_fm_modulator(&s->fm_right);
+	free(s->audio_in);
+	free(s->audio_out);
 	_free_am_modulator(&s->a2stereo_pilot);
 	_free_am_modulator(&s->a2stereo_signal);
 	limiter_free(&s->fm_mono.limiter);
@@ -4775,8 +6337,14 @@ void vid_free(vid_t *s)
 	}
 	
 	free(s->chrominance_buffer);
+	free(s->frame_cache_lines);
+	free(s->frame_cache);
 	free(s->burst_win);
+	free(s->burst_chroma);
 	free(s->syncs);
+	free(s->raster_lines);
+	free(s->raster_templates);
+	free(s->raster_tails);
 	free(s->fsc_syncs);
 	
 	memset(s, 0, sizeof(vid_t));
@@ -4803,75 +6371,447 @@ size_t vid_get_framebuffer_length(vid_t *s)
 	return(sizeof(uint32_t) * s->active_width * s->conf.active_lines);
 }
 
-static vid_line_t *_vid_next_line(vid_t *s)
+void vid_av_defaults(vid_t *s)
 {
-	vid_line_t *l = s->output_process->lines[0];
-	int i, j;
+	s->av = (av_t) {
+		.frame_rate = (r64_t) {
+			.num = s->conf.frame_rate.num * (s->conf.interlace ? 2 : 1),
+			.den = s->conf.frame_rate.den,
+		},
+		.display_aspect_ratios = {
+			s->conf.frame_aspects[0],
+			s->conf.frame_aspects[1]
+		},
+		.fit_mode = AV_FIT_STRETCH,
+		.scaler = AV_SCALER_BICUBIC,
+		.scaler_threads = 0,
+		.video_buffers = AV_DEFAULT_VIDEO_BUFFERS,
+		.width = s->active_width,
+		.height = s->conf.active_lines,
+		.sample_rate = (r64_t) { HACKTV_AUDIO_SAMPLE_RATE, 1 },
+		
+		/* The field sequential colour modes need RGB frames */
+		.ycc = s->conf.colour_mode != VID_APOLLO_FSC &&
+		       s->conf.colour_mode != VID_CBS_FSC,
+	};
 	
-	/* Load the next frame */
-	if(s->bline == 1 || (s->conf.interlace && s->bline == s->conf.hline))
+	if((s->conf.frame_orientation & 3) == VID_ROTATE_90 ||
+	   (s->conf.frame_orientation & 3) == VID_ROTATE_270)
+	{
+		/* Flip dimensions if the lines are scanned vertically */
+		s->av.width = s->conf.active_lines;
+		s->av.height = s->active_width;
+	}
+}
+
+void vid_pause(vid_t *s)
+{
+	_vid_worker_t *w;
+	
+	if(s->nworkers == 0) return;
+	
+	w = &s->workers[s->nworkers - 1];
+	
+	pthread_mutex_lock(&s->pipeline_mutex);
+	
+	/* Wait for the first worker to stop and the others to catch up */
+	s->pipeline_pause = 1;
+	pthread_cond_signal(&s->workers[0].cond);
+	
+	while(!s->pipeline_hold || w->lines != s->workers[0].lines)
+	{
+		pthread_cond_wait(&s->pipeline_cond, &s->pipeline_mutex);
+	}
+	
+	pthread_mutex_unlock(&s->pipeline_mutex);
+}
+
+int vid_get_stats(vid_t *s, prof_t **stages, int max)
+{
+	int i, n = 0;
+	
+	if(n < max) stages[n++] = &s->prof_read_video;
+	if(n < max) stages[n++] = &s->prof_read_audio;
+	
+	for(i = 0; i < s->nprocesses && n < max; i++)
+	{
+		/* The output process does nothing */
+		if(s->processes[i].process == NULL) continue;
+		
+		stages[n++] = &s->processes[i].prof;
+	}
+	
+	return(n);
+}
+
+static r64_t _vid_line_samples(const vid_t *s)
+{
+	return(r64_div(
+		(r64_t) { s->sample_rate, 1 },
+		(r64_t) { (int64_t) s->conf.frame_rate.num * s->conf.lines, s->conf.frame_rate.den }
+	));
+}
+
+int vid_seekable(const vid_t *s)
+{
+	/* These have state that can only be recovered by rendering */
+	if(s->conf.type == VID_MAC || s->conf.sis ||
+	   s->raw_bb_file || s->passthru)
+	{
+		return(0);
+	}
+	
+	/* The carrier phases are only recoverable with whole lines */
+	if(_vid_line_samples(s).den != 1)
+	{
+		return(0);
+	}
+	
+	return(1);
+}
+
+int vid_seek_tracked(const vid_t *s)
+{
+	return((s->conf.fm_mono_level > 0 && s->conf.fm_mono_carrier != 0) ||
+	       (s->conf.fm_left_level > 0 && s->conf.fm_left_carrier != 0) ||
+	       (s->conf.fm_right_level > 0 && s->conf.fm_right_carrier != 0) ||
+	       (s->conf.am_audio_level > 0 && s->conf.am_mono_carrier != 0) ||
+	       (s->conf.nicam_level > 0 && s->conf.nicam_carrier != 0) ||
+	       (s->conf.dance_level > 0 && s->conf.dance_carrier != 0));
+}
+
+int vid_seek_start(const vid_t *s, int frame)
+{
+	int delay, i;
+	
+	/* Render at least one whole frame before the target,
+	 * to fill the filters and delay lines with real lines */
+	for(delay = 0, i = 0; i < s->nprocesses; i++)
+	{
+		delay += s->processes[i].nlines - 1;
+	}
+	
+	frame -= 1 + delay / s->conf.lines;
+	
+	return(frame < 0 ? 0 : frame);
+}
+
+static uint64_t _mulmod(uint64_t a, uint64_t b, uint64_t m)
+{
+	uint64_t r = 0;
+	
+	/* (a * b) % m without overflow, for m < 2^63 */
+	for(a %= m; b > 0; b >>= 1)
+	{
+		if(b & 1) r = (r + a) % m;
+		a = (a * 2) % m;
+	}
+	
+	return(r);
+}
+
+static void _fm_energy_dispersal_seek(_mod_fm_t *fm, uint64_t samples)
+{
+	uint64_t m, c;
+	
+	/* The counter is stepped by a fixed amount each sample and
+	 * wraps at the overflow, in units of 1 / overflow.rem */
+	if(fm->ed_overflow.quot == 0) return;
+	
+	m = (uint64_t) fm->ed_overflow.quot * fm->ed_overflow.rem;
+	c = (uint64_t) fm->ed_counter.quot * fm->ed_overflow.rem + fm->ed_counter.rem;
+	c = (c + _mulmod(samples, (uint64_t) fm->ed_delta.quot * fm->ed_overflow.rem + fm->ed_delta.rem, m)) % m;
+	
+	fm->ed_counter.quot = c / fm->ed_overflow.rem;
+	fm->ed_counter.rem = c % fm->ed_overflow.rem;
+}
+
+int vid_seek(vid_t *s, int frame)
+{
+	vid_line_t l;
+	vid_line_t **window;
+	uint64_t lines, samples;
+	r64_t width;
+	int nlines;
+	int i, n;
+	
+	if(!vid_seekable(s))
+	{
+		return(VID_ERROR);
+	}
+	
+	width = _vid_line_samples(s);
+	
+	for(nlines = 1, i = 0; i < s->nprocesses; i++)
+	{
+		if(s->processes[i].nlines > nlines) nlines = s->processes[i].nlines;
+	}
+	
+	n = vid_seek_start(s, frame);
+	
+	lines = (uint64_t) n * s->conf.lines;
+	samples = lines * width.num;
+	
+	window = malloc(sizeof(vid_line_t *) * nlines);
+	l.output = malloc(sizeof(int16_t) * 2 * s->max_width);
+	
+	if(!window || !l.output)
+	{
+		free(window);
+		free(l.output);
+		return(VID_OUT_OF_MEMORY);
+	}
+	
+	memset(l.output, 0, sizeof(int16_t) * 2 * s->max_width);
+	l.previous = &l;
+	l.next = &l;
+	
+	for(i = 0; i < nlines; i++)
+	{
+		window[i] = &l;
+	}
+	
+	/* Replay the VBI and scrambler processes over a scratch line
+	 * for each skipped line, keeping their sequences in step */
+	while(s->bframe <= n)
+	{
+		l.width     = s->width;
+		l.frame     = s->bframe;
+		l.line      = s->bline;
+		l.vbialloc  = 0;
+		l.lut       = NULL;
+		l.audio     = NULL;
+		l.audio_len = 0;
+		
+		for(i = s->pipeline_first; i < s->seek_last; i++)
+		{
+			_lineprocess_t *p = &s->processes[i];
+			p->process(p->vid, p->arg, p->nlines, window);
+		}
+		
+		_vid_advance_line(s);
+	}
+	
+	free(l.output);
+	free(window);
+	
+	/* Advance the test signal */
+	if(s->testsignal)
+	{
+		testsignal_seek(s->testsignal, samples);
+	}
+	
+	/* Advance the colour subcarrier */
+	if(s->conf.colour_mode == VID_PAL ||
+	   s->conf.colour_mode == VID_NTSC)
+	{
+		s->colour_lookup_offset = (s->colour_lookup_offset + lines * s->width) % s->colour_lookup_width;
+	}
+	
+	/* Advance the FM video energy dispersal. The carrier
+	 * phase is left at zero, see vid_line_t fm_phase */
+	if(s->conf.modulation == VID_FM)
+	{
+		_fm_energy_dispersal_seek(&s->fm_video, samples);
+	}
+	
+	/* Advance the offset carrier */
+	if(s->offset.length > 0)
+	{
+		s->offset.pos = (s->offset.pos + samples % s->offset.length) % s->offset.length;
+	}
+	else
+	{
+		s->offset.phase += (uint32_t) (s->offset.delta * samples);
+	}
+	
+	/* Advance the audio resampler clock. With audio carriers the
+	 * clock is part of the state copied by vid_audio_copy() */
+	if(!vid_seek_tracked(s))
+	{
+		_vid_audio_clock(s, samples);
+	}
+	
+	/* The AV source starts at the first rendered frame (or field),
+	 * vid_next_line() drops the lines before the target frame */
+	s->av.start = (int64_t) n * (s->conf.interlace ? 2 : 1);
+	s->seek_frame = frame + 1;
+	
+	return(VID_OK);
+}
+
+int vid_track(vid_t *s, const int16_t **audio)
+{
+	vid_line_t l, *window = &l;
+	int64_t phase;
+	
+	/* Keep the video in step with the audio */
+	if(_vid_frame_due(s))
 	{
-		/* Have we reached the end of the video? */
 		if(av_eof(&s->av))
 		{
-			return(NULL);
+			return(-1);
 		}
 		
 		av_read_video(&s->av, &s->vframe);
-		
-		av_rotate_frame(&s->vframe, s->conf.frame_orientation & 3);
-		if(s->conf.frame_orientation & VID_HFLIP) av_hflip_frame(&s->vframe);
-		if(s->conf.frame_orientation & VID_VFLIP) av_vflip_frame(&s->vframe);
-		
-		/* Crop frame to fit inside active video area */
-		av_crop_frame(&s->vframe,
-			(s->vframe.width - s->active_width) / 2,
-			(s->vframe.height - s->conf.active_lines) / 2,
-			s->active_width,
-			s->conf.active_lines
-		);
-		
-		/* Calculate frame offset from top left */
-		s->vframe_x = (s->active_width - s->vframe.width) / 2;
-		s->vframe_y = (s->conf.active_lines - s->vframe.height) / 2;
 	}
 	
-	for(i = 0; i < s->nprocesses; i++)
+	l.output    = NULL;
+	l.width     = s->width;
+	l.frame     = s->bframe;
+	l.line      = s->bline;
+	l.audio     = NULL;
+	l.audio_len = 0;
+	
+	phase = s->audio_phase;
+	_vid_audio_process(s, NULL, 1, &window);
+	_vid_advance_line(s);
+	
+	/* The audio is left at the start of audio_in */
+	*audio = s->audio_in;
+	
+	return((phase + (int64_t) l.width * s->audio_decimation - s->audio_phase) / s->audio_interpolation);
+}
+
+void vid_audio_copy(vid_t *dst, const vid_t *src)
+{
+	dst->audio_phase = src->audio_phase;
+	
+	memcpy(dst->nicam_buf, src->nicam_buf, sizeof(src->nicam_buf));
+	dst->nicam_buf_len = src->nicam_buf_len;
+	
+	memcpy(dst->dance_buf, src->dance_buf, sizeof(src->dance_buf));
+	dst->dance_buf_len = src->dance_buf_len;
+	
+	if(src->conf.fm_mono_level > 0 && src->conf.fm_mono_carrier != 0)
 	{
-		_lineprocess_t *p = &s->processes[i];
+		dst->fm_mono.phase = src->fm_mono.phase;
+		limiter_copy(&dst->fm_mono.limiter, &src->fm_mono.limiter);
+		fir_int16_copy(&dst->fm_mono.resampler, &src->fm_mono.resampler);
+	}
+	
+	if(src->conf.fm_left_level > 0 && src->conf.fm_left_carrier != 0)
+	{
+		dst->fm_left.phase = src->fm_left.phase;
+		limiter_copy(&dst->fm_left.limiter, &src->fm_left.limiter);
+		fir_int16_copy(&dst->fm_left.resampler, &src->fm_left.resampler);
+	}
+	
+	if(src->conf.fm_right_level > 0 && src->conf.fm_right_carrier != 0)
+	{
+		dst->fm_right.phase = src->fm_right.phase;
+		limiter_copy(&dst->fm_right.limiter, &src->fm_right.limiter);
+		fir_int16_copy(&dst->fm_right.resampler, &src->fm_right.resampler);
+		
+		dst->a2stereo_pilot.counter = src->a2stereo_pilot.counter;
+		dst->a2stereo_pilot.phase = src->a2stereo_pilot.phase;
+		dst->a2stereo_signal.counter = src->a2stereo_signal.counter;
+		dst->a2stereo_signal.phase = src->a2stereo_signal.phase;
+	}
+	
+	if(src->conf.am_audio_level > 0 && src->conf.am_mono_carrier != 0)
+	{
+		dst->am_mono.counter = src->am_mono.counter;
+		dst->am_mono.phase = src->am_mono.phase;
+		fir_int16_copy(&dst->am_mono.resampler, &src->am_mono.resampler);
+	}
+	
+	if(src->conf.nicam_level > 0 && src->conf.nicam_carrier != 0)
+	{
+		nicam_mod_copy(&dst->nicam, &src->nicam);
+	}
+	
+	if(src->conf.dance_level > 0 && src->conf.dance_carrier != 0)
+	{
+		dance_mod_copy(&dst->dance, &src->dance);
+	}
+}
+
+int vid_audio_feed_init(vid_audio_feed_t *f)
+{
+	memset(f, 0, sizeof(vid_audio_feed_t));
+	pthread_mutex_init(&f->mutex, NULL);
+	pthread_cond_init(&f->cond, NULL);
+	
+	return(VID_OK);
+}
+
+int vid_audio_feed_write(vid_audio_feed_t *f, const int16_t *audio, size_t samples)
+{
+	int16_t *p;
+	size_t n;
+	
+	pthread_mutex_lock(&f->mutex);
+	
+	if(f->len + samples > f->alloc)
+	{
+		/* Drop the samples already read before growing the buffer */
+		memmove(f->samples, &f->samples[f->pos * 2], sizeof(int16_t) * 2 * (f->len - f->pos));
+		f->len -= f->pos;
+		f->pos = 0;
+	}
+	
+	if(f->len + samples > f->alloc)
+	{
+		n = (f->len + samples) * 2;
 		
-		if(p->process)
+		p = realloc(f->samples, sizeof(int16_t) * 2 * n);
+		if(!p)
 		{
-			p->process(p->vid, p->arg, p->nlines, p->lines);
+			pthread_mutex_unlock(&f->mutex);
+			return(VID_OUT_OF_MEMORY);
 		}
 		
-		for(j = 0; j < p->nlines; j++)
-		{
-			p->lines[j] = p->lines[j]->next;
-		}
+		f->samples = p;
+		f->alloc = n;
 	}
 	
-	/* Advance the next line/frame counter */
-	if(s->bline++ == s->conf.lines)
-	{
-		s->bline = 1;
-		s->bframe++;
-	}
+	memcpy(&f->samples[f->len * 2], audio, sizeof(int16_t) * 2 * samples);
+	f->len += samples;
 	
-	return(l);
+	pthread_cond_broadcast(&f->cond);
+	pthread_mutex_unlock(&f->mutex);
+	
+	return(VID_OK);
+}
+
+void vid_audio_feed_close(vid_audio_feed_t *f)
+{
+	pthread_mutex_lock(&f->mutex);
+	f->closed = 1;
+	pthread_cond_broadcast(&f->cond);
+	pthread_mutex_unlock(&f->mutex);
+}
+
+void vid_audio_feed_free(vid_audio_feed_t *f)
+{
+	pthread_cond_destroy(&f->cond);
+	pthread_mutex_destroy(&f->mutex);
+	free(f->samples);
 }
 
 vid_line_t *vid_next_line(vid_t *s)
 {
 	vid_line_t *l;
 	
-	/* Drop any delay lines introduced by scramblers / filters */
+	if(s->conf.threads > 0 && s->nworkers == 0)
+	{
+		/* Start the line process worker threads */
+		if(_vid_pipeline_start(s) != VID_OK)
+		{
+			fprintf(stderr, "Unable to start line process threads. Running single threaded.\n");
+			s->conf.threads = 0;
+		}
+	}
+	
+	/* Drop any delay lines introduced by scramblers / filters,
+	 * and any lines rendered before the vid_seek() target */
 	do
 	{
-		l = _vid_next_line(s);
+		l = s->nworkers > 0 ? _vid_pipeline_next_line(s) : _vid_next_line(s);
 		if(l == NULL) return(NULL);
 	}
-	while(l->line < 1);
+	while(l->line < 1 || l->frame < s->seek_frame);
 	
 	s->frame = l->frame;
 	s->line  = l->line;
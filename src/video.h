@@ -19,6 +19,7 @@
 #define _VIDEO_H
 
 #include <stdint.h>
+#include <pthread.h>
 #ifndef WIN32
 #include <limits.h>
 #endif
@@ -27,6 +28,7 @@
 #include "dance.h"
 #include "fir.h"
 #include "fifo.h"
+#include "prof.h"
 
 typedef struct vid_line_t vid_line_t;
 typedef struct vid_t vid_t;
@@ -89,16 +91,26 @@ typedef struct vid_t vid_t;
 #define VID_75US 2
 #define VID_J17  3
 
+/* RGB > YUV level conversion modes */
+#define VID_YUV_AUTO   0
+#define VID_YUV_TABLE  1
+#define VID_YUV_MATRIX 2
+
+/* PAL / NTSC colour subcarrier generation modes */
+#define VID_SUBCARRIER_TABLE 0
+#define VID_SUBCARRIER_LINE  1
+
 /* RF modulation */
 
 typedef struct {
 	int16_t level;
-	int32_t counter;
-	cint32_t phase;
-	cint32_t *lut;
+	uint32_t phase;
+	uint32_t delta;
+	int64_t deviation;
+	int16_t *lut;
 	
 	limiter_t limiter;
-	int16_t sample;
+	fir_int16_t resampler;
 	
 	/* FM energy dispersal */
 	div_t ed_delta;
@@ -113,14 +125,23 @@ typedef struct {
 	cint32_t phase;
 	cint32_t delta;
 	
-	int16_t sample;
+	fir_int16_t resampler;
 	
 } _mod_am_t;
 
 typedef struct {
-	int32_t counter;
-	cint32_t phase;
-	cint32_t delta;
+	
+	/* Rotator table. When the offset is periodic within length
+	 * samples this covers whole cycles and is stepped through one
+	 * entry per sample, otherwise it is one cycle indexed by the
+	 * phase accumulator */
+	cint16_t *lut;
+	uint32_t length;
+	uint32_t pos;
+	
+	uint32_t phase;
+	uint32_t delta;
+	
 } _mod_offset_t;
 
 
@@ -289,6 +310,21 @@ typedef struct {
 	/* Video filter enable flag */
 	int vfilter;
 	
+	/* Number of line process worker threads, 0 to disable */
+	int threads;
+	
+	/* RGB > YUV level conversion mode */
+	int yuv_mode;
+	
+	/* Colour subcarrier generation mode */
+	int subcarrier_mode;
+	
+	/* Record timing statistics for each line process */
+	int profile;
+	
+	/* Replay the rendered active video while the source is unchanged */
+	int frame_cache;
+	
 } vid_config_t;
 
 typedef struct {
@@ -303,6 +339,22 @@ typedef struct {
 	int16_t v;
 } _yuv16_t;
 
+/* Audio handed from the vid_track() encoder to a seeked one. The
+ * samples are the 32 kHz stereo audio after the volume and any audio
+ * scrambling, and replace the audio read from the seeked source */
+typedef struct {
+	
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	
+	int16_t *samples;
+	size_t len;
+	size_t pos;
+	size_t alloc;
+	int closed;
+	
+} vid_audio_feed_t;
+
 struct vid_line_t {
 	
 	/* The output line buffer */
@@ -313,6 +365,9 @@ struct vid_line_t {
 	int frame;
 	int line;
 	
+	/* Position of the source frame, in units of the AV frame rate */
+	int64_t pts;
+	
 	/* Colour subcarrier (complex) */
 	const cint16_t *lut;
 	
@@ -323,6 +378,9 @@ struct vid_line_t {
 	const int16_t *audio;
 	size_t audio_len;
 	
+	/* FM video carrier phase at the start of the line */
+	uint32_t fm_phase;
+	
 	/* Pointer the previous and next line */
 	vid_line_t *previous;
 	vid_line_t *next;
@@ -349,8 +407,49 @@ struct _lineprocess_t {
 	/* Callback parameters */
 	vid_t *vid;
 	void *arg;
+	
+	/* Timing statistics, if enabled */
+	prof_t prof;
 };
 
+/* Line process worker thread */
+typedef struct {
+	
+	/* The range of processes run by this worker */
+	int first;
+	int count;
+	
+	/* Number of lines completed by this worker */
+	uint64_t lines;
+	
+	pthread_t thread;
+	pthread_cond_t cond;
+	int running;
+	vid_t *vid;
+	
+} _vid_worker_t;
+
+/* Frame cache line entry, the conditions the cached line was rendered under */
+typedef struct {
+	unsigned int gen;
+	unsigned int lut;
+	int pal;
+	int vy;
+} _vid_cache_line_t;
+
+/* Raster line descriptor, built by vid_init() for each line of the frame */
+typedef struct {
+	int vy;			/* Active line number, before any frame adjustments */
+	int al;			/* Active video span, empty if al == ar */
+	int ar;
+	char burst;		/* Colour burst code, see _vid_raster_seq() */
+	uint8_t sync;		/* Sync pulses, bits of the syncs table */
+	int next;		/* Template for the line that follows */
+	int tail_x;		/* Part of the first sync pulse in the previous line */
+	int tail_n;
+	const int16_t *tail;
+} _vid_raster_line_t;
+
 struct vid_t {
 	
 	/* AV source */
@@ -370,21 +469,47 @@ struct vid_t {
 	
 	vbidata_lut_t *syncs;
 	
+	/* Raster line descriptors and the blanking + sync line templates */
+	_vid_raster_line_t *raster_lines;
+	int16_t *raster_templates;
+	int16_t *raster_tails;
+	
 	int16_t white_level;
 	int16_t black_level;
 	int16_t blanking_level;
 	int16_t sync_level;
 	
+	/* RGB > YUV levels, the lookup table is NULL unless enabled */
+	double yuv_glut[0x100];
+	double yuv_level;
+	_yuv16_t yuv_black;
 	_yuv16_t *yuv_level_lookup;
 	
+	/* Per-pixel conversion: gamma table, 3x3 matrix and level scaling */
+	float yuv_gamma[0x100];
+	float yuv_matrix[3][3];
+	float yuv_scale[3];
+	float yuv_offset[3];
+	
+	/* Y'CbCr to R'G'B' matrix and offset for the current frame */
+	float ycc_matrix[3][3];
+	float ycc_offset[3];
+	
 	unsigned int colour_lookup_width;
 	unsigned int colour_lookup_offset;
 	cint16_t *colour_lookup;
 	
+	/* Per-line colour subcarrier generator. The table holds the
+	 * subcarrier across one line, starting at zero phase */
+	unsigned int colour_lookup_cycles;
+	double *colour_line_base;
+	cint16_t *colour_lines;
+	
 	cint16_t burst_phase;
 	int burst_left;
 	int burst_width;
 	int16_t *burst_win;
+	int16_t *burst_chroma;
 	
 	_mod_fm_t fm_secam;
 	iir_int16_t fm_secam_iir;
@@ -405,6 +530,14 @@ struct vid_t {
 	av_frame_t vframe;
 	int vframe_x;
 	int vframe_y;
+	int64_t vframe_pts;
+	
+	/* Frame cache */
+	int frame_cache_frames;
+	uint64_t frame_cache_hash;
+	unsigned int frame_cache_gen;
+	_vid_cache_line_t *frame_cache_lines;
+	int16_t *frame_cache;
 	
 	/* The frame and line number being rendered next */
 	int bframe;
@@ -447,7 +580,13 @@ struct vid_t {
 	fifo_reader_t audio_reader;
 	int16_t *audiobuffer;
 	size_t audiobuffer_samples;
-	int interp;
+	int audio_interpolation;
+	int audio_decimation;
+	int audio_phase;
+	int audio_in_len;
+	int16_t *audio_in;
+	int16_t *audio_out;
+	vid_audio_feed_t *audio_feed;
 	
 	/* FM Mono/Stereo audio state */
 	_mod_fm_t fm_mono;
@@ -493,10 +632,31 @@ struct vid_t {
 	vid_line_t *oline;
 	int max_width;
 	
+	/* AV source timing statistics, if enabled */
+	prof_t prof_read_video;
+	prof_t prof_read_audio;
+	
 	/* Line processes */
 	int nprocesses;
 	_lineprocess_t *processes;
 	_lineprocess_t *output_process;
+	
+	/* The VBI and scrambler processes, from pipeline_first up to
+	 * seek_last, are replayed over any lines skipped by vid_seek() */
+	int seek_last;
+	int seek_frame;
+	
+	/* Threaded line process pipeline */
+	int pipeline_first;
+	int nworkers;
+	_vid_worker_t *workers;
+	pthread_mutex_t pipeline_mutex;
+	pthread_cond_t pipeline_cond;
+	uint64_t pipeline_lines;
+	int pipeline_held;
+	int pipeline_hold;
+	int pipeline_pause;
+	int pipeline_abort;
 };
 
 extern const vid_configs_t vid_configs[];
@@ -507,5 +667,83 @@ extern void vid_info(vid_t *s);
 extern size_t vid_get_framebuffer_length(vid_t *s);
 extern vid_line_t *vid_next_line(vid_t *s);
 
+/* Fill s->av with the AV source settings for the initialised mode,
+ * with the default fit, scaler and buffering. Callers may override
+ * these before opening the source */
+extern void vid_av_defaults(vid_t *s);
+
+/* Stop any line process threads reading from the AV source. Must be
+ * called before the source is closed. Rendering continues on the
+ * next call to vid_next_line() */
+extern void vid_pause(vid_t *s);
+
+/* Returns 1 if vid_seek() can recover the encoder state, or 0 for
+ * modes with state that can only be recovered by rendering: MAC and
+ * SiS, which carry their audio in the picture, raw baseband or passthru
+ * input, or a sample rate that is not a whole number of samples per line */
+extern int vid_seekable(const vid_t *s);
+
+/* Returns 1 if the mode has audio carriers. Their state depends on all
+ * of the earlier audio, so a seeked encoder takes it from a second
+ * encoder that follows the audio from the start with vid_track() */
+extern int vid_seek_tracked(const vid_t *s);
+
+/* Returns the frame vid_seek(s, frame) starts rendering from. This is
+ * ahead of the target, to fill the filters and delay lines */
+extern int vid_seek_start(const vid_t *s, int frame);
+
+/* Start rendering at a later frame (counting from 0) without rendering
+ * the frames before it. Frame and line counters, the colour subcarrier,
+ * the offset carrier, test signals and scrambler / teletext sequences
+ * are recovered exactly, so the output matches a serial render.
+ *
+ * If vid_seek_tracked() is 1 the audio state must first be copied with
+ * vid_audio_copy() from a vid_track() encoder at the start of frame
+ * vid_seek_start(frame), with the audio from that point in audio_feed.
+ *
+ * FM video is rendered from zero carrier phase. The line fm_phase gives
+ * the phase to rotate the output by to join it to the previous frames.
+ *
+ * Must be called before the first call to vid_next_line(), and after
+ * configuring the AV source but before opening it. Sets av.start to
+ * the first frame the source should return.
+ *
+ * Returns VID_OK, or VID_ERROR if vid_seekable() is 0. */
+extern int vid_seek(vid_t *s, int frame);
+
+/* Advance by one line, running only the audio carriers without adding
+ * them to any output. Video frames are read from the source and dropped.
+ * *audio is set to the 32 kHz stereo audio used by the line.
+ *
+ * Returns the number of audio samples, or -1 at the end of the source */
+extern int vid_track(vid_t *s, const int16_t **audio);
+
+/* Copy the audio carrier state of src into dst. Both must have been
+ * initialised with the same configuration */
+extern void vid_audio_copy(vid_t *dst, const vid_t *src);
+
+/* Audio feeds. Writes append to the feed, and the encoder with the feed
+ * as its audio_feed waits on any audio not yet written. Once closed the
+ * encoder reads what remains, then silence */
+extern int vid_audio_feed_init(vid_audio_feed_t *f);
+extern int vid_audio_feed_write(vid_audio_feed_t *f, const int16_t *audio, size_t samples);
+extern void vid_audio_feed_close(vid_audio_feed_t *f);
+extern void vid_audio_feed_free(vid_audio_feed_t *f);
+
+/* Fetch pointers to the timing statistics for the AV source and each
+ * line process, in order. Returns the number of entries, up to max.
+ * The statistics are only updated if conf.profile is set, and may be
+ * updated by worker threads; read them with prof_snapshot() */
+extern int vid_get_stats(vid_t *s, prof_t **stages, int max);
+
+/* Convert n RGB pixels to Y, U and V signal levels, writing one sample
+ * every step. Any of py, pu or pv may be NULL. */
+extern void vid_rgb_to_yuv(const vid_t *s, int16_t *py, int16_t *pu, int16_t *pv, int step, const uint32_t *prgb, int stride, int n);
+
+/* As vid_rgb_to_yuv(), for n pixels of line y of the current frame in
+ * either of its pixel formats. Starts at pixel x and advances by xstep
+ * pixels. The frame must not be empty. */
+extern void vid_frame_to_yuv(const vid_t *s, int16_t *py, int16_t *pu, int16_t *pv, int step, int x, int y, int xstep, int n);
+
 #endif
 